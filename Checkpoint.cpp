@@ -0,0 +1,368 @@
+#include "Checkpoint.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Stats.h"
+#include "Tracer.h"
+
+
+namespace {
+
+const char kMagic[8] = {'F', 'S', 'S', 'E', 'G', '0', '0', '1'};
+const char kEnd[8] = {'F', 'S', 'S', 'E', 'G', 'E', 'N', 'D'};
+const size_t kTrailerBytes = 40;
+const size_t kRecordHeaderBytes = 12;
+const size_t kIndexEntryBytes = 12;
+const size_t kFlushBytes = 1 << 22; // buffered before a write
+const char* kManifest = "MANIFEST";
+
+struct Trailer {
+    uint64_t indexOffset;
+    uint32_t records;
+    uint32_t root;
+    uint32_t nextId;
+    uint64_t sequence;
+};
+
+template <typename T>
+void put(string& buffer, T value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T get(const char* bytes) {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readAt(int fd, char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool readTrailer(int fd, Trailer& trailer) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(kMagic) + kTrailerBytes) return false;
+    char bytes[kTrailerBytes];
+    if (!readAt(fd, bytes, kTrailerBytes, static_cast<uint64_t>(st.st_size) - kTrailerBytes)) return false;
+    if (std::memcmp(bytes + 32, kEnd, sizeof(kEnd)) != 0) return false;
+    trailer.indexOffset = get<uint64_t>(bytes);
+    trailer.records = get<uint32_t>(bytes + 8);
+    trailer.root = get<uint32_t>(bytes + 12);
+    trailer.nextId = get<uint32_t>(bytes + 16);
+    trailer.sequence = get<uint64_t>(bytes + 24);
+    return trailer.indexOffset + static_cast<uint64_t>(trailer.records) * kIndexEntryBytes + kTrailerBytes ==
+           static_cast<uint64_t>(st.st_size);
+}
+
+string segmentName(uint64_t sequence, const char* kind) {
+    char name[40];
+    snprintf(name, sizeof(name), "%010llu.%s", static_cast<unsigned long long>(sequence), kind);
+    return name;
+}
+
+// so that files created or renamed in dir survive a crash
+void syncDirectory(const string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+} // namespace
+
+SegmentWriter::~SegmentWriter() {
+    if (fd_ >= 0) discard();
+}
+
+bool SegmentWriter::open(const string& path) {
+    path_ = path;
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    buffer_.assign(kMagic, sizeof(kMagic));
+    written_ = 0;
+    failed_ = fd_ < 0;
+    index_.clear();
+    return !failed_;
+}
+
+void SegmentWriter::beginRecord(uint32_t id) {
+    // Only between records, endRecord() patches the header in the buffer.
+    if (buffer_.size() >= kFlushBytes) flush();
+    recordStart_ = buffer_.size();
+    index_.emplace_back(id, written_ + recordStart_);
+    put<uint32_t>(buffer_, id);
+    put<uint32_t>(buffer_, 0);
+    put<uint32_t>(buffer_, 0);
+    children_ = 0;
+}
+
+void SegmentWriter::addChild(string_view name, bool isDir, uint32_t id) {
+    put<uint8_t>(buffer_, isDir ? 1 : 0);
+    put<uint32_t>(buffer_, id);
+    put<uint32_t>(buffer_, static_cast<uint32_t>(name.size()));
+    buffer_.append(name.data(), name.size());
+    children_++;
+}
+
+void SegmentWriter::endRecord() {
+    uint32_t bytes = static_cast<uint32_t>(buffer_.size() - recordStart_ - kRecordHeaderBytes);
+    std::memcpy(&buffer_[recordStart_ + 4], &children_, sizeof(children_));
+    std::memcpy(&buffer_[recordStart_ + 8], &bytes, sizeof(bytes));
+}
+
+void SegmentWriter::flush() {
+    if (!failed_ && !writeAll(fd_, buffer_.data(), buffer_.size())) failed_ = true;
+    written_ += buffer_.size();
+    buffer_.clear();
+}
+
+bool SegmentWriter::finish(uint32_t root, uint32_t nextId, uint64_t sequence) {
+    uint64_t indexOffset = bytes();
+    for (const std::pair<uint32_t, uint64_t>& entry : index_) {
+        put<uint32_t>(buffer_, entry.first);
+        put<uint64_t>(buffer_, entry.second);
+    }
+    put<uint64_t>(buffer_, indexOffset);
+    put<uint32_t>(buffer_, static_cast<uint32_t>(index_.size()));
+    put<uint32_t>(buffer_, root);
+    put<uint32_t>(buffer_, nextId);
+    put<uint32_t>(buffer_, 0);
+    put<uint64_t>(buffer_, sequence);
+    buffer_.append(kEnd, sizeof(kEnd));
+    flush();
+    if (!failed_ && fsync(fd_) != 0) failed_ = true;
+    if (close(fd_) != 0) failed_ = true;
+    fd_ = -1;
+    return !failed_;
+}
+
+void SegmentWriter::discard() {
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+    unlink(path_.c_str());
+    buffer_.clear();
+}
+
+CheckpointImage::~CheckpointImage() {
+    for (int fd : fds_) close(fd);
+}
+
+bool CheckpointImage::open(const string& dir, const std::vector<string>& segments) {
+    if (segments.empty()) return false;
+    string index;
+    for (uint32_t s = 0; s < segments.size(); s++) {
+        int fd = ::open((dir + "/" + segments[s]).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        fds_.push_back(fd);
+        Trailer trailer;
+        char magic[sizeof(kMagic)];
+        if (!readTrailer(fd, trailer) || !readAt(fd, magic, sizeof(magic), 0) ||
+            std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) return false;
+        index.resize(static_cast<size_t>(trailer.records) * kIndexEntryBytes);
+        if (!readAt(fd, &index[0], index.size(), trailer.indexOffset)) return false;
+        // Later segments overwrite what earlier ones said.
+        for (size_t i = 0; i < index.size(); i += kIndexEntryBytes) {
+            where_[get<uint32_t>(&index[i])] = Where{s, get<uint64_t>(&index[i + 4])};
+        }
+        root_ = trailer.root;
+        nextId_ = trailer.nextId;
+        sequence_ = trailer.sequence;
+    }
+    return where_.count(root_) != 0;
+}
+
+bool CheckpointImage::read(uint32_t id, std::vector<CheckpointEntry>& entries) const {
+    auto it = where_.find(id);
+    if (it == where_.end()) return false;
+    int fd = fds_[it->second.segment];
+    char header[kRecordHeaderBytes];
+    if (!readAt(fd, header, sizeof(header), it->second.offset) || get<uint32_t>(header) != id) return false;
+    uint32_t children = get<uint32_t>(header + 4);
+    string bytes(get<uint32_t>(header + 8), '\0');
+    if (!readAt(fd, &bytes[0], bytes.size(), it->second.offset + kRecordHeaderBytes)) return false;
+
+    entries.resize(children);
+    size_t pos = 0;
+    for (CheckpointEntry& entry : entries) {
+        if (pos + 9 > bytes.size()) return false;
+        entry.isDir = bytes[pos] != 0;
+        entry.id = get<uint32_t>(&bytes[pos + 1]);
+        uint32_t length = get<uint32_t>(&bytes[pos + 5]);
+        pos += 9;
+        if (pos + length > bytes.size()) return false;
+        entry.name.assign(bytes, pos, length);
+        pos += length;
+    }
+    return pos == bytes.size();
+}
+
+CheckpointStore::CheckpointStore(string dir) : dir_(std::move(dir)) {}
+
+CheckpointStore::~CheckpointStore() {
+    waitCompaction();
+}
+
+Status CheckpointStore::open(bool create) {
+    if (create && mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) return Status::CheckpointFailed;
+    Status unreadable = create ? Status::CheckpointFailed : Status::CheckpointUnreadable;
+
+    FILE* manifest = fopen((dir_ + "/" + kManifest).c_str(), "r");
+    if (manifest == nullptr) {
+        if (errno != ENOENT) return unreadable;
+        struct stat st;
+        if (stat(dir_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return unreadable;
+        return Status::Ok; // A new store.
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), manifest) != nullptr) {
+        string name(line);
+        while (!name.empty() && (name.back() == '\n' || name.back() == '\r')) name.pop_back();
+        if (!name.empty()) segments_.push_back(name);
+    }
+    fclose(manifest);
+    if (segments_.empty()) return Status::Ok;
+
+    // Ids and sequence carry on from the newest segment.
+    int fd = ::open((dir_ + "/" + segments_.back()).c_str(), O_RDONLY | O_CLOEXEC);
+    Trailer trailer;
+    bool ok = fd >= 0 && readTrailer(fd, trailer);
+    if (fd >= 0) close(fd);
+    if (!ok) return unreadable;
+    nextId_ = trailer.nextId;
+    sequence_ = trailer.sequence;
+    return Status::Ok;
+}
+
+bool CheckpointStore::begin(SegmentWriter& writer) {
+    return writer.open(dir_ + "/" + segmentName(sequence_ + 1, "delta"));
+}
+
+Status CheckpointStore::commit(SegmentWriter& writer, uint32_t root) {
+    TRACE_SPAN("checkpoint commit");
+    if (!writer.finish(root, nextId_, sequence_ + 1)) {
+        writer.discard();
+        return Status::CheckpointFailed;
+    }
+    string name = segmentName(sequence_ + 1, "delta");
+    std::lock_guard<std::mutex> lock(mutex_);
+    segments_.push_back(name);
+    if (!writeManifest(segments_)) {
+        segments_.pop_back();
+        writer.discard();
+        return Status::CheckpointFailed;
+    }
+    sequence_++;
+    Stats::count(Counter::CheckpointBytes, writer.bytes());
+
+    if (segments_.size() > kCompactAfter && !compacting_) {
+        if (compactor_.joinable()) compactor_.join(); // Finished, but not joined yet.
+        compacting_ = true;
+        compactor_ = std::thread(&CheckpointStore::compact, this, segments_, sequence_);
+    }
+    return Status::Ok;
+}
+
+Status CheckpointStore::image(CheckpointImage& image) {
+    // Held so that a compaction cannot remove the files before they are open.
+    std::lock_guard<std::mutex> lock(mutex_);
+    return image.open(dir_, segments_) ? Status::Ok : Status::CheckpointUnreadable;
+}
+
+size_t CheckpointStore::segments() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segments_.size();
+}
+
+void CheckpointStore::waitCompaction() {
+    if (compactor_.joinable()) compactor_.join();
+}
+
+// Written next to the old one and renamed over it, so a crash leaves one
+// or the other.
+bool CheckpointStore::writeManifest(const std::vector<string>& segments) const {
+    string text;
+    for (const string& name : segments) text += name + "\n";
+    string path = dir_ + "/" + kManifest;
+    string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = writeAll(fd, text.data(), text.size()) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        unlink(temp.c_str());
+        return false;
+    }
+    syncDirectory(dir_);
+    return true;
+}
+
+// Runs on compactor_: merge is a prefix of segments_ as it was, and stays
+// one, since only compaction takes segments out.
+void CheckpointStore::compact(std::vector<string> merge, uint64_t sequence) {
+    TRACE_SPAN("compact");
+    string name = segmentName(sequence, "base");
+    CheckpointImage image;
+    SegmentWriter writer;
+    bool ok = image.open(dir_, merge) && writer.open(dir_ + "/" + name);
+
+    // Whatever the root no longer reaches is left behind.
+    std::vector<uint32_t> stack;
+    if (ok) stack.push_back(image.root());
+    std::vector<CheckpointEntry> entries;
+    size_t records = 0;
+    while (ok && !stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        // More records than there are means the ids loop.
+        if (++records > image.records() || !image.read(id, entries)) {
+            ok = false;
+            break;
+        }
+        writer.beginRecord(id);
+        for (const CheckpointEntry& entry : entries) {
+            writer.addChild(entry.name, entry.isDir, entry.id);
+            if (entry.isDir) stack.push_back(entry.id);
+        }
+        writer.endRecord();
+    }
+    ok = ok && writer.finish(image.root(), image.nextId(), image.sequence());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ok) {
+        std::vector<string> segments(1, name);
+        segments.insert(segments.end(), segments_.begin() + merge.size(), segments_.end());
+        ok = writeManifest(segments);
+        if (ok) {
+            segments_ = segments;
+            for (const string& old : merge) unlink((dir_ + "/" + old).c_str());
+            Stats::count(Counter::Compactions);
+        }
+    }
+    if (!ok) writer.discard();
+    compacting_ = false;
+}
@@ -0,0 +1,168 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "FileSystem.h"
+using std::string;
+using std::string_view;
+
+// A checkpoint store is a host directory of segment files and a MANIFEST
+// naming the live ones, oldest first. A segment holds one record per
+// directory it wrote: the directory's persistent id and its children in
+// name order, each a name, a kind and, for a directory, its id. The
+// newest record of an id wins, so a checkpoint only writes directories
+// whose child lists changed and refers to the others by id.
+//
+// Segment layout, integers in host byte order:
+//   "FSSEG001"
+//   records  u32 id, u32 children, u32 bytes of entries, then per child
+//            u8 isDir, u32 id (0 for files), u32 name length, name bytes
+//   index    u32 id, u64 offset of its record, per record
+//   trailer  u64 index offset, u32 records, u32 root id, u32 next id,
+//            u32 unused, u64 sequence, "FSSEGEND"
+
+// One child in a record.
+struct CheckpointEntry {
+	string name;
+	bool isDir = false;
+	uint32_t id = 0; // 0 for files
+};
+
+// Writes one segment. Records are buffered and go out in large writes;
+// the file only counts once finish() has synced it.
+class SegmentWriter {
+public:
+	SegmentWriter() = default;
+	~SegmentWriter();
+
+	SegmentWriter(const SegmentWriter&) = delete;
+	SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+	[[nodiscard]] bool open(const string& path);
+
+	// one record: beginRecord(), addChild() per child in name order, endRecord()
+	void beginRecord(uint32_t id);
+	void addChild(string_view name, bool isDir, uint32_t id);
+	void endRecord();
+
+	// write the index and trailer, sync and close; false on any I/O error
+	[[nodiscard]] bool finish(uint32_t root, uint32_t nextId, uint64_t sequence);
+
+	// give up, removing the file
+	void discard();
+
+	[[nodiscard]] uint64_t records() const { return index_.size(); }
+	[[nodiscard]] uint64_t bytes() const { return written_ + buffer_.size(); }
+
+private:
+	void flush();
+
+	int fd_ = -1;
+	string path_;
+	string buffer_;
+	uint64_t written_ = 0;     // bytes of the file before buffer_
+	size_t recordStart_ = 0;   // in buffer_
+	uint32_t children_ = 0;    // of the open record
+	bool failed_ = false;
+	std::vector<std::pair<uint32_t, uint64_t>> index_;
+};
+
+// Read side: the newest record of every directory over a list of
+// segments. Only the index is held in memory, records are read with
+// pread() when asked for, so read() may be called from any thread.
+class CheckpointImage {
+public:
+	CheckpointImage() = default;
+	~CheckpointImage();
+
+	CheckpointImage(const CheckpointImage&) = delete;
+	CheckpointImage& operator=(const CheckpointImage&) = delete;
+
+	// segments are file names in dir, oldest first
+	[[nodiscard]] bool open(const string& dir, const std::vector<string>& segments);
+
+	[[nodiscard]] uint32_t root() const { return root_; }
+	[[nodiscard]] uint32_t nextId() const { return nextId_; }
+	[[nodiscard]] uint64_t sequence() const { return sequence_; }
+	// directories with a record
+	[[nodiscard]] size_t records() const { return where_.size(); }
+
+	// children of directory id in name order, false if it has no record
+	// or the record cannot be read
+	[[nodiscard]] bool read(uint32_t id, std::vector<CheckpointEntry>& entries) const;
+
+private:
+	struct Where {
+		uint32_t segment;
+		uint64_t offset;
+	};
+	std::vector<int> fds_;
+	std::unordered_map<uint32_t, Where> where_;
+	uint32_t root_ = 0;
+	uint32_t nextId_ = 1;
+	uint64_t sequence_ = 0;
+};
+
+// The store one FileSystem checkpoints to: its manifest, the ids handed
+// out, and compaction. Once more than kCompactAfter segments are live a
+// background thread merges all but the ones written since into a single
+// base segment, keeping only the records still reachable from the root,
+// and swaps it into the manifest. Compaction reads segments, never the
+// tree, so checkpoints carry on while it runs.
+class CheckpointStore {
+public:
+	static const size_t kCompactAfter = 8;
+
+	explicit CheckpointStore(string dir);
+	// waits for a running compaction
+	~CheckpointStore();
+
+	CheckpointStore(const CheckpointStore&) = delete;
+	CheckpointStore& operator=(const CheckpointStore&) = delete;
+
+	// read the manifest; with create, make the directory if missing.
+	// Status::CheckpointFailed or CheckpointUnreadable (without create)
+	// if the store cannot be used
+	Status open(bool create);
+
+	[[nodiscard]] const string& dir() const { return dir_; }
+
+	// a persistent id no record has used
+	uint32_t newId() { return nextId_++; }
+
+	// start the next segment
+	[[nodiscard]] bool begin(SegmentWriter& writer);
+	// finish it with the tree's root and add it to the manifest
+	Status commit(SegmentWriter& writer, uint32_t root);
+
+	// image of the live segments
+	Status image(CheckpointImage& image);
+
+	// live segments
+	[[nodiscard]] size_t segments() const;
+	[[nodiscard]] uint64_t sequence() const { return sequence_; }
+
+	// wait for a running compaction
+	void waitCompaction();
+
+private:
+	[[nodiscard]] bool writeManifest(const std::vector<string>& segments) const;
+	void compact(std::vector<string> merge, uint64_t sequence);
+
+	string dir_;
+	std::vector<string> segments_; // under mutex_
+	uint64_t sequence_ = 0;        // of the newest segment
+	uint32_t nextId_ = 1;
+	mutable std::mutex mutex_;
+	bool compacting_ = false;      // under mutex_
+	std::thread compactor_;
+};
+
+#endif /* CHECKPOINT_H_ */
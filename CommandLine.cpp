@@ -0,0 +1,457 @@
+#include "CommandLine.h"
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+#include "FileSystem.h"
+#include "Tracer.h"
+
+namespace {
+
+// Parse "--limit N" and "--after name" (any order) for a paged ls.
+// Returns false on anything else.
+bool parseLsPage(const std::string_view* args, size_t nargs, size_t& limit, std::string& after) {
+    limit = 0;
+    after.clear();
+    for (size_t i = 0; i < nargs; i += 2) {
+        if (i + 1 >= nargs) return false;
+        if (args[i] == "--limit") {
+            const char* end = args[i + 1].data() + args[i + 1].size();
+            unsigned long n = 0;
+            if (std::from_chars(args[i + 1].data(), end, n).ptr != end || n == 0) return false;
+            limit = n;
+        }
+        else if (args[i] == "--after") after.assign(args[i + 1]);
+        else return false;
+    }
+    return limit != 0;
+}
+
+// Parse "key=value" settings of "gen" into spec, e.g.
+// "seed=7 depth=5 fanout=2-32 files=80 names=3-20 nodes=1000000".
+// Ranges take "lo-hi" or a single number. Returns false on anything else.
+bool parseGenSpec(const std::string_view* args, size_t nargs, GenSpec& spec) {
+    for (size_t i = 0; i < nargs; i++) {
+        size_t eq = args[i].find('=');
+        if (eq == std::string_view::npos) return false;
+        std::string_view key = args[i].substr(0, eq);
+        std::string_view value = args[i].substr(eq + 1);
+
+        const char* end = value.data() + value.size();
+        unsigned long long lo = 0;
+        std::from_chars_result res = std::from_chars(value.data(), end, lo);
+        if (res.ec != std::errc()) return false;
+        unsigned long long hi = lo;
+        if (res.ptr != end && *res.ptr == '-') {
+            res = std::from_chars(res.ptr + 1, end, hi);
+            if (res.ec != std::errc()) return false;
+        }
+        if (res.ptr != end) return false;
+
+        if (key == "seed") spec.seed = lo;
+        else if (key == "depth") spec.depth = static_cast<unsigned>(lo);
+        else if (key == "fanout") { spec.minFanout = static_cast<unsigned>(lo); spec.maxFanout = static_cast<unsigned>(hi); }
+        else if (key == "files") spec.filePercent = static_cast<unsigned>(lo);
+        else if (key == "names") { spec.minNameLen = static_cast<unsigned>(lo); spec.maxNameLen = static_cast<unsigned>(hi); }
+        else if (key == "nodes") spec.maxNodes = lo;
+        else return false;
+    }
+    return spec.valid();
+}
+
+// Parse "-L depth", "--max-nodes N" and at most one directory for tree.
+// Returns false on anything else.
+bool parseTreeArgs(const std::string_view* args, size_t nargs, TreeLimits& limits, std::string_view& path) {
+    path = std::string_view();
+    for (size_t i = 0; i < nargs; i++) {
+        if (args[i] == "-L" || args[i] == "--max-nodes") {
+            if (i + 1 >= nargs) return false;
+            const char* end = args[i + 1].data() + args[i + 1].size();
+            unsigned long long n = 0;
+            if (std::from_chars(args[i + 1].data(), end, n).ptr != end || n == 0) return false;
+            if (args[i] == "-L") limits.depth = static_cast<unsigned>(n);
+            else limits.maxNodes = n;
+            i++;
+        }
+        else if (path.empty()) path = args[i];
+        else return false;
+    }
+    return true;
+}
+
+// "2026-10-19 14:03:07" (UTC) for ns since the epoch, "-" for 0.
+std::string formatTime(int64_t ns) {
+    if (ns == 0) return "-";
+    time_t secs = static_cast<time_t>(ns / 1000000000);
+    struct tm parts;
+    gmtime_r(&secs, &parts);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &parts);
+    return buf;
+}
+
+} // namespace
+
+
+size_t tokenize(std::string_view line, std::string_view* tokens, size_t max) {
+    size_t count = 0;
+    size_t i = 0;
+    while (count < max) {
+        // Same separators as operator>> with the default locale.
+        while (i < line.size() && (line[i] == ' ' || (line[i] >= '\t' && line[i] <= '\r'))) i++;
+        if (i == line.size()) break;
+        size_t start = i;
+        while (i < line.size() && line[i] != ' ' && (line[i] < '\t' || line[i] > '\r')) i++;
+        tokens[count++] = line.substr(start, i - start);
+    }
+    return count;
+}
+
+Verb verbFromName(std::string_view word) {
+    // The length picks a handful of candidates, one compare settles it.
+    switch (word.size()) {
+    case 2:
+        switch (word[0]) {
+        case 'c': return word == "cd" ? Verb::Cd : (word == "cp" ? Verb::Cp : Verb::Unknown);
+        case 'l': return word == "ls" ? Verb::Ls : Verb::Unknown;
+        case 'r': return word == "rm" ? Verb::Rm : Verb::Unknown;
+        case 'm': return word == "mv" ? Verb::Mv : Verb::Unknown;
+        }
+        break;
+    case 3:
+        if (word == "pwd") return Verb::Pwd;
+        if (word == "gen") return Verb::Gen;
+        if (word == "mem") return Verb::Mem;
+        break;
+    case 4:
+        switch (word[0]) {
+        case 't': return word == "tree" ? Verb::Tree : Verb::Unknown;
+        case 'l': return word == "load" ? Verb::Load : Verb::Unknown;
+        case 'e': return word == "exit" ? Verb::Exit : Verb::Unknown;
+        case 's': return word == "stat" ? Verb::Stat : Verb::Unknown;
+        }
+        break;
+    case 5:
+        switch (word[0]) {
+        case 't': return word == "touch" ? Verb::Touch : (word == "trace" ? Verb::Trace : Verb::Unknown);
+        case 'm': return word == "mkdir" ? Verb::Mkdir : Verb::Unknown;
+        case 'r': return word == "rmdir" ? Verb::Rmdir : Verb::Unknown;
+        case 's': return word == "stats" ? Verb::Stats : Verb::Unknown;
+        case 'b': return word == "begin" ? Verb::Begin : Verb::Unknown;
+        case 'a': return word == "abort" ? Verb::Abort : Verb::Unknown;
+        case 'w': return word == "watch" ? Verb::Watch : Verb::Unknown;
+        }
+        break;
+    case 6:
+        if (word == "commit") return Verb::Commit;
+        if (word == "events") return Verb::Events;
+        if (word == "import") return Verb::Import;
+        break;
+    case 7:
+        if (word == "unwatch") return Verb::Unwatch;
+        if (word == "restore") return Verb::Restore;
+        break;
+    case 8:
+        if (word == "complete") return Verb::Complete;
+        break;
+    case 10:
+        if (word == "checkpoint") return Verb::Checkpoint;
+        break;
+    }
+    return Verb::Unknown;
+}
+
+Command verbCommand(Verb verb) {
+    switch (verb) {
+    case Verb::Cd:    return Command::Cd;
+    case Verb::Ls:    return Command::Ls;
+    case Verb::Tree:  return Command::Tree;
+    case Verb::Touch: return Command::Touch;
+    case Verb::Mkdir: return Command::Mkdir;
+    case Verb::Rm:    return Command::Rm;
+    case Verb::Rmdir: return Command::Rmdir;
+    case Verb::Mv:    return Command::Mv;
+    case Verb::Cp:    return Command::Cp;
+    default:          return Command::Count;
+    }
+}
+
+bool CommandShell::run(FileSystem*& fs, std::string_view line, std::string& out, ShellClient& client) {
+    out.clear();
+    Transaction& tx = client.tx;
+
+    std::string_view words[kMaxTokens];
+    size_t nwords = tokenize(line, words, kMaxTokens);
+    Verb verb = nwords > 0 ? verbFromName(words[0]) : Verb::Unknown;
+    if (verb == Verb::Exit) return false;
+    const std::string_view* rest = words + 1; // the words after the command
+    size_t nrest = nwords > 0 ? nwords - 1 : 0;
+    std::string_view arg1 = nrest > 0 ? rest[0] : std::string_view();
+    std::string_view arg2 = nrest > 1 ? rest[1] : std::string_view();
+    std::string_view arg3 = nrest > 2 ? rest[2] : std::string_view();
+
+    // Time every counted command, the stats command itself is not counted.
+    Command counted = verbCommand(verb);
+    auto start = std::chrono::steady_clock::now();
+    TraceSpan commandSpan(counted == Command::Count ? "repl" : Stats::commandName(counted));
+
+    // Commands report a Status, which is only turned into text here.
+    Status status = Status::Ok;
+
+    if (tx.open()) {
+        switch (verb) {
+        case Verb::Touch: case Verb::Mkdir: case Verb::Rmdir: case Verb::Mv:
+            break;
+        case Verb::Rm:
+            if (arg1 == "-r") out = "rm -r is not available in a transaction";
+            break;
+        case Verb::Cd: case Verb::Ls: case Verb::Tree: case Verb::Complete:
+            fs->observe(tx);
+            break;
+        case Verb::Cp: case Verb::Load: case Verb::Gen: case Verb::Import: case Verb::Restore:
+            out = "not available in a transaction";
+            break;
+        default:
+            break;
+        }
+        if (out != "") return true;
+    }
+
+    switch (verb) {
+    case Verb::Exit:
+        break;
+    case Verb::Cd:
+        status = fs->tryCd(arg1);
+        if (tx.open()) fs->observe(tx);
+        break;
+    case Verb::Ls:
+        if (nrest == 0) fs->lsInto(out);
+        else if (nrest == 1 && arg1 == "-l") fs->lsLongInto(out);
+        else if (nrest == 1 && arg1.back() == '*') {
+            fs->lsPrefix(arg1.substr(0, arg1.size() - 1), out);
+        }
+        else {
+            // Only the first four words are options, like before.
+            size_t limit;
+            if (parseLsPage(rest, nrest < 4 ? nrest : 4, limit, after_)) {
+                ListCursor cursor(after_);
+                fs->lsPage(cursor, limit, out);
+            }
+            else out = "usage: ls [--limit N] [--after name]";
+        }
+        break;
+    case Verb::Pwd:
+        fs->pwdInto(out);
+        break;
+    case Verb::Tree: {
+        TreeLimits limits;
+        std::string_view dir;
+        if (nrest == 0) fs->treeInto(out);
+        else if (parseTreeArgs(rest, nrest, limits, dir)) status = fs->treeInto(out, limits, dir);
+        else out = "usage: tree [-L depth] [--max-nodes N] [dir]";
+        break;
+    }
+    case Verb::Touch:
+        if (tx.open()) fs->stage(tx, BatchOp{BatchOp::Kind::Touch, std::string(arg1), std::string()});
+        else status = fs->tryTouch(arg1);
+        break;
+    case Verb::Mkdir:
+        if (tx.open()) fs->stage(tx, BatchOp{BatchOp::Kind::Mkdir, std::string(arg1), std::string()});
+        else status = fs->tryMkdir(arg1);
+        break;
+    case Verb::Rm:
+        if (tx.open()) fs->stage(tx, BatchOp{BatchOp::Kind::Rm, std::string(arg1), std::string()});
+        else if (arg1 == "-r") status = fs->tryRm(arg2, true);
+        else status = fs->tryRm(arg1);
+        break;
+    case Verb::Rmdir:
+        if (tx.open()) fs->stage(tx, BatchOp{BatchOp::Kind::Rmdir, std::string(arg1), std::string()});
+        else status = fs->tryRmdir(arg1);
+        break;
+    case Verb::Mv:
+        if (tx.open()) fs->stage(tx, BatchOp{BatchOp::Kind::Mv, std::string(arg1), std::string(arg2)});
+        else status = fs->tryMv(arg1, arg2);
+        break;
+    case Verb::Cp:
+        if (arg1 == "-r") status = fs->tryCp(arg2, arg3, true);
+        else status = fs->tryCp(arg1, arg2);
+        break;
+    case Verb::Complete: {
+        // First line is what the word completes to, then the candidates.
+        size_t n = fs->complete(arg1, 32, candidates_, common_);
+        out = common_;
+        if (n > 1) out += "\n" + candidates_;
+        break;
+    }
+    case Verb::Load:
+        if (!canReplace_) out = "load is not available here";
+        else {
+            delete fs;
+            fs = new FileSystem(std::string(arg1));
+        }
+        break;
+    case Verb::Gen: {
+        GenSpec spec;
+        if (!canReplace_) out = "gen is not available here";
+        else if (parseGenSpec(rest, nrest, spec)) {
+            delete fs;
+            fs = new FileSystem(spec);
+        }
+        else out = "usage: gen [seed=N] [depth=N] [fanout=N-M] [files=PERCENT] [names=N-M] [nodes=N]";
+        break;
+    }
+    case Verb::Stats:
+        if (nrest == 0) out = Stats::report();
+        else if (arg1 == "--json") out = Stats::dump();
+        else if (arg1 == "reset") Stats::reset();
+        else out = "usage: stats [--json|reset]";
+        break;
+    case Verb::Trace:
+        if (arg1 == "start") out = Tracer::start(std::string(arg2));
+        else if (arg1 == "stop") out = Tracer::stop();
+        else out = "usage: trace start <file> | trace stop";
+        break;
+    case Verb::Begin:
+        if (tx.open()) out = "transaction already open";
+        else fs->begin(tx);
+        break;
+    case Verb::Commit:
+        if (!tx.open()) out = "no transaction open";
+        else status = fs->commit(tx);
+        break;
+    case Verb::Abort:
+        if (!tx.open()) out = "no transaction open";
+        else fs->abort(tx);
+        break;
+    case Verb::Watch:
+        if (nrest == 0 || nrest > 2 || (nrest == 2 && arg2 != "-r")) {
+            out = "usage: watch <dir> [-r]";
+            break;
+        }
+        if (client.events == nullptr) client.events = new WatchRing();
+        status = fs->watch(arg1, nrest == 2, *client.events);
+        break;
+    case Verb::Unwatch:
+        release(fs, client);
+        break;
+    case Verb::Events: {
+        // "create dir/name", a trailing / for directories, "..." in front
+        // of a path cut short.
+        WatchEvent event;
+        while (client.events != nullptr && client.events->pop(event)) {
+            out += watchKindName(event.kind);
+            if (event.kind != WatchEvent::Kind::Resync) {
+                out += event.truncated ? " ..." : " ";
+                out.append(event.path, event.length);
+                if (event.isDir) out += '/';
+            }
+            out += '\n';
+        }
+        if (out != "") out.pop_back();
+        break;
+    }
+    case Verb::Import: {
+        if (nrest == 0 || nrest > 2) {
+            out = "usage: import <hostpath> [dest]";
+            break;
+        }
+        ImportReport report;
+        status = fs->importHost(arg1, arg2, report, std::thread::hardware_concurrency());
+        if (status != Status::Ok) break;
+        char line[200];
+        snprintf(line, sizeof(line), "imported %llu entries (%llu directories) in %.3f s: %.0f entries/s, %.1f bytes/entry",
+                 (unsigned long long)report.entries, (unsigned long long)report.directories, report.seconds,
+                 report.entries / (report.seconds > 0 ? report.seconds : 1e-9),
+                 static_cast<double>(report.bytes) / (report.entries + 1));
+        out = line;
+        if (report.unreadable != 0) out += ", " + std::to_string(report.unreadable) + " unreadable directories";
+        break;
+    }
+    case Verb::Stat: {
+        NodeMeta meta;
+        status = fs->tryStat(arg1, meta);
+        if (status != Status::Ok) break;
+        char mode[8];
+        snprintf(mode, sizeof(mode), "%04o", meta.mode);
+        out = "size: " + std::to_string(meta.size) + "\nmode: " + mode + "\nowner: " + std::to_string(meta.owner) +
+              "\nctime: " + formatTime(meta.ctime) + "\nmtime: " + formatTime(meta.mtime);
+        break;
+    }
+    case Verb::Mem: {
+        if (arg1 == "--budget") {
+            uint64_t budget = 0;
+            const char* end = arg2.data() + arg2.size();
+            if (nrest != 2 || std::from_chars(arg2.data(), end, budget).ptr != end || arg2.empty()) {
+                out = "usage: mem [path] | mem --budget <bytes>";
+            } else {
+                fs->setMemoryBudget(budget);
+            }
+            break;
+        }
+        if (nrest > 1) {
+            out = "usage: mem [path] | mem --budget <bytes>";
+            break;
+        }
+        MemUsage usage;
+        status = fs->tryMem(arg1, usage);
+        if (status != Status::Ok) break;
+        uint64_t nodeBytes = usage.nodes * sizeof(Node);
+        out = "nodes: " + std::to_string(usage.nodes) + " (" + std::to_string(nodeBytes) + " bytes)" +
+              "\nnames, metadata, indexes: " + std::to_string(usage.bytes - nodeBytes) + " bytes" +
+              "\ntotal: " + std::to_string(usage.bytes) + " bytes";
+        if (fs->memoryBudget() != 0) {
+            MemUsage all;
+            (void)fs->tryMem("/", all);
+            out += "\nbudget: " + std::to_string(all.bytes) + " of " + std::to_string(fs->memoryBudget()) +
+                   " bytes used";
+        }
+        break;
+    }
+    case Verb::Checkpoint: {
+        if (nrest != 1) {
+            out = "usage: checkpoint <hostdir>";
+            break;
+        }
+        CheckpointReport report;
+        status = fs->checkpoint(arg1, report);
+        if (status != Status::Ok) break;
+        char line[200];
+        if (report.bytes == 0) {
+            snprintf(line, sizeof(line), "nothing changed since checkpoint %llu", (unsigned long long)report.sequence);
+        } else {
+            snprintf(line, sizeof(line), "checkpoint %llu: %llu directories, %llu bytes in %.3f s, %llu segments live",
+                     (unsigned long long)report.sequence, (unsigned long long)report.directories,
+                     (unsigned long long)report.bytes, report.seconds, (unsigned long long)report.segments);
+        }
+        out = line;
+        break;
+    }
+    case Verb::Restore: {
+        uint64_t limit = 0;
+        const char* end = arg2.data() + arg2.size();
+        if (nrest == 1) {
+            status = fs->restore(arg1);
+        } else if (nrest == 3 && arg1 == "--paged" && !arg2.empty() &&
+                   std::from_chars(arg2.data(), end, limit).ptr == end) {
+            status = fs->restorePaged(arg3, limit);
+        } else {
+            out = "usage: restore [--paged <bytes>] <hostdir>";
+        }
+        break;
+    }
+    case Verb::Unknown:
+        out = "command not found";
+        break;
+    }
+
+    Stats::recordCommand(counted, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+
+    if (status != Status::Ok) out = statusMessage(status);
+    return true;
+}
+
+void CommandShell::release(FileSystem* fs, ShellClient& client) {
+    if (client.events != nullptr) fs->unwatch(*client.events);
+}
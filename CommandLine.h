@@ -0,0 +1,74 @@
+#ifndef COMMANDLINE_H_
+#define COMMANDLINE_H_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "FileSystem.h"
+#include "Stats.h"
+
+// Command words understood by the REPL.
+enum class Verb : unsigned char {
+	Cd, Ls, Pwd, Tree, Touch, Mkdir, Rm, Rmdir, Mv, Cp,
+	Complete, Load, Gen, Stats, Trace, Exit,
+	Begin, Commit, Abort,
+	Watch, Unwatch, Events, Import, Stat, Mem,
+	Checkpoint, Restore,
+	Unknown
+};
+
+// most words a line is split into, the rest of the line is ignored
+const size_t kMaxTokens = 16;
+
+// split line at whitespace into at most max words, returns how many
+// the views point into line, nothing is copied
+size_t tokenize(std::string_view line, std::string_view* tokens, size_t max);
+
+// map a command word to its Verb, Verb::Unknown if there is none
+[[nodiscard]] Verb verbFromName(std::string_view word);
+
+// the Command a verb is counted and timed as, Command::Count if not counted
+[[nodiscard]] Command verbCommand(Verb verb);
+
+// What one client of a CommandShell keeps from line to line. The REPL has
+// one, the server one per connection.
+struct ShellClient {
+	Transaction tx;              // open between begin and commit/abort
+	WatchRing* events = nullptr; // fed by the client's watches, made by the first one
+
+	ShellClient() = default;
+	ShellClient(const ShellClient&) = delete;
+	ShellClient& operator=(const ShellClient&) = delete;
+	~ShellClient() { delete events; }
+};
+
+// Runs command lines against a FileSystem the way the REPL does. Shared by
+// main() and the socket server so both speak exactly the same language.
+// Scratch strings are kept from line to line, so a steady stream of
+// commands allocates nothing beyond what their output needs.
+class CommandShell {
+
+	bool canReplace_;  // load and gen may swap in a new FileSystem
+	ShellClient client_; // the REPL's, the server keeps one per connection
+	std::string after_, candidates_, common_;
+
+public:
+	explicit CommandShell(bool canReplace = true) : canReplace_(canReplace) {}
+
+	// run one line against fs and put what the REPL would print into out
+	// (cleared first, "" for nothing). load and gen delete fs and point it at
+	// the new FileSystem. Every counted command is timed into Stats and
+	// traced. Returns false for exit, leaving out empty.
+	// Between begin and commit/abort, touch/mkdir/rm/rmdir/mv are staged in
+	// tx instead of run, cd/ls/complete/tree are recorded as reads of the
+	// current directory, and commands that cannot be undone are refused.
+	// "watch <dir> [-r]" adds a watch feeding client.events, "events" prints
+	// and drains what they saw so far, "unwatch" ends them all.
+	bool run(FileSystem*& fs, std::string_view line, std::string& out, ShellClient& client);
+	bool run(FileSystem*& fs, std::string_view line, std::string& out) { return run(fs, line, out, client_); }
+
+	// end client's watches on fs, before the client goes away while fs stays
+	static void release(FileSystem* fs, ShellClient& client);
+};
+
+#endif /* COMMANDLINE_H_ */
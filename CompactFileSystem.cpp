@@ -0,0 +1,375 @@
+#include "CompactFileSystem.h"
+#include "NameKey.h"
+#include "Stats.h"
+#include "Tracer.h"
+#include <cstring>
+#include <string>
+
+
+/*
+==================================
+// Node storage.
+==================================
+*/
+
+CompactFileSystem::Handle CompactFileSystem::newNode(string_view name, bool isDir, Handle parent) {
+    Handle node;
+    if (freeList_ != kNil) {
+        // Reuse a deleted slot.
+        node = freeList_;
+        freeList_ = nextSibling_[node];
+        firstChild_[node] = kNil;
+        nextSibling_[node] = kNil;
+        parent_[node] = parent;
+        isDir_[node] = isDir;
+    } else {
+        node = static_cast<Handle>(keys_.size());
+        firstChild_.push_back(kNil);
+        nextSibling_.push_back(kNil);
+        keys_.push_back(0);
+        parent_.push_back(parent);
+        nameOff_.push_back(0);
+        nameLen_.push_back(0);
+        isDir_.push_back(isDir);
+    }
+    setName(node, name);
+    liveNodes_++;
+    return node;
+}
+
+void CompactFileSystem::freeNode(Handle node) {
+    // Its name tail is dead from now on; a length of 0 keeps compactNames() off it.
+    if (nameLen_[node] > 8) deadNameBytes_ += nameLen_[node] - 8;
+    nameLen_[node] = 0;
+    nextSibling_[node] = freeList_;
+    freeList_ = node;
+    liveNodes_--;
+    compactIfSparse();
+}
+
+// A tail no longer than the one node has is written over it; a longer one
+// goes at the end of names_ and the old one is dead. Callers check roomFor().
+void CompactFileSystem::setName(Handle node, string_view name) {
+    size_t oldLen = nameLen_[node];
+    keys_[node] = nameKey(name);
+    nameLen_[node] = static_cast<uint8_t>(name.size());
+    if (name.size() > 8 && oldLen >= name.size()) {
+        std::memcpy(&names_[nameOff_[node]], name.data() + 8, name.size() - 8);
+        deadNameBytes_ += oldLen - name.size();
+        return;
+    }
+    if (oldLen > 8) deadNameBytes_ += oldLen - 8;
+    if (name.size() > 8) {
+        nameOff_[node] = static_cast<uint32_t>(names_.size());
+        names_.append(name.data() + 8, name.size() - 8);
+    } else {
+        nameOff_[node] = 0;
+    }
+    compactIfSparse();
+}
+
+// Whether a name of nameLength bytes fits, and a new node too if node:
+// handles are 32-bit and so are the offsets into names_. Compacts names_
+// first if that is what it takes.
+Status CompactFileSystem::roomFor(size_t nameLength, bool node) {
+    if (node && freeList_ == kNil && keys_.size() >= kNil) return Status::MemoryBudgetExceeded;
+    if (nameLength <= 8 || names_.size() + nameLength - 8 <= nameLimit_) return Status::Ok;
+    compactNames();
+    return names_.size() + nameLength - 8 <= nameLimit_ ? Status::Ok : Status::MemoryBudgetExceeded;
+}
+
+// Copy the live tails into a fresh arena, dropping the dead bytes.
+void CompactFileSystem::compactNames() {
+    TRACE_SPAN("compactNames");
+    Column<char> packed;
+    packed.reserve(names_.size() - deadNameBytes_);
+    for (Handle node = 0; node < keys_.size(); node++) {
+        if (nameLen_[node] <= 8) continue;
+        uint64_t offset = packed.size();
+        packed.append(&names_[nameOff_[node]], nameLen_[node] - 8);
+        nameOff_[node] = static_cast<uint32_t>(offset);
+    }
+    names_.swap(packed);
+    deadNameBytes_ = 0;
+}
+
+// Compact once most of names_ is dead and there are at least as many dead
+// bytes as slots to walk, so the walk is paid for by the bytes it frees.
+void CompactFileSystem::compactIfSparse() {
+    if (deadNameBytes_ * 2 > names_.size() && deadNameBytes_ >= keys_.size()) compactNames();
+}
+
+// Same order as std::string::compare, see NameKey.h.
+int CompactFileSystem::compareName(Handle node, uint64_t key, string_view name) const {
+    if (keys_[node] != key) return keys_[node] < key ? -1 : 1;
+
+    // Equal keys: when either name fits in its key it is a prefix of the other.
+    size_t len = nameLen_[node];
+    if (len > 8 && name.size() > 8) {
+        size_t n = len < name.size() ? len : name.size();
+        int res = std::memcmp(&names_[nameOff_[node]], name.data() + 8, n - 8);
+        if (res != 0) return res;
+    }
+    return len < name.size() ? -1 : (len > name.size() ? 1 : 0);
+}
+
+int CompactFileSystem::compareNodes(Handle a, Handle b) const {
+    if (keys_[a] != keys_[b]) return keys_[a] < keys_[b] ? -1 : 1;
+
+    size_t lenA = nameLen_[a];
+    size_t lenB = nameLen_[b];
+    if (lenA > 8 && lenB > 8) {
+        size_t n = lenA < lenB ? lenA : lenB;
+        int res = std::memcmp(&names_[nameOff_[a]], &names_[nameOff_[b]], n - 8);
+        if (res != 0) return res;
+    }
+    return lenA < lenB ? -1 : (lenA > lenB ? 1 : 0);
+}
+
+void CompactFileSystem::appendName(Handle node, string& out) const {
+    size_t len = nameLen_[node];
+    uint64_t key = keys_[node];
+    for (size_t i = 0; i < len && i < 8; i++) {
+        out += static_cast<char>(key >> (56 - 8 * i));
+    }
+    if (len > 8) out.append(&names_[nameOff_[node]], len - 8);
+}
+
+
+/*
+==================================
+// Private helper methods.
+==================================
+*/
+
+CompactFileSystem::Handle CompactFileSystem::findChild(Handle dir, string_view name) const {
+    TRACE_SPAN("findChild");
+    uint64_t key = nameKey(name);
+    uint64_t visits = 0;
+    for (Handle tmp = firstChild_[dir]; tmp != kNil; tmp = nextSibling_[tmp]) {
+        visits++;
+        int res = compareName(tmp, key, name);
+        if (res >= 0) {
+            Stats::count(Counter::FindChildVisits, visits);
+            return res == 0 ? tmp : kNil; // Sorted, so nothing further can match.
+        }
+    }
+    Stats::count(Counter::FindChildVisits, visits);
+    return kNil;
+}
+
+void CompactFileSystem::insertChildAlphabetical(Handle dir, Handle node) {
+    TRACE_SPAN("insertChildAlphabetical");
+    Handle prev = kNil;
+    Handle next = firstChild_[dir];
+    uint64_t hops = 0;
+    while (next != kNil && compareNodes(next, node) < 0) {
+        prev = next;
+        next = nextSibling_[next];
+        hops++;
+    }
+    Stats::count(Counter::InsertSiblingHops, hops);
+
+    nextSibling_[node] = next;
+    if (prev == kNil) firstChild_[dir] = node;
+    else nextSibling_[prev] = node;
+    parent_[node] = dir;
+}
+
+void CompactFileSystem::detachChild(Handle dir, Handle node) {
+    TRACE_SPAN("detachChild");
+    if (firstChild_[dir] == node) {
+        firstChild_[dir] = nextSibling_[node];
+    } else {
+        Handle prev = firstChild_[dir];
+        while (prev != kNil && nextSibling_[prev] != node) {
+            prev = nextSibling_[prev];
+        }
+        if (prev == kNil) return; // Not a child of dir.
+        nextSibling_[prev] = nextSibling_[node];
+    }
+    nextSibling_[node] = kNil;
+}
+
+// Used by tryMv() to move node from curr_ into dest.
+Status CompactFileSystem::moveInto(Handle node, Handle dest) {
+    string name;
+    appendName(node, name);
+    if (findChild(dest, name) != kNil) return Status::DestinationHasSameName;
+    detachChild(curr_, node);
+    insertChildAlphabetical(dest, node);
+    return Status::Ok;
+}
+
+
+/*
+==================================
+// Public methods.
+==================================
+*/
+
+CompactFileSystem::CompactFileSystem()
+    : freeList_(kNil), liveNodes_(0), deadNameBytes_(0), nameLimit_(uint64_t(1) << 32) {
+    curr_ = root_ = newNode("", true, kNil);
+}
+
+CompactFileSystem::~CompactFileSystem() {
+    // Columns free themselves.
+}
+
+uint64_t CompactFileSystem::bytes() const {
+    return firstChild_.bytes() + nextSibling_.bytes() + keys_.bytes() + parent_.bytes()
+         + nameOff_.bytes() + nameLen_.bytes() + isDir_.bytes() + names_.bytes();
+}
+
+void CompactFileSystem::setNameLimit(uint64_t bytes) {
+    nameLimit_ = bytes < (uint64_t(1) << 32) ? bytes : uint64_t(1) << 32;
+}
+
+Status CompactFileSystem::tryCd(string_view path) {
+    TRACE_SPAN("resolvePath");
+    if (path == "..") {
+        if (curr_ == root_) return Status::InvalidPath;
+        curr_ = parent_[curr_];
+        return Status::Ok;
+    }
+    if (path == "/" || path == "~") {
+        curr_ = root_;
+        return Status::Ok;
+    }
+    if (path == ".") return Status::Ok;
+
+    Handle child = findChild(curr_, path);
+    if (child == kNil || !isDir_[child]) return Status::InvalidPath;
+    curr_ = child;
+    return Status::Ok;
+}
+
+void CompactFileSystem::lsInto(string& res) const {
+    TRACE_SPAN("format");
+    res.clear();
+    for (Handle tmp = firstChild_[curr_]; tmp != kNil; tmp = nextSibling_[tmp]) {
+        appendName(tmp, res);
+        res += isDir_[tmp] ? "/\n" : "\n";
+    }
+    if (res != "") res.pop_back(); // remove extra \n
+}
+
+void CompactFileSystem::pwdInto(string& res) const {
+    res.clear();
+    if (curr_ == root_) {
+        res = "/";
+        return;
+    }
+    // Names come out leaf first, so collect the handles and emit in reverse.
+    Column<Handle> path;
+    for (Handle tmp = curr_; tmp != root_; tmp = parent_[tmp]) {
+        path.push_back(tmp);
+    }
+    for (uint64_t i = path.size(); i > 0; i--) {
+        res += "/";
+        appendName(path[i - 1], res);
+    }
+}
+
+void CompactFileSystem::treeInto(string& res) const {
+    TRACE_SPAN("format");
+    res.clear();
+
+    if (curr_ == root_) {
+        res += "/";
+    } else {
+        appendName(curr_, res);
+        res += "/";
+        // FileSystem::tree() ends an empty subdirectory with a newline too.
+        if (firstChild_[curr_] == kNil) res += "\n";
+    }
+
+    // Iterative depth first walk, same layout as FileSystem::treeRecursion():
+    // one space of indent per level below curr_.
+    Handle node = firstChild_[curr_];
+    uint64_t depth = 1;
+    while (node != kNil) {
+        res += "\n";
+        res.append(depth, ' ');
+        appendName(node, res);
+        if (isDir_[node]) res += "/";
+
+        if (firstChild_[node] != kNil) {
+            node = firstChild_[node];
+            depth++;
+            continue;
+        }
+        // Climb until a level with a next sibling, never above curr_.
+        while (node != kNil && nextSibling_[node] == kNil) {
+            node = parent_[node];
+            depth--;
+            if (node == curr_) node = kNil;
+        }
+        if (node != kNil) node = nextSibling_[node];
+    }
+    Stats::count(Counter::TreeBytes, res.size());
+}
+
+Status CompactFileSystem::tryTouch(string_view name) {
+    if (name == "" || name.size() > 255) return Status::InvalidName;
+    if (findChild(curr_, name) != kNil) return Status::AlreadyExists;
+    Status status = roomFor(name.size(), true);
+    if (status != Status::Ok) return status;
+    insertChildAlphabetical(curr_, newNode(name, false, curr_));
+    return Status::Ok;
+}
+
+Status CompactFileSystem::tryMkdir(string_view name) {
+    if (name == "" || name.size() > 255) return Status::InvalidName;
+    if (findChild(curr_, name) != kNil) return Status::AlreadyExists;
+    Status status = roomFor(name.size(), true);
+    if (status != Status::Ok) return status;
+    insertChildAlphabetical(curr_, newNode(name, true, curr_));
+    return Status::Ok;
+}
+
+Status CompactFileSystem::tryRm(string_view name) {
+    Handle target = findChild(curr_, name);
+    if (target == kNil) return Status::FileNotFound;
+    if (isDir_[target]) return Status::NotAFile;
+    detachChild(curr_, target);
+    freeNode(target);
+    return Status::Ok;
+}
+
+Status CompactFileSystem::tryRmdir(string_view name) {
+    Handle target = findChild(curr_, name);
+    if (target == kNil) return Status::DirectoryNotFound;
+    if (!isDir_[target]) return Status::NotADirectory;
+    if (firstChild_[target] != kNil) return Status::DirectoryNotEmpty;
+    detachChild(curr_, target);
+    freeNode(target);
+    return Status::Ok;
+}
+
+Status CompactFileSystem::tryMv(string_view src, string_view dest) {
+    // Same rules, in the same order, as FileSystem::tryMv().
+    if (src == dest) return Status::SameSourceDestination;
+    if (dest == ".." && curr_ == root_) return Status::InvalidPath;
+
+    Handle srcNode = findChild(curr_, src);
+    if (srcNode == kNil) return Status::SourceNotFound;
+
+    if (dest == "..") return moveInto(srcNode, parent_[curr_]);
+
+    Handle destNode = findChild(curr_, dest);
+    if (destNode != kNil && !isDir_[destNode]) {
+        return isDir_[srcNode] ? Status::DirectoryOntoFile : Status::DestinationHasFile;
+    }
+    if (destNode != kNil) return moveInto(srcNode, destNode);
+
+    // Rename: relink under the new name to keep siblings sorted.
+    if (dest == "" || dest.size() > 255) return Status::InvalidName;
+    Status status = roomFor(dest.size(), false);
+    if (status != Status::Ok) return status;
+    detachChild(curr_, srcNode);
+    setName(srcNode, dest);
+    insertChildAlphabetical(curr_, srcNode);
+    return Status::Ok;
+}
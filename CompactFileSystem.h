@@ -0,0 +1,141 @@
+#ifndef COMPACTFILESYSTEM_H_
+#define COMPACTFILESYSTEM_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "FileSystem.h"
+using std::string;
+using std::string_view;
+
+// Growable array of plain values, the storage behind every column below.
+// Grows by doubling with realloc, so it only suits trivially copyable T.
+template <typename T>
+class Column {
+
+	T* data_;
+	uint64_t size_;
+	uint64_t capacity_;
+
+public:
+	Column() : data_(nullptr), size_(0), capacity_(0) {}
+	~Column() { std::free(data_); }
+
+	Column(const Column&) = delete;
+	Column& operator=(const Column&) = delete;
+
+	T& operator[](uint64_t i) { return data_[i]; }
+	const T& operator[](uint64_t i) const { return data_[i]; }
+	[[nodiscard]] uint64_t size() const { return size_; }
+	[[nodiscard]] uint64_t bytes() const { return capacity_ * sizeof(T); }
+	T* data() { return data_; }
+
+	void reserve(uint64_t capacity) {
+		if (capacity <= capacity_) return;
+		T* grown = static_cast<T*>(std::realloc(data_, capacity * sizeof(T)));
+		if (grown == nullptr) throw std::bad_alloc();
+		data_ = grown;
+		capacity_ = capacity;
+	}
+
+	void push_back(const T& value) {
+		if (size_ == capacity_) reserve(capacity_ ? capacity_ * 2 : 64);
+		data_[size_++] = value;
+	}
+
+	void swap(Column& other) {
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		std::swap(capacity_, other.capacity_);
+	}
+
+	void append(const T* values, uint64_t n) {
+		if (size_ + n > capacity_) {
+			uint64_t capacity = capacity_ ? capacity_ : 64;
+			while (capacity < size_ + n) capacity *= 2;
+			reserve(capacity);
+		}
+		for (uint64_t i = 0; i < n; i++) data_[size_ + i] = values[i];
+		size_ += n;
+	}
+};
+
+// Alternative storage engine with the same commands as FileSystem.
+// Nodes are 32-bit handles into struct-of-arrays columns instead of heap
+// objects: traversal walks firstChild_/nextSibling_ and compares keys_,
+// which are packed together, while names, parents and flags live in
+// columns of their own. A node costs about 26 bytes plus the part of its
+// name past the first 8 bytes (the key already holds those), so 100M
+// nodes fit in a few GB.
+class CompactFileSystem {
+
+	typedef uint32_t Handle;
+	static constexpr Handle kNil = 0xFFFFFFFFu;
+
+	// hot: what findChild() and tree() walk
+	Column<Handle> firstChild_;
+	Column<Handle> nextSibling_;
+	Column<uint64_t> keys_;      // nameKey() of each name
+	// cold
+	Column<Handle> parent_;
+	Column<uint32_t> nameOff_;   // bytes 8.. of the name start here in names_
+	Column<uint8_t> nameLen_;    // names are at most 255 bytes, like NAME_MAX
+	Column<uint8_t> isDir_;
+	Column<char> names_;         // name tails, only for names longer than 8
+
+	Handle root_;                // always handle 0
+	Handle curr_;                // current directory
+	Handle freeList_;            // deleted slots, chained through nextSibling_
+	uint64_t liveNodes_;
+	uint64_t deadNameBytes_;     // bytes of names_ no live node points at
+	uint64_t nameLimit_;         // names_ never grows past this, so offsets fit nameOff_
+
+	Handle newNode(string_view name, bool isDir, Handle parent);
+	void freeNode(Handle node);
+	[[nodiscard]] Status roomFor(size_t nameLength, bool node);
+	void compactNames();
+	void compactIfSparse();
+
+	[[nodiscard]] int compareName(Handle node, uint64_t key, string_view name) const;
+	[[nodiscard]] int compareNodes(Handle a, Handle b) const;
+	void appendName(Handle node, string& out) const;
+	void setName(Handle node, string_view name);
+
+	[[nodiscard]] Handle findChild(Handle dir, string_view name) const;
+	void insertChildAlphabetical(Handle dir, Handle node);
+	void detachChild(Handle dir, Handle node);
+	Status moveInto(Handle node, Handle dest);
+
+public:
+	CompactFileSystem();
+	~CompactFileSystem();
+
+	CompactFileSystem(const CompactFileSystem&) = delete;
+	CompactFileSystem& operator=(const CompactFileSystem&) = delete;
+
+	// same behaviour and messages as the FileSystem Status API
+	Status tryCd(string_view path);
+	void lsInto(string& out) const;
+	void treeInto(string& out) const;
+	void pwdInto(string& out) const;
+	Status tryTouch(string_view name);
+	Status tryMkdir(string_view name);
+	Status tryRm(string_view name);
+	Status tryRmdir(string_view name);
+	Status tryMv(string_view src, string_view dest);
+
+	// number of live nodes, root included
+	[[nodiscard]] uint64_t nodes() const { return liveNodes_; }
+
+	// bytes held by all columns
+	[[nodiscard]] uint64_t bytes() const;
+
+	// cap on the name tail arena, at most (and by default) 4 GiB; past it
+	// touch, mkdir and renames fail with Status::MemoryBudgetExceeded
+	void setNameLimit(uint64_t bytes);
+};
+
+#endif /* COMPACTFILESYSTEM_H_ */
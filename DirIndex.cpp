@@ -0,0 +1,179 @@
+#include "DirIndex.h"
+#include "FileSystem.h"
+#include <new>
+
+
+DirIndex::DirIndex(Node* dir) : dir_(dir), levels_(0), towers_(0), towerBytes_(0), children_(0), seenBytes_(0) {
+    // Seed from the address so sibling directories get different shapes.
+    rng_ = reinterpret_cast<uint64_t>(dir) * 0x9E3779B97F4A7C15ull | 1;
+    for (int l = 0; l < kMaxLevel; l++) {
+        head_[l] = nullptr;
+    }
+
+    // Children are already sorted, so append towers at the tail of each level.
+    Tower* tail[kMaxLevel];
+    for (Node* child = dir_->leftmostChild_; child != nullptr; child = child->rightSibling_) {
+        children_++;
+        int height = randomHeight();
+        if (height == 0) continue;
+        Tower* tower = newTower(child, height);
+        for (int l = 0; l < height; l++) {
+            if (l >= levels_) {
+                head_[l] = tower;
+            } else {
+                tail[l]->next_[l] = tower;
+            }
+            tail[l] = tower;
+        }
+        if (height > levels_) levels_ = height;
+    }
+}
+
+DirIndex::~DirIndex() {
+    Tower* tower = levels_ > 0 ? head_[0] : nullptr;
+    while (tower != nullptr) {
+        Tower* next = tower->next_[0];
+        ::operator delete(tower);
+        tower = next;
+    }
+}
+
+DirIndex::Tower* DirIndex::newTower(Node* node, int height) {
+    size_t size = sizeof(Tower) + (height - 1) * sizeof(Tower*);
+    void* mem = ::operator new(size);
+    towers_++;
+    towerBytes_ += size;
+    Tower* tower = static_cast<Tower*>(mem);
+    tower->key_ = node->key_;
+    tower->node_ = node;
+    tower->height_ = height;
+    for (int l = 0; l < height; l++) {
+        tower->next_[l] = nullptr;
+    }
+    return tower;
+}
+
+// Geometric with p = 1/4, and 0 (no tower) three times out of four.
+int DirIndex::randomHeight() {
+    int height = 0;
+    while (height < kMaxLevel) {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        if ((rng_ & 3) != 0) break;
+        height++;
+    }
+    return height;
+}
+
+DirIndex::Tower* DirIndex::seek(uint64_t key, string_view name, Tower** update, uint64_t& hops) const {
+    Tower* prev = nullptr; // nullptr stands for the head.
+    for (int l = levels_ - 1; l >= 0; l--) {
+        Tower* next = prev ? prev->next_[l] : head_[l];
+        while (next != nullptr && compareNames(next->key_, next->node_->name_, key, name) < 0) {
+            prev = next;
+            next = next->next_[l];
+            hops++;
+        }
+        if (update) update[l] = prev;
+    }
+    if (update) {
+        for (int l = levels_; l < kMaxLevel; l++) {
+            update[l] = nullptr;
+        }
+    }
+    return prev;
+}
+
+Node* DirIndex::predecessor(uint64_t key, string_view name, uint64_t& hops) const {
+    Tower* tower = seek(key, name, nullptr, hops);
+
+    // Finish on the sibling list, expected three hops or so.
+    Node* prev = tower ? tower->node_ : nullptr;
+    Node* next = prev ? prev->rightSibling_ : dir_->leftmostChild_;
+    while (next != nullptr && compareNames(next->key_, next->name_, key, name) < 0) {
+        prev = next;
+        next = next->rightSibling_;
+        hops++;
+    }
+    return prev;
+}
+
+Node* DirIndex::last(uint64_t& hops) const {
+    // Run right along every level, then off the end of the sibling list.
+    Tower* prev = nullptr;
+    for (int l = levels_ - 1; l >= 0; l--) {
+        Tower* next = prev ? prev->next_[l] : head_[l];
+        while (next != nullptr) {
+            prev = next;
+            next = next->next_[l];
+            hops++;
+        }
+    }
+    Node* tail = prev ? prev->node_ : dir_->leftmostChild_;
+    while (tail != nullptr && tail->rightSibling_ != nullptr) {
+        tail = tail->rightSibling_;
+        hops++;
+    }
+    return tail;
+}
+
+void DirIndex::inserted(Node* node) {
+    children_++;
+    int height = randomHeight();
+    if (height == 0) return;
+
+    Tower* update[kMaxLevel];
+    uint64_t hops = 0;
+    seek(node->key_, node->name_, update, hops);
+
+    Tower* tower = newTower(node, height);
+    for (int l = 0; l < height; l++) {
+        if (update[l]) {
+            tower->next_[l] = update[l]->next_[l];
+            update[l]->next_[l] = tower;
+        } else {
+            tower->next_[l] = head_[l];
+            head_[l] = tower;
+        }
+    }
+    if (height > levels_) levels_ = height;
+}
+
+void DirIndex::removed(Node* node) {
+    children_--;
+    if (levels_ == 0) return;
+
+    Tower* update[kMaxLevel];
+    uint64_t hops = 0;
+    seek(node->key_, node->name_, update, hops);
+
+    // Only nodes that drew a tower have anything to unlink.
+    Tower* tower = update[0] ? update[0]->next_[0] : head_[0];
+    if (tower == nullptr || tower->node_ != node) return;
+
+    for (int l = 0; l < tower->height_; l++) {
+        if (update[l]) {
+            update[l]->next_[l] = tower->next_[l];
+        } else {
+            head_[l] = tower->next_[l];
+        }
+    }
+    towers_--;
+    towerBytes_ -= sizeof(Tower) + (tower->height_ - 1) * sizeof(Tower*);
+    ::operator delete(tower);
+
+    while (levels_ > 0 && head_[levels_ - 1] == nullptr) {
+        levels_--;
+    }
+}
+
+uint64_t DirIndex::bytes() const {
+    return sizeof(DirIndex) + towerBytes_;
+}
+
+int64_t DirIndex::takeGrowth() {
+    int64_t growth = static_cast<int64_t>(bytes()) - static_cast<int64_t>(seenBytes_);
+    seenBytes_ = bytes();
+    return growth;
+}
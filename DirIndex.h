@@ -0,0 +1,80 @@
+#ifndef DIRINDEX_H_
+#define DIRINDEX_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+using std::string;
+using std::string_view;
+
+class Node;
+
+// Sparse skip list over one directory's sorted sibling list.
+// The sibling list itself (rightSibling_) is the bottom level, and only
+// about one child in four gets a tower, so an index costs a fraction of a
+// pointer per child. A lookup walks the towers down to the closest child
+// before the key and then a handful of siblings, O(log n) overall.
+// Directories build one lazily once a linear scan gets too long.
+class DirIndex {
+
+	static const int kMaxLevel = 16;
+
+	// express lane entry for one child, next_ has height_ entries
+	struct Tower {
+		uint64_t key_;   // node_->key_, so lanes are walked without touching nodes
+		Node* node_;
+		int height_;
+		Tower* next_[1];
+	};
+
+	Node* dir_;                 // directory whose children are indexed
+	Tower* head_[kMaxLevel];    // first tower on each level
+	int levels_;                // number of levels in use
+	uint64_t rng_;              // xorshift state for tower heights
+	uint64_t towers_;           // towers allocated
+	uint64_t towerBytes_;       // bytes held by towers
+	uint64_t children_;         // children of dir_, towers or not
+	uint64_t seenBytes_;        // bytes() at the last takeGrowth()
+
+	// fill update[] with the last tower before key on every level
+	// (nullptr means the head), return the lowest one
+	Tower* seek(uint64_t key, string_view name, Tower** update, uint64_t& hops) const;
+	int randomHeight();
+	Tower* newTower(Node* node, int height);
+
+public:
+	// a scan longer than this builds an index for the directory
+	static const uint64_t kBuildThreshold = 64;
+
+	// index every child currently linked under dir
+	explicit DirIndex(Node* dir);
+	~DirIndex();
+
+	DirIndex(const DirIndex&) = delete;
+	DirIndex& operator=(const DirIndex&) = delete;
+
+	// last child whose name is < name, nullptr if there is none
+	// key is nameKey(name); hops is increased by the number of nodes looked at
+	[[nodiscard]] Node* predecessor(uint64_t key, string_view name, uint64_t& hops) const;
+
+	// last child in the directory, nullptr if it is empty
+	[[nodiscard]] Node* last(uint64_t& hops) const;
+
+	// call after node has been linked into the sibling list
+	void inserted(Node* node);
+
+	// call before node is unlinked, while its name is unchanged
+	void removed(Node* node);
+
+	// number of children, without walking them
+	[[nodiscard]] uint64_t size() const { return children_; }
+
+	// bytes owned by the index itself
+	[[nodiscard]] uint64_t bytes() const;
+
+	// change of bytes() since the last call (since construction the first
+	// time), for memory accounting
+	int64_t takeGrowth();
+};
+
+#endif /* DIRINDEX_H_ */
@@ -1,6 +1,28 @@
 #include "FileSystem.h"
+#include "Checkpoint.h"
+#include "NodePool.h"
+#include "Reclaimer.h"
+#include "Stats.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <new>
 #include <string>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 
 /* 
@@ -9,163 +31,332 @@
 ==================================
 */
 
+// Wall clock time for metadata, ns since the epoch.
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// splitmix64 step for the tree generator: tiny state, same sequence on every platform.
+static uint64_t genNext(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [lo, hi].
+static uint64_t genRange(uint64_t& state, uint64_t lo, uint64_t hi) {
+    return lo + genNext(state) % (hi - lo + 1);
+}
+
+// Heap bytes behind name, 0 while it fits the short string buffer.
+static size_t nameHeapBytes(const string& name) {
+    const char* inside = reinterpret_cast<const char*>(&name);
+    const char* data = name.data();
+    return data >= inside && data < inside + sizeof(string) ? 0 : name.capacity() + 1;
+}
+
+// Split a BatchOp path into its directory part, "" or everything up to and
+// including the last /, and the name after it.
+static void splitPath(string_view path, string_view& prefix, string_view& name) {
+    size_t slash = path.rfind('/');
+    prefix = slash == string_view::npos ? string_view() : path.substr(0, slash + 1);
+    name = path.substr(prefix.size());
+}
+
+// What touch/mkdir of a name of length bytes adds: the node, the name if
+// it is too long for the short string buffer, a metadata row.
+static uint64_t newNodeBytes(size_t length) {
+    static const size_t inlineName = string().capacity();
+    return sizeof(Node) + MetaTable::kRowBytes + (length > inlineName ? length + 1 : 0);
+}
+
 // Used by cd() to handle special navigation cases like "..", ".", "/", "~".
 // For commands that need to interpret special paths.
 // Future use: extended for more complex path parsing.
-string FileSystem::handleSpecialPaths(const string& path) {
+// Returns false (status untouched) to signal to continue with child search.
+bool FileSystem::handleSpecialPaths(string_view path, Status& status) {
     if (path == "..") {
-        if (curr_ == root_) {
-            return "invalid path";
+        if (curr_ == root_ || !curr_->parent_) { // Null check.
+            status = Status::InvalidPath;
+            return true;
         }
-        if (!curr_->parent_) return "invalid path"; // Null check.
         curr_ = curr_->parent_;
-        return "";
+        status = Status::Ok;
+        return true;
     }
 
     if (path == "/" || path == "~") {
         curr_ = root_;
-        return "";
+        status = Status::Ok;
+        return true;
     }
 
     if (path == ".") {
-        return "";
+        status = Status::Ok;
+        return true;
+    }
+
+    return false;
+}
+
+// Used by findChild(), insertChildAlphabetical(), deleteChild() and lsPage()
+// to find the last child of dir whose name sorts before name.
+// Returns nullptr when name belongs at the head of the list.
+Node* FileSystem::predecessor(Node* dir, string_view name, Counter counter) const {
+    uint64_t hops = 0; // Counted locally, published once per call.
+    uint64_t key = nameKey(name);
+    Node* prev = nullptr;
+    ensureLoaded(dir);
+
+    if (dir->index_ != nullptr) {
+        prev = dir->index_->predecessor(key, name, hops);
+    } else {
+        Node* next = dir->leftmostChild_;
+        while(next != nullptr && compareNames(next->key_, next->name_, key, name) < 0) {
+            prev = next;
+            next = next->rightSibling_;
+            hops++;
+        }
+        // Long scans mean a big directory, index it for next time.
+        if (hops > DirIndex::kBuildThreshold) {
+            dir->index_ = new DirIndex(dir);
+            if (accounted_) charge(dir, dir->index_->takeGrowth(), 0);
+        }
+    }
+    Stats::count(counter, hops);
+    return prev;
+}
+
+// Used by complete() to find the last child of dir whose name starts with prefix.
+// Returns nullptr when no child matches.
+Node* FileSystem::lastWithPrefix(Node* dir, string_view prefix) const {
+    // Smallest string greater than every match: bump the last byte that can be bumped.
+    string bound(prefix);
+    while (bound != "" && static_cast<unsigned char>(bound.back()) == 0xFF) {
+        bound.pop_back();
     }
 
-    return "continue";  // Signal to continue with child search.
+    Node* last;
+    if (bound == "") {
+        // Every name matches, so the last match is the last child.
+        uint64_t hops = 0;
+        if (dir->index_ != nullptr) {
+            last = dir->index_->last(hops);
+        } else {
+            last = dir->leftmostChild_;
+            while (last != nullptr && last->rightSibling_ != nullptr) {
+                last = last->rightSibling_;
+                hops++;
+            }
+        }
+        Stats::count(Counter::FindChildVisits, hops);
+    } else {
+        bound.back() = static_cast<char>(static_cast<unsigned char>(bound.back()) + 1);
+        last = predecessor(dir, bound, Counter::FindChildVisits);
+    }
+    if (last == nullptr || last->name_.compare(0, prefix.size(), prefix) != 0) return nullptr;
+    return last;
 }
 
 // Used by navigateToChild(), mkdir(), touch(), rm()  to search for child nodes by name
 // For commands that need to find specific child nodes.
-Node* FileSystem::findChild(const string& name) const {
-    Node* tmp = curr_->leftmostChild_;
-    while(tmp != nullptr) {
-        if(tmp->name_ == name) {
-            return tmp;
-        }
-        tmp = tmp->rightSibling_;
+Node* FileSystem::findChild(string_view name) const {
+    return findChildIn(curr_, name);
+}
+
+// Same as findChild(), in dir instead of curr_.
+Node* FileSystem::findChildIn(Node* dir, string_view name) const {
+    TRACE_SPAN("findChild");
+    // Siblings are sorted, so the match (if any) directly follows the predecessor.
+    Node* prev = predecessor(dir, name, Counter::FindChildVisits);
+    Node* tmp = prev ? prev->rightSibling_ : dir->leftmostChild_;
+    if(tmp != nullptr && tmp->key_ == nameKey(name) && tmp->name_ == name) {
+        return tmp;
     }
     return nullptr;
 }
 
 // Used by cd() to move to a child directory by name
 // For commands that need to validate directory paths.
-string FileSystem::navigateToChild(const string& path) {
+Status FileSystem::navigateToChild(string_view path) {
     Node* child = findChild(path);
     if (child == nullptr) {
-        return "invalid path";
+        return Status::InvalidPath;
     }
 
     if (!child->isDir_) {
-        return "invalid path";
+        return Status::InvalidPath;
     }
 
     curr_ = child;
-    return ""; // success.
+    return Status::Ok;
 }
 
 // by mkdir() and touch() to insert new child nodes in alphabetical order.
 // Future use: any command that adds new files/directories.
 void FileSystem::insertChildAlphabetical(Node* newNode){
-    if(curr_->leftmostChild_ == nullptr || curr_->leftmostChild_->name_ > newNode->name_)
+    TRACE_SPAN("insertChildAlphabetical");
+    // Find alphabetical location to insert.
+    Node* prev = predecessor(curr_, newNode->name_, Counter::InsertSiblingHops);
+    if(prev == nullptr)
     {
         // Insert as the leftmost child.
         newNode->rightSibling_ = curr_->leftmostChild_;
         curr_->leftmostChild_ = newNode;
     } else {
-        // Find alphabetical location to insert.
-        Node* prev = curr_->leftmostChild_;
-        Node* next = prev->rightSibling_;
-        while(next != nullptr && next->name_ < newNode->name_) {
-            prev = next;
-            next = next->rightSibling_;
-        }
-        // Insert at the location found (with prev and next set).
-        newNode-> rightSibling_ = next;
+        // Insert at the location found (after prev).
+        newNode->rightSibling_ = prev->rightSibling_;
         prev->rightSibling_ = newNode;
     }
+    if (curr_->index_ != nullptr) curr_->index_->inserted(newNode);
+    noteMutation(curr_, newNode, moving_ ? WatchEvent::Kind::MovedTo : WatchEvent::Kind::Create);
 }
 
-// Used by tree() to recursively traverse and format directory structure.
-// Future use: any command that needs hierarchical directory display.
-string FileSystem::treeRecursion(Node* node, int nestCount) const {
-    string res = "";
-    Node* tmp = node->leftmostChild_;
+// Appends text[from, to) with every line's indentation changed by shift.
+static void appendShifted(string& res, const string& text, size_t from, size_t to, ptrdiff_t shift) {
+    if (shift == 0) {
+        res.append(text, from, to - from);
+        return;
+    }
+    while (from < to) {
+        size_t end = text.find('\n', from) + 1;
+        if (shift > 0) {
+            res.append(static_cast<size_t>(shift), ' ');
+            res.append(text, from, end - from);
+        } else {
+            res.append(text, from - shift, end - from + shift);
+        }
+        from = end;
+    }
+}
 
-    while(tmp != nullptr) {
-        // Indent and add current node.
-        res += std::string(nestCount + 1, ' ') + tmp->name_;
-        if (tmp->isDir_ ) {
-            res += "/";
-        } 
-        res += "\n";
-        
-        // Traverse into leftmost child.
-        if(tmp->leftmostChild_ != nullptr) {
-            string childRes = treeRecursion(tmp, nestCount + 1);
-            if(!childRes.empty()) {
-                res += childRes + "\n";
-            }
+// Used by tree() to recursively traverse and format directory structure:
+// appends a line per entry below node, each ending in \n, indented
+// nestCount + 1 spaces on node's children. Each directory's own lines are
+// kept in treeCache_ and reused while its child list stays the same.
+void FileSystem::treeRecursion(Node* node, size_t nestCount, string& res) const {
+    ensureLoaded(node);
+    TreeFragment* fragment;
+    if (node->treeGen_ == treeGen_) {
+        fragment = &treeCache_.find(node)->second;
+        Stats::count(Counter::TreeCacheHits);
+    } else {
+        fragment = &treeCache_[node];
+        treeCacheBytes_ -= fragment->text.size() + fragment->subdirs.size() * sizeof(fragment->subdirs[0]);
+        fragment->nest = nestCount;
+        fragment->text.clear();
+        fragment->subdirs.clear();
+        for (Node* tmp = node->leftmostChild_; tmp != nullptr; tmp = tmp->rightSibling_) {
+            // Indent and add current node.
+            fragment->text.append(nestCount + 1, ' ');
+            fragment->text += tmp->name_;
+            fragment->text += tmp->isDir_ ? "/\n" : "\n";
+            // A stub's children are only known once it is rendered.
+            if (tmp->leftmostChild_ != nullptr || tmp->stub_) fragment->subdirs.emplace_back(fragment->text.size(), tmp);
         }
-        tmp = tmp->rightSibling_;
+        treeCacheBytes_ += fragment->text.size() + fragment->subdirs.size() * sizeof(fragment->subdirs[0]);
+        node->treeGen_ = treeGen_;
     }
-    // remove extra \n like in predefined ls().
-    if (res != "") res.pop_back(); 
-    return res; // return tree path from curr_.
 
+    // Lines rendered at another depth move left or right.
+    ptrdiff_t shift = static_cast<ptrdiff_t>(nestCount) - static_cast<ptrdiff_t>(fragment->nest);
+    size_t pos = 0;
+    for (const auto& subdir : fragment->subdirs) {
+        appendShifted(res, fragment->text, pos, subdir.first, shift);
+        treeRecursion(subdir.second, nestCount + 1, res);
+        pos = subdir.first;
+    }
+    appendShifted(res, fragment->text, pos, fragment->text.size(), shift);
+}
+
+// Forget every kept rendering. Nodes are not visited, they may be gone:
+// a new generation makes all of them stale at once.
+void FileSystem::clearTreeCache() const {
+    treeCache_.clear();
+    treeCacheBytes_ = 0;
+    if (++treeGen_ != 0) return;
+    // Wrapped around: old generations come back, so reset the live tree.
+    treeGen_ = 1;
+    for (Node* node = root_; node != nullptr;) {
+        node->treeGen_ = 0;
+        if (node->leftmostChild_ != nullptr) {
+            node = node->leftmostChild_;
+            continue;
+        }
+        while (node != nullptr && node->rightSibling_ == nullptr) node = node->parent_;
+        if (node != nullptr) node = node->rightSibling_;
+    }
+}
+
+// Drop the renderings that showed dir's child list: its own and every
+// directory's above it.
+void FileSystem::invalidateTree(Node* dir) {
+    for (; dir != nullptr; dir = dir->parent_) {
+        if (dir->treeGen_ != treeGen_) continue;
+        auto it = treeCache_.find(dir);
+        treeCacheBytes_ -= it->second.text.size() + it->second.subdirs.size() * sizeof(it->second.subdirs[0]);
+        treeCache_.erase(it);
+        dir->treeGen_ = 0;
+    }
 }
 
 // Used by rm() and rmdir() to remove child nodes from the current directory.
 // For any command that deletes files/directories.
 void FileSystem::deleteChild(Node* removeTarget) {
+    TRACE_SPAN("deleteChild");
     // This function handles recursive deletion of nodes (files and dirs).
-    
-    if (curr_->leftmostChild_ == removeTarget){
-        // Remove the target from the list. Becomes the leftmost child.
-        curr_->leftmostChild_ = removeTarget->rightSibling_;
-        } else {
-            // prev points to the sibling before removeTarget.
-            Node* prev = curr_->leftmostChild_;
-            while (prev->rightSibling_ != removeTarget) {
-                if (!prev->rightSibling_) return; // Null check.
-                prev = prev->rightSibling_;
-            }
-            prev->rightSibling_ = removeTarget->rightSibling_;
-        }
-        delete removeTarget; // Free memory.
+    detachChild(removeTarget);
+    delete removeTarget; // Free memory.
 }
 // Used by mv() to detach a node from current position in file system before reattaching it elsewhere.
 // For commands that move files/directories.
 void FileSystem::detachChild(Node* node){
+    TRACE_SPAN("detachChild");
     if (curr_->leftmostChild_ == node) {
-            curr_->leftmostChild_ = node->rightSibling_;
-        } else {
-            Node* prev = curr_->leftmostChild_;
-            while (prev->rightSibling_ != node) {
-                if (!prev->rightSibling_) return; // Null check.
-                prev = prev->rightSibling_;
-            }
-            prev->rightSibling_ = node->rightSibling_;
-        }
+        curr_->leftmostChild_ = node->rightSibling_;
+    } else {
+        // prev points to the sibling before node.
+        Node* prev = predecessor(curr_, node->name_, Counter::FindChildVisits);
+        if (!prev || prev->rightSibling_ != node) return; // Not a child of curr_.
+        prev->rightSibling_ = node->rightSibling_;
+    }
+    if (curr_->index_ != nullptr) curr_->index_->removed(node);
+    node->rightSibling_ = nullptr;
+    noteMutation(curr_, node, moving_ ? WatchEvent::Kind::MovedFrom : WatchEvent::Kind::Delete);
 }
 
 
 // Used by mv() to rename nodes without changing their location.
 // For commands that rename files/directories.
-string FileSystem::renameChild(const string& src, const string& dest){
+Status FileSystem::renameChild(string_view src, string_view dest){
     Node* srcNode = findChild(src);
-    if (!srcNode) return "source does not exist"; // Null check.
-    if (findChild(dest)) return "file/directory already exists";
+    if (!srcNode) return Status::SourceNotFound; // Null check.
+    if (findChild(dest)) return Status::AlreadyExists;
+    moving_ = true;
     detachChild(srcNode);
-    srcNode->name_ = dest;
+    renameNode(srcNode, dest);
     insertChildAlphabetical(srcNode);
-    return ""; // success.
+    moving_ = false;
+    return Status::Ok;
+}
+
+// Used by renameChild() and undo() on a detached node: a directory keeps
+// its own name in its usage, a longer name may need heap.
+void FileSystem::renameNode(Node* node, string_view name) {
+    uint64_t before = ownBytes(node);
+    node->setName(name);
+    if (accounted_ && node->isDir_ && node->id_ != MetaTable::kNone) {
+        MetaTable::addUsage(node->id_, static_cast<int64_t>(ownBytes(node)) - static_cast<int64_t>(before), 0);
+    }
 }
 
 // Used by mv() to move nodes between directories.
 // For commands that move files/directories.
-string FileSystem::moveChild(const string& src, const string& dest){
+Status FileSystem::moveChild(string_view src, string_view dest){
     Node* srcNode = findChild(src);
-    if(!srcNode){return "source does not exist";} // Null check.
+    if(!srcNode){return Status::SourceNotFound;} // Null check.
 
     Node* destNode = findChild(dest);
     // Catch .. case earlier in mv().
@@ -173,8 +364,8 @@ string FileSystem::moveChild(const string& src, const string& dest){
     {
         destNode = curr_->parent_;
     } else {
-        if(!destNode){return "destination does not exist";} // Null check.
-        if(!destNode->isDir_){return "destination is not a directory";} 
+        if(!destNode){return Status::DestinationNotFound;} // Null check.
+        if(!destNode->isDir_){return Status::DestinationNotDirectory;}
     }
     
     // Check for conflicts before detaching.
@@ -182,10 +373,15 @@ string FileSystem::moveChild(const string& src, const string& dest){
     curr_ = destNode;
     if (findChild(srcNode->name_)) {
         curr_ = originalCurr;
-        return "destination already has file/directory of same name";
+        return Status::DestinationHasSameName;
     }
     curr_ = originalCurr;
 
+    // Sessions parked below srcNode now pin the destination's ancestors.
+    int32_t pins = static_cast<int32_t>(srcNode->pins_);
+    if (pins != 0) pinPath(srcNode->parent_, -pins);
+
+    moving_ = true;
     detachChild(srcNode);
     srcNode->parent_ = destNode;
 
@@ -193,7 +389,296 @@ string FileSystem::moveChild(const string& src, const string& dest){
     curr_ = destNode;
     insertChildAlphabetical(srcNode);
     curr_ = originalCurr; // Restore curr_.
-    return ""; // success.
+    moving_ = false;
+
+    if (pins != 0) pinPath(destNode, pins);
+    return Status::Ok;
+}
+
+// Used by ShardedFileSystem to start moving path to another FileSystem.
+// Refuses a node that is held already, or has a held node below it.
+Status FileSystem::holdNode(string_view path, Node*& node, bool& isDir) {
+    string_view prefix, name;
+    splitPath(path, prefix, name);
+    Node* dir;
+    if (resolvePath(root_, prefix, dir) != Status::Ok) return Status::SourceNotFound;
+    node = name == "" || name == "." || name == ".." || name == "~" ? nullptr : findChildIn(dir, name);
+    if (node == nullptr) return Status::SourceNotFound;
+    if (node->pins_ != 0) return Status::DirectoryInUse;
+    isDir = node->isDir_;
+    pinPath(node, 1);
+    return Status::Ok;
+}
+
+void FileSystem::releaseNode(Node* node) {
+    pinPath(node, -1);
+}
+
+// Unlink a held node for good: the caller hands it to fillReserved() of
+// another FileSystem, which may be on another thread.
+Node* FileSystem::takeNode(Node* node) {
+    pinPath(node, -1);
+    Node* originalCurr = curr_;
+    curr_ = node->parent_;
+    moving_ = true;
+    detachChild(node);
+    moving_ = false;
+    curr_ = originalCurr;
+    // Renderings and checkpoint ids are this FileSystem's, forget them.
+    for (Node* tmp = node; tmp != nullptr;) {
+        tmp->treeGen_ = 0;
+        tmp->dirty_ = false;
+        tmp->dirtyBelow_ = false;
+        if (tmp->isDir_ && tmp->id_ != MetaTable::kNone) MetaTable::setCheckpointId(tmp->id_, 0);
+        if (tmp->leftmostChild_ != nullptr) {
+            tmp = tmp->leftmostChild_;
+            continue;
+        }
+        while (tmp != node && tmp->rightSibling_ == nullptr) tmp = tmp->parent_;
+        tmp = tmp == node ? nullptr : tmp->rightSibling_;
+    }
+    node->parent_ = nullptr;
+    return node;
+}
+
+// Hold a place for a node coming from another FileSystem: a pinned file
+// under the final name, so nothing else can take the name, remove the
+// directory, or create anything inside the placeholder before fillReserved().
+Status FileSystem::reserveNode(string_view dirPath, string_view dest, string_view name, bool isDir, Node*& placeholder) {
+    Node* dir;
+    if (resolvePath(root_, dirPath, dir) != Status::Ok) return Status::DestinationNotFound;
+    if (dest != "") {
+        if (dest == "..") {
+            if (dir == root_) return Status::InvalidPath;
+            dir = dir->parent_;
+        } else {
+            Node* destNode = findChildIn(dir, dest);
+            if (destNode == nullptr) {
+                name = dest; // A rename.
+            } else if (!destNode->isDir_) {
+                return isDir ? Status::DirectoryOntoFile : Status::DestinationHasFile;
+            } else {
+                dir = destNode;
+            }
+        }
+    }
+    if (findChildIn(dir, name) != nullptr) return Status::DestinationHasSameName;
+
+    Node* originalCurr = curr_;
+    curr_ = dir;
+    Status status = createChild(name, nullptr, false);
+    placeholder = status == Status::Ok ? findChild(name) : nullptr;
+    curr_ = originalCurr;
+    if (status != Status::Ok) return status;
+    pinPath(placeholder, 1);
+    return Status::Ok;
+}
+
+// Put subtree, taken from another FileSystem, where placeholder is now.
+void FileSystem::fillReserved(Node* placeholder, Node* subtree) {
+    Node* dir = placeholder->parent_;
+    string name = placeholder->name_;
+    dropReserved(placeholder);
+    renameNode(subtree, name);
+    subtree->parent_ = dir;
+    if (accounted_) accountSubtree(subtree);
+    Node* originalCurr = curr_;
+    curr_ = dir;
+    moving_ = true;
+    insertChildAlphabetical(subtree);
+    moving_ = false;
+    curr_ = originalCurr;
+}
+
+void FileSystem::dropReserved(Node* placeholder) {
+    pinPath(placeholder, -1);
+    Node* originalCurr = curr_;
+    curr_ = placeholder->parent_;
+    deleteChild(placeholder);
+    curr_ = originalCurr;
+}
+
+// Used by cp() to copy src and everything below it, named name, under parent.
+// The copy is not linked into parent's child list, the caller inserts it.
+// All nodes come from one NodePool block and are laid out in pre-order;
+// siblings are already sorted in src so they are linked in the order met.
+Node* FileSystem::cloneSubtree(Node* src, string_view name, Node* parent) const {
+    TRACE_SPAN("cloneSubtree");
+
+    // Nodes in the subtree under node, node included. Iterative, trees can be deep.
+    auto subtreeSize = [](Node* node) {
+        uint64_t count = 1;
+        Node* tmp = node->leftmostChild_;
+        while (tmp != nullptr) {
+            count++;
+            if (tmp->leftmostChild_ != nullptr) {
+                tmp = tmp->leftmostChild_;
+                continue;
+            }
+            while (tmp != nullptr && tmp->rightSibling_ == nullptr) {
+                tmp = tmp->parent_;
+                if (tmp == node) tmp = nullptr;
+            }
+            if (tmp != nullptr) tmp = tmp->rightSibling_;
+        }
+        return count;
+    };
+
+    // Copies the subtree under from into slots, pre-order, returns the copy of from.
+    auto cloneInto = [](Node* from, Node* parent, Node* slots) {
+        Node* top = new (slots) Node(from->name_, from->isDir_, parent);
+        copyMeta(from, top);
+        uint64_t used = 1;
+        Node* s = from; // walks the source
+        Node* c = top;  // its copy
+        while (true) {
+            if (s->leftmostChild_ != nullptr) {
+                s = s->leftmostChild_;
+                Node* copy = new (slots + used++) Node(s->name_, s->isDir_, c);
+                copyMeta(s, copy);
+                c->leftmostChild_ = copy;
+                c = copy;
+                continue;
+            }
+            // Climb until a level with a next sibling, never above from.
+            while (s != from && s->rightSibling_ == nullptr) {
+                s = s->parent_;
+                c = c->parent_;
+            }
+            if (s == from) break;
+            s = s->rightSibling_;
+            Node* copy = new (slots + used++) Node(s->name_, s->isDir_, c->parent_);
+            copyMeta(s, copy);
+            c->rightSibling_ = copy;
+            c = copy;
+        }
+        return top;
+    };
+
+    // Count each top level child on its own so the block can be split between them.
+    uint64_t children = 0;
+    for (Node* tmp = src->leftmostChild_; tmp != nullptr; tmp = tmp->rightSibling_) children++;
+    uint64_t* sizes = new uint64_t[children + 1];
+    uint64_t total = 1;
+    uint64_t i = 0;
+    for (Node* tmp = src->leftmostChild_; tmp != nullptr; tmp = tmp->rightSibling_) {
+        sizes[i] = subtreeSize(tmp);
+        total += sizes[i++];
+    }
+
+    Node* block = static_cast<Node*>(NodePool::allocateBlock(total));
+    Node* top = new (block) Node(string(name), src->isDir_, parent);
+    copyMeta(src, top);
+    Node** copies = new Node*[children + 1];
+
+    unsigned threads = cloneThreads_;
+    if (total < kParallelCloneNodes || children < 2) threads = 1;
+    if (threads > children) threads = static_cast<unsigned>(children);
+
+    // Thread t takes a contiguous run of children holding about total / threads
+    // nodes; the runs and their slot ranges never overlap.
+    std::thread* workers = threads > 1 ? new std::thread[threads - 1] : nullptr;
+    Node* child = src->leftmostChild_;
+    uint64_t first = 0;
+    uint64_t offset = 1;
+    for (unsigned t = 0; t < threads; t++) {
+        uint64_t goal = (total - 1) * (t + 1) / threads;
+        uint64_t last = first;
+        uint64_t end = offset;
+        Node* runStart = child;
+        // Each run gets at least one child, and the last run gets the rest.
+        do {
+            end += sizes[last++];
+            child = child->rightSibling_;
+        } while (last < children && (t + 1 == threads || end - 1 < goal));
+
+        auto run = [=, &cloneInto]() {
+            Node* from = runStart;
+            Node* slots = block + offset;
+            for (uint64_t k = first; k < last; k++) {
+                copies[k] = cloneInto(from, top, slots);
+                slots += sizes[k];
+                from = from->rightSibling_;
+            }
+        };
+        if (t + 1 < threads) workers[t] = std::thread(run);
+        else run();
+        first = last;
+        offset = end;
+    }
+    for (unsigned t = 0; t + 1 < threads; t++) workers[t].join();
+    delete[] workers;
+
+    // Link the top level copies, still in src's sorted order.
+    for (uint64_t k = 0; k < children; k++) {
+        if (k == 0) top->leftmostChild_ = copies[k];
+        else copies[k - 1]->rightSibling_ = copies[k];
+    }
+    delete[] copies;
+    delete[] sizes;
+    return top;
+}
+
+// Used by touch() and mkdir() to add a new child to curr_.
+// The name is only copied (or, with owned, moved) into a string once
+// the checks pass, so failed calls never allocate.
+Status FileSystem::createChild(string_view name, string* owned, bool isDir, bool budgeted) {
+    if(name == "" ) {
+        return Status::InvalidName;
+    }
+
+    // Traverse list and check for existing file/directory with same name.
+    Node* existing = findChild(name);
+    if(existing != nullptr) {
+        return Status::AlreadyExists;
+    }
+    if (budgeted && !withinBudget(newNodeBytes(name.size()))) {
+        return Status::MemoryBudgetExceeded;
+    }
+
+    Node* newNode = owned != nullptr ? new Node(std::move(*owned), isDir, curr_)
+                                     : new Node(string(name), isDir, curr_);
+    stampCreated(newNode, nowNs());
+    if (accounted_) accountSubtree(newNode);
+    // Insert new node in alphabetical order among siblings.
+    insertChildAlphabetical(newNode);
+    return Status::Ok;
+}
+
+// Used by FileSystem(const GenSpec&) to fill dir with its children, not below.
+// Names are drawn and sorted up front, so the children are linked in order
+// from one NodePool block without any findChild() or insertChildAlphabetical().
+void FileSystem::generateChildren(Node* dir, const GenSpec& spec, uint64_t& rng, uint64_t& budget) {
+    uint64_t count = genRange(rng, spec.minFanout, spec.maxFanout);
+    if (count > budget) count = budget;
+    if (count == 0) return;
+
+    string* names = new string[count];
+    for (uint64_t i = 0; i < count; i++) {
+        names[i].resize(genRange(rng, spec.minNameLen, spec.maxNameLen));
+        // One draw gives 13 letters.
+        uint64_t bits = 0;
+        for (size_t j = 0; j < names[i].size(); j++) {
+            if (j % 13 == 0) bits = genNext(rng);
+            names[i][j] = static_cast<char>('a' + bits % 26);
+            bits /= 26;
+        }
+    }
+    // std::string orders bytes as unsigned, the same as compareNames().
+    std::sort(names, names + count);
+    count = std::unique(names, names + count) - names;
+    budget -= count;
+
+    Node* block = static_cast<Node*>(NodePool::allocateBlock(count));
+    Node* prev = nullptr;
+    for (uint64_t i = 0; i < count; i++) {
+        bool isDir = genNext(rng) % 100 >= spec.filePercent;
+        Node* node = new (block + i) Node(names[i], isDir, dir);
+        if (prev == nullptr) dir->leftmostChild_ = node;
+        else prev->rightSibling_ = node;
+        prev = node;
+    }
+    delete[] names;
 }
 
 /* 
@@ -204,22 +689,82 @@ string FileSystem::moveChild(const string& src, const string& dest){
 
 Node::Node(const string& name, bool isDir, Node* parent, Node* leftmostChild, Node* rightSibling) {
     // Initialise attributes.
-    name_ = name;
+    setName(name);
+    isDir_ = isDir;
+    watched_ = false;
+    dirty_ = false;
+    dirtyBelow_ = false;
+    stub_ = false;
+    backed_ = false;
+    referenced_ = false;
+    treeGen_ = 0;
+    pins_ = 0;
+    version_ = 0;
+    id_ = MetaTable::kNone;
+    parent_ = parent;
+    leftmostChild_ = leftmostChild;
+    rightSibling_ = rightSibling;
+    index_ = nullptr;
+}
+
+Node::Node(string&& name, bool isDir, Node* parent, Node* leftmostChild, Node* rightSibling) {
+    setName(std::move(name));
     isDir_ = isDir;
+    watched_ = false;
+    dirty_ = false;
+    dirtyBelow_ = false;
+    stub_ = false;
+    backed_ = false;
+    referenced_ = false;
+    treeGen_ = 0;
+    pins_ = 0;
+    version_ = 0;
+    id_ = MetaTable::kNone;
     parent_ = parent;
     leftmostChild_ = leftmostChild;
     rightSibling_ = rightSibling;
+    index_ = nullptr;
 }
 
 Node::~Node() {
-	// Recursively delete all child nodes.
-    Node* child = leftmostChild_;
-    while (child != nullptr) {
-        Node* nextSibling = child->rightSibling_;
-        delete child; // Each child's destructor will handle its own children.
-        child = nextSibling;
+	// Delete everything below, without recursing: a child's own children are
+	// spliced onto the front of the work list before it is deleted, so every
+	// delete here finds no children. Trees can be far deeper than the stack.
+    Node* work = leftmostChild_;
+    while (work != nullptr) {
+        Node* node = work;
+        work = node->rightSibling_;
+        if (node->leftmostChild_ != nullptr) {
+            Node* last = node->leftmostChild_;
+            while (last->rightSibling_ != nullptr) last = last->rightSibling_;
+            last->rightSibling_ = work;
+            work = node->leftmostChild_;
+            node->leftmostChild_ = nullptr;
+        }
+        delete node;
     }
+    delete index_;
+    if (id_ != MetaTable::kNone) MetaTable::release(id_);
+
+}
+
+void* Node::operator new(size_t size) {
+    (void)size; // Always sizeof(Node), Node has no subclasses.
+    return NodePool::allocate();
+}
+
+void Node::operator delete(void* slot) {
+    NodePool::release(slot);
+}
+
+void Node::setName(string_view name) {
+    name_ = name;
+    key_ = nameKey(name_);
+}
 
+void Node::setName(string&& name) {
+    name_ = std::move(name);
+    key_ = nameKey(name_);
 }
 
 Node* Node::leftSibling() const {
@@ -232,6 +777,10 @@ Node* Node::leftSibling() const {
 	return nullptr; // dummy
 }
 
+ListCursor::ListCursor() : after_(""), done_(false) {}
+
+ListCursor::ListCursor(const string& after) : after_(after), done_(false) {}
+
 FileSystem::FileSystem() {
     // Initailise current directory to be root.
     curr_ = root_ = new Node("", true);
@@ -293,23 +842,157 @@ FileSystem::FileSystem(const string& testinput) {
 	}
 }
 
+bool GenSpec::valid() const {
+    return minFanout <= maxFanout && minNameLen >= 1 && minNameLen <= maxNameLen
+        && maxNameLen <= 255 && filePercent <= 100;
+}
+
+FileSystem::FileSystem(const GenSpec& spec) {
+    TRACE_SPAN("generate");
+    curr_ = root_ = new Node("", true);
+    // An invalid spec leaves just the root.
+    if (!spec.valid() || spec.depth == 0) return;
+    uint64_t rng = spec.seed;
+    uint64_t budget = spec.maxNodes != 0 ? spec.maxNodes : UINT64_MAX;
+    generateChildren(root_, spec, rng, budget);
+
+    // Fill each directory as the walk enters it, depth first. Iterative:
+    // depth is only bounded by the node budget, not by the stack.
+    Node* node = root_->leftmostChild_;
+    unsigned level = 1; // of node, the root's children are 1
+    while (node != nullptr && budget > 0) {
+        if (node->isDir_ && level < spec.depth) {
+            generateChildren(node, spec, rng, budget);
+            if (node->leftmostChild_ != nullptr) {
+                node = node->leftmostChild_;
+                level++;
+                continue;
+            }
+        }
+        // Next sibling, climbing out of finished directories.
+        while (node != root_ && node->rightSibling_ == nullptr) {
+            node = node->parent_;
+            level--;
+        }
+        if (node == root_) break;
+        node = node->rightSibling_;
+    }
+}
+
+// One watch() call: where it looks and where its events go.
+struct FileSystem::Watch {
+    Node* dir;
+    bool recursive;
+    WatchRing* ring;
+    Watch* next;
+};
+
 FileSystem::~FileSystem() {
-    delete root_;  // Now this triggers recursive deletion.
+    while (watches_ != nullptr) {
+        Watch* next = watches_->next;
+        delete watches_;
+        watches_ = next;
+    }
+    delete store_;
+    delete image_;
+    delete root_;  // ~Node() frees the whole tree, iteratively.
+}
+
+const char* statusMessage(Status status) {
+    switch (status) {
+    case Status::Ok:                      return "";
+    case Status::InvalidPath:             return "invalid path";
+    case Status::InvalidName:             return "invalid name";
+    case Status::AlreadyExists:           return "file/directory already exists";
+    case Status::FileNotFound:            return "file not found";
+    case Status::NotAFile:                return "not a file";
+    case Status::DirectoryNotFound:       return "directory not found";
+    case Status::NotADirectory:           return "not a directory";
+    case Status::DirectoryNotEmpty:       return "directory not empty";
+    case Status::SourceNotFound:          return "source does not exist";
+    case Status::DestinationNotFound:     return "destination does not exist";
+    case Status::DestinationNotDirectory: return "destination is not a directory";
+    case Status::SameSourceDestination:   return "source and destination are the same";
+    case Status::DestinationHasFile:      return "destination already has file of same name";
+    case Status::DirectoryOntoFile:       return "source is a directory but destination is an existing file";
+    case Status::DestinationHasSameName:  return "destination already has file/directory of same name";
+    case Status::SourceIsDirectory:       return "source is a directory";
+    case Status::DirectoryInUse:          return "directory is in use";
+    case Status::TransactionConflict:     return "transaction conflict";
+    case Status::HostPathUnreadable:      return "cannot read host directory";
+    case Status::MemoryBudgetExceeded:    return "memory budget exceeded";
+    case Status::FileInUse:               return "file is in use";
+    case Status::CheckpointFailed:        return "cannot write checkpoint";
+    case Status::CheckpointUnreadable:    return "cannot read checkpoint";
+    }
+    return "";
+}
+
+// The string API is a thin wrapper over the Status API below.
+
+string FileSystem::cd(string_view path) {
+    return statusMessage(tryCd(path));
+}
+
+string FileSystem::ls() const {
+    string res;
+    lsInto(res);
+    return res;
+}
+
+string FileSystem::pwd() const {
+    string res;
+    pwdInto(res);
+    return res;
+}
+
+string FileSystem::tree() const {
+    string res;
+    treeInto(res);
+    return res;
+}
+
+string FileSystem::touch(string_view name) {
+    return statusMessage(tryTouch(name));
+}
+
+string FileSystem::mkdir(string_view name) {
+    return statusMessage(tryMkdir(name));
+}
+
+string FileSystem::rm(string_view name, bool recursive) {
+    return statusMessage(tryRm(name, recursive));
+}
+
+string FileSystem::rmdir(string_view name) {
+    return statusMessage(tryRmdir(name));
+}
+
+string FileSystem::mv(string_view src, string_view dest) {
+    return statusMessage(tryMv(src, dest));
+}
+
+string FileSystem::cp(string_view src, string_view dest, bool recursive) {
+    return statusMessage(tryCp(src, dest, recursive));
 }
 
-string FileSystem::cd(const string& path) {
+Status FileSystem::tryCd(string_view path) {
     // navigate to the directory specified by path and update curr_.
-    string result = handleSpecialPaths(path);
-    if (result != "continue") return result;
+    TRACE_SPAN("resolvePath");
+    evictIfOver();
+    Status status;
+    if (handleSpecialPaths(path, status)) return status;
 
     return navigateToChild(path);
 }
 
 
 // This is done for you as an example
-string FileSystem::ls() const {
-
-	string res;
+void FileSystem::lsInto(string& res) const {
+	TRACE_SPAN("format");
+	res.clear();
+	evictIfOver();
+	ensureLoaded(curr_);
 
 	Node* tmp = curr_->leftmostChild_;
 	while(tmp != nullptr) {
@@ -319,135 +1002,339 @@ string FileSystem::ls() const {
 		tmp = tmp->rightSibling_;
 	}
 	if (res != "") res.pop_back(); // remove extra \n
+}
+
+void FileSystem::lsPage(ListCursor& cursor, size_t limit, string& res) const {
+	TRACE_SPAN("format");
+	res.clear();
+	evictIfOver();
+	ensureLoaded(curr_);
+
+	// Jump to the first name after the cursor through the index.
+	Node* tmp;
+	if (cursor.after_ == "") {
+		tmp = curr_->leftmostChild_;
+	} else {
+		Node* prev = predecessor(curr_, cursor.after_, Counter::FindChildVisits);
+		tmp = prev ? prev->rightSibling_ : curr_->leftmostChild_;
+		if (tmp != nullptr && tmp->name_ == cursor.after_) tmp = tmp->rightSibling_;
+	}
+
+	size_t taken = 0;
+	while(tmp != nullptr && taken < limit) {
+		res += tmp->name_;
+		if (tmp->isDir_) res += "/\n";
+		else res += "\n";
+		cursor.after_ = tmp->name_;
+		taken++;
+		tmp = tmp->rightSibling_;
+	}
+	cursor.done_ = tmp == nullptr;
+	if (res != "") res.pop_back(); // remove extra \n
+}
 
-	return res;
+void FileSystem::lsPrefix(string_view prefix, string& res) const {
+	TRACE_SPAN("format");
+	res.clear();
+	evictIfOver();
+
+	// Jump to the first name >= prefix, stop at the first one without it.
+	Node* prev = predecessor(curr_, prefix, Counter::FindChildVisits);
+	Node* tmp = prev ? prev->rightSibling_ : curr_->leftmostChild_;
+	while(tmp != nullptr && tmp->name_.compare(0, prefix.size(), prefix) == 0) {
+		res += tmp->name_;
+		if (tmp->isDir_) res += "/\n";
+		else res += "\n";
+		tmp = tmp->rightSibling_;
+	}
+	if (res != "") res.pop_back(); // remove extra \n
 }
 
-string FileSystem::pwd() const {
-	// Opposite of ls, build the path from curr_ to root_.
+size_t FileSystem::complete(string_view prefix, size_t limit, string& candidates, string& common) const {
+	TRACE_SPAN("complete");
+	candidates.clear();
+	common = prefix;
+	evictIfOver();
+
+	Node* prev = predecessor(curr_, prefix, Counter::FindChildVisits);
+	Node* first = prev ? prev->rightSibling_ : curr_->leftmostChild_;
+	if (first == nullptr || first->name_.compare(0, prefix.size(), prefix) != 0) return 0;
+
+	// Matches are contiguous and sorted, so what the first and last share
+	// is shared by all of them.
+	Node* last = lastWithPrefix(curr_, prefix);
+	size_t len = prefix.size();
+	while (len < first->name_.size() && len < last->name_.size() && first->name_[len] == last->name_[len]) {
+		len++;
+	}
+	common.assign(first->name_, 0, len);
+
+	size_t taken = 0;
+	for (Node* tmp = first; tmp != nullptr && taken < limit; tmp = tmp->rightSibling_) {
+		if (tmp->name_.compare(0, prefix.size(), prefix) != 0) break;
+		candidates += tmp->name_;
+		if (tmp->isDir_) candidates += "/\n";
+		else candidates += "\n";
+		taken++;
+	}
+	if (candidates != "") candidates.pop_back(); // remove extra \n
+	return taken;
+}
 
-    string res; 
+void FileSystem::pwdInto(string& res) const {
+	// Opposite of ls, build the path from curr_ to root_.
+    res.clear();
 
-    Node* tmp = curr_;
-    while(tmp != root_) {
-        res = "/" + tmp->name_ + res;
-        if (!tmp->parent_) break; // Null check.
-        tmp = tmp->parent_;
+    // Walk up once to size the path, then fill it in from the back.
+    size_t len = 0;
+    for (Node* tmp = curr_; tmp != root_ && tmp != nullptr; tmp = tmp->parent_) {
+        len += tmp->name_.size() + 1;
+    }
+    if (len == 0) {
+        res = "/"; // root case.
+        return;
     }
-    if (res == "") res = "/"; // root case.
-
 
-	return res; 
+    res.resize(len);
+    size_t pos = len;
+    for (Node* tmp = curr_; tmp != root_ && tmp != nullptr; tmp = tmp->parent_) {
+        pos -= tmp->name_.size();
+        tmp->name_.copy(&res[pos], tmp->name_.size());
+        res[--pos] = '/';
+    }
 }
 
 
-string FileSystem::tree() const {
+void FileSystem::treeInto(string& res) const {
 	// Append right sibling and leftmost child strings recursively to result.
+    TRACE_SPAN("format");
+    res.clear();
+    evictIfOver();
+    ensureLoaded(curr_);
 
-    string res = "";
     // Determine if at root.
     if(curr_ == root_ && curr_->leftmostChild_ == nullptr) {
         res += "/";
-    }else if(curr_ == root_) {
-        res += "/\n" + treeRecursion(curr_, 0);
-    }else
-    {
-        res += curr_->name_ + "/\n" + treeRecursion(curr_, 0);
+        return;
     }
-    return res;
+    res += curr_ == root_ ? "/\n" : curr_->name_ + "/\n";
+
+    if (treeCacheBytes_ > kTreeCacheBytes) clearTreeCache();
+    treeRecursion(curr_, 0, res);
+    // remove extra \n like in predefined ls().
+    if (curr_->leftmostChild_ != nullptr) res.pop_back();
+    Stats::count(Counter::TreeBytes, res.size());
 }
 
-string FileSystem::touch(const string& name) {
-	// Create new file node as child of curr_, keeping alphabetical ordering.
-    
-    if(name == "" ) {
-        return "invalid name";
+Status FileSystem::treeInto(string& res, const TreeLimits& limits, string_view path) const {
+    TRACE_SPAN("format");
+    res.clear();
+    evictIfOver();
+    ensureLoaded(curr_);
+    Node* top = curr_;
+    size_t indent = 0;
+    if (!path.empty()) {
+        string full(path);
+        if (full.back() != '/') full += '/';
+        Status status = resolvePath(curr_, full, top);
+        if (status != Status::Ok) return status;
+        // Indented by its depth below the current directory.
+        for (Node* tmp = top; tmp != curr_; tmp = tmp->parent_) {
+            if (tmp == nullptr) return Status::InvalidPath;
+            indent++;
+        }
+    } else {
+        res += curr_ == root_ ? "/" : curr_->name_ + "/";
+        if (curr_ == root_ && curr_->leftmostChild_ == nullptr) return Status::Ok;
+        res += "\n";
     }
+    treeLimited(top, indent, limits, res);
+    Stats::count(Counter::TreeBytes, res.size());
+    return Status::Ok;
+}
 
-    // Traverse list and check for existing file/directory with same name.
-    Node* existing = findChild(name);
-    if(existing != nullptr) {
-        return "file/directory already exists";
+// Children of dir, from the index when it has one.
+uint64_t FileSystem::childCount(const Node* dir) {
+    if (dir->index_ != nullptr) return dir->index_->size();
+    uint64_t count = 0;
+    for (Node* tmp = dir->leftmostChild_; tmp != nullptr; tmp = tmp->rightSibling_) count++;
+    return count;
+}
+
+// Used by treeInto() with limits: the entries below top in treeRecursion()'s
+// layout, each indented indent more. Iterative, with shown[level] counting
+// the entries already written in the directory open at each level, so the
+// elided rest is a subtraction rather than a walk.
+void FileSystem::treeLimited(Node* top, size_t indent, const TreeLimits& limits, string& res) const {
+    uint64_t budget = limits.maxNodes != 0 ? limits.maxNodes : UINT64_MAX;
+    std::vector<uint64_t> shown(1, 0);
+    size_t start = res.size();
+    ensureLoaded(top);
+    Node* node = top->leftmostChild_;
+    size_t level = 1; // of node, top's children are 1
+
+    auto line = [&](size_t depth) { res.append(indent + depth, ' '); };
+    while (node != nullptr) {
+        if (budget == 0) {
+            // Close every open directory from here up to top.
+            for (Node* dir = node->parent_; level > 0; level--, dir = dir->parent_) {
+                uint64_t left = childCount(dir) - shown[level - 1];
+                if (left != 0) {
+                    line(level);
+                    res += "... " + std::to_string(left) + " more\n";
+                }
+                // The directory itself counts as shown in its parent.
+            }
+            break;
+        }
+        line(level);
+        res += node->name_;
+        res += node->isDir_ ? "/\n" : "\n";
+        budget--;
+        shown[level - 1]++;
+
+        if (node->isDir_) ensureLoaded(node);
+        if (node->leftmostChild_ != nullptr) {
+            if (limits.depth != 0 && level >= limits.depth) {
+                line(level + 1);
+                res += "... " + std::to_string(childCount(node)) + " entries\n";
+            } else {
+                node = node->leftmostChild_;
+                level++;
+                if (shown.size() < level) shown.push_back(0);
+                shown[level - 1] = 0;
+                continue;
+            }
+        }
+        // Next sibling, climbing out of finished directories.
+        while (node != top && node->rightSibling_ == nullptr) {
+            node = node->parent_;
+            level--;
+        }
+        if (node == top) break;
+        node = node->rightSibling_;
     }
+    if (res.size() > start) res.pop_back(); // remove extra \n
+}
 
-    Node* newFile = newFile = new Node(name, false, curr_);
-    // Insert new File node in alphabetical order among siblings.
-    insertChildAlphabetical(newFile);
-	return ""; // success.
+Status FileSystem::tryTouch(string_view name) {
+	// Create new file node as child of curr_, keeping alphabetical ordering.
+    return createChild(name, nullptr, false);
 }
 
-string FileSystem::mkdir(const string& name) {
-	// Create new directory node as child of curr_, keeping alphabetical ordering.
-    
-    if(name == "" ) {
-        return "invalid name";
-    }
+Status FileSystem::tryTouch(string&& name) {
+    return createChild(name, &name, false);
+}
 
-    // Traverse list and check for existing file/directory with same name.
-    Node* existing = findChild(name);
-    if(existing != nullptr) {
-        return "file/directory already exists";
-    }
+Status FileSystem::tryTouch(const char* name) {
+    return createChild(name, nullptr, false);
+}
 
-    Node* newDir = new Node(name, true, curr_);
-    // Insert new Dir node in alphabetical order among siblings.
-    insertChildAlphabetical(newDir);
+Status FileSystem::tryMkdir(string_view name) {
+	// Create new directory node as child of curr_, keeping alphabetical ordering.
+    return createChild(name, nullptr, true);
+}
+
+Status FileSystem::tryMkdir(string&& name) {
+    return createChild(name, &name, true);
+}
 
-	return ""; // success.
+Status FileSystem::tryMkdir(const char* name) {
+    return createChild(name, nullptr, true);
 }
 
-string FileSystem::rm(const string& name) {
+Status FileSystem::tryRm(string_view name, bool recursive) {
 	// Search for node by name and remove it if it's a file.
 
     Node* removeTargetFile = findChild(name);
     if (removeTargetFile == nullptr) {
-        return "file not found";
+        return Status::FileNotFound;
     }
 
-    if (removeTargetFile->isDir_) {
-        return "not a file";
+    if (removeTargetFile->isDir_ && recursive) {
+        if (removeTargetFile->pins_ != 0) {
+            return Status::DirectoryInUse;
+        }
+        // Unlink now, free the nodes on the Reclaimer's thread. Its size
+        // is known once accounting is on, otherwise the Reclaimer counts.
+        uint64_t bytes, nodes = 0;
+        if (accounted_) usageOf(removeTargetFile, bytes, nodes);
+        detachChild(removeTargetFile);
+        Reclaimer::retire(removeTargetFile, nodes);
+        return Status::Ok;
+    }
+
+    Status status = removable(removeTargetFile, false);
+    if (status != Status::Ok) {
+        return status;
     }
     
     // Remove target from sibling list.
     deleteChild(removeTargetFile);
-	return ""; // success.
+	return Status::Ok;
 }
 
-string FileSystem::rmdir(const string& name) {
+Status FileSystem::tryRmdir(string_view name) {
 	// Search for dir by name and remove if it's a directory and empty.
 
     Node* removeTargetDir = findChild(name);
-    if (removeTargetDir == nullptr) {
-        return "directory not found";
+    Status status = removable(removeTargetDir, true);
+    if (status != Status::Ok) {
+        return status;
     }
 
-    if (!removeTargetDir->isDir_) {
-        return "not a directory";
-    }
+    // Remove target from sibling list.
+    deleteChild(removeTargetDir);
+	return Status::Ok;
+}
 
-    if (removeTargetDir->leftmostChild_ != nullptr) {
-        return "directory not empty";
+// Used by tryRm() (dir false, not recursive), tryRmdir() (dir true) and
+// commit(): whether node, a child of curr_ or nullptr, may be removed.
+Status FileSystem::removable(Node* node, bool dir) const {
+    if (node == nullptr) {
+        return dir ? Status::DirectoryNotFound : Status::FileNotFound;
     }
 
-    // Remove target from sibling list.
-    deleteChild(removeTargetDir);
-	return ""; // success.
+    if (!dir) {
+        if (node->isDir_) {
+            return Status::NotAFile;
+        }
+        if (node->pins_ != 0) {
+            return Status::FileInUse; // Held for a mv to another shard.
+        }
+        return Status::Ok;
+    }
+
+    if (!node->isDir_) {
+        return Status::NotADirectory;
+    }
+
+    ensureLoaded(node);
+
+    if (node->leftmostChild_ != nullptr) {
+        return Status::DirectoryNotEmpty;
+    }
+
+    if (node->pins_ != 0) {
+        return Status::DirectoryInUse;
+    }
+    return Status::Ok;
 }
 
-string FileSystem::mv(const string& src, const string& dest) {
+Status FileSystem::tryMv(string_view src, string_view dest) {
 	// move or rename a file/directory from src to dest.
 
     if(src == dest) {
-        return "source and destination are the same";
+        return Status::SameSourceDestination;
     }
 
     if (dest == ".." && curr_ == root_) {
-        return "invalid path";
+        return Status::InvalidPath;
     }
     
     // Traverse children to find source node.
     Node* srcNode = findChild(src);
-    if (!srcNode) { return "source does not exist";} // Null check.
+    if (!srcNode) { return Status::SourceNotFound;} // Null check.
 
     // Move.
 
@@ -455,17 +1342,15 @@ string FileSystem::mv(const string& src, const string& dest) {
     Node* destNode = findChild(dest);
     if (dest == "..") {
         // Move to parent directory and detach source node from current location.
-        string res = moveChild(src, "..");
-        return res;
+        return moveChild(src, "..");
     } else if (destNode != nullptr && !destNode->isDir_) {
         if (srcNode->isDir_){
-            return "source is a directory but destination is an existing file";
+            return Status::DirectoryOntoFile;
         }else{
-            return "destination already has file of same name";
+            return Status::DestinationHasFile;
         }
     } else if (destNode != nullptr && destNode->isDir_) {
-        string res = moveChild(src, dest);
-        return res;
+        return moveChild(src, dest);
     }
     
     // Rename.
@@ -475,5 +1360,1435 @@ string FileSystem::mv(const string& src, const string& dest) {
         return renameChild(src, dest);
     }
 
-    return "destination already has file/directory of same name";
-}
\ No newline at end of file
+    return Status::DestinationHasSameName;
+}
+
+Status FileSystem::tryCp(string_view src, string_view dest, bool recursive) {
+	// copy a file, or with recursive a whole directory, following mv()'s rules for dest.
+
+    if(src == dest) {
+        return Status::SameSourceDestination;
+    }
+
+    if (dest == ".." && curr_ == root_) {
+        return Status::InvalidPath;
+    }
+
+    Node* srcNode = findChild(src);
+    if (!srcNode) { return Status::SourceNotFound;} // Null check.
+    if (srcNode->isDir_ && !recursive) {
+        return Status::SourceIsDirectory;
+    }
+
+    // Work out the directory and name of the copy.
+    Node* destDir = curr_;
+    string_view name = dest;
+    if (dest == "..") {
+        destDir = curr_->parent_;
+        name = src;
+    } else {
+        Node* destNode = findChild(dest);
+        if (destNode != nullptr && !destNode->isDir_) {
+            return srcNode->isDir_ ? Status::DirectoryOntoFile : Status::DestinationHasFile;
+        }
+        if (destNode != nullptr) {
+            destDir = destNode;
+            name = src;
+        }
+    }
+
+    if (name == "") {
+        return Status::InvalidName;
+    }
+
+    // Check for conflicts before copying anything.
+    Node* originalCurr = curr_;
+    curr_ = destDir;
+    if (findChild(name)) {
+        curr_ = originalCurr;
+        return Status::DestinationHasSameName;
+    }
+
+    // The copy takes about what the source does.
+    loadSubtree(srcNode);
+    uint64_t bytes = 0, nodes = 0;
+    if (memoryBudget_ != 0) usageOf(srcNode, bytes, nodes);
+    if (!withinBudget(bytes)) {
+        curr_ = originalCurr;
+        return Status::MemoryBudgetExceeded;
+    }
+
+    Node* copy = cloneSubtree(srcNode, name, destDir);
+    if (accounted_) accountSubtree(copy);
+    insertChildAlphabetical(copy);
+    curr_ = originalCurr; // Restore curr_.
+    return Status::Ok;
+}
+
+Status FileSystem::tryStat(string_view name, NodeMeta& meta) const {
+    Node* node = name == "." ? curr_ : findChild(name);
+    if (node == nullptr) return Status::FileNotFound;
+    metaOf(node, meta);
+    return Status::Ok;
+}
+
+// What node's row holds, or the defaults for a node without one.
+void FileSystem::metaOf(const Node* node, NodeMeta& meta) {
+    if (node->id_ != MetaTable::kNone) {
+        MetaTable::read(node->id_, meta);
+    } else {
+        meta = NodeMeta();
+        meta.mode = node->isDir_ ? 0755 : 0644;
+    }
+}
+
+Status FileSystem::trySetMeta(string_view name, uint64_t size, uint32_t mode, uint32_t owner) {
+    Node* node = name == "." ? curr_ : findChild(name);
+    if (node == nullptr) return Status::FileNotFound;
+    if (node->id_ == MetaTable::kNone) {
+        stampCreated(node, 0);
+        if (node->id_ == MetaTable::kNone) return Status::Ok; // Out of rows, nothing to keep it in.
+        if (accounted_) charge(node->parent_, MetaTable::kRowBytes, 0);
+    }
+    NodeMeta meta;
+    MetaTable::read(node->id_, meta);
+    meta.size = size;
+    meta.mode = mode;
+    meta.owner = owner;
+    meta.mtime = nowNs();
+    MetaTable::write(node->id_, meta);
+    // The image holds no metadata: evicting would lose it.
+    if (image_ != nullptr) unback(node->isDir_ ? node : node->parent_);
+    return Status::Ok;
+}
+
+void FileSystem::lsLongInto(string& res) const {
+    TRACE_SPAN("format");
+    res.clear();
+    evictIfOver();
+    ensureLoaded(curr_);
+
+    // e.g. "drwxr-xr-x     0          0 2026-10-19 14:03 name/"
+    char line[96];
+    for (Node* tmp = curr_->leftmostChild_; tmp != nullptr; tmp = tmp->rightSibling_) {
+        NodeMeta meta;
+        metaOf(tmp, meta);
+        char perms[11] = "----------";
+        if (tmp->isDir_) perms[0] = 'd';
+        for (int bit = 0; bit < 9; bit++) {
+            if (meta.mode & (1u << (8 - bit))) perms[1 + bit] = "rwx"[bit % 3];
+        }
+        char when[20] = "               -";
+        if (meta.mtime != 0) {
+            time_t secs = static_cast<time_t>(meta.mtime / 1000000000);
+            struct tm parts;
+            gmtime_r(&secs, &parts);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &parts);
+        }
+        snprintf(line, sizeof(line), "%s %5u %10llu %s ", perms, meta.owner,
+                 static_cast<unsigned long long>(meta.size), when);
+        res += line;
+        res += tmp->name_;
+        res += tmp->isDir_ ? "/\n" : "\n";
+    }
+    if (res != "") res.pop_back(); // remove extra \n
+}
+
+void FileSystem::setCloneThreads(unsigned threads) {
+    cloneThreads_ = threads > 0 ? threads : 1;
+}
+
+// Shared by the importHost() workers: a stack of host directories still to
+// read. A directory's fd stays open until every subdirectory has been opened
+// relative to it; taking the newest task first keeps the walk roughly depth
+// first, so only a few fds are open at once.
+struct FileSystem::ImportScan {
+    struct HostDir {
+        int fd;
+        std::atomic<uint64_t> refs; // subdirectories not yet opened
+    };
+    struct Task {
+        HostDir* parent;
+        Node* dir; // to be filled from parent's entry dir->name_
+    };
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Task> stack;
+    uint64_t busy = 0; // tasks on the stack or being read
+    std::atomic<uint64_t> room{UINT64_MAX}; // bytes the memory budget still allows
+    std::atomic<bool> over{false};          // a directory did not fit, the rest is skipped
+
+    // Take bytes from room, or mark the import over the budget.
+    bool charge(uint64_t bytes) {
+        uint64_t left = room.load(std::memory_order_relaxed);
+        do {
+            if (bytes > left) {
+                over.store(true, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!room.compare_exchange_weak(left, left - bytes, std::memory_order_relaxed));
+        return true;
+    }
+
+    static void release(HostDir* host) {
+        if (host->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ::close(host->fd);
+            delete host;
+        }
+    }
+};
+
+// Used by importHost() to read the host directory open at fd into the empty
+// dir, then queue its subdirectories. Takes over fd. The entries are charged
+// to the budget before any is created; if they do not fit, dir stays empty.
+void FileSystem::importDirectory(ImportScan& scan, int fd, Node* dir, ImportReport& report) {
+    // getdents64 records: d_ino (8 bytes), d_off (8), d_reclen (2), d_type (1), d_name.
+    const size_t kRecLen = 16, kType = 18, kName = 19;
+    char buf[32 * 1024];
+    std::vector<std::pair<string, bool>> entries;
+    for (;;) {
+        long got = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (got < 0) report.unreadable++;
+        if (got <= 0) break;
+        for (long pos = 0; pos < got;) {
+            unsigned short reclen;
+            std::memcpy(&reclen, buf + pos + kRecLen, sizeof(reclen));
+            unsigned char type = static_cast<unsigned char>(buf[pos + kType]);
+            const char* name = buf + pos + kName;
+            pos += reclen;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
+            bool isDir = type == DT_DIR;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                isDir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            entries.emplace_back(name, isDir);
+        }
+    }
+
+    // std::string orders bytes as unsigned, the same as compareNames().
+    std::sort(entries.begin(), entries.end(),
+              [](const std::pair<string, bool>& a, const std::pair<string, bool>& b) { return a.first < b.first; });
+    size_t count = entries.size();
+    uint64_t subdirs = 0;
+    // What the entries will hold once counted: slots, long names, and a row
+    // for each directory.
+    uint64_t bytes = count * sizeof(Node);
+    for (const std::pair<string, bool>& entry : entries) {
+        bytes += nameHeapBytes(entry.first) + (entry.second ? MetaTable::kRowBytes : 0);
+    }
+    if (!scan.charge(bytes)) {
+        ::close(fd);
+        return;
+    }
+    if (count != 0) {
+        Node* block = static_cast<Node*>(NodePool::allocateBlock(count));
+        for (size_t i = 0; i < count; i++) {
+            Node* node = new (block + i) Node(std::move(entries[i].first), entries[i].second, dir);
+            if (i == 0) dir->leftmostChild_ = node;
+            else block[i - 1].rightSibling_ = node;
+            report.bytes += nameHeapBytes(node->name_);
+            if (node->isDir_) subdirs++;
+        }
+        report.entries += count;
+        report.directories += subdirs;
+        report.bytes += count * sizeof(Node);
+    }
+    if (subdirs == 0) {
+        ::close(fd);
+        return;
+    }
+
+    ImportScan::HostDir* host = new ImportScan::HostDir{fd, {subdirs}};
+    std::lock_guard<std::mutex> lock(scan.mutex);
+    for (Node* tmp = dir->leftmostChild_; tmp != nullptr; tmp = tmp->rightSibling_) {
+        if (tmp->isDir_) scan.stack.push_back(ImportScan::Task{host, tmp});
+    }
+    scan.busy += subdirs;
+    scan.wake.notify_all();
+}
+
+Status FileSystem::importHost(string_view hostPath, string_view dest, ImportReport& report, unsigned threads) {
+    TRACE_SPAN("import");
+    report = ImportReport();
+    auto start = std::chrono::steady_clock::now();
+
+    // The name defaults to the last component of hostPath.
+    string path(hostPath);
+    if (dest.empty()) {
+        size_t end = path.find_last_not_of('/');
+        size_t slash = end == string::npos ? string::npos : path.rfind('/', end);
+        dest = end == string::npos ? string_view() : string_view(path).substr(slash + 1, end - slash);
+    }
+    if (dest.empty()) return Status::InvalidName;
+    if (findChild(dest) != nullptr) return Status::AlreadyExists;
+
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOTDIR ? Status::NotADirectory : Status::HostPathUnreadable;
+
+    Node* top = new Node(string(dest), true, curr_);
+    ImportScan scan;
+    if (memoryBudget_ != 0) {
+        uint64_t bytes, nodes;
+        usageOf(root_, bytes, nodes);
+        uint64_t need = sizeof(Node) + nameHeapBytes(top->name_) + MetaTable::kRowBytes;
+        scan.room = memoryBudget_ > bytes + need ? memoryBudget_ - bytes - need : 0;
+        if (bytes + need > memoryBudget_) scan.over = true;
+    }
+    if (threads == 0) threads = 1;
+    std::vector<ImportReport> reports(threads);
+    scan.busy = 1;
+    if (scan.over) ::close(fd);
+    else importDirectory(scan, fd, top, reports[0]);
+    scan.busy--;
+
+    auto work = [&scan](ImportReport& mine) {
+        for (;;) {
+            ImportScan::Task task;
+            {
+                std::unique_lock<std::mutex> lock(scan.mutex);
+                scan.wake.wait(lock, [&scan] { return !scan.stack.empty() || scan.busy == 0; });
+                if (scan.stack.empty()) return;
+                task = scan.stack.back();
+                scan.stack.pop_back();
+            }
+            // Once over the budget the stack is only emptied.
+            int sub = scan.over ? -1 : openat(task.parent->fd, task.dir->name_.c_str(),
+                                                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            ImportScan::release(task.parent);
+            if (sub < 0 && !scan.over) mine.unreadable++;
+            else if (sub >= 0) importDirectory(scan, sub, task.dir, mine);
+
+            std::lock_guard<std::mutex> lock(scan.mutex);
+            if (--scan.busy == 0) scan.wake.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) workers.emplace_back(work, std::ref(reports[t]));
+    work(reports[0]);
+    for (std::thread& worker : workers) worker.join();
+
+    for (const ImportReport& part : reports) {
+        report.entries += part.entries;
+        report.directories += part.directories;
+        report.unreadable += part.unreadable;
+        report.bytes += part.bytes;
+    }
+    report.bytes += sizeof(Node) + nameHeapBytes(top->name_);
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // What was read before the budget ran out goes, none of it was linked.
+    if (scan.over) {
+        Reclaimer::retire(top);
+        return Status::MemoryBudgetExceeded;
+    }
+    if (accounted_) accountSubtree(top);
+    insertChildAlphabetical(top);
+    return Status::Ok;
+}
+
+// Used by applyBatch() and commit() to find the directory named by the
+// directory part of a path ("" or everything up to and including the last /),
+// starting at base, or the root for a leading /, without moving curr_. Each
+// component is taken the way cd takes it, and the first one cd would refuse
+// fails the same way.
+Status FileSystem::resolvePath(Node* base, string_view path, Node*& dir) const {
+    TRACE_SPAN("resolvePath");
+    dir = base;
+    size_t pos = 0;
+    if (!path.empty() && path[0] == '/') {
+        dir = root_;
+        pos = 1;
+    }
+    while (pos < path.size()) {
+        size_t slash = path.find('/', pos);
+        string_view part = path.substr(pos, slash - pos);
+        pos = slash + 1;
+
+        if (part == ".") continue;
+        if (part == "~") {
+            dir = root_;
+        } else if (part == "..") {
+            if (dir == root_ || !dir->parent_) return Status::InvalidPath;
+            dir = dir->parent_;
+        } else {
+            Node* child = findChildIn(dir, part);
+            if (child == nullptr || !child->isDir_) return Status::InvalidPath;
+            dir = child;
+        }
+    }
+    return Status::Ok;
+}
+
+// A touch/mkdir/rm of applyBatch() waiting for its directory's turn.
+struct FileSystem::BatchEntry {
+    Node* dir;
+    uint64_t key;     // nameKey(name)
+    string_view name; // points into the op's path
+    size_t op;        // index into ops and results
+};
+
+void FileSystem::applyBatch(const std::vector<BatchOp>& ops, std::vector<Status>& results) {
+    TRACE_SPAN("applyBatch");
+    results.assign(ops.size(), Status::Ok);
+    evictIfOver();
+
+    // Directory parts resolved so far, direct mapped by hash with about two
+    // slots per op. They stay valid until the next rmdir or mv: touch, mkdir
+    // and rm never remove a directory.
+    size_t cacheSlots = 16;
+    while (cacheSlots < 2 * ops.size()) cacheSlots *= 2;
+    string_view* cachedPath = new string_view[cacheSlots];
+    Node** cachedDir = new Node*[cacheSlots]();
+
+    BatchEntry* pending = new BatchEntry[ops.size() + 1];
+    size_t npending = 0;
+
+    // Apply everything pending, one directory at a time.
+    auto flush = [&]() {
+        // The op index keeps ops on the same name in the order they were given;
+        // ops on different names in one directory do not affect each other.
+        std::sort(pending, pending + npending, [](const BatchEntry& a, const BatchEntry& b) {
+            if (a.dir != b.dir) return std::less<Node*>()(a.dir, b.dir);
+            int order = compareNames(a.key, a.name, b.key, b.name);
+            if (order != 0) return order < 0;
+            return a.op < b.op;
+        });
+        for (size_t first = 0, last; first < npending; first = last) {
+            last = first + 1;
+            while (last < npending && pending[last].dir == pending[first].dir) last++;
+            applyGroup(pending[first].dir, pending + first, pending + last, ops, results);
+        }
+        npending = 0;
+    };
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        const BatchOp& op = ops[i];
+        string_view prefix, name;
+        splitPath(op.path, prefix, name);
+
+        if (op.kind == BatchOp::Kind::Rmdir || op.kind == BatchOp::Kind::Mv) {
+            flush();
+            std::fill(cachedDir, cachedDir + cacheSlots, nullptr);
+
+            Node* dir;
+            results[i] = resolvePath(curr_, prefix, dir);
+            if (results[i] != Status::Ok) continue;
+            if (op.kind == BatchOp::Kind::Rmdir && findChildIn(dir, name) == curr_) {
+                results[i] = Status::DirectoryInUse; // "rmdir ../here" would strand curr_.
+                continue;
+            }
+            Node* originalCurr = curr_;
+            curr_ = dir;
+            results[i] = op.kind == BatchOp::Kind::Rmdir ? tryRmdir(name) : tryMv(name, op.dest);
+            curr_ = originalCurr;
+            continue;
+        }
+
+        Node* dir = curr_;
+        if (!prefix.empty()) {
+            size_t slot = std::hash<string_view>()(prefix) & (cacheSlots - 1);
+            if (cachedDir[slot] != nullptr && cachedPath[slot] == prefix) {
+                dir = cachedDir[slot];
+            } else {
+                Status status = resolvePath(curr_, prefix, dir);
+                // The directory may be one a pending mkdir creates.
+                if (status != Status::Ok && npending != 0) {
+                    flush();
+                    status = resolvePath(curr_, prefix, dir);
+                }
+                if (status != Status::Ok) {
+                    results[i] = status;
+                    continue;
+                }
+                cachedPath[slot] = prefix;
+                cachedDir[slot] = dir;
+            }
+        }
+        pending[npending++] = BatchEntry{dir, nameKey(name), name, i};
+    }
+    flush();
+    delete[] pending;
+    delete[] cachedPath;
+    delete[] cachedDir;
+}
+
+// Used by applyBatch() to apply the touch/mkdir/rm aimed at dir, sorted by
+// name, in one pass along its sibling list. Indexed directories are entered
+// through the index for each name instead, so a big one is never walked.
+void FileSystem::applyGroup(Node* dir, const BatchEntry* first, const BatchEntry* last,
+                            const std::vector<BatchOp>& ops, std::vector<Status>& results) {
+    TRACE_SPAN("applyGroup");
+    ensureLoaded(dir);
+    uint64_t hops = 0;
+    int64_t now = 0;                  // read once, on the first create
+    Node* prev = nullptr;             // last child before the current name
+    Node* next = dir->leftmostChild_; // first child not before it
+
+    for (const BatchEntry* e = first; e != last; e++) {
+        if (dir->index_ != nullptr) {
+            prev = predecessor(dir, e->name, Counter::InsertSiblingHops);
+            next = prev ? prev->rightSibling_ : dir->leftmostChild_;
+        } else {
+            while (next != nullptr && compareNames(next->key_, next->name_, e->key, e->name) < 0) {
+                prev = next;
+                next = next->rightSibling_;
+                hops++;
+            }
+        }
+        bool found = next != nullptr && next->key_ == e->key && next->name_ == e->name;
+        BatchOp::Kind kind = ops[e->op].kind;
+        Status& result = results[e->op];
+
+        if (kind == BatchOp::Kind::Rm) {
+            if (!found) {
+                result = Status::FileNotFound;
+            } else if (next->isDir_) {
+                result = Status::NotAFile;
+            } else if (next->pins_ != 0) {
+                result = Status::FileInUse;
+            } else {
+                Node* gone = next;
+                next = gone->rightSibling_;
+                if (prev == nullptr) dir->leftmostChild_ = next;
+                else prev->rightSibling_ = next;
+                if (dir->index_ != nullptr) dir->index_->removed(gone);
+                noteMutation(dir, gone, WatchEvent::Kind::Delete);
+                delete gone;
+            }
+        } else if (e->name.empty()) {
+            result = Status::InvalidName;
+        } else if (found) {
+            result = Status::AlreadyExists;
+        } else if (!withinBudget(newNodeBytes(e->name.size()))) {
+            result = Status::MemoryBudgetExceeded;
+        } else {
+            Node* node = new Node(string(e->name), kind == BatchOp::Kind::Mkdir, dir, nullptr, next);
+            if (now == 0) now = nowNs();
+            stampCreated(node, now);
+            if (accounted_) accountSubtree(node);
+            if (prev == nullptr) dir->leftmostChild_ = node;
+            else prev->rightSibling_ = node;
+            if (dir->index_ != nullptr) dir->index_->inserted(node);
+            next = node;
+            noteMutation(dir, node, WatchEvent::Kind::Create);
+        }
+    }
+    // Same rule as predecessor(): long scans per name mean a big directory.
+    if (dir->index_ == nullptr && hops > DirIndex::kBuildThreshold * static_cast<uint64_t>(last - first)) {
+        dir->index_ = new DirIndex(dir);
+        if (accounted_) charge(dir, dir->index_->takeGrowth(), 0);
+    }
+    Stats::count(Counter::InsertSiblingHops, hops);
+}
+
+// Every change to dir's child list goes through here, see Transaction
+// and watch(). child is the node created, deleted or moved.
+void FileSystem::noteMutation(Node* dir, Node* child, WatchEvent::Kind kind) {
+    dir->version_ = ++versions_;
+    if (kind == WatchEvent::Kind::Create) child->version_ = ++versions_;
+    if (!treeCache_.empty()) invalidateTree(dir);
+    if (dir->id_ == MetaTable::kNone) stampCreated(dir, 0);
+    if (dir->id_ != MetaTable::kNone) MetaTable::setMtime(dir->id_, nowNs());
+    if (store_ != nullptr) markDirty(dir);
+    if (image_ != nullptr) {
+        unback(dir);
+        if (kind == WatchEvent::Kind::Delete && child->isDir_) {
+            for (Node* node = hand_; node != nullptr; node = node->parent_) {
+                if (node == child) hand_ = dir; // Keep the clock off nodes about to be freed.
+            }
+        }
+    }
+    if (accounted_) {
+        uint64_t bytes, nodes;
+        usageOf(child, bytes, nodes);
+        int64_t index = dir->index_ != nullptr ? dir->index_->takeGrowth() : 0;
+        if (kind == WatchEvent::Kind::Delete || kind == WatchEvent::Kind::MovedFrom) {
+            charge(dir, index - static_cast<int64_t>(bytes), -static_cast<int64_t>(nodes));
+        } else {
+            charge(dir, index + static_cast<int64_t>(bytes), static_cast<int64_t>(nodes));
+        }
+    }
+    if (watches_ != nullptr) publish(dir, child, kind);
+}
+
+// Give node a metadata row with default mode, created at now (0 if not known).
+void FileSystem::stampCreated(Node* node, int64_t now) {
+    node->id_ = MetaTable::allocate();
+    if (node->id_ == MetaTable::kNone) return;
+    NodeMeta meta;
+    meta.ctime = now;
+    meta.mtime = now;
+    meta.mode = node->isDir_ ? 0755 : 0644;
+    MetaTable::write(node->id_, meta);
+}
+
+// Used by cloneSubtree(): to gets a row of its own holding from's metadata,
+// as cp -p would keep it. Usage and checkpoint id are left to the caller.
+void FileSystem::copyMeta(const Node* from, Node* to) {
+    if (from->id_ == MetaTable::kNone) return;
+    to->id_ = MetaTable::allocate();
+    if (to->id_ == MetaTable::kNone) return;
+    NodeMeta meta;
+    MetaTable::read(from->id_, meta);
+    MetaTable::write(to->id_, meta);
+}
+
+// Memory node holds itself: its slot, its name when too long to be stored
+// inline, its metadata row. A directory's index is charged as it grows.
+uint64_t FileSystem::ownBytes(const Node* node) {
+    return sizeof(Node) + nameHeapBytes(node->name_) + (node->id_ != MetaTable::kNone ? MetaTable::kRowBytes : 0);
+}
+
+// Usage of node and, for a directory, everything below it. Only complete
+// once accounting has started.
+void FileSystem::usageOf(const Node* node, uint64_t& bytes, uint64_t& nodes) {
+    if (node->isDir_ && node->id_ != MetaTable::kNone) {
+        MetaTable::usage(node->id_, bytes, nodes);
+    } else {
+        bytes = ownBytes(node);
+        nodes = 1;
+    }
+}
+
+// Add to the usage of dir and of every directory above it.
+void FileSystem::charge(Node* dir, int64_t bytes, int64_t nodes) {
+    for (; dir != nullptr; dir = dir->parent_) {
+        if (dir->id_ != MetaTable::kNone) MetaTable::addUsage(dir->id_, bytes, nodes);
+    }
+}
+
+// Fill in the usage of every directory from top down, giving rows to those
+// without one. For trees built while nothing was counted: the whole tree
+// when accounting starts, new nodes and bulk copies before they are linked.
+void FileSystem::accountSubtree(Node* top) {
+    auto enter = [](Node* node) {
+        if (!node->isDir_) return;
+        if (node->id_ == MetaTable::kNone) stampCreated(node, 0);
+        if (node->id_ == MetaTable::kNone) return;
+        int64_t index = node->index_ != nullptr ? node->index_->takeGrowth() : 0;
+        MetaTable::setUsage(node->id_, ownBytes(node) + index, 1);
+    };
+    // node and everything below it are counted: add them to its parent.
+    auto leave = [](Node* node) {
+        uint64_t bytes, nodes;
+        usageOf(node, bytes, nodes);
+        if (node->parent_->id_ != MetaTable::kNone) MetaTable::addUsage(node->parent_->id_, bytes, nodes);
+    };
+    // Iterative, depth first: trees may be deeper than the stack allows.
+    enter(top);
+    Node* node = top;
+    while (true) {
+        if (node->leftmostChild_ != nullptr) {
+            node = node->leftmostChild_;
+            enter(node);
+            continue;
+        }
+        while (node != top && node->rightSibling_ == nullptr) {
+            leave(node);
+            node = node->parent_;
+        }
+        if (node == top) break;
+        leave(node);
+        node = node->rightSibling_;
+        enter(node);
+    }
+}
+
+void FileSystem::startAccounting() {
+    if (accounted_) return;
+    TRACE_SPAN("account");
+    accountSubtree(root_);
+    accounted_ = true;
+}
+
+// false if more bytes would take the tree past the budget
+bool FileSystem::withinBudget(uint64_t more) const {
+    if (memoryBudget_ == 0) return true;
+    uint64_t bytes, nodes;
+    usageOf(root_, bytes, nodes);
+    return bytes + more <= memoryBudget_;
+}
+
+void FileSystem::setMemoryBudget(uint64_t bytes) {
+    if (bytes != 0) startAccounting();
+    memoryBudget_ = bytes;
+}
+
+Status FileSystem::tryMem(string_view path, MemUsage& usage) {
+    startAccounting();
+    Node* node = curr_;
+    if (!path.empty()) {
+        string_view prefix, name;
+        splitPath(path, prefix, name);
+        Status status = resolvePath(curr_, prefix, node);
+        if (status != Status::Ok) return status;
+        if (name == "..") {
+            if (node == root_) return Status::InvalidPath;
+            node = node->parent_;
+        } else if (name == "~") {
+            node = root_;
+        } else if (name != "" && name != ".") {
+            node = findChildIn(node, name);
+            if (node == nullptr) return Status::FileNotFound;
+        }
+    }
+    usageOf(node, usage.bytes, usage.nodes);
+    return Status::Ok;
+}
+
+// Called for every change to dir's child list once the tree has a store.
+// Marks above an already marked directory are there already.
+void FileSystem::markDirty(Node* dir) {
+    dir->dirty_ = true;
+    for (Node* node = dir; node != nullptr && !node->dirtyBelow_; node = node->parent_) node->dirtyBelow_ = true;
+}
+
+uint32_t FileSystem::checkpointIdOf(const Node* dir) {
+    return dir->id_ == MetaTable::kNone ? 0 : MetaTable::checkpointId(dir->id_);
+}
+
+// A new persistent id for dir, kept in its row; false when out of rows.
+// Under accounting every directory has its row already.
+bool FileSystem::giveCheckpointId(Node* dir) {
+    if (dir->id_ == MetaTable::kNone) stampCreated(dir, 0);
+    if (dir->id_ == MetaTable::kNone) return false;
+    MetaTable::setCheckpointId(dir->id_, store_->newId());
+    return true;
+}
+
+// Drop every id and mark, before checkpointing to another store.
+void FileSystem::forgetCheckpoint() {
+    for (Node* node = root_; node != nullptr;) {
+        node->dirty_ = false;
+        node->dirtyBelow_ = false;
+        if (node->isDir_ && node->id_ != MetaTable::kNone) MetaTable::setCheckpointId(node->id_, 0);
+        if (node->leftmostChild_ != nullptr) {
+            node = node->leftmostChild_;
+            continue;
+        }
+        while (node != nullptr && node->rightSibling_ == nullptr) node = node->parent_;
+        if (node != nullptr) node = node->rightSibling_;
+    }
+}
+
+Status FileSystem::checkpoint(string_view storeDir, CheckpointReport& report) {
+    TRACE_SPAN("checkpoint");
+    auto start = std::chrono::steady_clock::now();
+    report = CheckpointReport();
+    // Stubs are only written down in the store they were paged in from.
+    if (image_ != nullptr && store_->dir() != storeDir) return Status::CheckpointFailed;
+    if (store_ == nullptr || store_->dir() != storeDir) {
+        CheckpointStore* store = new CheckpointStore(string(storeDir));
+        Status status = store->open(true);
+        if (status != Status::Ok) {
+            delete store;
+            return status;
+        }
+        if (store_ != nullptr) forgetCheckpoint();
+        delete store_;
+        store_ = store;
+    }
+
+    // Down the marked paths. A directory without an id is new to the
+    // store (mkdir, cp, import, or the first checkpoint) and is written
+    // whole; its parent's child list changed, so the parent is written too.
+    SegmentWriter writer;
+    bool started = false;
+    std::vector<Node*> stack;
+    std::vector<Node*> visited;
+    if (checkpointIdOf(root_) == 0) {
+        if (!giveCheckpointId(root_)) return Status::CheckpointFailed;
+        root_->dirty_ = true;
+    }
+    stack.push_back(root_);
+    while (!stack.empty()) {
+        Node* dir = stack.back();
+        stack.pop_back();
+        visited.push_back(dir);
+        if (dir->dirty_) {
+            if (!started && !store_->begin(writer)) return Status::CheckpointFailed;
+            started = true;
+            writer.beginRecord(checkpointIdOf(dir));
+        }
+        for (Node* child = dir->leftmostChild_; child != nullptr; child = child->rightSibling_) {
+            if (child->isDir_ && checkpointIdOf(child) == 0) {
+                if (!giveCheckpointId(child)) return Status::CheckpointFailed;
+                child->dirty_ = true;
+            }
+            if (dir->dirty_) writer.addChild(child->name_, child->isDir_, child->isDir_ ? checkpointIdOf(child) : 0);
+            if (child->isDir_ && (child->dirty_ || child->dirtyBelow_)) stack.push_back(child);
+        }
+        if (dir->dirty_) writer.endRecord();
+    }
+
+    // Marks stay until the segment is safely in the manifest, so a failed
+    // checkpoint is redone by the next one.
+    if (started) {
+        Status status = store_->commit(writer, checkpointIdOf(root_));
+        if (status != Status::Ok) return status;
+        report.directories = writer.records();
+        report.bytes = writer.bytes();
+    }
+    for (Node* dir : visited) {
+        dir->dirty_ = false;
+        dir->dirtyBelow_ = false;
+    }
+    report.segments = store_->segments();
+    report.sequence = store_->sequence();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return Status::Ok;
+}
+
+Status FileSystem::restore(string_view storeDir) {
+    TRACE_SPAN("restore");
+    if (root_->pins_ != 0 || watches_ != nullptr) return Status::DirectoryInUse;
+    CheckpointStore* store = new CheckpointStore(string(storeDir));
+    CheckpointImage image;
+    if (store->open(false) != Status::Ok || store->segments() == 0 || store->image(image) != Status::Ok) {
+        delete store;
+        return Status::CheckpointUnreadable;
+    }
+
+    // Records list children in name order, so each list is linked as read.
+    Node* root = new Node("", true);
+    std::vector<std::pair<Node*, uint32_t>> stack(1, std::make_pair(root, image.root()));
+    std::vector<CheckpointEntry> entries;
+    size_t records = 0;
+    bool ok = true;
+    while (ok && !stack.empty()) {
+        Node* dir = stack.back().first;
+        uint32_t id = stack.back().second;
+        stack.pop_back();
+        // More records than there are means the ids loop.
+        ok = ++records <= image.records() && image.read(id, entries);
+        if (dir->id_ == MetaTable::kNone) stampCreated(dir, 0);
+        ok = ok && dir->id_ != MetaTable::kNone;
+        if (!ok) break;
+        MetaTable::setCheckpointId(dir->id_, id);
+        Node* prev = nullptr;
+        for (CheckpointEntry& entry : entries) {
+            Node* node = new Node(std::move(entry.name), entry.isDir, dir);
+            if (node->name_.empty() || (prev != nullptr &&
+                compareNames(prev->key_, prev->name_, node->key_, node->name_) >= 0)) ok = false;
+            if (prev == nullptr) dir->leftmostChild_ = node;
+            else prev->rightSibling_ = node;
+            prev = node;
+            if (entry.isDir) stack.emplace_back(node, entry.id);
+        }
+    }
+    if (!ok) {
+        Reclaimer::retire(root);
+        delete store;
+        return Status::CheckpointUnreadable;
+    }
+
+    replaceTree(root, store, nullptr, 0);
+    return Status::Ok;
+}
+
+// Swap in a restored tree and the store it came from, with image for
+// paged mode (nullptr otherwise).
+void FileSystem::replaceTree(Node* root, CheckpointStore* store, CheckpointImage* image, uint64_t pageLimit) {
+    Reclaimer::retire(root_);
+    root_ = curr_ = root;
+    clearTreeCache();
+    delete store_;
+    store_ = store;
+    delete image_;
+    image_ = image;
+    pageLimit_ = pageLimit;
+    hand_ = root_;
+    overLimit_ = false;
+    if (accounted_) accountSubtree(root_);
+    if (image_ != nullptr) startAccounting();
+}
+
+Status FileSystem::restorePaged(string_view storeDir, uint64_t limit) {
+    TRACE_SPAN("restore");
+    if (root_->pins_ != 0 || watches_ != nullptr) return Status::DirectoryInUse;
+    CheckpointStore* store = new CheckpointStore(string(storeDir));
+    CheckpointImage* image = new CheckpointImage();
+    std::vector<CheckpointEntry> entries;
+    // Only the root's record is read now, the rest as it is needed.
+    Node* root = new Node("", true);
+    stampCreated(root, 0);
+    if (store->open(false) != Status::Ok || store->segments() == 0 || store->image(*image) != Status::Ok ||
+        !image->read(image->root(), entries) || root->id_ == MetaTable::kNone) {
+        delete root;
+        delete image;
+        delete store;
+        return Status::CheckpointUnreadable;
+    }
+    MetaTable::setCheckpointId(root->id_, image->root());
+    root->stub_ = true;
+    root->backed_ = true;
+    replaceTree(root, store, image, limit);
+    return Status::Ok;
+}
+
+// dir and the directories above it no longer hold what the image does,
+// so they are never evicted.
+void FileSystem::unback(Node* dir) {
+    for (; dir != nullptr && dir->backed_; dir = dir->parent_) dir->backed_ = false;
+}
+
+// Every look at a directory's children goes through here first. Outside
+// paged mode it is a single branch.
+void FileSystem::ensureLoaded(Node* dir) const {
+    if (image_ == nullptr) return;
+    dir->referenced_ = true;
+    if (dir->stub_) faultIn(dir);
+    else Stats::count(Counter::PageHits);
+}
+
+// Link dir's children from its record in the image, directories among
+// them as stubs. A record that cannot be read leaves dir an ordinary
+// empty directory, no longer backed by the image.
+void FileSystem::faultIn(Node* dir) const {
+    TRACE_SPAN("faultIn");
+    std::vector<CheckpointEntry> entries;
+    bool ok = image_->read(checkpointIdOf(dir), entries);
+    uint64_t bytes = 0;
+    Node* prev = nullptr;
+    for (CheckpointEntry& entry : entries) {
+        if (!ok) break;
+        Node* node = new Node(std::move(entry.name), entry.isDir, dir);
+        if (node->name_.empty() || (prev != nullptr &&
+            compareNames(prev->key_, prev->name_, node->key_, node->name_) >= 0)) ok = false;
+        if (prev == nullptr) dir->leftmostChild_ = node;
+        else prev->rightSibling_ = node;
+        prev = node;
+        if (entry.isDir) {
+            stampCreated(node, 0);
+            if (node->id_ == MetaTable::kNone) {
+                ok = false;
+                continue;
+            }
+            MetaTable::setCheckpointId(node->id_, entry.id);
+            MetaTable::setUsage(node->id_, ownBytes(node), 1);
+            node->stub_ = true;
+            node->backed_ = true;
+        }
+        bytes += ownBytes(node);
+    }
+    dir->stub_ = false;
+    if (!ok) {
+        Reclaimer::retireList(dir->leftmostChild_);
+        dir->leftmostChild_ = nullptr;
+        unback(dir);
+        return;
+    }
+    Stats::count(Counter::PageFaults);
+    if (accounted_) charge(dir, static_cast<int64_t>(bytes), static_cast<int64_t>(entries.size()));
+    if (pageLimit_ != 0) {
+        uint64_t total, nodes;
+        usageOf(root_, total, nodes);
+        if (total > pageLimit_) overLimit_ = true;
+    }
+}
+
+// Fault in everything below top, for cp -r.
+void FileSystem::loadSubtree(Node* top) const {
+    if (image_ == nullptr || !top->isDir_) return;
+    if (top->stub_) faultIn(top);
+    for (Node* node = top->leftmostChild_; node != nullptr && node != top;) {
+        if (node->stub_) faultIn(node);
+        if (node->leftmostChild_ != nullptr) {
+            node = node->leftmostChild_;
+            continue;
+        }
+        while (node != top && node->rightSibling_ == nullptr) node = node->parent_;
+        if (node != top) node = node->rightSibling_;
+    }
+}
+
+// The eviction clock. Its hand goes round the directories in tree order:
+// a referenced one loses its bit and the hand moves on into it, an
+// unreferenced one that may go is turned back into a stub. So a subtree
+// is evicted only if nothing looked in it for a whole turn. Runs until
+// the tree is down to 7/8 of the limit, or for at most two turns after
+// passing the root.
+void FileSystem::evictCold() const {
+    TRACE_SPAN("evict");
+    overLimit_ = false;
+    uint64_t bytes, nodes;
+    usageOf(root_, bytes, nodes);
+    if (bytes <= pageLimit_) return;
+    uint64_t target = pageLimit_ - pageLimit_ / 8;
+    pinPath(curr_, 1); // Nor the current directory, like a session's.
+    Node* node = hand_ != nullptr ? hand_ : root_;
+    for (unsigned laps = 0; bytes > target && laps < 3;) {
+        bool descend = true;
+        if (node == root_) {
+            laps++;
+            node->referenced_ = false;
+        } else if (node->stub_) {
+            descend = false;
+        } else if (node->referenced_) {
+            node->referenced_ = false;
+        } else if (node->backed_ && node->pins_ == 0 && node->leftmostChild_ != nullptr) {
+            bytes -= evict(node);
+            descend = false;
+        }
+        node = nextDir(node, descend);
+    }
+    hand_ = node;
+    pinPath(curr_, -1);
+}
+
+// Turn dir back into a stub, its children going to the Reclaimer. Returns
+// the bytes freed.
+uint64_t FileSystem::evict(Node* dir) const {
+    uint64_t bytes, nodes;
+    usageOf(dir, bytes, nodes);
+    Reclaimer::retireList(dir->leftmostChild_, nodes - 1);
+    dir->leftmostChild_ = nullptr;
+    delete dir->index_;
+    dir->index_ = nullptr;
+    dir->stub_ = true;
+    // Transactions that read its children conflict.
+    dir->version_ = ++versions_;
+    dir->treeGen_ = 0;
+    uint64_t own = ownBytes(dir);
+    charge(dir, static_cast<int64_t>(own) - static_cast<int64_t>(bytes), 1 - static_cast<int64_t>(nodes));
+    Stats::count(Counter::PageEvictions);
+    return bytes - own;
+}
+
+// Directory after node in tree order, node's own children skipped unless
+// descend; after the last one comes the root again.
+Node* FileSystem::nextDir(Node* node, bool descend) const {
+    if (descend) {
+        for (Node* child = node->leftmostChild_; child != nullptr; child = child->rightSibling_) {
+            if (child->isDir_) return child;
+        }
+    }
+    for (; node != root_; node = node->parent_) {
+        for (Node* sibling = node->rightSibling_; sibling != nullptr; sibling = sibling->rightSibling_) {
+            if (sibling->isDir_) return sibling;
+        }
+    }
+    return root_;
+}
+
+void FileSystem::waitCompaction() {
+    if (store_ != nullptr) store_->waitCompaction();
+}
+
+size_t FileSystem::checkpointSegments() const {
+    return store_ != nullptr ? store_->segments() : 0;
+}
+
+// Record that tx has gone through dir, and read its child list if children.
+// The directories above it are recorded first, so commit() checks a parent
+// before it looks at a child: a parent found where it was that still holds
+// the child under its name means the child has not been freed.
+void FileSystem::noteRead(Transaction& tx, Node* dir, bool children) const {
+    // Directories not recorded yet, dir first; above the first recorded one
+    // all are.
+    std::vector<Node*> chain;
+    for (Node* node = dir; node != nullptr; node = node->parent_) {
+        auto seen = std::find_if(tx.reads_.begin(), tx.reads_.end(),
+                                 [node](const Transaction::Read& read) { return read.dir == node; });
+        if (seen != tx.reads_.end()) {
+            if (node == dir) seen->children |= children;
+            break;
+        }
+        chain.push_back(node);
+    }
+    for (size_t i = chain.size(); i > 0; i--) {
+        Node* node = chain[i - 1];
+        Node* parent = node->parent_;
+        tx.reads_.push_back(Transaction::Read{node, parent, parent != nullptr ? parent->version_ : 0, node->version_,
+                                              children && node == dir, parent != nullptr ? node->name_ : string()});
+    }
+}
+
+void FileSystem::begin(Transaction& tx) const {
+    tx.reads_.clear();
+    tx.steps_.clear();
+    tx.open_ = true;
+}
+
+void FileSystem::stage(Transaction& tx, const BatchOp& op) const {
+    // Record the directories the path runs through, as far as they exist now;
+    // the rest can only come from the transaction's own ops.
+    string_view prefix, name;
+    splitPath(op.path, prefix, name);
+    if (!tx.steps_.empty() && tx.steps_.back().base == curr_) {
+        // Runs of ops in one directory only record it once.
+        string_view lastPrefix, lastName;
+        splitPath(tx.steps_.back().op.path, lastPrefix, lastName);
+        if (lastPrefix == prefix) {
+            tx.steps_.push_back(Transaction::Step{op, curr_});
+            return;
+        }
+    }
+    Node* dir = curr_;
+    noteRead(tx, dir, false);
+    size_t pos = 0;
+    if (!prefix.empty() && prefix[0] == '/') {
+        dir = root_;
+        pos = 1;
+    }
+    while (pos < prefix.size()) {
+        size_t slash = prefix.find('/', pos);
+        string_view part = prefix.substr(pos, slash - pos);
+        pos = slash + 1;
+        if (part == "~") dir = root_;
+        else if (part == ".." && dir->parent_ != nullptr) dir = dir->parent_;
+        else if (part != "." && part != "..") {
+            Node* child = findChildIn(dir, part);
+            if (child == nullptr || !child->isDir_) break;
+            dir = child;
+            noteRead(tx, dir, false);
+        }
+    }
+    // The op reads the children of where its path ends, or of where it
+    // broke off: one made there later would change what the path means.
+    noteRead(tx, dir, true);
+    tx.steps_.push_back(Transaction::Step{op, curr_});
+}
+
+void FileSystem::observe(Transaction& tx) const {
+    noteRead(tx, curr_, true);
+}
+
+void FileSystem::abort(Transaction& tx) const {
+    tx.reads_.clear();
+    tx.steps_.clear();
+    tx.open_ = false;
+}
+
+// What commit() does to take back one op that went through.
+struct FileSystem::Undo {
+    enum class Kind : unsigned char { Remove, Relink, Move };
+    Kind kind;
+    Node* node;  // Remove: the node created, Relink: the node unlinked, Move: the node moved
+    Node* dir;   // Relink and Move: its old parent
+    string name; // Move: its old name
+};
+
+void FileSystem::undo(const Undo& step) {
+    switch (step.kind) {
+    case Undo::Kind::Remove:
+        curr_ = step.node->parent_;
+        deleteChild(step.node);
+        break;
+    case Undo::Kind::Relink:
+        // The node itself comes back, with its metadata; never over the
+        // budget, it was counted before.
+        curr_ = step.dir;
+        insertChildAlphabetical(step.node);
+        break;
+    case Undo::Kind::Move: {
+        // Same steps as moveChild(), pins included, back to the old place.
+        int32_t pins = static_cast<int32_t>(step.node->pins_);
+        curr_ = step.node->parent_;
+        if (pins != 0) pinPath(curr_, -pins);
+        moving_ = true;
+        detachChild(step.node);
+        renameNode(step.node, step.name);
+        step.node->parent_ = step.dir;
+        curr_ = step.dir;
+        insertChildAlphabetical(step.node);
+        moving_ = false;
+        if (pins != 0) pinPath(step.dir, pins);
+        break;
+    }
+    }
+}
+
+Status FileSystem::commit(Transaction& tx) {
+    TRACE_SPAN("commit");
+    tx.open_ = false;
+
+    // Parents come before their children, so every parent looked at here
+    // is still alive: its own check has just passed. A dir is only looked
+    // at once its parent is seen to hold it.
+    for (const Transaction::Read& read : tx.reads_) {
+        bool held = read.parent == nullptr || read.parent->version_ == read.parentVersion ||
+                    findChildIn(read.parent, read.name) == read.dir;
+        if (!held || (read.children && read.dir->version_ != read.version)) {
+            Stats::count(Counter::TxConflicts);
+            return Status::TransactionConflict;
+        }
+    }
+
+    Node* originalCurr = curr_;
+    std::vector<Undo> done;
+    Status status = Status::Ok;
+    const Transaction::Step* last = nullptr; // step dir was resolved for
+    Node* dir = nullptr;
+    string_view lastPrefix;
+    for (const Transaction::Step& step : tx.steps_) {
+        const BatchOp& op = step.op;
+        string_view prefix, name;
+        splitPath(op.path, prefix, name);
+        // touch, mkdir and rm cannot change where a path leads, so the next
+        // op on the same path needs no new walk.
+        bool same = last != nullptr && last->base == step.base && lastPrefix == prefix &&
+                    last->op.kind != BatchOp::Kind::Rmdir && last->op.kind != BatchOp::Kind::Mv;
+        if (!same) {
+            status = resolvePath(step.base, prefix, dir);
+            if (status != Status::Ok) break;
+        }
+        last = &step;
+        lastPrefix = prefix;
+        curr_ = dir;
+
+        Node* target = findChild(name);
+        switch (op.kind) {
+        case BatchOp::Kind::Touch:
+        case BatchOp::Kind::Mkdir:
+            status = createChild(name, nullptr, op.kind == BatchOp::Kind::Mkdir);
+            if (status == Status::Ok) done.push_back(Undo{Undo::Kind::Remove, findChild(name), nullptr, string()});
+            break;
+        case BatchOp::Kind::Rm:
+            // Unlinked but kept until the commit is through, for undo().
+            status = removable(target, false);
+            if (status == Status::Ok) {
+                detachChild(target);
+                done.push_back(Undo{Undo::Kind::Relink, target, dir, string()});
+            }
+            break;
+        case BatchOp::Kind::Rmdir:
+            // Later steps may still start from it.
+            for (const Transaction::Step& other : tx.steps_) {
+                if (target != nullptr && other.base == target) status = Status::DirectoryInUse;
+            }
+            if (target != nullptr && target == originalCurr) status = Status::DirectoryInUse;
+            if (status == Status::Ok) status = removable(target, true);
+            if (status == Status::Ok) {
+                detachChild(target);
+                done.push_back(Undo{Undo::Kind::Relink, target, dir, string()});
+            }
+            break;
+        case BatchOp::Kind::Mv:
+            status = tryMv(name, op.dest);
+            if (status == Status::Ok) done.push_back(Undo{Undo::Kind::Move, target, dir, string(name)});
+            break;
+        }
+        if (status != Status::Ok) break;
+    }
+
+    if (status != Status::Ok) {
+        for (size_t i = done.size(); i > 0; i--) undo(done[i - 1]);
+    } else {
+        for (const Undo& step : done) {
+            if (step.kind == Undo::Kind::Relink) delete step.node;
+        }
+    }
+    curr_ = originalCurr;
+    tx.reads_.clear();
+    tx.steps_.clear();
+    return status;
+}
+
+// Add delta to the pin count of dir and every directory above it.
+void FileSystem::pinPath(Node* dir, int32_t delta) {
+    for (; dir != nullptr; dir = dir->parent_) {
+        dir->pins_ = static_cast<uint32_t>(static_cast<int32_t>(dir->pins_) + delta);
+    }
+}
+
+void FileSystem::openSession(Session& session) {
+    session.cwd_ = root_;
+    pinPath(root_, 1);
+}
+
+void FileSystem::closeSession(Session& session) {
+    if (session.cwd_ != nullptr) pinPath(session.cwd_, -1);
+    session.cwd_ = nullptr;
+}
+
+void FileSystem::enter(Session& session) {
+    // The session's own commands can never remove its directory: they only
+    // name children of it. So the pin is not needed while it runs.
+    pinPath(session.cwd_, -1);
+    curr_ = session.cwd_;
+    session.cwd_ = nullptr;
+}
+
+void FileSystem::leave(Session& session) {
+    session.cwd_ = curr_;
+    pinPath(curr_, 1);
+}
+
+Status FileSystem::watch(string_view path, bool recursive, WatchRing& ring) {
+    // resolvePath() wants the directory part of a path, so end it with /.
+    string full(path);
+    if (full.empty() || full.back() != '/') full += '/';
+    Node* dir = nullptr;
+    Status status = resolvePath(curr_, full, dir);
+    if (status != Status::Ok) return status == Status::InvalidPath ? Status::DirectoryNotFound : status;
+
+    watches_ = new Watch{dir, recursive, &ring, watches_};
+    dir->watched_ = true;
+    pinPath(dir, 1);
+    return Status::Ok;
+}
+
+void FileSystem::unwatch(WatchRing& ring) {
+    Watch** link = &watches_;
+    while (*link != nullptr) {
+        Watch* w = *link;
+        if (w->ring != &ring) {
+            link = &w->next;
+            continue;
+        }
+        *link = w->next;
+        pinPath(w->dir, -1);
+        // Another watch may still be on the same directory.
+        w->dir->watched_ = false;
+        for (Watch* other = watches_; other != nullptr; other = other->next) {
+            if (other->dir == w->dir) w->dir->watched_ = true;
+        }
+        delete w;
+    }
+}
+
+// Push one event to every watch that sees child change in dir: watches on
+// dir, and recursive ones on any directory above it. Only directories
+// flagged watched_ are looked up in the list, so the cost is one walk up
+// the parent chain plus the matching watches.
+void FileSystem::publish(Node* dir, Node* child, WatchEvent::Kind kind) const {
+    for (Node* watched = dir; watched != nullptr; watched = watched->parent_) {
+        if (!watched->watched_) continue;
+        for (Watch* w = watches_; w != nullptr; w = w->next) {
+            if (w->dir != watched || (watched != dir && !w->recursive)) continue;
+
+            WatchEvent event;
+            event.kind = kind;
+            event.isDir = child->isDir_;
+            event.truncated = false;
+            event.node = reinterpret_cast<uintptr_t>(child);
+            event.dir = reinterpret_cast<uintptr_t>(dir);
+            // Fill the path from its end: child's name, then the directories
+            // between it and the watched one. Keep the tail if it does not fit.
+            char* end = event.path + WatchEvent::kPathBytes;
+            char* start = end;
+            const Node* part = child;
+            for (;;) {
+                size_t room = static_cast<size_t>(start - event.path);
+                size_t len = part->name_.size();
+                if (len > room) {
+                    std::memcpy(event.path, part->name_.data() + len - room, room);
+                    start = event.path;
+                    event.truncated = true;
+                    break;
+                }
+                start -= len;
+                std::memcpy(start, part->name_.data(), len);
+                part = part == child ? dir : part->parent_;
+                if (part == watched) break;
+                if (start == event.path) {
+                    event.truncated = true;
+                    break;
+                }
+                *--start = '/';
+            }
+            event.length = static_cast<unsigned char>(end - start);
+            std::memmove(event.path, start, event.length);
+            w->ring->push(event);
+        }
+    }
+}
+
+string FileSystem::checkInvariants() const {
+    // No tree can hold more nodes than the pool has handed out, so walking
+    // more than that means the links loop somewhere.
+    uint64_t limit = NodePool::slotsInUse();
+    uint64_t visited = 1;
+
+    if (root_->parent_ != nullptr) return "root has a parent";
+    if (root_->stub_ && root_->leftmostChild_ != nullptr) return "stub with children: /";
+    Node* dir = root_;
+    Node* node = root_->leftmostChild_;
+    while (node != nullptr) {
+        if (++visited > limit) return "cycle below /" + dir->name_;
+        if (node->parent_ != dir) return "wrong parent_ on " + node->name_;
+        if (node->key_ != nameKey(node->name_)) return "stale key_ on " + node->name_;
+        if (node->name_ == "") return "empty name under " + dir->name_;
+        Node* next = node->rightSibling_;
+        if (next != nullptr && compareNames(node->key_, node->name_, next->key_, next->name_) >= 0) {
+            return "siblings out of order: " + node->name_ + ", " + next->name_;
+        }
+        if (!node->isDir_ && node->leftmostChild_ != nullptr) return "file with children: " + node->name_;
+        if (node->stub_ && (node->leftmostChild_ != nullptr || node->index_ != nullptr)) {
+            return "stub with children: " + node->name_;
+        }
+        if (node->stub_ && checkpointIdOf(node) == 0) return "stub without a checkpoint id: " + node->name_;
+        if (node->isDir_ && dir->backed_ && !node->backed_) return "changed directory in an unchanged one: " + node->name_;
+        if ((node->dirty_ && !node->dirtyBelow_) || (node->dirtyBelow_ && !dir->dirtyBelow_)) {
+            return "dirty mark not passed up from " + node->name_;
+        }
+
+        if (node->leftmostChild_ != nullptr) {
+            dir = node;
+            node = node->leftmostChild_;
+            continue;
+        }
+        // Climb until a level with a next sibling.
+        while (node != nullptr && node->rightSibling_ == nullptr) {
+            node = node->parent_;
+            if (node == root_) node = nullptr;
+        }
+        if (node != nullptr) {
+            dir = node->parent_; // Already checked, the sibling must share it.
+            node = node->rightSibling_;
+        }
+    }
+
+    uint64_t depth = 0;
+    Node* tmp = curr_;
+    while (tmp != root_) {
+        if (tmp == nullptr || ++depth > limit) return "current directory not under the root";
+        tmp = tmp->parent_;
+    }
+
+    // Every directory's usage is what counting it again gives.
+    if (!accounted_) return "";
+    string wrong;
+    // Bytes and nodes counted so far for each directory on the way down.
+    std::vector<std::pair<uint64_t, uint64_t>> sums;
+    auto enter = [&sums](const Node* node) {
+        sums.emplace_back(ownBytes(node) + (node->index_ != nullptr ? node->index_->bytes() : 0), 1);
+    };
+    // node and everything below it are counted: check it, add it to its parent.
+    auto leave = [&sums, &wrong](const Node* node) {
+        auto [bytes, nodes] = sums.back();
+        sums.pop_back();
+        uint64_t keptBytes, keptNodes;
+        usageOf(node, keptBytes, keptNodes);
+        if (wrong == "" && (keptBytes != bytes || keptNodes != nodes)) {
+            wrong = "usage of /" + node->name_ + " is " + std::to_string(keptBytes) + " bytes, " +
+                    std::to_string(keptNodes) + " nodes, counted " + std::to_string(bytes) + ", " +
+                    std::to_string(nodes);
+        }
+        if (!sums.empty()) {
+            sums.back().first += bytes;
+            sums.back().second += nodes;
+        }
+    };
+    // Iterative post-order, the same climb as accountSubtree().
+    enter(root_);
+    node = root_;
+    while (true) {
+        if (node->leftmostChild_ != nullptr) {
+            node = node->leftmostChild_;
+            enter(node);
+            continue;
+        }
+        while (node != root_ && node->rightSibling_ == nullptr) {
+            leave(node);
+            node = node->parent_;
+        }
+        if (node == root_) break;
+        leave(node);
+        node = node->rightSibling_;
+        enter(node);
+    }
+    leave(root_);
+    return wrong;
+}
@@ -1,22 +1,82 @@
 #ifndef FILESYSTEM_H_
 #define FILESYSTEM_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "DirIndex.h"
+#include "MetaTable.h"
+#include "NameKey.h"
+#include "Stats.h"
+#include "Watch.h"
 using std::string;
+using std::string_view;
+
+// Result of a FileSystem operation. Ok means success; every other value
+// maps to the message the string API returns, see statusMessage().
+// Statuses are plain bytes so failing calls never allocate.
+enum class Status : unsigned char {
+	Ok,
+	InvalidPath,             // "invalid path"
+	InvalidName,             // "invalid name"
+	AlreadyExists,           // "file/directory already exists"
+	FileNotFound,            // "file not found"
+	NotAFile,                // "not a file"
+	DirectoryNotFound,       // "directory not found"
+	NotADirectory,           // "not a directory"
+	DirectoryNotEmpty,       // "directory not empty"
+	SourceNotFound,          // "source does not exist"
+	DestinationNotFound,     // "destination does not exist"
+	DestinationNotDirectory, // "destination is not a directory"
+	SameSourceDestination,   // "source and destination are the same"
+	DestinationHasFile,      // "destination already has file of same name"
+	DirectoryOntoFile,       // "source is a directory but destination is an existing file"
+	DestinationHasSameName,  // "destination already has file/directory of same name"
+	SourceIsDirectory,       // "source is a directory"
+	DirectoryInUse,          // "directory is in use"
+	TransactionConflict,     // "transaction conflict"
+	HostPathUnreadable,      // "cannot read host directory"
+	MemoryBudgetExceeded,    // "memory budget exceeded"
+	FileInUse,               // "file is in use"
+	CheckpointFailed,        // "cannot write checkpoint"
+	CheckpointUnreadable     // "cannot read checkpoint"
+};
+
+// message for a status, "" for Status::Ok (static storage, never freed)
+[[nodiscard]] const char* statusMessage(Status status);
 
 class Node {
 
+	uint64_t key_;        // nameKey(name_): first 8 bytes, decides most compares
 	string name_;         // name of the file/directory
 	bool isDir_;          // is this node a directory or not
+	bool watched_ : 1;    // some watch is on this directory, see FileSystem::watch()
+	bool dirty_ : 1;      // child list changed since the last checkpoint, see FileSystem::checkpoint()
+	bool dirtyBelow_ : 1; // dirty_ here or anywhere below
+	bool stub_ : 1;       // paged directory whose children are still only in the image, see FileSystem::restorePaged()
+	bool backed_ : 1;     // paged directory, nothing changed here or below since it was faulted in
+	bool referenced_ : 1; // children looked at since the eviction clock last passed
+	uint16_t treeGen_;    // equal to FileSystem::treeGen_ while treeCache_ holds this directory
+	uint32_t pins_;       // idle sessions whose directory is this one or below it
+	uint32_t version_;    // new on every change to the child list, see Transaction
+	uint32_t id_;         // row of the node's metadata in MetaTable, kNone until it has one
 	Node* parent_;        // pointer to parent
 	Node* leftmostChild_; // pointer to leftmost child
 	Node* rightSibling_;  // pointer to next (right side) sibling
+	DirIndex* index_;     // skip list over children, built once the directory gets big
 
 	// return pointer to previous (left side) sibling
 	// (if your compiler is too old to understand [[nodiscard]],
 	// you can remove this keyword, and same for other functions below)
 	[[nodiscard]] Node* leftSibling() const;
 
+	// set name_ and key_ together
+	void setName(string_view name);
+	void setName(string&& name);
+
 	// you are allowed to add other members
 
 public:
@@ -27,29 +87,255 @@ public:
 	// are not there.
 	Node(const string& name, bool isDir, Node* parent = nullptr, Node* leftmostChild = nullptr, Node* rightSibling = nullptr);
 
+	// same, but takes over name's buffer instead of copying it
+	Node(string&& name, bool isDir, Node* parent = nullptr, Node* leftmostChild = nullptr, Node* rightSibling = nullptr);
+
 	// destructor
 	~Node();
 
+	// nodes live in NodePool slots
+	static void* operator new(size_t size);
+	static void operator delete(void* slot);
+	// placement new into a NodePool::allocateBlock() slot
+	static void* operator new(size_t size, void* slot) { (void)size; return slot; }
+	static void operator delete(void* ptr, void* slot) { (void)ptr; (void)slot; }
+
 friend class FileSystem; // allow FileSystem to access private members
+friend class DirIndex;
+friend class Reclaimer;
+};
+
+// Resumable position in a directory listing, see FileSystem::lsPage().
+// It remembers the last name handed out rather than a node, so it stays
+// valid while entries are inserted or deleted between pages: the next
+// page starts at the first name after it, nothing is skipped or repeated.
+class ListCursor {
+
+	string after_; // last name returned, "" before the first page
+	bool done_;    // no entries left after after_ when the last page was taken
+
+public:
+	ListCursor();
+
+	// start listing after name (exclusive)
+	explicit ListCursor(const string& after);
+
+	[[nodiscard]] bool done() const { return done_; }
+	[[nodiscard]] const string& after() const { return after_; }
+
+friend class FileSystem;
+};
+
+// Working directory of one client when several share a FileSystem, see
+// FileSystem::openSession(). Holds nothing but the directory, so sessions
+// are cheap enough to keep one per connection.
+class Session {
+
+	Node* cwd_; // nullptr until opened, and while entered
+
+public:
+	Session() : cwd_(nullptr) {}
+
+friend class FileSystem;
+};
+
+// Shape of a synthetic tree, see FileSystem(const GenSpec&). Every
+// directory gets a fan-out drawn uniformly from [minFanout, maxFanout]
+// children, each a file with probability filePercent / 100, with names of
+// [minNameLen, maxNameLen] random lowercase letters (duplicate names
+// within a directory are dropped). The same spec always gives the same tree.
+struct GenSpec {
+	uint64_t seed = 1;
+	unsigned depth = 4;          // deepest level, children of the root are level 1
+	unsigned minFanout = 4;
+	unsigned maxFanout = 16;
+	unsigned filePercent = 75;
+	unsigned minNameLen = 4;
+	unsigned maxNameLen = 12;    // at most 255
+	uint64_t maxNodes = 0;       // stop once this many nodes exist (root excluded), 0 for no cap
+
+	// ranges are non-empty, names 1 to 255 bytes, filePercent at most 100
+	[[nodiscard]] bool valid() const;
+};
+
+// Limits for FileSystem::treeInto(), 0 meaning no limit.
+struct TreeLimits {
+	unsigned depth = 0;    // levels shown below the directory, like tree -L
+	uint64_t maxNodes = 0; // entries shown at most
+};
+
+// Memory held by a node and, for a directory, everything below it, see
+// FileSystem::tryMem(). bytes counts node slots, names too long to be
+// stored inside the string, metadata rows and directory indexes.
+struct MemUsage {
+	uint64_t nodes = 0;
+	uint64_t bytes = 0;
+};
+
+// What FileSystem::checkpoint() did.
+struct CheckpointReport {
+	uint64_t directories = 0; // records written, one per directory
+	uint64_t bytes = 0;       // size of the segment, 0 if nothing had changed
+	uint64_t segments = 0;    // live in the store afterwards
+	uint64_t sequence = 0;    // of the newest segment
+	double seconds = 0;
+};
+
+class CheckpointStore;
+class CheckpointImage;
+
+// What FileSystem::importHost() did.
+struct ImportReport {
+	uint64_t entries = 0;     // files and directories created below the top one
+	uint64_t directories = 0; // of which directories
+	uint64_t unreadable = 0;  // host directories that could not be read, imported empty
+	uint64_t bytes = 0;       // node slots plus name buffers of everything created
+	double seconds = 0;
+};
+
+// One operation of FileSystem::applyBatch(). path is "name" or
+// "dir/.../name", relative to the current directory or starting with /;
+// the directory part may use "." and "..". The operation behaves as if
+// the caller did cd into the directory one component at a time, ran the
+// command on name, then went back to where it started.
+struct BatchOp {
+	enum class Kind : unsigned char { Touch, Mkdir, Rm, Rmdir, Mv };
+	Kind kind;
+	string path;
+	string dest; // Mv only: destination as tryMv() takes it, seen from path's directory
+};
+
+// Optimistic transaction over one FileSystem, see FileSystem::begin().
+// Holds the queued operations and the directories read so far: each with
+// where it hung then, and the version it had if its children were read.
+// Nothing is locked while it is open.
+class Transaction {
+
+	struct Read {
+		Node* dir;
+		Node* parent;           // nullptr for the root
+		uint32_t parentVersion; // parent's version when dir was found in it
+		uint32_t version;
+		bool children;          // dir's child list was read, not only passed through
+		string name;            // dir's name in parent
+	};
+	struct Step {
+		BatchOp op;
+		Node* base; // current directory when the op was staged
+	};
+	std::vector<Read> reads_; // every directory after its parent
+	std::vector<Step> steps_;
+	bool open_ = false;
+
+public:
+	[[nodiscard]] bool open() const { return open_; }
+	[[nodiscard]] size_t size() const { return steps_.size(); }
+
+friend class FileSystem;
 };
 
 class FileSystem {
 
 	Node* root_; // pointer to root directory
 	Node* curr_; // pointer to current directory
+	unsigned cloneThreads_ = 1; // threads cp -r may use for one big subtree
+	struct Watch;
+	Watch* watches_ = nullptr;  // open watches, see watch()
+	bool moving_ = false;       // in mv: detach and insert are one move, not delete and create
+	// last version handed out; none is handed out twice, so a node in a
+	// reused slot never has a version a transaction read from the old one
+	mutable uint32_t versions_ = 0;
+	// tree() lines of one directory's children, as rendered at depth nest,
+	// and where the renderings of the non-empty subdirectories go in.
+	struct TreeFragment {
+		size_t nest;
+		string text;
+		std::vector<std::pair<size_t, Node*>> subdirs; // offset into text, after the subdir's line
+	};
+	// Entries of destroyed nodes linger until the cache is next cleared,
+	// only a node whose treeGen_ matches is ever looked up.
+	mutable std::unordered_map<const Node*, TreeFragment> treeCache_;
+	mutable uint64_t treeCacheBytes_ = 0;
+	mutable uint16_t treeGen_ = 1;
+	bool accounted_ = false;    // directories' MetaTable rows hold their usage, see tryMem()
+	uint64_t memoryBudget_ = 0; // 0 for none
+	CheckpointStore* store_ = nullptr; // checkpoint() target, directories' rows hold their ids in it
+	CheckpointImage* image_ = nullptr; // paged mode: where stubs fault their children in from
+	uint64_t pageLimit_ = 0;           // paged mode: bytes kept in memory, 0 for no limit
+	mutable Node* hand_ = nullptr;     // next directory the eviction clock looks at
+	mutable bool overLimit_ = false;   // a fault took the tree past pageLimit_
 
 	// you are allowed to add other members
 
 	// Private helper methods
-	string handleSpecialPaths(const string& path);
-	string navigateToChild(const string& path);
-	[[nodiscard]] Node* findChild(const string& name) const;
-    string treeRecursion(Node* node, int nestCount) const;
+	bool handleSpecialPaths(string_view path, Status& status);
+	Status navigateToChild(string_view path);
+	[[nodiscard]] Node* findChild(string_view name) const;
+	[[nodiscard]] Node* findChildIn(Node* dir, string_view name) const;
+	[[nodiscard]] Node* predecessor(Node* dir, string_view name, Counter counter) const;
+	[[nodiscard]] Node* lastWithPrefix(Node* dir, string_view prefix) const;
+    void treeRecursion(Node* node, size_t nestCount, string& res) const;
+    void clearTreeCache() const;
+    void invalidateTree(Node* dir);
+    void treeLimited(Node* top, size_t indent, const TreeLimits& limits, string& res) const;
+    [[nodiscard]] static uint64_t childCount(const Node* dir);
     void insertChildAlphabetical(Node* newNode);
     void deleteChild(Node* removeTarget);
     void detachChild(Node* node);
-    string renameChild(const string& src, const string& dest);
-    string moveChild(const string& src, const string& dest);
+    Status renameChild(string_view src, string_view dest);
+    void renameNode(Node* node, string_view name);
+    Status moveChild(string_view src, string_view dest);
+    Node* cloneSubtree(Node* src, string_view name, Node* parent) const;
+    Status createChild(string_view name, string* owned, bool isDir, bool budgeted = true);
+    void generateChildren(Node* dir, const GenSpec& spec, uint64_t& rng, uint64_t& budget);
+    struct ImportScan;
+    static void importDirectory(ImportScan& scan, int fd, Node* dir, ImportReport& report);
+    static void pinPath(Node* dir, int32_t delta);
+    Status resolvePath(Node* base, string_view path, Node*& dir) const;
+    void noteMutation(Node* dir, Node* child, WatchEvent::Kind kind);
+    static void stampCreated(Node* node, int64_t now);
+    static void copyMeta(const Node* from, Node* to);
+    static void metaOf(const Node* node, NodeMeta& meta);
+    [[nodiscard]] static uint64_t ownBytes(const Node* node);
+    static void usageOf(const Node* node, uint64_t& bytes, uint64_t& nodes);
+    static void charge(Node* dir, int64_t bytes, int64_t nodes);
+    static void accountSubtree(Node* top);
+    void startAccounting();
+    void markDirty(Node* dir);
+    [[nodiscard]] static uint32_t checkpointIdOf(const Node* dir);
+    [[nodiscard]] bool giveCheckpointId(Node* dir);
+    void forgetCheckpoint();
+    void replaceTree(Node* root, CheckpointStore* store, CheckpointImage* image, uint64_t pageLimit);
+    static void unback(Node* dir);
+    void ensureLoaded(Node* dir) const;
+    void faultIn(Node* dir) const;
+    void loadSubtree(Node* top) const;
+    void evictIfOver() const { if (overLimit_) evictCold(); }
+    void evictCold() const;
+    uint64_t evict(Node* dir) const;
+    [[nodiscard]] Node* nextDir(Node* node, bool descend) const;
+    [[nodiscard]] bool withinBudget(uint64_t more) const;
+    void publish(Node* dir, Node* child, WatchEvent::Kind kind) const;
+    void noteRead(Transaction& tx, Node* dir, bool children) const;
+    Status removable(Node* node, bool dir) const;
+    struct Undo;
+    void undo(const Undo& step);
+    struct BatchEntry;
+    void applyGroup(Node* dir, const BatchEntry* first, const BatchEntry* last,
+                    const std::vector<BatchOp>& ops, std::vector<Status>& results);
+
+    // Handing a subtree to another FileSystem, for ShardedFileSystem's
+    // two-phase mv. Paths are taken from the root. A held node is pinned,
+    // so it and its ancestors cannot be removed until take or release.
+    Status holdNode(string_view path, Node*& node, bool& isDir);
+    void releaseNode(Node* node);
+    Node* takeNode(Node* node);
+    // room for a node moved into dirPath's directory by mv name dest,
+    // dest as tryMv() takes it ("" to keep name in dirPath itself)
+    Status reserveNode(string_view dirPath, string_view dest, string_view name, bool isDir, Node*& placeholder);
+    void fillReserved(Node* placeholder, Node* subtree);
+    void dropReserved(Node* placeholder);
+    friend class ShardedFileSystem;
 
 
 
@@ -60,35 +346,216 @@ public:
 	// parameterised constructor
 	FileSystem(const string& testinput);
 
+	// synthetic tree generated from spec
+	explicit FileSystem(const GenSpec& spec);
+
 	// destructor
 	~FileSystem();
 
 	// change directory
-	string cd(const string& path);
+	string cd(string_view path);
 
 	// list directory contents
 	[[nodiscard]] string ls() const;
 
-	// display subtree contents
+	// display subtree contents. The lines tree() renders for a directory's
+	// children are kept until that child list, or anything below it,
+	// changes; an unchanged subtree is then copied in instead of walked,
+	// with its indentation shifted if it is shown at another depth now.
 	[[nodiscard]] string tree() const;
 
+	// kept renderings are dropped once they take more than this many bytes
+	static const uint64_t kTreeCacheBytes = 64 << 20;
+
 	// print working directory
 	[[nodiscard]] string pwd() const;
 
 	// create new file
-	string touch(const string& name);
+	string touch(string_view name);
 
 	// create new directory
-	string mkdir(const string& name);
+	string mkdir(string_view name);
 
-	// remove file
-	string rm(const string& name);
+	// remove file, or with recursive a directory and everything below it
+	string rm(string_view name, bool recursive = false);
 
 	// remove directory
-	string rmdir(const string& name);
+	string rmdir(string_view name);
 
 	// move file/directory from src to dest
-	string mv(const string& src, const string& dest);
+	string mv(string_view src, string_view dest);
+
+	// Status API: same behaviour as the string methods above, but results
+	// are reported as a Status and never allocate. Listings are written
+	// into a caller owned buffer (cleared first) so it can be reused.
+	Status tryCd(string_view path);
+	void lsInto(string& out) const;
+	void treeInto(string& out) const;
+	// tree() that stops descending at limits.depth levels, and stops
+	// altogether after limits.maxNodes entries. A directory whose children
+	// are not shown is followed by "... N entries" one level in, and once
+	// the budget is spent every open directory ends with "... N more".
+	// N counts direct children, free for indexed (big) directories. With a
+	// path (as cd takes it, to a directory at or below the current one)
+	// only the entries below it are rendered, indented as in the tree of
+	// the current directory, so the result can replace its elision line.
+	Status treeInto(string& out, const TreeLimits& limits, string_view path = "") const;
+	void pwdInto(string& out) const;
+	// list at most limit entries of the current directory after cursor,
+	// formatted like ls(); costs O(log n + limit) in indexed directories
+	void lsPage(ListCursor& cursor, size_t limit, string& out) const;
+	// list the entries of the current directory whose name starts with prefix,
+	// formatted like ls(); stops at the first name past the prefix
+	void lsPrefix(string_view prefix, string& out) const;
+	// completion candidates for prefix in the current directory: up to limit
+	// names (formatted like ls()) go into candidates, and common receives the
+	// longest name prefix shared by every match (prefix itself if none).
+	// Returns the number of candidates written.
+	size_t complete(string_view prefix, size_t limit, string& candidates, string& common) const;
+	Status tryTouch(string_view name);
+	Status tryMkdir(string_view name);
+	// a name the caller no longer needs is moved into the new node; the
+	// const char* overloads keep literals from being ambiguous between the two
+	Status tryTouch(string&& name);
+	Status tryMkdir(string&& name);
+	Status tryTouch(const char* name);
+	Status tryMkdir(const char* name);
+	// recursive unlinks the subtree and leaves freeing it to the Reclaimer
+	Status tryRm(string_view name, bool recursive = false);
+	Status tryRmdir(string_view name);
+	Status tryMv(string_view src, string_view dest);
+
+	// copy src to dest with the same dest rules as mv; directories need recursive
+	string cp(string_view src, string_view dest, bool recursive = false);
+	Status tryCp(string_view src, string_view dest, bool recursive = false);
+
+	// Metadata lives in MetaTable, outside Node. Nodes made by touch/mkdir
+	// (also in batches and commits) get ctime and mtime; a directory's mtime
+	// follows changes to its child list. Nodes made in bulk (gen, import)
+	// start with default modes and no times, shown as 0 / "-". cp keeps
+	// the source's metadata, times included, like cp -p.
+	// tryStat() reports child name of the current directory ("." for itself).
+	Status tryStat(string_view name, NodeMeta& meta) const;
+	// set size, mode and owner of child name, its mtime becomes now
+	Status trySetMeta(string_view name, uint64_t size, uint32_t mode, uint32_t owner);
+	// like lsInto(), one "mode owner size mtime name" line per entry
+	void lsLongInto(string& out) const;
+
+	// Memory use is tracked per directory once the first tryMem() or
+	// setMemoryBudget() asks for it: a walk of the whole tree fills in
+	// every directory's usage, then each change to a child list adds or
+	// takes the child's usage along the path to the root. tryMem() reports
+	// path (a directory or a file, the current directory for "").
+	Status tryMem(string_view path, MemUsage& usage);
+	// with a budget, touch, mkdir, cp and import (also in batches and
+	// commits) fail with Status::MemoryBudgetExceeded rather than take the
+	// tree past it; 0 removes the budget
+	void setMemoryBudget(uint64_t bytes);
+	[[nodiscard]] uint64_t memoryBudget() const { return memoryBudget_; }
+
+	// Incremental checkpoints to a host directory, see CheckpointStore.
+	// Once a tree has a store every change to a child list marks the
+	// directory dirty and its ancestors as having something dirty below,
+	// the walk up stopping at the first one already marked. checkpoint()
+	// then visits only marked paths and writes one record per dirty (or
+	// new) directory as a new segment, so its I/O follows the changes,
+	// not the tree; nothing changed writes nothing. The first checkpoint,
+	// or the first to another directory, writes everything. Segments are
+	// compacted in the background. Only names and kinds are kept, not
+	// metadata. restore() replaces the whole tree with the newest
+	// checkpoint in storeDir and goes on checkpointing there; it fails
+	// with Status::DirectoryInUse while sessions or watches are open.
+	Status checkpoint(string_view storeDir, CheckpointReport& report);
+	Status restore(string_view storeDir);
+	// Paged mode, for images bigger than memory: restore() that starts
+	// with every directory a stub, its children left in the checkpoint
+	// until something looks at them (cd through it, ls, tree, or any
+	// lookup by name) and they are faulted in. Once faults take the tree
+	// past limit bytes (0 for no limit) a CLOCK sweep over the directories
+	// turns cold subtrees back into stubs, down to 7/8 of the limit:
+	// those not looked at since the hand last passed, with nothing changed
+	// in them (child lists or metadata) since they were faulted in, and
+	// holding neither the current directory, a session nor a watch. The
+	// sweep runs before the next cd, ls, tree or applyBatch, so one
+	// command may go past the limit.
+	// Memory accounting is on, tryMem() reports what is in memory.
+	// checkpoint() only writes to storeDir while stubs refer to it.
+	Status restorePaged(string_view storeDir, uint64_t limit);
+	// wait for a running compaction
+	void waitCompaction();
+	// live segments in the store, 0 without one
+	[[nodiscard]] size_t checkpointSegments() const;
+
+	// let cp -r clone subtrees of at least kParallelCloneNodes nodes on up
+	// to threads threads (1, the default, clones serially)
+	static const uint64_t kParallelCloneNodes = 1 << 18;
+	void setCloneThreads(unsigned threads);
+
+	// copy the host directory tree at hostPath into a new directory dest
+	// (its last component if dest is "") under the current one. Host
+	// directories are read with openat()/getdents64() by threads workers,
+	// each directory's entries sorted once and linked as one NodePool block.
+	// Symbolic links and other non-directories become files. The copy is
+	// linked in only when complete.
+	Status importHost(string_view hostPath, string_view dest, ImportReport& report, unsigned threads = 1);
+
+	// run ops and put each one's Status into results (same order and size).
+	// Gives the same tree and statuses as running them one by one, but
+	// every distinct directory is resolved once and the touch/mkdir/rm
+	// aimed at one directory are applied in name order, so they merge into
+	// the sibling list in a single pass. rmdir and mv run in place and end
+	// a group, since they can change what later paths resolve to.
+	void applyBatch(const std::vector<BatchOp>& ops, std::vector<Status>& results);
+
+	// Transactions apply a group of touch/mkdir/rm/rmdir/mv all or nothing.
+	// stage() only queues an op (paths as in BatchOp, from the current
+	// directory) and records the directories its path runs through;
+	// observe() records a read of the current directory (ls, cd). Each
+	// directory has a version that changes with its child list. commit()
+	// first checks every directory a path ran through still hangs where it
+	// did, and every directory whose children were read still has the
+	// version it was read at, failing with Status::TransactionConflict
+	// otherwise, then runs the ops in order. If one fails, those before it are undone and its
+	// Status is returned. Either way the transaction is closed. Reads see the
+	// tree itself, not the transaction's queued ops. Transactions on
+	// disjoint subtrees never conflict with each other.
+	void begin(Transaction& tx) const;
+	void stage(Transaction& tx, const BatchOp& op) const;
+	void observe(Transaction& tx) const;
+	Status commit(Transaction& tx);
+	void abort(Transaction& tx) const;
+
+	// Sessions let several clients share one FileSystem, each with its own
+	// working directory (the server runs one per connection). A session
+	// starts at / and is made current with enter() while its commands run,
+	// then leave() stores where it ended up. While a session is not entered
+	// its directory and every directory above it are pinned: rmdir and rm -r
+	// of them fail with Status::DirectoryInUse, mv just moves the pins along.
+	void openSession(Session& session);
+	void closeSession(Session& session);
+	void enter(Session& session);
+	void leave(Session& session);
+
+	// Watches report changes to directories as WatchEvents in a WatchRing
+	// the caller owns: create, delete, and a moved_from/moved_to pair for mv
+	// and renames. A watch sees changes to the child list of the directory
+	// at path (as cd takes it, "a/b" and ".." included), with recursive
+	// also those anywhere below it, each with its path relative to the
+	// watched directory. rm -r and cp -r report their top node only. Events
+	// are pushed while the change is made, so another thread can consume
+	// them as they happen. Watched directories are pinned like a session's.
+	// Several watches may feed one ring. With no watch open mutations pay
+	// a single branch.
+	Status watch(string_view path, bool recursive, WatchRing& ring);
+	// end every watch feeding ring; do so before the ring is destroyed
+	void unwatch(WatchRing& ring);
+
+	// walk the whole tree and check its structure: siblings strictly sorted
+	// with up to date keys, every parent_ pointing at the directory listing
+	// the node, files without children, no cycles, curr_ reachable from the
+	// root, and once memory is accounted every directory's usage matching a
+	// recount. Returns "" when all hold, otherwise the first violation.
+	[[nodiscard]] string checkInvariants() const;
 };
 
 #endif
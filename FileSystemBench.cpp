@@ -0,0 +1,1208 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <malloc.h>
+#include <dirent.h>
+#include <new>
+#include "Checkpoint.h"
+#include "CommandLine.h"
+#include "CompactFileSystem.h"
+#include "FileSystem.h"
+#include "MetaTable.h"
+#include "NodePool.h"
+#include "Reclaimer.h"
+#include "ShardedFileSystem.h"
+
+using namespace std;
+
+// Micro benchmarks for the emulator. Build with "make bench" (optimised)
+// and run under "perf stat -e cache-references,cache-misses" to see the
+// memory side of each mode, e.g.
+//   perf stat -e cache-misses ./FileSystemBench findchild 20000 48
+
+// Counts every heap allocation, for the modes that report allocations per call.
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+namespace {
+
+// Deterministic xorshift so every run sees the same names.
+struct Rng {
+	uint64_t s;
+	explicit Rng(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ull | 1) {}
+	uint64_t next() {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+	uint64_t below(uint64_t n) { return next() % n; }
+};
+
+string randomName(Rng& rng, int minLen, int maxLen) {
+	int len = minLen + static_cast<int>(rng.below(maxLen - minLen + 1));
+	string name(len, 'a');
+	for (char& c : name) c = static_cast<char>('a' + rng.below(26));
+	return name;
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Many small directories (plain sibling lists, below the index threshold)
+// and random lookups through findChild(), which is what touch() of an
+// existing name costs. Names are 16-32 bytes, so past the small string
+// buffer and stored on the heap like typical file names.
+void benchFindChild(int dirs, int children, int lookups) {
+	FileSystem fs;
+	vector<vector<string>> names(dirs);
+	Rng rng(1);
+	for (int d = 0; d < dirs; d++) {
+		string dir = "d" + to_string(d);
+		fs.tryMkdir(dir);
+		fs.tryCd(dir);
+		for (int c = 0; c < children; c++) {
+			string name = randomName(rng, 16, 32);
+			if (fs.tryTouch(name) == Status::Ok) names[d].push_back(name);
+		}
+		fs.tryCd("..");
+	}
+
+	// Visit directories in random order, a few lookups in each, so the
+	// working set (all directories) is far bigger than the cache.
+	const int perDir = 4;
+	double secs = 0;
+	uint64_t hits = 0;
+	for (int i = 0; i < lookups; i += perDir) {
+		int d = static_cast<int>(rng.below(dirs));
+		fs.tryCd("d" + to_string(d));
+		auto start = chrono::steady_clock::now();
+		for (int j = 0; j < perDir; j++) {
+			const string& name = names[d][rng.below(names[d].size())];
+			if (fs.tryTouch(name) == Status::AlreadyExists) hits++;
+		}
+		secs += secondsSince(start);
+		fs.tryCd("..");
+	}
+	printf("findchild: %d dirs x %d children, %d lookups, %.1f ns/lookup (%llu hits)\n",
+	       dirs, children, lookups, secs * 1e9 / lookups, (unsigned long long)hits);
+}
+
+// Bytes currently handed out by malloc, mmapped blocks (NodePool chunks) included.
+uint64_t heapInUse() {
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+// Depth first build of about `nodes` nodes, 16 children per directory,
+// one child in four a directory, at most 8 levels deep. Remembers a sample of (directory path,
+// child name) pairs for lookups. Works on either engine.
+template <typename FS>
+void buildTree(FS& fs, Rng& rng, uint64_t& remaining, vector<string>& path,
+               vector<pair<vector<string>, string>>& sample) {
+	vector<string> dirs;
+	for (int c = 0; c < 16 && remaining > 0; c++) {
+		string name = randomName(rng, 6, 20);
+		bool isDir = rng.below(4) == 0;
+		if ((isDir ? fs.tryMkdir(name) : fs.tryTouch(name)) != Status::Ok) continue;
+		remaining--;
+		if (isDir) dirs.push_back(name);
+		if (rng.below(64) == 0) sample.push_back(make_pair(path, name));
+	}
+	for (const string& dir : dirs) {
+		if (remaining == 0 || path.size() >= 8) break;
+		fs.tryCd(dir);
+		path.push_back(dir);
+		buildTree(fs, rng, remaining, path, sample);
+		path.pop_back();
+		fs.tryCd("..");
+	}
+}
+
+template <typename FS>
+void runEngine(const char* label, FS& fs, uint64_t nodes, uint64_t heapBefore) {
+	Rng rng(3);
+	uint64_t remaining = nodes;
+	vector<string> path;
+	vector<pair<vector<string>, string>> sample;
+	while (remaining > 0) {
+		// Keep adding top level directories until the budget is spent.
+		string top = "top" + to_string(nodes - remaining);
+		fs.tryMkdir(top);
+		remaining--;
+		fs.tryCd(top);
+		path.assign(1, top);
+		buildTree(fs, rng, remaining, path, sample);
+		fs.tryCd("/");
+	}
+	uint64_t heap = heapInUse() - heapBefore;
+
+	string out;
+	auto start = chrono::steady_clock::now();
+	fs.treeInto(out);
+	double treeSecs = secondsSince(start);
+
+	start = chrono::steady_clock::now();
+	uint64_t hits = 0;
+	for (const auto& entry : sample) {
+		fs.tryCd("/");
+		for (const string& dir : entry.first) fs.tryCd(dir);
+		if (fs.tryTouch(entry.second) == Status::AlreadyExists) hits++;
+	}
+	double lookupSecs = secondsSince(start);
+
+	printf("%-8s %llu nodes: %.1f bytes/node, tree() %.3f s (%zu bytes), %.1f ns/path lookup (%llu/%zu hits)\n",
+	       label, (unsigned long long)nodes, double(heap) / nodes, treeSecs, out.size(),
+	       lookupSecs * 1e9 / sample.size(), (unsigned long long)hits, sample.size());
+}
+
+// Same tree in the pointer engine and the struct-of-arrays engine.
+void benchCompact(uint64_t nodes) {
+	{
+		uint64_t before = heapInUse();
+		FileSystem fs;
+		runEngine("pointer", fs, nodes, before);
+	}
+	{
+		uint64_t before = heapInUse();
+		CompactFileSystem fs;
+		runEngine("compact", fs, nodes, before);
+	}
+}
+
+// Builds a directory "src" of about `nodes` nodes under the root of fs.
+void buildSubtree(FileSystem& fs, uint64_t nodes, uint64_t seed) {
+	Rng rng(seed);
+	uint64_t remaining = nodes - 1;
+	vector<string> path;
+	vector<pair<vector<string>, string>> sample;
+	fs.tryMkdir("src");
+	fs.tryCd("src");
+	while (remaining > 0) {
+		string top = "top" + to_string(remaining);
+		fs.tryMkdir(top);
+		remaining--;
+		fs.tryCd(top);
+		path.assign(1, top);
+		buildTree(fs, rng, remaining, path, sample);
+		fs.tryCd("..");
+	}
+	fs.tryCd("/");
+}
+
+// cp -r of one subtree of about `nodes` nodes: serial, then on every
+// thread count up to `threads`.
+void benchCp(uint64_t nodes, unsigned threads) {
+	FileSystem fs;
+	buildSubtree(fs, nodes, 4);
+
+	for (unsigned t = 1; t <= threads; t++) {
+		fs.setCloneThreads(t);
+		string dest = "copy" + to_string(t);
+		auto start = chrono::steady_clock::now();
+		Status status = fs.tryCp("src", dest, true);
+		double secs = secondsSince(start);
+		printf("cp -r %llu nodes, %u thread(s): %.3f s, %.1f M nodes/s%s\n",
+		       (unsigned long long)nodes, t, secs, nodes / secs / 1e6,
+		       status == Status::Ok ? "" : " (FAILED)");
+	}
+}
+
+// How long rm -r of a subtree of about `nodes` nodes keeps the caller
+// waiting, against freeing the same subtree in place.
+void benchRm(uint64_t nodes) {
+	{
+		FileSystem* fs = new FileSystem();
+		buildSubtree(*fs, nodes, 5);
+		auto start = chrono::steady_clock::now();
+		delete fs;
+		printf("rm -r %llu nodes, freed in place: %.3f s\n",
+		       (unsigned long long)nodes, secondsSince(start));
+	}
+	{
+		FileSystem fs;
+		// The first rm -r also starts the reclaimer thread, keep that out of the timing.
+		fs.tryMkdir("warmup");
+		fs.tryRm("warmup", true);
+		buildSubtree(fs, nodes, 5);
+		auto start = chrono::steady_clock::now();
+		Status status = fs.tryRm("src", true);
+		double secs = secondsSince(start);
+		start = chrono::steady_clock::now();
+		Reclaimer::drain();
+		printf("rm -r %llu nodes, reclaimed in background: %.1f us in rm, %.3f s until freed%s\n",
+		       (unsigned long long)nodes, secs * 1e6, secondsSince(start),
+		       status == Status::Ok ? "" : " (FAILED)");
+	}
+}
+
+// The generator against building a tree of the same size one touch/mkdir
+// at a time.
+void benchGen(uint64_t nodes) {
+	// Half the children are directories, so the cap is reached well before depth 12.
+	GenSpec spec;
+	spec.depth = 12;
+	spec.filePercent = 50;
+	spec.maxNodes = nodes;
+	uint64_t before = NodePool::slotsInUse();
+	auto start = chrono::steady_clock::now();
+	{
+		FileSystem fs(spec);
+		double secs = secondsSince(start);
+		uint64_t made = NodePool::slotsInUse() - before;
+		printf("gen %llu nodes: %.3f s, %.1f M nodes/s\n",
+		       (unsigned long long)made, secs, made / secs / 1e6);
+	}
+	{
+		FileSystem fs;
+		start = chrono::steady_clock::now();
+		buildSubtree(fs, nodes, 6);
+		double secs = secondsSince(start);
+		printf("touch/mkdir %llu nodes: %.3f s, %.1f M nodes/s\n",
+		       (unsigned long long)nodes, secs, nodes / secs / 1e6);
+	}
+
+	// One wide directory, where touch pays for keeping the siblings sorted.
+	uint64_t wide = nodes / 10;
+	spec.depth = 1;
+	spec.minFanout = spec.maxFanout = static_cast<unsigned>(wide);
+	spec.filePercent = 100;
+	spec.minNameLen = 6;
+	spec.maxNameLen = 20;
+	start = chrono::steady_clock::now();
+	{
+		FileSystem fs(spec);
+		printf("gen one directory of %llu: %.3f s\n", (unsigned long long)wide, secondsSince(start));
+	}
+	{
+		FileSystem fs;
+		Rng rng(7);
+		start = chrono::steady_clock::now();
+		for (uint64_t i = 0; i < wide; i++) fs.tryTouch(randomName(rng, 6, 20));
+		printf("touch one directory of %llu: %.3f s\n", (unsigned long long)wide, secondsSince(start));
+	}
+}
+
+// REPL parsing before this change: a stringstream per line, strings for
+// the command and four arguments, and a chain of string compares.
+Verb parseWithStream(const string& input, string& cmd, string* args) {
+	cmd = "";
+	for (int i = 0; i < 4; i++) args[i] = "";
+	stringstream ss(input);
+	ss >> cmd >> args[0] >> args[1] >> args[2] >> args[3];
+	if (cmd == "exit") return Verb::Exit;
+	else if (cmd == "cd") return Verb::Cd;
+	else if (cmd == "ls") return Verb::Ls;
+	else if (cmd == "pwd") return Verb::Pwd;
+	else if (cmd == "tree") return Verb::Tree;
+	else if (cmd == "touch") return Verb::Touch;
+	else if (cmd == "mkdir") return Verb::Mkdir;
+	else if (cmd == "rm") return Verb::Rm;
+	else if (cmd == "rmdir") return Verb::Rmdir;
+	else if (cmd == "mv") return Verb::Mv;
+	else if (cmd == "cp") return Verb::Cp;
+	else if (cmd == "complete") return Verb::Complete;
+	else if (cmd == "load") return Verb::Load;
+	else if (cmd == "gen") return Verb::Gen;
+	else if (cmd == "stats") return Verb::Stats;
+	else if (cmd == "trace") return Verb::Trace;
+	return Verb::Unknown;
+}
+
+// REPL parsing now: views into the line and a switch on the word; the
+// views go to FileSystem as they are.
+Verb parseWithViews(const string& input, string_view* words, string_view* args) {
+	size_t nwords = tokenize(input, words, kMaxTokens);
+	Verb verb = nwords > 0 ? verbFromName(words[0]) : Verb::Unknown;
+	for (size_t i = 0; i < 3; i++) {
+		args[i] = i + 1 < nwords ? words[i + 1] : string_view();
+	}
+	return verb;
+}
+
+// Replays a script through both parsers, as main() reads it: each line
+// copied into a reused buffer first, then parsed.
+void replayParse(const char* label, const vector<string>& script, uint64_t lines) {
+	string input, cmd, oldArgs[4];
+	string_view newArgs[3];
+	string_view words[kMaxTokens];
+	uint64_t checksum[2] = { 0, 0 };
+	double secs[2];
+	for (int parser = 0; parser < 2; parser++) {
+		auto start = chrono::steady_clock::now();
+		for (uint64_t i = 0; i < lines; i++) {
+			input.assign(script[i % script.size()]);
+			Verb verb = parser == 0 ? parseWithStream(input, cmd, oldArgs) : parseWithViews(input, words, newArgs);
+			checksum[parser] += static_cast<uint64_t>(verb) + (parser == 0 ? oldArgs[0].size() : newArgs[0].size());
+		}
+		secs[parser] = secondsSince(start);
+	}
+	printf("%-10s %9.1f %9.1f%s\n", label, secs[0] * 1e9 / lines, secs[1] * 1e9 / lines,
+	       checksum[0] == checksum[1] ? "" : " (MISMATCH)");
+}
+
+// Parse overhead per line for a replayed script, before and after the
+// string_view tokenizer: a mixed script of `lines` lines, then each
+// command on its own.
+void benchParse(uint64_t lines) {
+	const char* commands[] = { "cd", "ls", "pwd", "tree", "touch", "mkdir", "rm", "rmdir", "mv", "cp" };
+	Rng rng(8);
+	vector<string> mixed;
+	for (int i = 0; i < 4096; i++) {
+		const char* cmd = commands[rng.below(10)];
+		string line = cmd;
+		if (strcmp(cmd, "cp") == 0 && rng.below(2) == 0) line += " -r";
+		if (strcmp(cmd, "ls") != 0 && strcmp(cmd, "pwd") != 0 && strcmp(cmd, "tree") != 0) {
+			line += " " + randomName(rng, 4, 20);
+		}
+		if (strcmp(cmd, "mv") == 0 || strcmp(cmd, "cp") == 0) line += " " + randomName(rng, 4, 20);
+		mixed.push_back(line);
+	}
+
+	printf("%-10s %9s %9s\n", "script", "old_ns", "new_ns");
+	replayParse("mixed", mixed, lines);
+	for (const char* cmd : commands) {
+		vector<string> only;
+		for (const string& line : mixed) {
+			if (line.compare(0, line.find(' '), cmd) == 0) only.push_back(line);
+		}
+		replayParse(cmd, only, lines / 10);
+	}
+}
+
+// Commands whose names are slices of one big buffer, the way a log replayer
+// or the REPL tokenizer holds them: copying each slice into a std::string
+// first (all the old const string& API allowed) against passing the view.
+void benchViews(int names, int calls) {
+	FileSystem fs;
+	Rng rng(9);
+	string buffer;
+	vector<pair<size_t, size_t>> slices;
+	for (int i = 0; i < names; i++) {
+		string name = randomName(rng, 16, 32); // past the small string buffer
+		slices.push_back(make_pair(buffer.size(), name.size()));
+		buffer += name + " ";
+	}
+	string_view all(buffer);
+	for (auto& slice : slices) fs.tryTouch(all.substr(slice.first, slice.second));
+
+	printf("%-22s %10s %12s\n", "touch existing", "ns/call", "allocs/call");
+	for (int mode = 0; mode < 2; mode++) {
+		uint64_t before = allocations.load();
+		auto start = chrono::steady_clock::now();
+		uint64_t exists = 0;
+		for (int i = 0; i < calls; i++) {
+			auto& slice = slices[rng.below(slices.size())];
+			string_view name = all.substr(slice.first, slice.second);
+			Status status = mode == 0 ? fs.tryTouch(string(name)) : fs.tryTouch(name);
+			if (status == Status::AlreadyExists) exists++;
+		}
+		double secs = secondsSince(start);
+		printf("%-22s %10.1f %12.2f%s\n", mode == 0 ? "string copy per call" : "string_view",
+		       secs * 1e9 / calls, double(allocations.load() - before) / calls,
+		       exists == uint64_t(calls) ? "" : " (MISMATCH)");
+	}
+
+	// New names: one allocation either way, the node's own copy (moved in from
+	// an rvalue string, copied once from a view).
+	for (int mode = 0; mode < 2; mode++) {
+		fs.tryCd("/");
+		string dir = "new" + to_string(mode);
+		fs.tryMkdir(dir);
+		fs.tryCd(dir);
+		uint64_t before = allocations.load();
+		for (int i = 0; i < names; i++) {
+			string_view name = all.substr(slices[i].first, slices[i].second);
+			if (mode == 0) fs.tryTouch(string(name));
+			else fs.tryTouch(name);
+		}
+		printf("%-22s %10s %12.2f\n", mode == 0 ? "new, moved string" : "new, string_view", "",
+		       double(allocations.load() - before) / names);
+	}
+}
+
+// Scripts of touch/rm spread over dirs directories two levels down, run one
+// command at a time (cd along the path, command, cd back) against
+// applyBatch() in batches of batchSize.
+void benchBatch(int ops, int dirs, int batchSize) {
+	Rng rng(12);
+	vector<BatchOp> script;
+	for (int i = 0; i < ops; i++) {
+		BatchOp op;
+		op.kind = rng.below(3) == 0 ? BatchOp::Kind::Rm : BatchOp::Kind::Touch;
+		op.path = "/p" + to_string(rng.below(dirs)) + "/q/n" + to_string(rng.below(200));
+		script.push_back(op);
+	}
+	FileSystem serial, batched;
+	for (FileSystem* fs : { &serial, &batched }) {
+		for (int d = 0; d < dirs; d++) {
+			string dir = "p" + to_string(d);
+			fs->tryMkdir(dir);
+			fs->tryCd(dir);
+			fs->tryMkdir("q");
+			fs->tryCd("/");
+		}
+	}
+
+	uint64_t okSerial = 0, okBatched = 0;
+	auto start = chrono::steady_clock::now();
+	for (const BatchOp& op : script) {
+		string_view path = op.path;
+		size_t pos = 1, slash;
+		serial.tryCd("/");
+		while ((slash = path.find('/', pos)) != string_view::npos) {
+			serial.tryCd(path.substr(pos, slash - pos));
+			pos = slash + 1;
+		}
+		string_view name = path.substr(pos);
+		Status status = op.kind == BatchOp::Kind::Rm ? serial.tryRm(name) : serial.tryTouch(name);
+		if (status == Status::Ok) okSerial++;
+		serial.tryCd("/");
+	}
+	double serialSecs = secondsSince(start);
+
+	vector<vector<BatchOp>> batches;
+	for (size_t first = 0; first < script.size(); first += batchSize) {
+		size_t last = min(script.size(), first + batchSize);
+		batches.emplace_back(script.begin() + first, script.begin() + last);
+	}
+	vector<Status> results;
+	start = chrono::steady_clock::now();
+	for (const vector<BatchOp>& batch : batches) {
+		batched.applyBatch(batch, results);
+		for (Status status : results) if (status == Status::Ok) okBatched++;
+	}
+	double batchSecs = secondsSince(start);
+
+	bool same = okSerial == okBatched && serial.tree() == batched.tree();
+	printf("%d ops over %d dirs, batches of %d\n", ops, dirs, batchSize);
+	printf("one by one: %.3f s, %.1f ns/op\n", serialSecs, serialSecs * 1e9 / ops);
+	printf("applyBatch: %.3f s, %.1f ns/op%s\n", batchSecs,
+	       batchSecs * 1e9 / ops, same ? "" : " (MISMATCH)");
+}
+
+// Transactions of three ops (touch, mkdir, mv the file into the new
+// directory), open inFlight at a time before they commit: against running
+// the ops directly, with every transaction in its own directory (all
+// commit), and with all of them in one directory (all but one conflict).
+void benchTxn(int txns, int inFlight) {
+	auto stageOne = [](FileSystem& fs, Transaction& tx, const string& dir, int i) {
+		string f = dir + "/f" + to_string(i), sub = "s" + to_string(i);
+		fs.begin(tx);
+		fs.stage(tx, BatchOp{BatchOp::Kind::Touch, f, ""});
+		fs.stage(tx, BatchOp{BatchOp::Kind::Mkdir, dir + "/" + sub, ""});
+		fs.stage(tx, BatchOp{BatchOp::Kind::Mv, f, sub});
+	};
+	auto setup = [&](FileSystem& fs) {
+		for (int d = 0; d < inFlight; d++) fs.tryMkdir("d" + to_string(d));
+	};
+
+	{
+		FileSystem fs;
+		setup(fs);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < txns; i++) {
+			fs.tryCd("d" + to_string(i % inFlight));
+			string f = "f" + to_string(i), sub = "s" + to_string(i);
+			fs.tryTouch(f);
+			fs.tryMkdir(sub);
+			fs.tryMv(f, sub);
+			fs.tryCd("/");
+		}
+		double secs = secondsSince(start);
+		printf("%-26s %10.1f ns/group\n", "direct", secs * 1e9 / txns);
+	}
+	for (int shared = 0; shared < 2; shared++) {
+		FileSystem fs;
+		setup(fs);
+		vector<Transaction> open(inFlight);
+		uint64_t committed = 0, conflicts = 0;
+		auto start = chrono::steady_clock::now();
+		for (int first = 0; first < txns; first += inFlight) {
+			int n = min(inFlight, txns - first);
+			for (int k = 0; k < n; k++) {
+				stageOne(fs, open[k], "d" + to_string(shared ? 0 : k), first + k);
+			}
+			for (int k = 0; k < n; k++) {
+				Status status = fs.commit(open[k]);
+				if (status == Status::Ok) committed++;
+				else if (status == Status::TransactionConflict) conflicts++;
+			}
+		}
+		double secs = secondsSince(start);
+		printf("%-26s %10.1f ns/txn  %llu committed, %llu conflicts\n",
+		       shared ? "transactions, one dir" : "transactions, own dirs", secs * 1e9 / txns,
+		       (unsigned long long)committed, (unsigned long long)conflicts);
+	}
+}
+
+// Keeping a mirror of one directory of files entries up to date while
+// changes touch/rm ops hit it per round: polling with ls and diffing the
+// listing against the last one, against draining a watch's events. Then
+// what the ops cost with no watch, and with a watch drained by another thread.
+void benchWatch(int files, int rounds, int changes) {
+	auto fill = [&](FileSystem& fs) {
+		for (int i = 0; i < files; i++) fs.tryTouch("f" + to_string(i));
+	};
+	// Round r touches or removes changes names, never the same one twice in a row.
+	auto change = [&](FileSystem& fs, int r, int k) {
+		string name = "f" + to_string((r * 7919 + k * 104729) % files);
+		if (fs.tryRm(name) != Status::Ok) fs.tryTouch(name);
+	};
+
+	{
+		FileSystem fs;
+		fill(fs);
+		string last, now;
+		fs.lsInto(last);
+		uint64_t differing = 0;
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			for (int k = 0; k < changes; k++) change(fs, r, k);
+			fs.lsInto(now);
+			if (now != last) differing++;
+			swap(now, last);
+		}
+		double secs = secondsSince(start);
+		printf("%-28s %10.1f us/round (%llu rounds changed)\n", "poll: ls and compare",
+		       secs * 1e6 / rounds, (unsigned long long)differing);
+	}
+	{
+		FileSystem fs;
+		fill(fs);
+		WatchRing ring(1 << 16);
+		fs.watch(".", false, ring);
+		uint64_t events = 0;
+		WatchEvent event;
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			for (int k = 0; k < changes; k++) change(fs, r, k);
+			while (ring.pop(event)) events++;
+		}
+		double secs = secondsSince(start);
+		printf("%-28s %10.1f us/round (%llu events)\n", "watch: drain events",
+		       secs * 1e6 / rounds, (unsigned long long)events);
+		fs.unwatch(ring);
+	}
+
+	uint64_t ops = static_cast<uint64_t>(rounds) * changes;
+	for (int watched = 0; watched < 2; watched++) {
+		FileSystem fs;
+		fill(fs);
+		WatchRing ring(1 << 12);
+		atomic<bool> done(false);
+		uint64_t events = 0;
+		thread consumer;
+		if (watched) {
+			fs.watch(".", false, ring);
+			consumer = thread([&] {
+				WatchEvent event;
+				while (!done.load(memory_order_relaxed)) {
+					while (ring.pop(event)) events++;
+					this_thread::yield();
+				}
+				while (ring.pop(event)) events++;
+			});
+		}
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++) {
+			for (int k = 0; k < changes; k++) change(fs, r, k);
+		}
+		double secs = secondsSince(start);
+		done = true;
+		if (watched) consumer.join();
+		printf("%-28s %10.1f ns/op", watched ? "ops, watched (other thread)" : "ops, no watch", secs * 1e9 / ops);
+		if (watched) printf("  %llu events, %llu dropped", (unsigned long long)events, (unsigned long long)ring.dropped());
+		printf("\n");
+		if (watched) fs.unwatch(ring);
+	}
+}
+
+// Importing a host tree: readdir() with a touch/mkdir per entry, against
+// importHost() with 1, 2, 4 ... up to threads workers.
+void benchImport(const char* hostPath, int threads) {
+	{
+		FileSystem fs;
+		uint64_t entries = 0;
+		// cd into each directory as it is made, like a user would.
+		std::function<void(const string&)> walk = [&](const string& path) {
+			DIR* dir = opendir(path.c_str());
+			if (dir == nullptr) return;
+			while (dirent* entry = readdir(dir)) {
+				string_view name = entry->d_name;
+				if (name == "." || name == "..") continue;
+				entries++;
+				if (entry->d_type == DT_DIR) {
+					fs.tryMkdir(name);
+					fs.tryCd(name);
+					walk(path + "/" + string(name));
+					fs.tryCd("..");
+				} else {
+					fs.tryTouch(name);
+				}
+			}
+			closedir(dir);
+		};
+		auto start = chrono::steady_clock::now();
+		fs.tryMkdir("t");
+		fs.tryCd("t");
+		walk(hostPath);
+		double secs = secondsSince(start);
+		printf("%-24s %10llu entries %8.3f s %12.0f entries/s\n", "readdir + touch/mkdir",
+		       (unsigned long long)entries, secs, entries / secs);
+	}
+	for (int t = 1; t <= threads; t *= 2) {
+		FileSystem fs;
+		ImportReport report;
+		if (fs.importHost(hostPath, "t", report, t) != Status::Ok) {
+			printf("cannot read %s\n", hostPath);
+			return;
+		}
+		char label[32];
+		snprintf(label, sizeof(label), "importHost, %d thread%s", t, t == 1 ? "" : "s");
+		printf("%-24s %10llu entries %8.3f s %12.0f entries/s %6.1f bytes/entry\n", label,
+		       (unsigned long long)report.entries, report.seconds, report.entries / report.seconds,
+		       static_cast<double>(report.bytes) / (report.entries + 1));
+	}
+}
+
+// The hot walks, tree() and findChild lookups, on a generated tree whose
+// nodes have no metadata, then again once every node has a MetaTable row.
+// Node itself is the same size either way.
+void benchMeta(int nodes, int lookups) {
+	GenSpec spec;
+	spec.depth = 8;
+	spec.minFanout = 8;
+	spec.maxFanout = 48;
+	spec.maxNodes = nodes;
+	uint64_t before = NodePool::slotsInUse();
+	FileSystem fs(spec);
+	nodes = static_cast<int>(NodePool::slotsInUse() - before);
+
+	// Names in each directory of the first level, for lookups.
+	string listing;
+	fs.lsInto(listing);
+	vector<string> dirs;
+	vector<vector<string>> names;
+	istringstream top(listing);
+	for (string line; getline(top, line);) {
+		if (line.back() != '/') continue;
+		line.pop_back();
+		fs.tryCd(line);
+		fs.lsInto(listing);
+		vector<string> inside;
+		istringstream below(listing);
+		for (string name; getline(below, name);) {
+			if (name.back() == '/') name.pop_back();
+			inside.push_back(name);
+		}
+		fs.tryCd("..");
+		if (inside.empty()) continue;
+		dirs.push_back(line);
+		names.push_back(inside);
+	}
+
+	auto measure = [&](const char* label) {
+		string out;
+		double best = 1e9;
+		for (int rep = 0; rep < 3; rep++) {
+			auto start = chrono::steady_clock::now();
+			fs.treeInto(out);
+			best = min(best, secondsSince(start));
+		}
+		Rng rng(3);
+		double secs = 0;
+		uint64_t hits = 0;
+		for (int i = 0; i < lookups; i += 4) {
+			size_t d = rng.below(dirs.size());
+			fs.tryCd(dirs[d]);
+			auto start = chrono::steady_clock::now();
+			for (int j = 0; j < 4; j++) {
+				if (fs.tryTouch(names[d][rng.below(names[d].size())]) == Status::AlreadyExists) hits++;
+			}
+			secs += secondsSince(start);
+			fs.tryCd("..");
+		}
+		printf("%-24s tree %8.1f ns/node   findchild %8.1f ns/lookup (%llu hits)\n", label,
+		       best * 1e9 / nodes, secs * 1e9 / lookups, (unsigned long long)hits);
+	};
+
+	printf("sizeof(Node) %zu, %d nodes\n", sizeof(Node), nodes);
+	measure("no metadata");
+
+	// Give every node a row, depth first through the public API.
+	function<void()> stamp = [&]() {
+		string here;
+		fs.lsInto(here);
+		istringstream entries(here);
+		for (string name; getline(entries, name);) {
+			bool isDir = name.back() == '/';
+			if (isDir) name.pop_back();
+			fs.trySetMeta(name, name.size(), isDir ? 0750 : 0640, 1000);
+			if (isDir) {
+				fs.tryCd(name);
+				stamp();
+				fs.tryCd("..");
+			}
+		}
+	};
+	stamp();
+	measure("metadata on every node");
+	printf("metadata rows %llu, %.1f MB of columns\n", (unsigned long long)MetaTable::rowsInUse(),
+	       MetaTable::reservedBytes() / 1e6);
+}
+
+// tree() at the root with the renderings memoized: the first call walks,
+// repeats copy, and after a touch deep down only the directories on the
+// path to it are walked again. A full walk each time (treeInto() with no
+// limits) is the baseline.
+void benchTreeCache(int nodes, int rounds) {
+	GenSpec spec;
+	spec.depth = 8;
+	spec.minFanout = 8;
+	spec.maxFanout = 48;
+	spec.filePercent = 50;
+	spec.maxNodes = nodes;
+	uint64_t before = NodePool::slotsInUse();
+	FileSystem fs(spec);
+	nodes = static_cast<int>(NodePool::slotsInUse() - before);
+
+	// The deepest directory the first entries lead to, as cd steps.
+	vector<string> deep;
+	string listing;
+	while (true) {
+		fs.lsInto(listing);
+		istringstream entries(listing);
+		string next;
+		for (string name; getline(entries, name);) {
+			if (name.back() == '/') {
+				name.pop_back();
+				next = name;
+				break;
+			}
+		}
+		if (next.empty()) break;
+		fs.tryCd(next);
+		deep.push_back(next);
+	}
+	fs.tryCd("/");
+
+	string out;
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) fs.treeInto(out, TreeLimits());
+	double walkSecs = secondsSince(start) / rounds;
+
+	start = chrono::steady_clock::now();
+	fs.treeInto(out);
+	double coldSecs = secondsSince(start);
+
+	start = chrono::steady_clock::now();
+	for (int i = 0; i < rounds; i++) fs.treeInto(out);
+	double warmSecs = secondsSince(start) / rounds;
+
+	double dirtySecs = 0;
+	for (int i = 0; i < rounds; i++) {
+		for (const string& dir : deep) fs.tryCd(dir);
+		fs.tryTouch("bench" + to_string(i));
+		fs.tryCd("/");
+		start = chrono::steady_clock::now();
+		fs.treeInto(out);
+		dirtySecs += secondsSince(start);
+	}
+	dirtySecs /= rounds;
+
+	printf("%d nodes, %zu bytes of output, touches %zu levels down\n", nodes, out.size(), deep.size());
+	printf("%-28s %10.3f ms\n", "full walk", walkSecs * 1e3);
+	printf("%-28s %10.3f ms\n", "memoized, first call", coldSecs * 1e3);
+	printf("%-28s %10.3f ms\n", "memoized, unchanged", warmSecs * 1e3);
+	printf("%-28s %10.3f ms\n", "memoized, after deep touch", dirtySecs * 1e3);
+}
+
+// Memory accounting: the walk that starts it on a generated tree, what it
+// reports against the heap the tree really took, and touch/rm at depth
+// with and without it (each change then walks up to the root).
+void benchMem(int nodes, int ops) {
+	GenSpec spec;
+	spec.depth = 8;
+	spec.minFanout = 8;
+	spec.maxFanout = 48;
+	spec.maxNodes = nodes;
+	uint64_t heapBefore = heapInUse();
+	FileSystem fs(spec);
+	uint64_t heap = heapInUse() - heapBefore;
+
+	// Down the first directories to the bottom.
+	int depth = 0;
+	string listing;
+	for (bool found = true; found;) {
+		found = false;
+		fs.lsInto(listing);
+		istringstream entries(listing);
+		for (string name; getline(entries, name);) {
+			if (name.back() != '/') continue;
+			name.pop_back();
+			fs.tryCd(name);
+			depth++;
+			found = true;
+			break;
+		}
+	}
+
+	auto churn = [&](const char* label) {
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < ops; i++) {
+			string name = "m" + to_string(i % 64);
+			if (i / 64 % 2 == 0) fs.tryTouch(name);
+			else fs.tryRm(name);
+		}
+		printf("%-28s %10.1f ns/op\n", label, secondsSince(start) * 1e9 / ops);
+	};
+	churn("touch/rm, not accounted");
+
+	uint64_t heapRows = heapInUse();
+	auto start = chrono::steady_clock::now();
+	MemUsage usage;
+	fs.tryMem("/", usage);
+	double walkSecs = secondsSince(start);
+	heap += heapInUse() - heapRows; // new MetaTable pages
+	printf("start accounting %llu nodes: %.3f s\n", (unsigned long long)usage.nodes, walkSecs);
+	printf("tracked %llu bytes, heap grew %llu bytes\n",
+	       (unsigned long long)usage.bytes, (unsigned long long)heap);
+	char label[40];
+	snprintf(label, sizeof(label), "touch/rm, accounted, depth %d", depth);
+	churn(label);
+	fs.setMemoryBudget(usage.bytes * 2);
+	churn("touch/rm, with a budget");
+	string broken = fs.checkInvariants();
+	if (broken != "") printf("usage out of step: %s\n", broken.c_str());
+}
+
+// Sharded mode: clients keep a window of touch/rm in flight, each on its
+// own top-level directories, against 1, 2, 4 ... shards. The baseline is
+// one FileSystem applying the same ops in batches of the window size on
+// one thread. Then the round trip of a mv that crosses shards.
+void benchShard(int ops, int maxShards, int clients) {
+	const int kDirs = 64;   // top-level directories per client
+	const int kWindow = 64; // ops in flight per client
+	auto opAt = [](int client, int i, BatchOp& op) {
+		int dir = i % kDirs, file = i / kDirs % 128;
+		op.kind = i / (kDirs * 128) % 2 == 0 ? BatchOp::Kind::Touch : BatchOp::Kind::Rm;
+		op.path = "/c" + to_string(client) + "_" + to_string(dir) + "/f" + to_string(file);
+	};
+
+	{
+		FileSystem fs;
+		for (int c = 0; c < clients; c++) {
+			for (int d = 0; d < kDirs; d++) fs.tryMkdir("c" + to_string(c) + "_" + to_string(d));
+		}
+		std::vector<BatchOp> batch(kWindow);
+		std::vector<Status> results;
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < ops; i += kWindow) {
+			for (int k = 0; k < kWindow; k++) opAt((i + k) % clients, (i + k) / clients, batch[k]);
+			fs.applyBatch(batch, results);
+		}
+		double secs = secondsSince(start);
+		printf("%-22s %10.2f Mops/s\n", "one FileSystem", ops / secs / 1e6);
+	}
+
+	for (int shards = 1; shards <= maxShards; shards *= 2) {
+		ShardedFileSystem sharded(shards, clients);
+		for (int c = 0; c < clients; c++) {
+			for (int d = 0; d < kDirs; d++) {
+				ShardOp op;
+				op.kind = ShardOp::Kind::Mkdir;
+				op.path = "/c" + to_string(c) + "_" + to_string(d);
+				sharded.run(c, op);
+			}
+		}
+		auto start = chrono::steady_clock::now();
+		std::vector<thread> threads;
+		for (int c = 0; c < clients; c++) {
+			threads.emplace_back([&sharded, &opAt, ops, clients, c]() {
+				std::vector<ShardOp> window(kWindow);
+				BatchOp op;
+				for (int i = 0; i < ops / clients; i += kWindow) {
+					for (int k = 0; k < kWindow; k++) {
+						opAt(c, i + k, op);
+						window[k].kind = op.kind == BatchOp::Kind::Touch ? ShardOp::Kind::Touch : ShardOp::Kind::Rm;
+						window[k].path = op.path;
+						sharded.submit(c, window[k]);
+					}
+					for (int k = 0; k < kWindow; k++) sharded.wait(window[k]);
+				}
+			});
+		}
+		for (thread& t : threads) t.join();
+		double secs = secondsSince(start);
+		char label[40];
+		snprintf(label, sizeof(label), "%d shard%s, %d client%s", shards, shards == 1 ? "" : "s",
+		         clients, clients == 1 ? "" : "s");
+		printf("%-22s %10.2f Mops/s\n", label, ops / secs / 1e6);
+
+		// Renames of one directory to names on other shards.
+		if (shards == 1) continue;
+		const int moves = 2000;
+		string name = "c0_0";
+		start = chrono::steady_clock::now();
+		int crossed = 0;
+		for (int i = 0; i < moves; i++) {
+			string next = "m" + to_string(i);
+			crossed += sharded.shardOf(next) != sharded.shardOf(name);
+			ShardOp op;
+			op.kind = ShardOp::Kind::Mv;
+			op.path = "/" + name;
+			op.dest = next;
+			sharded.run(0, op);
+			name = next;
+		}
+		printf("%-22s %10.2f us/mv, %d of %d across shards\n", "  mv of a top-level dir",
+		       secondsSince(start) * 1e6 / moves, crossed, moves);
+		string broken = sharded.checkInvariants();
+		if (broken != "") printf("invariants broken: %s\n", broken.c_str());
+	}
+	printf("(%u hardware threads)\n", thread::hardware_concurrency());
+}
+
+// Paths (from the root, each starting with /) of up to max directories
+// of fs, breadth first; fs is left at /.
+std::vector<string> someDirs(FileSystem& fs, size_t max) {
+	std::vector<string> dirs(1, "");
+	string listing;
+	for (size_t i = 0; i < dirs.size() && dirs.size() < max; i++) {
+		fs.tryCd("/");
+		for (size_t pos = 1; pos < dirs[i].size();) {
+			size_t slash = min(dirs[i].find('/', pos), dirs[i].size());
+			fs.tryCd(dirs[i].substr(pos, slash - pos));
+			pos = slash + 1;
+		}
+		fs.lsInto(listing);
+		istringstream entries(listing);
+		for (string name; getline(entries, name);) {
+			if (name.back() == '/') dirs.push_back(dirs[i] + "/" + name.substr(0, name.size() - 1));
+		}
+	}
+	fs.tryCd("/");
+	return dirs;
+}
+
+// Checkpoints of a generated tree: the first one, which writes it all,
+// then incremental ones after a growing number of touches spread over
+// random directories, then restore and compaction.
+void benchCheckpoint(int nodes, int changes) {
+	char base[] = "/tmp/fsbenchXXXXXX";
+	if (mkdtemp(base) == nullptr) {
+		printf("mkdtemp failed\n");
+		return;
+	}
+	string store = string(base) + "/store";
+	GenSpec spec;
+	spec.depth = 8;
+	spec.minFanout = 8;
+	spec.maxFanout = 48;
+	spec.maxNodes = nodes;
+	FileSystem fs(spec);
+
+	std::vector<string> dirs = someDirs(fs, 4096);
+
+	CheckpointReport report;
+	Status status = fs.checkpoint(store, report);
+	printf("%-26s %9llu dirs %12llu bytes %10.3f s%s\n", "full", (unsigned long long)report.directories,
+	       (unsigned long long)report.bytes, report.seconds, status == Status::Ok ? "" : " (FAILED)");
+	uint64_t rng = 42;
+	std::vector<BatchOp> ops;
+	std::vector<Status> results;
+	for (int touches = 10; touches <= changes; touches *= 10) {
+		ops.clear();
+		for (int i = 0; i < touches; i++) {
+			rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+			ops.push_back(BatchOp{BatchOp::Kind::Touch, dirs[(rng >> 33) % dirs.size()] + "/t" + to_string(touches) + "_" + to_string(i), ""});
+		}
+		fs.applyBatch(ops, results);
+		status = fs.checkpoint(store, report);
+		char label[40];
+		snprintf(label, sizeof(label), "after %d touches", touches);
+		printf("%-26s %9llu dirs %12llu bytes %10.3f s%s\n", label, (unsigned long long)report.directories,
+		       (unsigned long long)report.bytes, report.seconds, status == Status::Ok ? "" : " (FAILED)");
+	}
+
+	auto start = chrono::steady_clock::now();
+	{
+		FileSystem copy;
+		status = copy.restore(store);
+		printf("restore: %.3f s%s\n", secondsSince(start), status == Status::Ok && copy.tree() == fs.tree() ? "" : " (DIFFERS)");
+	}
+	// Enough small checkpoints to start a compaction.
+	start = chrono::steady_clock::now();
+	for (size_t i = 0; i < CheckpointStore::kCompactAfter; i++) {
+		fs.tryTouch("c" + to_string(i));
+		(void)fs.checkpoint(store, report);
+	}
+	fs.waitCompaction();
+	printf("%zu checkpoints and a compaction: %.3f s, %zu segments live\n", CheckpointStore::kCompactAfter,
+	       secondsSince(start), fs.checkpointSegments());
+	string cleanup = string("rm -rf ") + base;
+	if (system(cleanup.c_str()) != 0) printf("cleanup of %s failed\n", base);
+}
+
+// a Stats counter, as the stats command shows it
+uint64_t statsCounter(const string& name) {
+	string all = Stats::report();
+	size_t at = all.find("\n" + name + ": ");
+	return at == string::npos ? 0 : stoull(all.substr(at + name.size() + 3));
+}
+
+// Paged mode over the checkpoint of a generated tree: ops walks from the
+// root to a directory and ls there, nine in ten of them into a hot tenth
+// of the directories, with no limit and with the tree held to a half and
+// an eighth of its full size.
+void benchPage(int nodes, int ops) {
+	char base[] = "/tmp/fsbenchXXXXXX";
+	if (mkdtemp(base) == nullptr) {
+		printf("mkdtemp failed\n");
+		return;
+	}
+	string store = string(base) + "/store";
+	std::vector<string> dirs;
+	uint64_t fullBytes;
+	{
+		GenSpec spec;
+		spec.depth = 8;
+		spec.minFanout = 8;
+		spec.maxFanout = 48;
+		spec.maxNodes = nodes;
+		FileSystem fs(spec);
+		dirs = someDirs(fs, 1 << 16);
+		CheckpointReport report;
+		if (fs.checkpoint(store, report) != Status::Ok) {
+			printf("checkpoint failed\n");
+			return;
+		}
+		MemUsage usage;
+		fs.tryMem("/", usage);
+		fullBytes = usage.bytes;
+	}
+	auto start = chrono::steady_clock::now();
+	{
+		FileSystem fs;
+		(void)fs.restore(store);
+		printf("full restore: %.3f s, %llu bytes\n", secondsSince(start), (unsigned long long)fullBytes);
+	}
+
+	printf("%-10s %10s %10s %10s %9s %10s %14s %8s\n", "limit", "open_s", "faults", "hits", "hit_rate",
+	       "evictions", "resident_bytes", "us/op");
+	string listing;
+	for (uint64_t limit : {uint64_t(0), fullBytes / 2, fullBytes / 8}) {
+		FileSystem fs;
+		start = chrono::steady_clock::now();
+		(void)fs.restorePaged(store, limit);
+		double open = secondsSince(start);
+		Stats::reset();
+		uint64_t rng = 7;
+		size_t hot = dirs.size() / 10 + 1;
+		start = chrono::steady_clock::now();
+		for (int i = 0; i < ops; i++) {
+			rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+			uint64_t pick = rng >> 33;
+			const string& path = dirs[pick % 10 != 0 ? (pick / 10) % hot : (pick / 10) % dirs.size()];
+			fs.tryCd("/");
+			for (size_t pos = 1; pos < path.size();) {
+				size_t slash = min(path.find('/', pos), path.size());
+				fs.tryCd(string_view(path).substr(pos, slash - pos));
+				pos = slash + 1;
+			}
+			fs.lsInto(listing);
+		}
+		double seconds = secondsSince(start);
+		MemUsage usage;
+		fs.tryMem("/", usage);
+		uint64_t faults = statsCounter("page_faults"), hits = statsCounter("page_hits");
+		char label[24];
+		snprintf(label, sizeof(label), "%llu", (unsigned long long)limit);
+		printf("%-10s %10.3f %10llu %10llu %9.4f %10llu %14llu %8.2f\n", limit == 0 ? "none" : label, open,
+		       (unsigned long long)faults, (unsigned long long)hits,
+		       faults + hits != 0 ? static_cast<double>(hits) / static_cast<double>(faults + hits) : 0.0,
+		       (unsigned long long)statsCounter("page_evictions"), (unsigned long long)usage.bytes,
+		       seconds * 1e6 / ops);
+	}
+	string cleanup = string("rm -rf ") + base;
+	if (system(cleanup.c_str()) != 0) printf("cleanup of %s failed\n", base);
+}
+
+void usage() {
+	printf("usage: FileSystemBench findchild [dirs] [children] [lookups]\n"
+	       "       FileSystemBench compact [nodes]\n"
+	       "       FileSystemBench cp [nodes] [threads]\n"
+	       "       FileSystemBench rm [nodes]\n"
+	       "       FileSystemBench gen [nodes]\n"
+	       "       FileSystemBench parse [lines]\n"
+	       "       FileSystemBench views [names] [calls]\n"
+	       "       FileSystemBench batch [ops] [dirs] [batch size]\n"
+	       "       FileSystemBench txn [txns] [in flight]\n"
+	       "       FileSystemBench watch [files] [rounds] [changes]\n"
+	       "       FileSystemBench import <hostpath> [threads]\n"
+	       "       FileSystemBench meta [nodes] [lookups]\n"
+	       "       FileSystemBench treecache [nodes] [rounds]\n"
+	       "       FileSystemBench mem [nodes] [ops]\n"
+	       "       FileSystemBench shard [ops] [max shards] [clients]\n"
+	       "       FileSystemBench checkpoint [nodes] [changes]\n"
+	       "       FileSystemBench page [nodes] [ops]\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+	auto arg = [&](int i, int def) { return argc > i ? atoi(argv[i]) : def; };
+
+	if (strcmp(argv[1], "findchild") == 0) benchFindChild(arg(2, 20000), arg(3, 48), arg(4, 2000000));
+	else if (strcmp(argv[1], "compact") == 0) benchCompact(arg(2, 1000000));
+	else if (strcmp(argv[1], "cp") == 0) benchCp(arg(2, 1000000), arg(3, 4));
+	else if (strcmp(argv[1], "rm") == 0) benchRm(arg(2, 1000000));
+	else if (strcmp(argv[1], "gen") == 0) benchGen(arg(2, 1000000));
+	else if (strcmp(argv[1], "parse") == 0) benchParse(arg(2, 10000000));
+	else if (strcmp(argv[1], "views") == 0) benchViews(arg(2, 2000), arg(3, 2000000));
+	else if (strcmp(argv[1], "batch") == 0) benchBatch(arg(2, 2000000), arg(3, 1000), arg(4, 10000));
+	else if (strcmp(argv[1], "txn") == 0) benchTxn(arg(2, 1000000), arg(3, 64));
+	else if (strcmp(argv[1], "watch") == 0) benchWatch(arg(2, 100000), arg(3, 2000), arg(4, 16));
+	else if (strcmp(argv[1], "import") == 0 && argc > 2) benchImport(argv[2], arg(3, 8));
+	else if (strcmp(argv[1], "meta") == 0) benchMeta(arg(2, 1000000), arg(3, 2000000));
+	else if (strcmp(argv[1], "treecache") == 0) benchTreeCache(arg(2, 1000000), arg(3, 20));
+	else if (strcmp(argv[1], "mem") == 0) benchMem(arg(2, 1000000), arg(3, 2000000));
+	else if (strcmp(argv[1], "shard") == 0) benchShard(arg(2, 2000000), arg(3, 8), arg(4, 4));
+	else if (strcmp(argv[1], "checkpoint") == 0) benchCheckpoint(arg(2, 1000000), arg(3, 10000));
+	else if (strcmp(argv[1], "page") == 0) benchPage(arg(2, 1000000), arg(3, 200000));
+	else {
+		usage();
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,210 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Stats.h"
+
+using namespace std;
+
+// Load generator for "main --serve <socket>". Each client is a thread with
+// its own connection and its own directory, keeping depth requests in
+// flight (pipelined) for the given number of seconds. Prints aggregate
+// throughput and latency percentiles, where latency is from writing a
+// request to reading its reply, e.g.
+//   ./main --serve /tmp/fs.sock &
+//   ./FileSystemLoad /tmp/fs.sock 200 16 10
+
+namespace {
+
+// Same xorshift as the soak test, one per client.
+struct Rng {
+	uint64_t s;
+	explicit Rng(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ull | 1) {}
+	uint64_t next() {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+	uint64_t below(uint64_t n) { return next() % n; }
+};
+
+// Weighted workload inside the client's own directory.
+const char* const kOps[] = { "touch f", "rm f", "ls", "mkdir d", "rmdir d", "pwd" };
+const unsigned kWeights[] = { 30, 25, 15, 10, 10, 10 };
+const uint64_t kNamePool = 256;
+
+void nextRequest(Rng& rng, string& out) {
+	unsigned total = 0;
+	for (unsigned w : kWeights) total += w;
+	uint64_t r = rng.below(total);
+	int op = 0;
+	while (r >= kWeights[op]) r -= kWeights[op++];
+	out += kOps[op];
+	if (op != 2 && op != 5) out += to_string(rng.below(kNamePool));
+	out += '\n';
+}
+
+// Reads framed replies ("<length>\n" then length bytes) off one socket.
+class ReplyReader {
+	int fd_;
+	string buf_;
+	size_t pos_ = 0;
+
+public:
+	explicit ReplyReader(int fd) : fd_(fd) {}
+
+	// false if the server hung up
+	bool next() {
+		for (;;) {
+			size_t nl = buf_.find('\n', pos_);
+			if (nl != string::npos) {
+				size_t len = strtoull(buf_.c_str() + pos_, nullptr, 10);
+				if (buf_.size() >= nl + 1 + len) {
+					pos_ = nl + 1 + len;
+					if (pos_ == buf_.size()) {
+						buf_.clear();
+						pos_ = 0;
+					}
+					return true;
+				}
+			}
+			char chunk[64 * 1024];
+			ssize_t got = read(fd_, chunk, sizeof(chunk));
+			if (got <= 0) return false;
+			buf_.append(chunk, got);
+		}
+	}
+};
+
+bool sendAll(int fd, const string& data) {
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t sent = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+		if (sent <= 0) return false;
+		done += sent;
+	}
+	return true;
+}
+
+int connectTo(const char* path) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+struct ClientResult {
+	LatencyHistogram latency;
+	uint64_t requests = 0;
+	bool failed = false;
+};
+
+void runClient(const char* path, unsigned id, unsigned depth, chrono::steady_clock::time_point deadline,
+               ClientResult& result) {
+	int fd = connectTo(path);
+	if (fd < 0) {
+		result.failed = true;
+		return;
+	}
+	ReplyReader replies(fd);
+	string batch = "mkdir c" + to_string(id) + "\ncd c" + to_string(id) + "\n";
+	if (!sendAll(fd, batch) || !replies.next() || !replies.next()) {
+		result.failed = true;
+		close(fd);
+		return;
+	}
+
+	// Send times of the requests in flight, oldest first, in a ring.
+	vector<chrono::steady_clock::time_point> sentAt(depth);
+	size_t oldest = 0, inFlight = 0;
+	Rng rng(id + 1);
+
+	batch.clear();
+	auto now = chrono::steady_clock::now();
+	for (; inFlight < depth; inFlight++) {
+		nextRequest(rng, batch);
+		sentAt[inFlight] = now;
+	}
+	if (!sendAll(fd, batch)) result.failed = true;
+
+	while (inFlight > 0 && !result.failed) {
+		if (!replies.next()) {
+			result.failed = true;
+			break;
+		}
+		now = chrono::steady_clock::now();
+		result.latency.record(chrono::duration_cast<chrono::nanoseconds>(now - sentAt[oldest]).count());
+		result.requests++;
+		oldest = (oldest + 1) % depth;
+		inFlight--;
+
+		// Refill the slot just freed, until the time is up.
+		if (now < deadline) {
+			batch.clear();
+			nextRequest(rng, batch);
+			sentAt[(oldest + inFlight) % depth] = now;
+			inFlight++;
+			if (!sendAll(fd, batch)) result.failed = true;
+		}
+	}
+	close(fd);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printf("usage: FileSystemLoad <socket> [clients] [depth] [seconds]\n");
+		return 1;
+	}
+	const char* path = argv[1];
+	unsigned clients = argc > 2 ? strtoul(argv[2], nullptr, 10) : 64;
+	unsigned depth = argc > 3 ? strtoul(argv[3], nullptr, 10) : 16;
+	double seconds = argc > 4 ? strtod(argv[4], nullptr) : 5;
+	if (clients == 0 || depth == 0 || seconds <= 0) {
+		printf("usage: FileSystemLoad <socket> [clients] [depth] [seconds]\n");
+		return 1;
+	}
+
+	vector<ClientResult> results(clients);
+	vector<thread> threads;
+	auto start = chrono::steady_clock::now();
+	auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+	for (unsigned i = 0; i < clients; i++) {
+		threads.emplace_back(runClient, path, i, depth, deadline, ref(results[i]));
+	}
+	for (thread& t : threads) t.join();
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	LatencyHistogram all;
+	uint64_t requests = 0;
+	unsigned failed = 0;
+	for (const ClientResult& r : results) {
+		all.add(r.latency);
+		requests += r.requests;
+		if (r.failed) failed++;
+	}
+
+	printf("%u clients, %u in flight each, %.1f s\n", clients, depth, elapsed);
+	printf("%llu requests, %.0f req/s\n", (unsigned long long)requests, requests / elapsed);
+	printf("latency ns: p50 %llu  p99 %llu  p999 %llu  max %llu\n",
+	       (unsigned long long)all.percentile(0.50), (unsigned long long)all.percentile(0.99),
+	       (unsigned long long)all.percentile(0.999), (unsigned long long)all.max());
+	if (failed != 0) printf("%u clients lost their connection\n", failed);
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <malloc.h>
+#include "FileSystem.h"
+#include "NodePool.h"
+#include "Stats.h"
+
+using namespace std;
+
+// Long running random workload. Runs weighted cd/ls/touch/mkdir/rm/rmdir/mv
+// against one FileSystem, prints latency percentiles and memory per window
+// of operations so drift over time shows up, and checks the tree's
+// invariants every window. Build with "make soak", e.g.
+//   ./FileSystemSoak 10000000 200000 7
+// Exits with status 1 at the first broken invariant.
+
+namespace {
+
+// Deterministic xorshift so a failing seed can be replayed.
+struct Rng {
+	uint64_t s;
+	explicit Rng(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ull | 1) {}
+	uint64_t next() {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return s;
+	}
+	uint64_t below(uint64_t n) { return next() % n; }
+};
+
+// Relative weight of each operation, in Command order (Cd .. Mv).
+const Command kOps[] = { Command::Cd, Command::Ls, Command::Touch, Command::Mkdir,
+                         Command::Rm, Command::Rmdir, Command::Mv };
+const unsigned kWeights[] = { 15, 10, 20, 10, 20, 10, 15 };
+const int kNumOps = sizeof(kOps) / sizeof(kOps[0]);
+
+// Names come from a fixed pool per directory, so removes and moves mostly
+// find their target and directories settle at a steady size.
+const uint64_t kNamePool = 2000;
+const unsigned kMaxDepth = 8;
+
+// Bytes handed out by malloc, big blocks (NodePool chunks) included.
+uint64_t heapInUse() {
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+Command pickOp(Rng& rng) {
+	unsigned total = 0;
+	for (unsigned w : kWeights) total += w;
+	uint64_t r = rng.below(total);
+	for (int i = 0; i < kNumOps; i++) {
+		if (r < kWeights[i]) return kOps[i];
+		r -= kWeights[i];
+	}
+	return Command::Ls;
+}
+
+string pickName(Rng& rng) {
+	return "n" + to_string(rng.below(kNamePool));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+	uint64_t ops = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+	uint64_t window = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100000;
+	uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1;
+	if (ops == 0 || window == 0) {
+		printf("usage: FileSystemSoak [ops] [window] [seed]\n");
+		return 1;
+	}
+
+	FileSystem fs;
+	Rng rng(seed);
+	unsigned depth = 0;
+	string out;
+	LatencyHistogram all;
+	LatencyHistogram perOp[static_cast<int>(Command::Count)];
+	uint64_t failed = 0;
+	auto runStart = chrono::steady_clock::now();
+
+	printf("%8s %10s %10s %10s %10s %12s %12s %12s %8s\n",
+	       "window", "ops", "p50_ns", "p99_ns", "p999_ns", "nodes", "heap_bytes", "mem_bytes", "failed");
+	for (uint64_t done = 0, w = 0; done < ops; w++) {
+		all.reset();
+		for (LatencyHistogram& h : perOp) h.reset();
+		failed = 0;
+
+		uint64_t end = done + window < ops ? done + window : ops;
+		for (; done < end; done++) {
+			Command op = pickOp(rng);
+			string name = pickName(rng);
+			// Keep the tree from growing without bound in depth.
+			if (op == Command::Cd && depth >= kMaxDepth) name = "..";
+			else if (op == Command::Cd && rng.below(4) == 0) name = "..";
+			string dest = rng.below(8) == 0 ? ".." : pickName(rng);
+
+			Status status = Status::Ok;
+			auto start = chrono::steady_clock::now();
+			switch (op) {
+			case Command::Cd:    status = fs.tryCd(name); break;
+			case Command::Ls:    fs.lsInto(out); break;
+			case Command::Touch: status = fs.tryTouch(name); break;
+			case Command::Mkdir: status = fs.tryMkdir(name); break;
+			case Command::Rm:    status = fs.tryRm(name); break;
+			case Command::Rmdir: status = fs.tryRmdir(name); break;
+			default:             status = fs.tryMv(name, dest); break;
+			}
+			uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+				chrono::steady_clock::now() - start).count();
+			all.record(ns);
+			perOp[static_cast<int>(op)].record(ns);
+
+			if (status != Status::Ok) failed++;
+			else if (op == Command::Cd && name == "..") depth--;
+			else if (op == Command::Cd) depth++;
+		}
+
+		// Also starts memory accounting, which checkInvariants() then checks.
+		MemUsage usage;
+		(void)fs.tryMem("/", usage);
+		string broken = fs.checkInvariants();
+		printf("%8llu %10llu %10llu %10llu %10llu %12llu %12llu %12llu %8llu\n",
+		       (unsigned long long)w, (unsigned long long)done,
+		       (unsigned long long)all.percentile(0.50), (unsigned long long)all.percentile(0.99),
+		       (unsigned long long)all.percentile(0.999), (unsigned long long)NodePool::slotsInUse(),
+		       (unsigned long long)heapInUse(), (unsigned long long)usage.bytes, (unsigned long long)failed);
+		fflush(stdout);
+		if (broken != "") {
+			printf("invariant broken after %llu ops: %s\n", (unsigned long long)done, broken.c_str());
+			return 1;
+		}
+	}
+
+	// Per operation view of the last window.
+	printf("\n%-8s %10s %10s %10s %10s\n", "op", "count", "p50_ns", "p99_ns", "p999_ns");
+	for (Command op : kOps) {
+		const LatencyHistogram& h = perOp[static_cast<int>(op)];
+		printf("%-8s %10llu %10llu %10llu %10llu\n", Stats::commandName(op),
+		       (unsigned long long)h.count(), (unsigned long long)h.percentile(0.50),
+		       (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999));
+	}
+	printf("\n%llu ops in %.1f s, invariants held\n", (unsigned long long)ops,
+	       chrono::duration<double>(chrono::steady_clock::now() - runStart).count());
+	return 0;
+}
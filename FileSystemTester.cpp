@@ -1,6 +1,25 @@
 #include <iostream>
 #include "FileSystemTester.h"
+#include "Checkpoint.h"
 #include "FileSystem.h"
+#include "CommandLine.h"
+#include "CompactFileSystem.h"
+#include "MetaTable.h"
+#include "NodePool.h"
+#include "Reclaimer.h"
+#include "Server.h"
+#include "ShardedFileSystem.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -897,6 +916,2368 @@ void FileSystemTester::testz() {
 	passOut_();
 }
 
+// status api matches the string api
+void FileSystemTester::testA() {
+	funcname_ = "FileSystemTester::testA";
+	string s, ans;
+	{
+
+	FileSystem fs("1");
+
+	if (fs.tryCd("c.txt") != Status::InvalidPath)
+		errorOut_("tryCd into file wrong status", 1);
+	if (fs.tryMkdir("e") != Status::AlreadyExists)
+		errorOut_("tryMkdir e wrong status", 1);
+	if (fs.tryRm("e") != Status::NotAFile)
+		errorOut_("tryRm e wrong status", 1);
+	if (fs.tryRmdir("zzz") != Status::DirectoryNotFound)
+		errorOut_("tryRmdir zzz wrong status", 1);
+	if (fs.tryMv("b", "c.txt") != Status::DirectoryOntoFile)
+		errorOut_("tryMv b c.txt wrong status", 1);
+
+	s = statusMessage(Status::AlreadyExists);
+	ans = "file/directory already exists";
+	if (s != ans)
+		errorOut_("wrong status message: ", ans, s, 2);
+	s = statusMessage(Status::Ok);
+	ans = "";
+	if (s != ans)
+		errorOut_("wrong ok message: ", ans, s, 2);
+
+	// listings reuse the caller's buffer
+	if (fs.tryCd("b") != Status::Ok)
+		errorOut_("tryCd b wrong status", 3);
+	s = "stale";
+	fs.lsInto(s);
+	ans = "bb1/\nbb2/";
+	if (s != ans)
+		errorOut_("lsInto wrong output: ", ans, s, 3);
+	fs.pwdInto(s);
+	ans = "/b";
+	if (s != ans)
+		errorOut_("pwdInto wrong output: ", ans, s, 3);
+	fs.treeInto(s);
+	ans = "b/\n bb1/\n  bbb.txt\n bb2/";
+	if (s != ans)
+		errorOut_("treeInto wrong output: ", ans, s, 3);
+
+	}
+	passOut_();
+}
+
+// big (indexed) directories, paged ls
+void FileSystemTester::testB() {
+	funcname_ = "FileSystemTester::testB";
+	string s, ans;
+	{
+
+	// 1000 names inserted out of order, enough to build the index
+	FileSystem fs;
+	for (int i = 0; i < 1000; i++) {
+		int n = (i * 7919) % 1000;
+		string name = "f" + std::to_string(1000 + n);
+		if (n % 2) fs.touch(name);
+		else fs.mkdir(name);
+	}
+	for (int n = 0; n < 1000; n++) {
+		ans += "f" + std::to_string(1000 + n) + (n % 2 ? "\n" : "/\n");
+	}
+	ans.pop_back();
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("big directory wrong ls order", 1);
+
+	// lookups, removals and renames through the index
+	if (fs.touch("f1500") != "file/directory already exists")
+		errorOut_("duplicate in big directory not found", 2);
+	for (int n = 0; n < 1000; n += 3) {
+		string name = "f" + std::to_string(1000 + n);
+		if ((n % 2 ? fs.rm(name) : fs.rmdir(name)) != "")
+			errorOut_("remove from big directory failed: ", name, 2);
+	}
+	if (fs.mv("f1001", "g1001") != "" || fs.cd("f1998") != "" || fs.cd("..") != "")
+		errorOut_("rename or cd in big directory failed", 2);
+	ans = "";
+	for (int n = 0; n < 1000; n++) {
+		if (n % 3 == 0 || n == 1) continue;
+		ans += "f" + std::to_string(1000 + n) + (n % 2 ? "\n" : "/\n");
+	}
+	ans += "g1001";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("big directory wrong ls after removals", 2);
+
+	// paging sees every entry exactly once while the directory changes
+	string all, page;
+	ListCursor cursor;
+	int pages = 0;
+	while (!cursor.done()) {
+		fs.lsPage(cursor, 7, page);
+		if (page != "") all += page + "\n";
+		fs.touch("a" + std::to_string(pages)); // before the cursor, never listed
+		fs.touch("z" + std::to_string(pages)); // after the cursor, listed later
+		pages++;
+	}
+	// every entry present before paging is listed, in order, exactly once
+	all.pop_back();
+	all += "\n";
+	s += "\n";
+	size_t pos = 0, found = 0, expected = 0;
+	string prev = "";
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '\n') expected++;
+	}
+	while (pos < all.size()) {
+		size_t end = all.find('\n', pos);
+		string line = all.substr(pos, end - pos + 1);
+		if (line <= prev)
+			errorOut_("paged ls out of order or repeated: ", line, 3);
+		if (line[0] == 'a')
+			errorOut_("paged ls listed entry behind the cursor: ", line, 3);
+		if (s.find(line) != string::npos) found++;
+		prev = line;
+		pos = end + 1;
+	}
+	if (found != expected)
+		errorOut_("paged ls lost entries", 3);
+
+	ListCursor after("f1100");
+	fs.lsPage(after, 3, page);
+	ans = "f1101\nf1103\nf1104/";
+	if (page != ans || after.after() != "f1104" || after.done())
+		errorOut_("lsPage --after wrong page: ", ans, page, 4);
+
+	}
+	{
+
+	// name keys order names as std::string::compare does: lengths around
+	// the 8 byte key, bytes above 0x7F, ties on the first 8 bytes
+	const string names[] = { "abcdefg", "abcdefgh", "abcdefghi", "abcdefgha", "abcdefgg", "abcdefg\x80",
+	                         "abcdefgh\xff", "abcdefgh\x01", "\x7f", "\x80", "\xff\xff", "z", "", "abcdefghij" };
+	for (const string& a : names) {
+		for (const string& b : names) {
+			int want = a.compare(b);
+			int got = compareNames(nameKey(a), a, nameKey(b), b);
+			if ((want < 0) != (got < 0) || (want > 0) != (got > 0))
+				errorOut_("compareNames disagrees on: ", a + " / " + b, 5);
+			if (a.substr(0, 8) == b.substr(0, 8) && nameKey(a) != nameKey(b))
+				errorOut_("keys differ on names sharing 8 bytes: ", a + " / " + b, 5);
+		}
+	}
+	if (nameKey("abcdefg") >= nameKey("abcdefgh") || nameKey("\x7f") >= nameKey("\x80"))
+		errorOut_("wrong key order", 5);
+
+	// the same names, many times over with suffixes, through an indexed directory
+	FileSystem fs;
+	std::vector<string> sorted;
+	for (int i = 0; i < 20; i++) {
+		for (const string& name : names) {
+			if (name.empty()) continue;
+			string full = name + std::to_string(i % 10) + (i < 10 ? "" : "\x90");
+			fs.tryTouch(full);
+			sorted.push_back(full);
+		}
+	}
+	std::sort(sorted.begin(), sorted.end());
+	ans = "";
+	for (const string& name : sorted) ans += name + "\n";
+	ans.pop_back();
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("ls order over tied keys: ", ans, s, 5);
+	for (const string& name : sorted) {
+		if (fs.tryTouch(name) != Status::AlreadyExists)
+			errorOut_("name with a tied key not found: ", name, 5);
+	}
+
+	}
+	passOut_();
+}
+
+// prefix listing, completion
+void FileSystemTester::testC() {
+	funcname_ = "FileSystemTester::testC";
+	string s, ans, common;
+	{
+
+	FileSystem fs("1");
+	fs.lsPrefix("b", s);
+	ans = "b/";
+	if (s != ans)
+		errorOut_("lsPrefix b wrong output: ", ans, s, 1);
+	fs.lsPrefix("", s);
+	ans = fs.ls();
+	if (s != ans)
+		errorOut_("lsPrefix empty wrong output: ", ans, s, 1);
+	fs.lsPrefix("x", s);
+	ans = "";
+	if (s != ans)
+		errorOut_("lsPrefix x wrong output: ", ans, s, 1);
+
+	fs.cd("b");
+	if (fs.complete("b", 10, s, common) != 2 || common != "bb")
+		errorOut_("complete b wrong common prefix: ", "bb", common, 2);
+	ans = "bb1/\nbb2/";
+	if (s != ans)
+		errorOut_("complete b wrong candidates: ", ans, s, 2);
+	if (fs.complete("bb1", 10, s, common) != 1 || common != "bb1")
+		errorOut_("complete bb1 wrong common prefix: ", "bb1", common, 2);
+
+	}
+	{
+
+	// big directory: range stops at the first non-match
+	FileSystem fs;
+	for (int i = 0; i < 2000; i++) {
+		fs.touch("n" + std::to_string(i));
+	}
+	fs.lsPrefix("n199", s);
+	ans = "n199\nn1990\nn1991\nn1992\nn1993\nn1994\nn1995\nn1996\nn1997\nn1998\nn1999";
+	if (s != ans)
+		errorOut_("lsPrefix n199 wrong output: ", ans, s, 3);
+	if (fs.complete("n19", 3, s, common) != 3 || common != "n19")
+		errorOut_("complete n19 wrong result: ", "n19", common, 3);
+	ans = "n19\nn190\nn1900";
+	if (s != ans)
+		errorOut_("complete n19 wrong candidates: ", ans, s, 3);
+	if (fs.complete("", 1, s, common) != 1 || common != "n")
+		errorOut_("complete empty wrong common prefix: ", "n", common, 3);
+
+	}
+	passOut_();
+}
+
+// compact storage engine matches FileSystem
+void FileSystemTester::testD() {
+	funcname_ = "FileSystemTester::testD";
+	string s, ans;
+	{
+
+	// same random command sequence on both engines
+	FileSystem fs;
+	CompactFileSystem cfs;
+	const char* names[] = { "a", "b", "c.txt", "dd", "a_rather_long_name", "a_rather_long_name2", ".." };
+	unsigned int seed = 12345;
+	for (int i = 0; i < 5000; i++) {
+		seed = seed * 1103515245 + 12345;
+		int op = (seed >> 16) % 8;
+		seed = seed * 1103515245 + 12345;
+		const char* x = names[(seed >> 16) % 6];
+		seed = seed * 1103515245 + 12345;
+		const char* y = names[(seed >> 16) % 7];
+
+		Status a = Status::Ok, b = Status::Ok;
+		switch (op) {
+		case 0: a = fs.tryCd(x); b = cfs.tryCd(x); break;
+		case 1: a = fs.tryCd(".."); b = cfs.tryCd(".."); break;
+		case 2: a = fs.tryTouch(x); b = cfs.tryTouch(x); break;
+		case 3: a = fs.tryMkdir(x); b = cfs.tryMkdir(x); break;
+		case 4: a = fs.tryRm(x); b = cfs.tryRm(x); break;
+		case 5: a = fs.tryRmdir(x); b = cfs.tryRmdir(x); break;
+		default: a = fs.tryMv(x, y); b = cfs.tryMv(x, y); break;
+		}
+		if (a != b)
+			errorOut_("compact engine wrong status at step ", i, 1);
+
+		fs.lsInto(ans);
+		cfs.lsInto(s);
+		if (s != ans)
+			errorOut_("compact engine wrong ls: ", ans, s, 2);
+		fs.pwdInto(ans);
+		cfs.pwdInto(s);
+		if (s != ans)
+			errorOut_("compact engine wrong pwd: ", ans, s, 2);
+		if (i % 100 == 0) {
+			fs.cd("/");
+			cfs.tryCd("/");
+			fs.treeInto(ans);
+			cfs.treeInto(s);
+			if (s != ans)
+				errorOut_("compact engine wrong tree: ", ans, s, 3);
+		}
+		if (error_) break;
+	}
+
+	}
+	{
+
+	// name tails of deleted and renamed nodes are reused, a full arena is an error
+	CompactFileSystem cfs;
+	string name(40, 'n');
+	for (int i = 0; i < 100; i++) {
+		cfs.tryTouch(name);
+		cfs.tryMv(name, name + "x");
+		cfs.tryRm(name + "x");
+	}
+	uint64_t bytes = cfs.bytes();
+	for (int i = 0; i < 100000; i++) {
+		cfs.tryTouch(name);
+		cfs.tryMv(name, name + "x");
+		cfs.tryRm(name + "x");
+	}
+	if (cfs.bytes() != bytes)
+		errorOut_("name arena grows under churn: ", static_cast<int>(cfs.bytes() - bytes), 4);
+
+	cfs.setNameLimit(40);
+	if (cfs.tryTouch("a_long_name_1") != Status::Ok || cfs.tryTouch("a_long_name_2") != Status::Ok)
+		errorOut_("names within the limit refused", 4);
+	if (cfs.tryTouch(name) != Status::MemoryBudgetExceeded || cfs.tryMkdir(name) != Status::MemoryBudgetExceeded ||
+	    cfs.tryMv("a_long_name_1", name) != Status::MemoryBudgetExceeded)
+		errorOut_("name past the limit not refused", 4);
+	// renaming to a shorter name writes over the old tail
+	if (cfs.tryMv("a_long_name_2", "a_long_n2") != Status::Ok || cfs.tryRm("a_long_name_1") != Status::Ok ||
+	    cfs.tryTouch(name) != Status::Ok)
+		errorOut_("freed name bytes not reused", 4);
+	cfs.lsInto(s);
+	ans = "a_long_n2\n" + name;
+	if (s != ans)
+		errorOut_("names after compaction: ", ans, s, 4);
+
+	}
+	passOut_();
+}
+
+// cp, cp -r
+void FileSystemTester::testE() {
+	funcname_ = "FileSystemTester::testE";
+	string s, ans;
+	{
+
+	FileSystem fs("1");
+	if (fs.tryCp("b", "x") != Status::SourceIsDirectory)
+		errorOut_("cp of a directory without -r should fail", 1);
+	if (fs.tryCp("a.txt", "a2.txt") != Status::Ok)
+		errorOut_("cp a.txt a2.txt failed", 1);
+	if (fs.tryCp("a.txt", "e") != Status::Ok)
+		errorOut_("cp a.txt e failed", 1);
+	if (fs.tryCp("a.txt", "e") != Status::DestinationHasSameName)
+		errorOut_("cp a.txt e twice should fail", 1);
+	if (fs.tryCp("b", "c.txt", true) != Status::DirectoryOntoFile)
+		errorOut_("cp -r b c.txt should fail", 1);
+	if (fs.tryCp("x", "y") != Status::SourceNotFound)
+		errorOut_("cp of a missing source should fail", 1);
+	ans = "a.txt\na2.txt\nb/\nc.txt\nd.txt\ne/";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("cp wrong ls: ", ans, s, 1);
+
+	// copies keep the whole subtree, sorted, and are independent of the source
+	if (fs.tryCp("b", "e", true) != Status::Ok)
+		errorOut_("cp -r b e failed", 2);
+	if (fs.tryCp("b", "bcopy", true) != Status::Ok)
+		errorOut_("cp -r b bcopy failed", 2);
+	fs.cd("e");
+	fs.rmdir("b");
+	fs.cd("b");
+	fs.rm("bb1");
+	fs.cd("bb1");
+	fs.rm("bbb.txt");
+	fs.cd("/");
+	fs.cd("e");
+	ans = "e/\n a.txt\n b/\n  bb1/\n  bb2/\n ee.txt";
+	s = fs.tree();
+	if (s != ans)
+		errorOut_("cp -r wrong copy: ", ans, s, 2);
+	fs.cd("..");
+	fs.cd("b");
+	ans = "b/\n bb1/\n  bbb.txt\n bb2/";
+	s = fs.tree();
+	if (s != ans)
+		errorOut_("cp -r changed the source: ", ans, s, 2);
+	if (fs.tryCp("bb1", "..", true) != Status::Ok)
+		errorOut_("cp -r bb1 .. failed", 2);
+	if (fs.tryCp("bb1", "..", true) != Status::DestinationHasSameName)
+		errorOut_("cp -r bb1 .. twice should fail", 2);
+	fs.cd("..");
+	fs.cd("bcopy");
+	s = fs.tree();
+	ans = "bcopy/\n bb1/\n  bbb.txt\n bb2/";
+	if (s != ans)
+		errorOut_("cp -r to a new name wrong copy: ", ans, s, 2);
+
+	}
+	{
+
+	// a subtree big enough to clone on several threads
+	FileSystem fs;
+	fs.mkdir("src");
+	fs.cd("src");
+	for (int d = 0; d < 600; d++) {
+		string dir = "d" + std::to_string(d);
+		fs.mkdir(dir);
+		fs.cd(dir);
+		for (int f = 0; f < 450; f++) {
+			fs.touch("f" + std::to_string(f));
+		}
+		fs.cd("..");
+	}
+	fs.cd("..");
+	if (fs.tryCp("src", "serial", true) != Status::Ok)
+		errorOut_("cp -r of a big subtree failed", 3);
+	fs.setCloneThreads(4);
+	if (fs.tryCp("src", "parallel", true) != Status::Ok)
+		errorOut_("parallel cp -r of a big subtree failed", 3);
+	fs.cd("serial");
+	fs.treeInto(ans);
+	fs.cd("/");
+	fs.cd("parallel");
+	fs.treeInto(s);
+	if (s.substr(s.find('\n')) != ans.substr(ans.find('\n')))
+		errorOut_("parallel cp -r differs from serial cp -r", 4);
+	fs.cd("d599");
+	fs.touch("new");
+	if (fs.ls().find("new") == string::npos)
+		errorOut_("parallel cp -r copy not usable", 4);
+
+	}
+	passOut_();
+}
+
+// rm -r, background reclamation
+void FileSystemTester::testF() {
+	funcname_ = "FileSystemTester::testF";
+	string s, ans;
+	{
+
+	FileSystem fs("1");
+	if (fs.tryRm("b") != Status::NotAFile)
+		errorOut_("rm of a directory without -r should fail", 1);
+	if (fs.tryRm("x", true) != Status::FileNotFound)
+		errorOut_("rm -r of a missing name should fail", 1);
+	if (fs.tryRm("a.txt", true) != Status::Ok)
+		errorOut_("rm -r of a file failed", 1);
+	if (fs.tryRm("b", true) != Status::Ok)
+		errorOut_("rm -r b failed", 1);
+	ans = "c.txt\nd.txt\ne/";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("rm -r wrong ls: ", ans, s, 1);
+	fs.mkdir("b");
+	fs.cd("b");
+	ans = "";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("directory recreated after rm -r not empty: ", ans, s, 1);
+
+	}
+	{
+
+	// every node of a big (indexed, deep) subtree goes back to the pool
+	Reclaimer::drain(); // earlier subtrees may still be pending
+	uint64_t before = NodePool::slotsInUse();
+	FileSystem fs;
+	fs.mkdir("big");
+	fs.cd("big");
+	for (int i = 0; i < 5000; i++) {
+		fs.touch("f" + std::to_string(i));
+	}
+	for (int i = 0; i < 2000; i++) {
+		fs.mkdir("deep");
+		fs.cd("deep");
+	}
+	fs.cd("/");
+	if (fs.tryRm("big", true) != Status::Ok)
+		errorOut_("rm -r of a big subtree failed", 2);
+	ans = "";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("rm -r left the subtree linked: ", ans, s, 2);
+	Reclaimer::drain();
+	if (NodePool::slotsInUse() != before + 1)
+		errorOut_("rm -r did not free every node, in use: ", static_cast<int>(NodePool::slotsInUse() - before), 2);
+
+	}
+	{
+
+	// a tree far deeper than the stack is freed by its FileSystem too
+	Reclaimer::drain();
+	uint64_t before = NodePool::slotsInUse();
+	{
+		GenSpec spec;
+		spec.depth = 300000;
+		spec.minFanout = spec.maxFanout = 1;
+		spec.filePercent = 0;
+		FileSystem fs(spec);
+	}
+	if (NodePool::slotsInUse() != before)
+		errorOut_("deep tree not freed, in use: ", static_cast<int>(NodePool::slotsInUse() - before), 3);
+
+	// the backlog is bounded in nodes: a subtree that would go past it is
+	// freed by the caller, counted or taken from its usage
+	auto inlineFrees = []() {
+		string all = Stats::report();
+		size_t at = all.find("\nreclaimed_inline: ");
+		return at == string::npos ? 0ull : std::stoull(all.substr(at + 19));
+	};
+	const int longChain = static_cast<int>(Reclaimer::kMaxBacklog) + 1000;
+	FileSystem fs;
+	auto chain = [&fs](const string& top, int depth) {
+		fs.mkdir(top);
+		fs.cd(top);
+		for (int i = 0; i < depth; i++) {
+			fs.mkdir("d");
+			fs.cd("d");
+		}
+		fs.cd("/");
+	};
+	Reclaimer::drain();
+	unsigned long long inlineBefore = inlineFrees();
+	chain("short", 1000);
+	fs.tryRm("short", true);
+	if (inlineFrees() != inlineBefore) errorOut_("subtree within the backlog freed inline", 3);
+	Reclaimer::drain();
+	chain("long", longChain);
+	fs.tryRm("long", true);
+	if (inlineFrees() != inlineBefore + 1) errorOut_("subtree past the backlog not freed inline", 3);
+
+	// the same with sizes taken from the usage once accounting is on
+	chain("long", longChain);
+	MemUsage usage;
+	if (fs.tryMem("long", usage) != Status::Ok || usage.nodes != static_cast<uint64_t>(longChain) + 1)
+		errorOut_("usage of the long chain: ", static_cast<int>(usage.nodes), 3);
+	chain("short", 1000);
+	Reclaimer::drain();
+	inlineBefore = inlineFrees();
+	fs.tryRm("short", true);
+	if (inlineFrees() != inlineBefore) errorOut_("accounted subtree within the backlog freed inline", 3);
+	Reclaimer::drain();
+	fs.tryRm("long", true);
+	if (inlineFrees() != inlineBefore + 1) errorOut_("accounted subtree past the backlog not freed inline", 3);
+	Reclaimer::drain();
+	if (NodePool::slotsInUse() != before + 1)
+		errorOut_("backlogged subtrees not freed, in use: ", static_cast<int>(NodePool::slotsInUse() - before), 3);
+
+	}
+	passOut_();
+}
+
+// synthetic tree generator
+void FileSystemTester::testG() {
+	funcname_ = "FileSystemTester::testG";
+	string s, ans;
+	{
+
+	// same seed, same tree; another seed, another tree
+	GenSpec spec;
+	spec.seed = 42;
+	spec.depth = 3;
+	FileSystem a(spec), b(spec);
+	a.treeInto(ans);
+	b.treeInto(s);
+	if (s != ans)
+		errorOut_("same spec gave different trees: ", ans, s, 1);
+	spec.seed = 43;
+	FileSystem c(spec);
+	c.treeInto(s);
+	if (s == ans)
+		errorOut_("different seeds gave the same tree", 1);
+
+	}
+	{
+
+	// siblings come out sorted and are found like any other
+	GenSpec spec;
+	spec.depth = 1;
+	spec.minFanout = spec.maxFanout = 3000;
+	spec.minNameLen = 1;
+	spec.maxNameLen = 3;
+	spec.filePercent = 100;
+	FileSystem fs(spec);
+	fs.lsInto(ans);
+	size_t pos = 0, found = 0;
+	string prev = "";
+	while (pos <= ans.size()) {
+		size_t end = ans.find('\n', pos);
+		if (end == string::npos) end = ans.size();
+		string name = ans.substr(pos, end - pos);
+		if (name <= prev)
+			errorOut_("generated siblings out of order or repeated: ", name, 2);
+		if (fs.tryTouch(name) == Status::AlreadyExists) found++;
+		prev = name;
+		pos = end + 1;
+	}
+	if (found == 0 || fs.tryTouch("newname") != Status::Ok)
+		errorOut_("generated directory not searchable", 2);
+
+	}
+	{
+
+	// nodes caps the size, an invalid spec leaves only the root
+	GenSpec spec;
+	spec.depth = 6;
+	spec.filePercent = 0;
+	spec.maxNodes = 1000;
+	Reclaimer::drain(); // nothing else may free nodes while counting
+	uint64_t before = NodePool::slotsInUse();
+	FileSystem fs(spec);
+	if (NodePool::slotsInUse() - before != 1001)
+		errorOut_("nodes cap not kept, nodes: ", static_cast<int>(NodePool::slotsInUse() - before), 3);
+	spec.minFanout = 10;
+	spec.maxFanout = 2;
+	FileSystem bad(spec);
+	if (bad.ls() != "")
+		errorOut_("invalid spec generated nodes", 3);
+
+	}
+	{
+
+	// a chain far deeper than the stack would allow recursion for
+	GenSpec spec;
+	spec.depth = 200000;
+	spec.minFanout = spec.maxFanout = 1;
+	spec.filePercent = 0;
+	Reclaimer::drain();
+	uint64_t before = NodePool::slotsInUse();
+	FileSystem fs(spec);
+	if (NodePool::slotsInUse() - before != 200001)
+		errorOut_("deep chain not generated, nodes: ", static_cast<int>(NodePool::slotsInUse() - before), 4);
+	if (fs.tryRm(fs.ls().substr(0, fs.ls().size() - 1), true) != Status::Ok)
+		errorOut_("deep chain not removed", 4);
+
+	}
+	passOut_();
+}
+
+// structural invariants under random commands
+void FileSystemTester::testH() {
+	funcname_ = "FileSystemTester::testH";
+	string s;
+	{
+
+	const char* fixtures[] = { "1", "2", "3" };
+	for (const char* fixture : fixtures) {
+		FileSystem fs(fixture);
+		s = fs.checkInvariants();
+		if (s != "")
+			errorOut_("fixture breaks an invariant: ", s, 1);
+	}
+	GenSpec spec;
+	FileSystem generated(spec);
+	s = generated.checkInvariants();
+	if (s != "")
+		errorOut_("generated tree breaks an invariant: ", s, 1);
+
+	}
+	{
+
+	// small name pool so commands keep hitting existing names
+	FileSystem fs("1");
+	const char* names[] = { "a.txt", "b", "bb1", "e", "x", "y", "zz", ".." };
+	unsigned int seed = 777;
+	for (int i = 0; i < 20000; i++) {
+		seed = seed * 1103515245 + 12345;
+		int op = (seed >> 16) % 9;
+		seed = seed * 1103515245 + 12345;
+		const char* x = names[(seed >> 16) % 7];
+		seed = seed * 1103515245 + 12345;
+		const char* y = names[(seed >> 16) % 8];
+
+		switch (op) {
+		case 0: fs.tryCd(x); break;
+		case 1: fs.tryCd(".."); break;
+		case 2: fs.tryTouch(x); break;
+		case 3: fs.tryMkdir(x); break;
+		case 4: fs.tryRm(x); break;
+		case 5: fs.tryRmdir(x); break;
+		case 6: fs.tryCp(x, y, true); break;
+		case 7: fs.tryRm(x, true); break;
+		default: fs.tryMv(x, y); break;
+		}
+		if (i % 500 == 0) {
+			s = fs.checkInvariants();
+			if (s != "") {
+				errorOut_("invariant broken at step " + std::to_string(i) + ": ", s, 2);
+				break;
+			}
+		}
+	}
+
+	}
+	passOut_();
+}
+
+// command line tokenizer and verb table
+void FileSystemTester::testI() {
+	funcname_ = "FileSystemTester::testI";
+	std::string_view words[kMaxTokens];
+	{
+
+	string line = "  cp\t-r  src dest \r";
+	size_t n = tokenize(line, words, kMaxTokens);
+	if (n != 4 || words[0] != "cp" || words[1] != "-r" || words[2] != "src" || words[3] != "dest")
+		errorOut_("tokenize split the line wrong, words: ", static_cast<int>(n), 1);
+	if (words[2].data() != line.data() + 9)
+		errorOut_("tokenize copied a word", 1);
+	if (tokenize("", words, kMaxTokens) != 0 || tokenize(" \t ", words, kMaxTokens) != 0)
+		errorOut_("tokenize found words in a blank line", 1);
+	if (tokenize("a b c d", words, 2) != 2 || words[1] != "b")
+		errorOut_("tokenize went past max", 1);
+
+	}
+	{
+
+	const char* names[] = { "cd", "ls", "pwd", "tree", "touch", "mkdir", "rm", "rmdir", "mv", "cp",
+	                        "complete", "load", "gen", "stats", "trace", "exit" };
+	for (int i = 0; i < 16; i++) {
+		if (verbFromName(names[i]) != static_cast<Verb>(i))
+			errorOut_("verbFromName wrong verb for ", names[i], 2);
+	}
+	const char* unknown[] = { "", "c", "cdd", "Cd", "lsx", "touc", "trees", "completes" };
+	for (const char* name : unknown) {
+		if (verbFromName(name) != Verb::Unknown)
+			errorOut_("verbFromName accepted ", name, 2);
+	}
+	if (verbCommand(Verb::Cp) != Command::Cp || verbCommand(Verb::Stats) != Command::Count)
+		errorOut_("verbCommand wrong command", 2);
+
+	}
+	passOut_();
+}
+
+// string_view, const char* and string&& arguments
+void FileSystemTester::testJ() {
+	funcname_ = "FileSystemTester::testJ";
+	string s, ans;
+	{
+
+	// names sliced out of a bigger buffer, not nul terminated
+	string buffer = "mkdir a_directory_with_a_long_name file.txt";
+	std::string_view all(buffer);
+	std::string_view dir = all.substr(6, 28);
+	std::string_view file = all.substr(35, 8);
+	FileSystem fs;
+	if (fs.tryMkdir(dir) != Status::Ok || fs.tryTouch(file) != Status::Ok)
+		errorOut_("string_view slices not accepted", 1);
+	if (fs.tryTouch(dir) != Status::AlreadyExists || fs.tryTouch(all.substr(35, 4)) != Status::Ok)
+		errorOut_("string_view lookup wrong", 1);
+	ans = "a_directory_with_a_long_name/\nfile\nfile.txt";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("string_view names wrong ls: ", ans, s, 1);
+	if (fs.tryCd(dir) != Status::Ok || fs.pwd() != "/a_directory_with_a_long_name")
+		errorOut_("cd through a string_view failed", 1);
+
+	}
+	{
+
+	// literals, lvalue and rvalue strings
+	FileSystem fs;
+	string name = "a_name_long_enough_for_the_heap";
+	string copy = name;
+	if (fs.tryTouch("lit") != Status::Ok || fs.tryMkdir("dir") != Status::Ok)
+		errorOut_("const char* names not accepted", 2);
+	if (fs.tryTouch(name) != Status::Ok || name != copy)
+		errorOut_("lvalue string changed or not accepted", 2);
+	if (fs.tryMkdir(std::move(name)) != Status::AlreadyExists)
+		errorOut_("rvalue string of an existing name accepted", 2);
+	if (fs.tryMkdir(copy + "2") != Status::Ok)
+		errorOut_("rvalue string not accepted", 2);
+	ans = "a_name_long_enough_for_the_heap\na_name_long_enough_for_the_heap2/\ndir/\nlit";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("mixed argument types wrong ls: ", ans, s, 2);
+	if (fs.touch("") != "invalid name" || fs.tryMkdir(string()) != Status::InvalidName)
+		errorOut_("empty names accepted", 2);
+
+	}
+	passOut_();
+}
+
+// sessions, socket server
+void FileSystemTester::testK() {
+	funcname_ = "FileSystemTester::testK";
+	string s, ans;
+	{
+
+	// two sessions, each keeps its own directory
+	FileSystem fs;
+	Session one, two;
+	fs.openSession(one);
+	fs.openSession(two);
+	fs.enter(one);
+	fs.tryMkdir("a");
+	fs.tryMkdir("b");
+	fs.tryCd("a");
+	fs.tryMkdir("deep");
+	fs.tryCd("deep");
+	fs.leave(one);
+	fs.enter(two);
+	s = fs.pwd();
+	if (s != "/")
+		errorOut_("second session did not start at the root: ", "/", s, 1);
+	if (fs.tryRm("a", true) != Status::DirectoryInUse || fs.tryRmdir("a") != Status::DirectoryNotEmpty)
+		errorOut_("removed the directory above another session", 1);
+	fs.tryCd("a");
+	if (fs.tryRmdir("deep") != Status::DirectoryInUse || fs.rmdir("deep") != "directory is in use")
+		errorOut_("removed another session's directory", 1);
+	fs.tryCd("..");
+	if (fs.tryMv("a", "b") != Status::Ok)
+		errorOut_("mv of a pinned directory failed", 1);
+	if (fs.tryRm("b", true) != Status::DirectoryInUse)
+		errorOut_("pins did not follow mv", 1);
+	fs.leave(two);
+	fs.enter(one);
+	s = fs.pwd();
+	if (s != "/b/a/deep")
+		errorOut_("session lost its directory in mv: ", "/b/a/deep", s, 1);
+	fs.tryCd("/");
+	fs.leave(one);
+	fs.enter(two);
+	if (fs.tryRm("b", true) != Status::Ok)
+		errorOut_("directory still pinned after the session left it", 1);
+	fs.leave(two);
+	fs.closeSession(one);
+	fs.closeSession(two);
+	Reclaimer::drain();
+	s = fs.checkInvariants();
+	if (s != "")
+		errorOut_("invariant broken: ", s, 1);
+
+	}
+	{
+
+	// pipelined commands over the socket, replies framed in order
+	string path = "/tmp/FileSystemTester." + std::to_string(getpid()) + ".sock";
+	FileSystem fs;
+	Server server(&fs, path);
+	s = server.listen();
+	if (s != "")
+		errorOut_("server did not listen: ", s, 2);
+	std::thread serving([&server] { server.run(); });
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	path.copy(addr.sun_path, path.size());
+	int a = socket(AF_UNIX, SOCK_STREAM, 0);
+	int b = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connect(a, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+	    connect(b, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+		errorOut_("connect failed", 2);
+
+	auto exchange = [](int fd, const string& request) {
+		string got;
+		if (write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size())) return got;
+		char buf[4096];
+		ssize_t n;
+		while ((n = read(fd, buf, sizeof(buf))) > 0) got.append(buf, n);
+		return got;
+	};
+	// a's exit ends its reply stream, b pipelines after that in its own directory
+	s = exchange(a, "mkdir x\ncd x\nmkdir y\ncd y\npwd\nbogus\nexit\nls\n");
+	ans = "0\n0\n0\n0\n4\n/x/y17\ncommand not found";
+	if (s != ans)
+		errorOut_("wrong replies: ", ans, s, 2);
+	s = exchange(b, "pwd\nrmdir x\nls\nload x\r\nexit\n");
+	ans = "1\n/19\ndirectory not empty2\nx/26\nload is not available here";
+	if (s != ans)
+		errorOut_("wrong replies: ", ans, s, 2);
+	close(a);
+	close(b);
+	server.stop();
+	serving.join();
+
+	}
+	passOut_();
+}
+
+// batch operations match running them one by one
+void FileSystemTester::testL() {
+	funcname_ = "FileSystemTester::testL";
+	string s, ans;
+
+	// Run op the way applyBatch() describes it: cd along the directory part,
+	// run the command, come back to the root.
+	auto runOne = [](FileSystem& fs, const BatchOp& op) {
+		std::string_view path = op.path;
+		size_t slash = path.rfind('/');
+		std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+		Status status = Status::Ok;
+		if (slash != std::string_view::npos) {
+			std::string_view dirs = path.substr(0, slash + 1);
+			size_t pos = 0;
+			if (dirs[0] == '/') pos = 1;
+			while (status == Status::Ok && pos < dirs.size()) {
+				size_t next = dirs.find('/', pos);
+				status = fs.tryCd(dirs.substr(pos, next - pos));
+				pos = next + 1;
+			}
+		}
+		if (status == Status::Ok) {
+			switch (op.kind) {
+			case BatchOp::Kind::Touch: status = fs.tryTouch(name); break;
+			case BatchOp::Kind::Mkdir: status = fs.tryMkdir(name); break;
+			case BatchOp::Kind::Rm:    status = fs.tryRm(name); break;
+			case BatchOp::Kind::Rmdir: status = fs.tryRmdir(name); break;
+			case BatchOp::Kind::Mv:    status = fs.tryMv(name, op.dest); break;
+			}
+		}
+		fs.tryCd("/");
+		return status;
+	};
+	{
+
+	// mkdir of a directory later ops go into, and ops on one name in order
+	FileSystem fs;
+	std::vector<BatchOp> ops = {
+		{ BatchOp::Kind::Touch, "z", "" },
+		{ BatchOp::Kind::Mkdir, "d", "" },
+		{ BatchOp::Kind::Touch, "d/f", "" },
+		{ BatchOp::Kind::Rm, "d/f", "" },
+		{ BatchOp::Kind::Touch, "/d/f", "" },
+		{ BatchOp::Kind::Touch, "d/./../a", "" },
+		{ BatchOp::Kind::Touch, "d/f", "" },
+		{ BatchOp::Kind::Mkdir, "d/f/x", "" },
+		{ BatchOp::Kind::Rm, "d", "" },
+		{ BatchOp::Kind::Touch, "d/", "" },
+		{ BatchOp::Kind::Mv, "z", "d" },
+		{ BatchOp::Kind::Touch, "../x", "" },
+	};
+	std::vector<Status> results;
+	fs.applyBatch(ops, results);
+	Status expected[] = { Status::Ok, Status::Ok, Status::Ok, Status::Ok, Status::Ok, Status::Ok,
+	                      Status::AlreadyExists, Status::InvalidPath, Status::NotAFile,
+	                      Status::InvalidName, Status::Ok, Status::InvalidPath };
+	for (size_t i = 0; i < ops.size(); i++) {
+		if (results[i] != expected[i])
+			errorOut_("wrong status for " + ops[i].path + ": ", statusMessage(expected[i]), statusMessage(results[i]), 1);
+	}
+	ans = "/\n a\n d/\n  f\n  z";
+	s = fs.tree();
+	if (s != ans)
+		errorOut_("wrong tree after batch: ", ans, s, 1);
+
+	}
+	{
+
+	// random batches against the same ops one by one, including a directory
+	// big enough to be indexed
+	const char* dirs[] = { "", "a/", "b/", "a/c/", "/b/", "big/", "a/../b/", "nope/", "a/x/" };
+	const char* names[] = { "a", "b", "c", "x", "f1", "f2", "f3" };
+	FileSystem batched, serial;
+	for (FileSystem* fs : { &batched, &serial }) {
+		fs->tryMkdir("big");
+		fs->tryCd("big");
+		for (int i = 0; i < 300; i++) fs->tryTouch("n" + std::to_string(i));
+		fs->tryCd("/");
+	}
+	unsigned seed = 11;
+	for (int round = 0; round < 40 && !error_; round++) {
+		std::vector<BatchOp> ops;
+		for (int i = 0; i < 50; i++) {
+			seed = seed * 1103515245 + 12345;
+			unsigned r = seed >> 8;
+			BatchOp op;
+			unsigned kind = r % 20;
+			op.kind = kind < 7 ? BatchOp::Kind::Touch : kind < 13 ? BatchOp::Kind::Mkdir
+			        : kind < 18 ? BatchOp::Kind::Rm : kind < 19 ? BatchOp::Kind::Rmdir : BatchOp::Kind::Mv;
+			op.path = dirs[(r / 20) % 9];
+			op.path += names[(r / 180) % 7];
+			if (op.path.compare(0, 4, "big/") == 0 && (r & 1)) op.path = "big/n" + std::to_string(r % 400);
+			op.dest = (r / 1260) % 4 == 0 ? ".." : names[(r / 5040) % 7];
+			ops.push_back(op);
+		}
+		std::vector<Status> results;
+		batched.applyBatch(ops, results);
+		for (size_t i = 0; i < ops.size(); i++) {
+			Status one = runOne(serial, ops[i]);
+			if (results[i] != one) {
+				errorOut_("round " + std::to_string(round) + " status differs for " + ops[i].path + ": ",
+				          statusMessage(one), statusMessage(results[i]), 2);
+				break;
+			}
+		}
+		if (batched.tree() != serial.tree())
+			errorOut_("round " + std::to_string(round) + " trees differ", 2);
+		s = batched.checkInvariants();
+		if (s != "")
+			errorOut_("invariant broken: ", s, 2);
+	}
+
+	}
+	passOut_();
+}
+
+// transactions: all or nothing, conflicts
+void FileSystemTester::testM() {
+	funcname_ = "FileSystemTester::testM";
+	string s, ans;
+	{
+
+	// disjoint subtrees both commit, a failing op takes back the ones before it
+	FileSystem fs;
+	fs.tryMkdir("p");
+	fs.tryMkdir("q");
+	fs.tryCd("p");
+	fs.tryTouch("a");
+	fs.tryTouch("b");
+	fs.tryCd("/");
+	Transaction one, two, three;
+	fs.begin(one);
+	fs.begin(two);
+	fs.stage(one, BatchOp{BatchOp::Kind::Mkdir, "p/x", ""});
+	fs.stage(one, BatchOp{BatchOp::Kind::Mv, "p/a", "x"});
+	fs.stage(one, BatchOp{BatchOp::Kind::Mv, "p/b", "x"});
+	fs.stage(two, BatchOp{BatchOp::Kind::Touch, "q/f", ""});
+	if (!one.open() || one.size() != 3)
+		errorOut_("staged ops not queued", 1);
+	s = fs.tree();
+	ans = "/\n p/\n  a\n  b\n q/";
+	if (s != ans)
+		errorOut_("staged ops ran before commit: ", ans, s, 1);
+	if (fs.commit(two) != Status::Ok || fs.commit(one) != Status::Ok || one.open())
+		errorOut_("transactions on disjoint subtrees did not both commit", 1);
+	ans = "/\n p/\n  x/\n   a\n   b\n q/\n  f";
+	s = fs.tree();
+	if (s != ans)
+		errorOut_("wrong tree after commit: ", ans, s, 1);
+
+	fs.begin(three);
+	fs.stage(three, BatchOp{BatchOp::Kind::Rm, "q/f", ""});
+	fs.stage(three, BatchOp{BatchOp::Kind::Mv, "p/x", "y"});
+	fs.stage(three, BatchOp{BatchOp::Kind::Rmdir, "p/y", ""});
+	if (fs.commit(three) != Status::DirectoryNotEmpty)
+		errorOut_("failing op did not fail the commit", 1);
+	s = fs.tree();
+	if (s != ans)
+		errorOut_("failed commit left changes behind: ", ans, s, 1);
+	s = fs.checkInvariants();
+	if (s != "")
+		errorOut_("invariant broken: ", s, 1);
+
+	}
+	{
+
+	// something read changed: the commit is refused and nothing runs
+	FileSystem fs;
+	fs.tryMkdir("d");
+	Transaction tx;
+	fs.begin(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "d/f", ""});
+	fs.tryCd("d");
+	fs.tryTouch("g");
+	fs.tryCd("/");
+	if (fs.commit(tx) != Status::TransactionConflict)
+		errorOut_("commit after a change to a read directory did not conflict", 2);
+	fs.tryCd("d");
+	ans = "g";
+	s = fs.ls();
+	if (s != ans)
+		errorOut_("conflicting commit ran ops: ", ans, s, 2);
+
+	// the directory itself went away, as it is read through its parent the
+	// freed node is never looked at
+	fs.tryCd("/");
+	fs.tryMkdir("e");
+	fs.begin(tx);
+	fs.tryCd("e");
+	fs.observe(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "f", ""});
+	fs.tryCd("/");
+	fs.tryRmdir("e");
+	if (fs.commit(tx) != Status::TransactionConflict)
+		errorOut_("commit into a removed directory did not conflict", 2);
+
+	// changes beside the path to what the transaction reads are no conflict
+	fs.tryMkdir("a");
+	fs.tryCd("a");
+	fs.tryMkdir("b");
+	fs.tryTouch("x");
+	fs.tryCd("/");
+	fs.begin(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "a/b/f", ""});
+	fs.tryCd("a");
+	fs.tryMkdir("c");
+	fs.tryRm("x");
+	fs.tryCd("/");
+	if (fs.commit(tx) != Status::Ok)
+		errorOut_("commit below a changed ancestor did not go through", 2);
+	fs.tryCd("a");
+	fs.tryCd("b");
+	if (fs.ls() != "f")
+		errorOut_("commit below a changed ancestor: ", "f", fs.ls(), 2);
+	// but the ancestor going away is
+	fs.tryCd("/");
+	fs.begin(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "a/b/g", ""});
+	fs.tryMv("a", "z");
+	if (fs.commit(tx) != Status::TransactionConflict)
+		errorOut_("commit below a moved ancestor did not conflict", 2);
+
+	// undo puts back the very node rm took, metadata and all
+	fs.tryTouch("m");
+	fs.trySetMeta("m", 77, 0600, 3);
+	NodeMeta before, after;
+	fs.tryStat("m", before);
+	fs.begin(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Rm, "m", ""});
+	fs.stage(tx, BatchOp{BatchOp::Kind::Rmdir, "nothing", ""});
+	if (fs.commit(tx) != Status::DirectoryNotFound)
+		errorOut_("failing op did not fail the commit", 2);
+	if (fs.tryStat("m", after) != Status::Ok || after.size != 77 || after.mode != 0600 || after.owner != 3 ||
+	    after.ctime != before.ctime)
+		errorOut_("metadata lost by undo", 2);
+	s = fs.checkInvariants();
+	if (s != "")
+		errorOut_("invariant broken: ", s, 2);
+
+	}
+	{
+
+	// the same through the command language, one transaction per session
+	FileSystem* fs = new FileSystem();
+	CommandShell shell;
+	const char* lines[] = { "begin", "mkdir x", "touch x/f", "ls", "cp a b", "begin", "commit", "ls", "commit" };
+	const char* replies[] = { "", "", "", "", "not available in a transaction", "transaction already open", "", "x/",
+	                          "no transaction open" };
+	for (int i = 0; i < 9; i++) {
+		shell.run(fs, lines[i], s);
+		if (s != replies[i])
+			errorOut_(string("wrong reply to ") + lines[i] + ": ", replies[i], s, 3);
+	}
+	delete fs;
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testN() {
+	funcname_ = "FileSystemTester::testN";
+	string s, ans;
+	{
+
+	// one directory, then everything below another, through the shell
+	FileSystem* fs = new FileSystem();
+	CommandShell shell;
+	const char* lines[] = {
+		"mkdir d", "cd d", "mkdir sub", "cd /", "watch d", "events",
+		"cd d", "touch f", "cd sub", "mkdir g", "cd ..", "mv f h", "mv h sub", "cd /", "events",
+		"rm -r d", "unwatch", "watch d -r", "cd d", "cd sub", "touch x", "mv x ..", "cd /", "events",
+		"watch nowhere", "watch", "unwatch", "rm -r d", "events" };
+	const char* replies[] = {
+		"", "", "", "", "", "",
+		"", "", "", "", "", "", "", "", "create f\nmoved_from f\nmoved_to h\nmoved_from h",
+		"directory is in use", "", "", "", "", "", "", "", "create sub/x\nmoved_from sub/x\nmoved_to x",
+		"directory not found", "usage: watch <dir> [-r]", "", "", "" };
+	for (int i = 0; i < 29; i++) {
+		shell.run(fs, lines[i], s);
+		if (s != replies[i])
+			errorOut_(string("wrong reply to ") + lines[i] + ": ", replies[i], s, 0);
+	}
+	delete fs;
+
+	}
+	{
+
+	// long paths keep their tail, batches and commits are seen too
+	FileSystem fs;
+	WatchRing ring;
+	fs.tryMkdir("a");
+	if (fs.watch("/", true, ring) != Status::Ok) errorOut_("watch / failed", 1);
+	string deep(30, 'x');
+	fs.tryCd("a");
+	fs.tryMkdir(deep);
+	fs.tryCd(deep);
+	fs.tryTouch(deep);
+	std::vector<Status> results;
+	fs.applyBatch({ BatchOp{BatchOp::Kind::Touch, "/a/b", ""}, BatchOp{BatchOp::Kind::Rm, "/a/b", ""} }, results);
+	WatchEvent e;
+	ans = "";
+	while (ring.pop(e)) {
+		ans += string(watchKindName(e.kind)) + (e.truncated ? " ..." : " ") + string(e.path, e.length) + "\n";
+	}
+	string expected = "create a/" + deep + "\ncreate ...x" + string(12, 'x') + "/" + deep + "\ncreate a/b\ndelete a/b\n";
+	if (ans != expected) errorOut_("wrong events: ", expected, ans, 1);
+	fs.unwatch(ring);
+
+	}
+	{
+
+	// a full ring drops events and owes a resync, nothing blocks
+	FileSystem fs;
+	WatchRing ring(4);
+	fs.watch(".", false, ring);
+	for (int i = 0; i < 10; i++) fs.tryTouch("f" + std::to_string(i));
+	WatchEvent e;
+	ans = "";
+	while (ring.pop(e)) ans += string(watchKindName(e.kind)) + " " + string(e.path, e.length) + ",";
+	fs.tryTouch("g");
+	while (ring.pop(e)) ans += string(watchKindName(e.kind)) + " " + string(e.path, e.length) + ",";
+	if (ans != "create f0,create f1,create f2,create f3,resync ,create g,")
+		errorOut_("wrong overflow events: ", "create f0,create f1,create f2,create f3,resync ,create g,", ans, 2);
+	if (ring.dropped() != 6) errorOut_("dropped events: ", static_cast<int>(ring.dropped()), 2);
+	fs.unwatch(ring);
+
+	}
+	{
+
+	// a consumer thread reading while the tree changes: events arrive in
+	// order, and every gap is announced by a resync
+	FileSystem fs;
+	WatchRing ring(256);
+	fs.watch("/", false, ring);
+	const int kFiles = 20000;
+	std::atomic<bool> done(false);
+	int received = 0, resyncs = 0;
+	bool ordered = true;
+	std::thread consumer([&] {
+		WatchEvent e;
+		int last = -1;
+		bool gap = false;
+		for (;;) {
+			bool finished = done.load();
+			if (!ring.pop(e)) {
+				if (finished) break;
+				continue;
+			}
+			if (e.kind == WatchEvent::Kind::Resync) {
+				resyncs++;
+				gap = true;
+				continue;
+			}
+			int n = std::stoi(string(e.path + 1, e.length - 1));
+			if (n <= last || (n != last + 1 && !gap)) ordered = false;
+			last = n;
+			gap = false;
+			received++;
+		}
+	});
+	for (int i = 0; i < kFiles; i++) fs.tryTouch("f" + std::to_string(i));
+	done = true;
+	consumer.join();
+	if (!ordered) errorOut_("events out of order or lost without a resync", 3);
+	if (received + static_cast<int>(ring.dropped()) != kFiles)
+		errorOut_("events received plus dropped: ", received + static_cast<int>(ring.dropped()), 3);
+	if ((ring.dropped() == 0) != (resyncs == 0)) errorOut_("resyncs: ", resyncs, 3);
+	fs.unwatch(ring);
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testO() {
+	funcname_ = "FileSystemTester::testO";
+	string s, ans;
+
+	// a small host tree: files, directories, a symlink (imported as a file)
+	char base[] = "/tmp/fstestXXXXXX";
+	if (mkdtemp(base) == nullptr) {
+		errorOut_("mkdtemp failed", 0);
+		return;
+	}
+	string host = base;
+	auto makeFile = [](const string& path) { int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0644); if (fd >= 0) close(fd); };
+	::mkdir((host + "/b").c_str(), 0755);
+	::mkdir((host + "/b/c").c_str(), 0755);
+	::mkdir((host + "/e").c_str(), 0755);
+	makeFile(host + "/a.txt");
+	makeFile(host + "/b/x");
+	makeFile(host + "/b/c/y");
+	if (symlink("b", (host + "/link").c_str()) != 0) errorOut_("symlink failed", 0);
+	{
+
+	FileSystem fs;
+	ImportReport report;
+	if (fs.importHost(host, "t", report) != Status::Ok) errorOut_("import failed", 0);
+	fs.tryCd("t");
+	s = fs.tree();
+	ans = "t/\n a.txt\n b/\n  c/\n   y\n  x\n e/\n link";
+	if (s != ans) errorOut_("imported tree: ", ans, s, 0);
+	if (report.entries != 7 || report.directories != 3 || report.unreadable != 0)
+		errorOut_("report entries: ", static_cast<int>(report.entries), 0);
+	if (report.bytes < 8 * sizeof(Node)) errorOut_("report bytes: ", static_cast<int>(report.bytes), 0);
+
+	// the default name is the last component, trailing slashes ignored
+	fs.tryCd("/");
+	if (fs.importHost(host + "/b/", "", report) != Status::Ok) errorOut_("import with default name failed", 1);
+	s = fs.ls();
+	if (s != "b/\nt/") errorOut_("default name: ", "b/\nt/", s, 1);
+	if (fs.importHost(host, "t", report) != Status::AlreadyExists) errorOut_("import onto an existing name", 1);
+	if (fs.importHost(host + "/missing", "m", report) != Status::HostPathUnreadable) errorOut_("import of a missing path", 1);
+	if (fs.importHost(host + "/a.txt", "m", report) != Status::NotADirectory) errorOut_("import of a file", 1);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("invariants after import: ", s, 1);
+
+	}
+	{
+
+	// a wider tree, many threads give the same copy as one
+	for (int d = 0; d < 40; d++) {
+		string dir = host + "/e/d" + std::to_string(d);
+		::mkdir(dir.c_str(), 0755);
+		for (int f = 0; f < 25; f++) makeFile(dir + "/f" + std::to_string((f * 7) % 25));
+		::mkdir((dir + "/sub").c_str(), 0755);
+		makeFile(dir + "/sub/z");
+	}
+	FileSystem one, many;
+	ImportReport r1, r8;
+	one.importHost(host, "t", r1, 1);
+	many.importHost(host, "t", r8, 8);
+	if (one.tree() != many.tree()) errorOut_("threaded import differs", 2);
+	if (r1.entries != r8.entries || r8.entries != 7 + 40 * 28) errorOut_("threaded entries: ", static_cast<int>(r8.entries), 2);
+	s = many.checkInvariants();
+	if (s != "") errorOut_("invariants after threaded import: ", s, 2);
+	many.tryCd("t");
+	many.tryCd("e");
+	many.tryCd("d7");
+	if (many.tryRm("f3") != Status::Ok || many.tryTouch("f3") != Status::Ok) errorOut_("imported directory not usable", 2);
+
+	// past the memory budget the import stops early and leaves nothing behind
+	FileSystem small;
+	MemUsage usage;
+	small.setMemoryBudget(UINT64_MAX);
+	small.tryMem("", usage);
+	small.setMemoryBudget(usage.bytes + 100 * sizeof(Node));
+	ImportReport r;
+	if (small.importHost(host, "t", r, 8) != Status::MemoryBudgetExceeded) errorOut_("import past the budget", 2);
+	if (r.entries == 0 || r.entries >= r8.entries) errorOut_("import did not stop early, entries: ", static_cast<int>(r.entries), 2);
+	small.tryMem("", usage);
+	if (small.ls() != "" || usage.nodes != 1) errorOut_("import past the budget left nodes: ", static_cast<int>(usage.nodes), 2);
+	// with room for all of it, it fits exactly as counted
+	small.setMemoryBudget(UINT64_MAX);
+	if (small.importHost(host, "t", r, 8) != Status::Ok) errorOut_("import within the budget", 2);
+	MemUsage all;
+	small.tryMem("", all);
+	small.tryRm("t", true);
+	small.setMemoryBudget(all.bytes);
+	if (small.importHost(host, "t", r, 8) != Status::Ok) errorOut_("import of exactly the budget", 2);
+	if (small.tree() != one.tree()) errorOut_("import within the budget differs", 2);
+
+	}
+	string cleanup = "rm -rf " + host;
+	if (system(cleanup.c_str()) != 0) errorOut_("cleanup failed", 3);
+	passOut_();
+}
+
+void FileSystemTester::testP() {
+	funcname_ = "FileSystemTester::testP";
+	string s, ans;
+	{
+
+	// created nodes get times and a default mode, their directory's mtime follows
+	FileSystem fs;
+	Reclaimer::drain(); // earlier tests may still have nodes waiting
+	uint64_t rows = MetaTable::rowsInUse();
+	fs.tryMkdir("d");
+	fs.tryCd("d");
+	NodeMeta before, after, meta;
+	fs.tryStat(".", before);
+	fs.tryTouch("f");
+	fs.tryStat(".", after);
+	if (before.ctime == 0 || before.mode != 0755) errorOut_("mkdir metadata, mode: ", static_cast<int>(before.mode), 0);
+	if (after.mtime < before.mtime || after.ctime != before.ctime) errorOut_("directory times after touch", 0);
+	if (fs.tryStat("f", meta) != Status::Ok || meta.mode != 0644 || meta.ctime < before.ctime || meta.size != 0)
+		errorOut_("touch metadata", 0);
+	if (fs.tryStat("g", meta) != Status::FileNotFound) errorOut_("stat of a missing name", 0);
+
+	if (fs.trySetMeta("f", 1234, 0600, 42) != Status::Ok) errorOut_("setting metadata failed", 1);
+	fs.tryStat("f", meta);
+	if (meta.size != 1234 || meta.mode != 0600 || meta.owner != 42) errorOut_("set metadata not kept", 1);
+	fs.lsLongInto(s);
+	ans = "-rw-------    42       1234 ";
+	if (s.compare(0, ans.size(), ans) != 0 || s.substr(s.size() - 2) != " f")
+		errorOut_("ls -l line: ", ans + "<mtime> f", s, 1);
+
+	// cp keeps the source's metadata, cp -r for every node below too
+	fs.tryCp("f", "g");
+	fs.tryStat("g", after);
+	if (after.size != 1234 || after.mode != 0600 || after.owner != 42 || after.mtime != meta.mtime)
+		errorOut_("metadata of a copy", 1);
+
+	// rows go back with their nodes, also through the Reclaimer
+	fs.tryMkdir("sub");
+	fs.tryCd("sub");
+	for (int i = 0; i < 20; i++) fs.tryTouch("x" + std::to_string(i));
+	fs.trySetMeta("x3", 99, 0640, 5);
+	fs.tryCd("..");
+	fs.tryCp("sub", "sub2", true);
+	fs.tryCd("sub2");
+	fs.tryStat("x3", after);
+	if (after.size != 99 || after.mode != 0640 || after.owner != 5) errorOut_("metadata of a copy under cp -r", 1);
+	if (fs.tryStat("x0", after) != Status::Ok || after.ctime < before.ctime) errorOut_("times of a copy under cp -r", 1);
+	fs.tryCd("..");
+	fs.tryRm("f");
+	fs.tryRm("g");
+	fs.tryRm("sub", true);
+	fs.tryRm("sub2", true);
+	fs.tryCd("/");
+	fs.tryRmdir("d");
+	Reclaimer::drain();
+	// the root got a row when its child list first changed
+	if (MetaTable::rowsInUse() != rows + 1) errorOut_("metadata rows in use: ", static_cast<int>(MetaTable::rowsInUse() - rows), 2);
+
+	}
+	{
+
+	// bulk made nodes have defaults and no times, through the shell too
+	GenSpec spec;
+	spec.depth = 1;
+	spec.minFanout = spec.maxFanout = 3;
+	spec.filePercent = 100;
+	FileSystem* fs = new FileSystem(spec);
+	CommandShell shell;
+	shell.run(fs, "ls", s);
+	string first = s.substr(0, s.find('\n'));
+	shell.run(fs, "stat " + first, s);
+	ans = "size: 0\nmode: 0644\nowner: 0\nctime: -\nmtime: -";
+	if (s != ans) errorOut_("stat of a generated file: ", ans, s, 3);
+	shell.run(fs, "ls -l", s);
+	ans = "-rw-r--r--     0          0                - " + first;
+	if (s.substr(0, s.find('\n')) != ans) errorOut_("ls -l of a generated file: ", ans, s, 3);
+	shell.run(fs, "stat nothing", s);
+	if (s != "file not found") errorOut_("stat of a missing name: ", "file not found", s, 3);
+	delete fs;
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testQ() {
+	funcname_ = "FileSystemTester::testQ";
+	string s, ans;
+	{
+
+	// no limits gives exactly tree(), from the root and from below it
+	for (uint64_t seed = 1; seed <= 20; seed++) {
+		GenSpec spec;
+		spec.seed = seed;
+		spec.depth = 1 + seed % 4;
+		spec.minFanout = 0;
+		spec.maxFanout = 6;
+		spec.filePercent = 40;
+		FileSystem fs(spec);
+		for (int step = 0; step < 2; step++) {
+			fs.treeInto(s, TreeLimits());
+			ans = fs.tree();
+			if (s != ans) errorOut_("unlimited tree differs: ", ans, s, 0);
+			// go one level down for the second round, if there is a directory
+			fs.lsInto(s);
+			size_t slash = s.find('/');
+			if (slash == string::npos) break;
+			size_t begin = s.rfind('\n', slash);
+			fs.tryCd(s.substr(begin == string::npos ? 0 : begin + 1, slash - (begin == string::npos ? 0 : begin + 1)));
+		}
+	}
+
+	}
+	{
+
+	// depth and node limits, and expanding what they hid
+	FileSystem fs("1");
+	TreeLimits limits;
+	limits.depth = 1;
+	fs.treeInto(s, limits);
+	ans = "/\n a.txt\n b/\n  ... 2 entries\n c.txt\n d.txt\n e/\n  ... 1 entries";
+	if (s != ans) errorOut_("tree -L 1: ", ans, s, 1);
+	fs.treeInto(s, limits, "b");
+	ans = "  bb1/\n   ... 1 entries\n  bb2/";
+	if (s != ans) errorOut_("tree -L 1 b: ", ans, s, 1);
+	limits.depth = 0;
+	fs.treeInto(s, limits, "b/bb1");
+	ans = "   bbb.txt";
+	if (s != ans) errorOut_("tree b/bb1: ", ans, s, 1);
+	if (fs.treeInto(s, limits, "a.txt") != Status::InvalidPath) errorOut_("tree of a file", 1);
+	fs.tryCd("e");
+	if (fs.treeInto(s, limits, "../b") != Status::InvalidPath) errorOut_("tree of a directory outside", 1);
+	fs.tryCd("/");
+
+	limits.maxNodes = 3;
+	fs.treeInto(s, limits);
+	ans = "/\n a.txt\n b/\n  bb1/\n   ... 1 more\n  ... 1 more\n ... 3 more";
+	if (s != ans) errorOut_("tree --max-nodes 3: ", ans, s, 2);
+	limits.maxNodes = 9;
+	fs.treeInto(s, limits);
+	if (s != fs.tree()) errorOut_("a budget that fits changes nothing: ", fs.tree(), s, 2);
+
+	}
+	{
+
+	// big directories count their elided children from the index
+	FileSystem* fs = new FileSystem();
+	CommandShell shell;
+	shell.run(fs, "mkdir big", s);
+	shell.run(fs, "cd big", s);
+	for (int i = 0; i < 500; i++) shell.run(fs, "touch f" + std::to_string(i), s);
+	shell.run(fs, "cd /", s);
+	shell.run(fs, "tree -L 1", s);
+	if (s != "/\n big/\n  ... 500 entries") errorOut_("tree -L 1 over a big directory: ", "/\n big/\n  ... 500 entries", s, 3);
+	shell.run(fs, "tree --max-nodes 3 big", s);
+	if (s != "  f0\n  f1\n  f10\n  ... 497 more") errorOut_("tree --max-nodes 3 big: ", "  f0\n  f1\n  f10\n  ... 497 more", s, 3);
+	shell.run(fs, "tree -L", s);
+	if (s != "usage: tree [-L depth] [--max-nodes N] [dir]") errorOut_("tree -L without a depth: ", s, 3);
+	delete fs;
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testR() {
+	funcname_ = "FileSystemTester::testR";
+	string s, ans;
+	{
+
+	// cached renderings follow every kind of change, at every depth
+	GenSpec spec;
+	spec.seed = 7;
+	spec.depth = 4;
+	spec.minFanout = 1;
+	spec.maxFanout = 4;
+	spec.filePercent = 30;
+	FileSystem fs(spec);
+	fs.tryMkdir("x");
+	fs.tryCd("x");
+	fs.tryMkdir("y");
+	fs.tryCd("y");
+	fs.tryMkdir("z");
+	fs.tryCd("z");
+	fs.tryTouch("deep.txt");
+	fs.tryMkdir("w");
+	fs.tryCd("w");
+	fs.tryTouch("w.txt");
+	// warm the cache from the bottom up, every level reusing the one below
+	for (int level = 0; level < 5; level++) {
+		s = fs.tree();
+		fs.treeInto(ans, TreeLimits());
+		if (s != ans) errorOut_("cached tree differs while warming: ", ans, s, 0);
+		if (fs.tree() != ans) errorOut_("tree repeated: ", ans, fs.tree(), 0);
+		fs.tryCd("..");
+	}
+	fs.tryCd("/");
+
+	// cd takes one name at a time
+	auto cdPath = [&fs](const string& path) {
+		fs.tryCd("/");
+		size_t begin = 0;
+		while (begin < path.size()) {
+			size_t end = path.find('/', begin);
+			if (end == string::npos) end = path.size();
+			if (fs.tryCd(path.substr(begin, end - begin)) != Status::Ok) return false;
+			begin = end + 1;
+		}
+		return true;
+	};
+	const char* steps[] = {
+		"x/y/z",  "touch new.txt",
+		"x/y/z",  "mkdir newdir",
+		"x/y/z",  "rm deep.txt",
+		"x/y/z",  "rmdir newdir",
+		"x/y",    "mv z zz",
+		"x/y/zz", "mv w ..",    // a cached directory one level up
+		"x/y",    "mv w ..",    // and another
+		"x",      "mv w y",     // and back down
+		"x/y/w",  "mv w.txt .."
+	};
+	for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i += 2) {
+		if (!cdPath(steps[i])) errorOut_(string("cd failed: ") + steps[i], 1);
+		string cmd = steps[i + 1];
+		size_t space = cmd.find(' ');
+		string verb = cmd.substr(0, space), arg = cmd.substr(space + 1);
+		if (verb == "touch") fs.tryTouch(arg);
+		else if (verb == "mkdir") fs.tryMkdir(arg);
+		else if (verb == "rm") fs.tryRm(arg);
+		else if (verb == "rmdir") fs.tryRmdir(arg);
+		else {
+			space = arg.find(' ');
+			if (fs.tryMv(arg.substr(0, space), arg.substr(space + 1)) != Status::Ok) errorOut_("mv failed: ", cmd, 1);
+		}
+		// every directory on the way, cached or not, against a fresh walk
+		for (const char* dir : {"", "x", "x/y", "x/y/zz", "x/w", "x/y/w"}) {
+			if (!cdPath(dir)) continue;
+			s = fs.tree();
+			fs.treeInto(ans, TreeLimits());
+			if (s != ans) errorOut_(string("stale tree in ") + dir + " after " + cmd + ": ", ans, s, 1);
+		}
+	}
+	cdPath("x/y");
+	ans = "y/\n w/\n w.txt\n zz/\n  new.txt";
+	if (fs.tree() != ans) errorOut_("tree x/y at the end: ", ans, fs.tree(), 1);
+
+	}
+	{
+
+	// transaction commits and rm -r invalidate too
+	FileSystem* fs = new FileSystem("1");
+	CommandShell shell;
+	for (const char* line : {"cd b", "tree", "cd bb1", "tree", "cd /", "tree",
+	                         "begin", "cd b", "cd bb1", "touch q.txt", "cd /", "commit", "tree"}) {
+		shell.run(fs, line, s);
+	}
+	ans = "/\n a.txt\n b/\n  bb1/\n   bbb.txt\n   q.txt\n  bb2/\n c.txt\n d.txt\n e/\n  ee.txt";
+	if (s != ans) errorOut_("tree after a commit: ", ans, s, 2);
+	shell.run(fs, "rm -r b", s);
+	shell.run(fs, "tree", s);
+	ans = "/\n a.txt\n c.txt\n d.txt\n e/\n  ee.txt";
+	if (s != ans) errorOut_("tree after rm -r: ", ans, s, 2);
+	shell.run(fs, "mkdir b", s);
+	shell.run(fs, "cd b", s);
+	shell.run(fs, "tree", s);
+	if (s != "b/\n") errorOut_("recreated directory: ", "b/\n", s, 2);
+	delete fs;
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testS() {
+	funcname_ = "FileSystemTester::testS";
+	string s, ans;
+	const uint64_t node = sizeof(Node), row = MetaTable::kRowBytes;
+	{
+
+	// usage per subtree, kept up to date through every kind of change
+	FileSystem fs("1");
+	MemUsage usage;
+	// root, b, bb1, bb2 and e get rows when accounting starts, files do not
+	if (fs.tryMem("", usage) != Status::Ok || usage.nodes != 10 || usage.bytes != 10 * node + 5 * row)
+		errorOut_("usage of tree 1: ", static_cast<int>(usage.bytes), 0);
+	fs.tryMem("b", usage);
+	if (usage.nodes != 4 || usage.bytes != 4 * node + 3 * row) errorOut_("usage of b: ", static_cast<int>(usage.bytes), 0);
+	fs.tryMem("b/bb1/bbb.txt", usage);
+	if (usage.nodes != 1 || usage.bytes != node) errorOut_("usage of a file: ", static_cast<int>(usage.bytes), 0);
+	if (fs.tryMem("b/nothing", usage) != Status::FileNotFound) errorOut_("usage of a missing name", 0);
+	if (fs.tryMem("a.txt/x", usage) != Status::InvalidPath) errorOut_("usage below a file", 0);
+
+	string longName(40, 'q');
+	fs.tryCd("e");
+	fs.tryTouch(longName);
+	fs.tryMem(longName, usage);
+	if (usage.bytes != node + row + 41) errorOut_("usage of a long name: ", static_cast<int>(usage.bytes), 1);
+	fs.tryMem("..", usage);
+	if (usage.nodes != 11 || usage.bytes != 11 * node + 6 * row + 41) errorOut_("root after touch: ", static_cast<int>(usage.bytes), 1);
+	fs.tryCd("..");
+	fs.tryMv("b", "e");
+	fs.tryMem("e", usage);
+	if (usage.nodes != 7) errorOut_("e after mv: ", static_cast<int>(usage.nodes), 1);
+	fs.tryCd("e");
+	fs.tryMv("b", longName + "dir");
+	fs.tryCp(longName + "dir", "copy", true);
+	fs.tryCd("copy");
+	for (int i = 0; i < 300; i++) fs.tryTouch("f" + std::to_string(i)); // big enough for an index
+	fs.tryCd("/");
+	std::vector<BatchOp> ops = {{BatchOp::Kind::Mkdir, "e/copy/g", ""}, {BatchOp::Kind::Rm, "e/copy/f7", ""},
+	                            {BatchOp::Kind::Touch, "/c.txt.2", ""}};
+	std::vector<Status> results;
+	fs.applyBatch(ops, results);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after mv, cp, index and batch: ", s, 2);
+	fs.tryCd("e");
+	fs.tryRm(longName + "dir", true);
+	fs.tryRm(longName);
+	fs.tryCd("copy");
+	for (int i = 0; i < 300; i++) fs.tryRm("f" + std::to_string(i));
+	fs.tryCd("/");
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after rm: ", s, 2);
+
+	}
+	{
+
+	// a budget refuses growth past it with its own status, nothing else
+	FileSystem fs("2");
+	MemUsage usage;
+	fs.tryMem("", usage);
+	fs.setMemoryBudget(usage.bytes + 2 * (node + row));
+	if (fs.tryTouch("x1") != Status::Ok || fs.tryMkdir("x2") != Status::Ok) errorOut_("growth within the budget refused", 3);
+	if (fs.tryTouch("x3") != Status::MemoryBudgetExceeded) errorOut_("touch past the budget", 3);
+	if (fs.tryMkdir("x3") != Status::MemoryBudgetExceeded) errorOut_("mkdir past the budget", 3);
+	if (fs.tryCp("a.txt", "x3") != Status::MemoryBudgetExceeded) errorOut_("cp past the budget", 3);
+	if (fs.tryTouch("a.txt") != Status::AlreadyExists) errorOut_("other errors come first", 3);
+	// two files without rows make room for one with a row
+	std::vector<BatchOp> ops = {{BatchOp::Kind::Rm, "a.txt", ""}, {BatchOp::Kind::Rm, "c.txt", ""},
+	                            {BatchOp::Kind::Touch, "x3", ""}, {BatchOp::Kind::Touch, "x4", ""}};
+	std::vector<Status> results;
+	fs.applyBatch(ops, results);
+	if (results[2] != Status::Ok || results[3] != Status::MemoryBudgetExceeded)
+		errorOut_("batch past the budget", 4);
+	ans = fs.ls();
+
+	// a commit that would go past it changes nothing
+	Transaction tx;
+	fs.begin(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Rm, "e.txt", ""});
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "y1", ""});
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "y2", ""});
+	if (fs.commit(tx) != Status::MemoryBudgetExceeded) errorOut_("commit past the budget", 4);
+	if (fs.ls() != ans) errorOut_("commit past the budget left changes: ", ans, fs.ls(), 4);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after the undone commit: ", s, 4);
+
+	fs.setMemoryBudget(0);
+	if (fs.tryTouch("x4") != Status::Ok) errorOut_("budget not removed", 4);
+
+	}
+	{
+
+	// the mem command
+	FileSystem* fs = new FileSystem("1");
+	CommandShell shell;
+	shell.run(fs, "mem b", s);
+	ans = "nodes: 4 (" + std::to_string(4 * node) + " bytes)\nnames, metadata, indexes: " + std::to_string(3 * row) +
+	      " bytes\ntotal: " + std::to_string(4 * node + 3 * row) + " bytes";
+	if (s != ans) errorOut_("mem b: ", ans, s, 5);
+	shell.run(fs, "mem --budget 1", s);
+	shell.run(fs, "touch z", s);
+	if (s != "memory budget exceeded") errorOut_("touch in the shell: ", "memory budget exceeded", s, 5);
+	shell.run(fs, "mem b/bb1/bbb.txt", s);
+	ans = "nodes: 1 (" + std::to_string(node) + " bytes)\nnames, metadata, indexes: 0 bytes\ntotal: " +
+	      std::to_string(node) + " bytes\nbudget: " + std::to_string(10 * node + 5 * row) + " of 1 bytes used";
+	if (s != ans) errorOut_("mem with a budget: ", ans, s, 5);
+	shell.run(fs, "mem --budget x", s);
+	if (s != "usage: mem [path] | mem --budget <bytes>") errorOut_("mem --budget x: ", s, 5);
+	delete fs;
+
+	}
+	{
+
+	// usage is checked without recursion on a chain deeper than the stack
+	GenSpec spec;
+	spec.depth = 300000;
+	spec.minFanout = spec.maxFanout = 1;
+	spec.filePercent = 0;
+	FileSystem fs(spec);
+	MemUsage usage;
+	if (fs.tryMem("/", usage) != Status::Ok || usage.nodes != 300001)
+		errorOut_("usage of deep chain, nodes: ", static_cast<int>(usage.nodes), 6);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("deep chain with accounting: ", s, 6);
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testT() {
+	funcname_ = "FileSystemTester::testT";
+	string s, ans;
+	{
+
+	// every op gives what one FileSystem gives, mv between shards included
+	ShardedFileSystem sharded(4);
+	FileSystem ref;
+	std::vector<Status> results;
+	auto both = [&](ShardOp::Kind kind, const string& path, const string& dest, unsigned errBit) {
+		ShardOp op;
+		op.kind = kind;
+		op.path = path;
+		op.dest = dest;
+		Status status = sharded.run(0, op);
+		if (kind == ShardOp::Kind::Ls || kind == ShardOp::Kind::Tree) {
+			for (size_t pos = 1; pos < path.size();) {
+				size_t slash = std::min(path.find('/', pos), path.size());
+				ref.tryCd(path.substr(pos, slash - pos));
+				pos = slash + 1;
+			}
+			ans = kind == ShardOp::Kind::Ls ? ref.ls() : ref.tree();
+			ref.tryCd("/");
+			if (op.out != ans) errorOut_((kind == ShardOp::Kind::Ls ? "ls " : "tree ") + path + ": ", ans, op.out, errBit);
+			return;
+		}
+		ref.applyBatch({BatchOp{static_cast<BatchOp::Kind>(kind), path, dest}}, results);
+		if (status != results[0]) {
+			errorOut_("status of " + path + " " + dest + ": " + statusMessage(status) + ", not ", statusMessage(results[0]), errBit);
+		}
+	};
+
+	// names on two different shards
+	string a = "d0", b;
+	for (int i = 1; b.empty(); i++) {
+		if (sharded.shardOf("d" + std::to_string(i)) != sharded.shardOf(a)) b = "d" + std::to_string(i);
+	}
+	for (int i = 0; i < 12; i++) {
+		both(ShardOp::Kind::Mkdir, "/d" + std::to_string(i), "", 0);
+		both(ShardOp::Kind::Touch, "/f" + std::to_string(i), "", 0);
+		both(ShardOp::Kind::Touch, "/d" + std::to_string(i) + "/x" + std::to_string(i), "", 0);
+	}
+	both(ShardOp::Kind::Mkdir, "/" + a + "/sub", "", 0);
+	both(ShardOp::Kind::Touch, "/" + a + "/sub/y", "", 0);
+	both(ShardOp::Kind::Touch, "/f0", "", 0);
+	both(ShardOp::Kind::Rm, "/f11", "", 0);
+	both(ShardOp::Kind::Rmdir, "/" + a, "", 0);
+	both(ShardOp::Kind::Ls, "/", "", 0);
+	both(ShardOp::Kind::Tree, "/", "", 0);
+	both(ShardOp::Kind::Tree, "/" + a, "", 0);
+	both(ShardOp::Kind::Ls, "/" + a + "/sub", "", 0);
+
+	// into a directory on another shard, and back up to /
+	both(ShardOp::Kind::Mv, "/" + a, b, 1);
+	both(ShardOp::Kind::Tree, "/", "", 1);
+	both(ShardOp::Kind::Mv, "/" + b + "/" + a, "..", 1);
+	both(ShardOp::Kind::Tree, "/", "", 1);
+	// renames to names hashed elsewhere
+	for (int i = 0; i < 8; i++) both(ShardOp::Kind::Mv, "/f" + std::to_string(i), "g" + std::to_string(i), 1);
+	for (int i = 0; i < 8; i++) both(ShardOp::Kind::Mv, "/d" + std::to_string(i), "e" + std::to_string(i), 1);
+	both(ShardOp::Kind::Tree, "/", "", 1);
+	s = sharded.checkInvariants();
+	if (s != "") errorOut_("after moves: ", s, 1);
+
+	// refused moves change nothing
+	both(ShardOp::Kind::Mv, "/nothing", b, 2);
+	both(ShardOp::Kind::Mv, "/g1", "g2", 2);
+	both(ShardOp::Kind::Mv, "/e1", "g2", 2);
+	both(ShardOp::Kind::Mkdir, "/e2/g3", "", 2);
+	both(ShardOp::Kind::Mv, "/g3", "e2", 2);
+	both(ShardOp::Kind::Mv, "/e2/g3", "..", 2);
+	both(ShardOp::Kind::Mv, "/e3/x3", "..", 2);
+	both(ShardOp::Kind::Mv, "/e4", "e4", 2);
+	both(ShardOp::Kind::Tree, "/", "", 2);
+	s = sharded.checkInvariants();
+	if (s != "") errorOut_("after refused moves: ", s, 2);
+
+	}
+	{
+
+	// clients at once, each on its own names, moving them between shards
+	const unsigned clients = 3;
+	const int rounds = 300;
+	ShardedFileSystem sharded(3, clients);
+	std::vector<std::thread> threads;
+	std::atomic<int> failures(0);
+	for (unsigned c = 0; c < clients; c++) {
+		threads.emplace_back([&sharded, &failures, c]() {
+			string me = "c" + std::to_string(c) + "_";
+			ShardOp ops[4];
+			for (int i = 0; i < rounds; i++) {
+				string name = me + std::to_string(i);
+				ops[0].kind = ShardOp::Kind::Mkdir;
+				ops[0].path = "/" + name;
+				ops[1].kind = ShardOp::Kind::Touch;
+				ops[1].path = "/" + name + "/f";
+				for (int k = 0; k < 2; k++) sharded.submit(c, ops[k]);
+				for (int k = 0; k < 2; k++) if (sharded.wait(ops[k]) != Status::Ok) failures++;
+				ops[2].kind = ShardOp::Kind::Mv;
+				ops[2].path = "/" + name;
+				ops[2].dest = name + "m";
+				if (sharded.run(c, ops[2]) != Status::Ok) failures++;
+				if (i % 2 == 0) continue;
+				// into the previous one, then back up
+				ops[3].kind = ShardOp::Kind::Mv;
+				ops[3].path = "/" + name + "m";
+				ops[3].dest = me + std::to_string(i - 1) + "m";
+				if (sharded.run(c, ops[3]) != Status::Ok) failures++;
+				ops[3].path = "/" + me + std::to_string(i - 1) + "m/" + name + "m";
+				ops[3].dest = "..";
+				if (sharded.run(c, ops[3]) != Status::Ok) failures++;
+			}
+		});
+	}
+	for (std::thread& t : threads) t.join();
+	if (failures != 0) errorOut_("ops failed with clients at once: ", failures, 3);
+	s = sharded.checkInvariants();
+	if (s != "") errorOut_("with clients at once: ", s, 3);
+	ShardOp ls;
+	ls.kind = ShardOp::Kind::Ls;
+	ls.path = "/";
+	sharded.run(0, ls);
+	size_t entries = std::count(ls.out.begin(), ls.out.end(), '\n') + 1;
+	if (entries != clients * rounds) errorOut_("entries after clients at once: ", static_cast<int>(entries), 3);
+
+	}
+	{
+
+	// workers allocate from caches of their own and give every slot and row back
+	const int dirs = 10000;
+	Reclaimer::drain();
+	uint64_t slots = NodePool::slotsInUse(), rows = MetaTable::rowsInUse();
+	ShardedFileSystem* sharded = new ShardedFileSystem(2);
+	ShardOp op;
+	auto run = [&](ShardOp::Kind kind, const string& path) {
+		op.kind = kind;
+		op.path = path;
+		if (sharded->run(0, op) != Status::Ok) errorOut_(path + ": ", statusMessage(op.status), 4);
+	};
+	for (int i = 0; i < dirs; i++) {
+		run(ShardOp::Kind::Mkdir, "/t" + std::to_string(i));
+		run(ShardOp::Kind::Touch, "/t" + std::to_string(i) + "/f");
+	}
+	if (NodePool::slotsInUse() != slots + 2 * dirs + 2)
+		errorOut_("slots in use with cached workers: ", static_cast<int>(NodePool::slotsInUse() - slots), 4);
+	for (int i = 0; i < dirs; i++) {
+		run(ShardOp::Kind::Rm, "/t" + std::to_string(i) + "/f");
+		run(ShardOp::Kind::Rmdir, "/t" + std::to_string(i));
+	}
+	if (NodePool::slotsInUse() != slots + 2)
+		errorOut_("slots in use after rm: ", static_cast<int>(NodePool::slotsInUse() - slots), 4);
+	delete sharded;
+	Reclaimer::drain();
+	if (NodePool::slotsInUse() != slots) errorOut_("slots not given back: ", static_cast<int>(NodePool::slotsInUse() - slots), 4);
+	if (MetaTable::rowsInUse() != rows) errorOut_("rows not given back: ", static_cast<int>(MetaTable::rowsInUse() - rows), 4);
+
+	}
+	passOut_();
+}
+
+void FileSystemTester::testU() {
+	funcname_ = "FileSystemTester::testU";
+	string s, ans;
+	char base[] = "/tmp/fstestXXXXXX";
+	if (mkdtemp(base) == nullptr) {
+		errorOut_("mkdtemp failed", 0);
+		return;
+	}
+	string store = string(base) + "/store";
+	CheckpointReport report;
+	// cd takes one name at a time
+	auto cdPath = [](FileSystem& fs, const string& path) {
+		for (size_t pos = 0; pos < path.size();) {
+			size_t slash = std::min(path.find('/', pos), path.size());
+			fs.tryCd(path.substr(pos, slash - pos));
+			pos = slash + 1;
+		}
+	};
+	{
+
+	// the first checkpoint writes every directory, later ones what changed
+	FileSystem fs("1");
+	if (fs.checkpoint(store, report) != Status::Ok || report.directories != 5 || report.segments != 1)
+		errorOut_("first checkpoint wrote: ", static_cast<int>(report.directories), 0);
+	cdPath(fs, "b/bb1");
+	fs.tryTouch("new.txt");
+	fs.tryCd("/");
+	fs.checkpoint(store, report);
+	if (report.directories != 1) errorOut_("touch in bb1 wrote: ", static_cast<int>(report.directories), 0);
+	fs.tryCd("e");
+	fs.tryMkdir("x");
+	fs.tryCd("x");
+	fs.tryTouch("y");
+	fs.tryCd("/");
+	fs.checkpoint(store, report);
+	if (report.directories != 2) errorOut_("mkdir in e wrote: ", static_cast<int>(report.directories), 0);
+	fs.tryMv("b", "e");
+	fs.checkpoint(store, report);
+	if (report.directories != 2) errorOut_("mv b e wrote: ", static_cast<int>(report.directories), 0);
+	fs.checkpoint(store, report);
+	if (report.directories != 0 || report.bytes != 0 || report.segments != 4)
+		errorOut_("checkpoint without changes wrote: ", static_cast<int>(report.bytes), 0);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after checkpoints: ", s, 0);
+
+	// a restored tree is the same, and checkpoints on from where it was
+	ans = fs.tree();
+	FileSystem copy;
+	if (copy.restore(store) != Status::Ok) errorOut_("restore failed", 1);
+	if (copy.tree() != ans) errorOut_("restored tree: ", ans, copy.tree(), 1);
+	s = copy.checkInvariants();
+	if (s != "") errorOut_("after restore: ", s, 1);
+	cdPath(copy, "e/b/bb2");
+	copy.tryTouch("z");
+	copy.tryCd("/");
+	copy.checkpoint(store, report);
+	if (report.directories != 1) errorOut_("touch after restore wrote: ", static_cast<int>(report.directories), 1);
+	FileSystem again;
+	again.restore(store);
+	if (again.tree() != copy.tree()) errorOut_("restored twice: ", copy.tree(), again.tree(), 1);
+
+	}
+	{
+
+	// compaction merges segments into one base that restores the same
+	string compacted = string(base) + "/compacted";
+	FileSystem fs;
+	for (size_t i = 0; i < CheckpointStore::kCompactAfter + 3; i++) {
+		string name = "d" + std::to_string(i);
+		fs.tryMkdir(name);
+		fs.tryCd(name);
+		fs.tryTouch("f");
+		fs.tryCd("/");
+		if (i % 3 == 2) fs.tryRm("d" + std::to_string(i - 1), true);
+		if (fs.checkpoint(compacted, report) != Status::Ok) errorOut_("checkpoint failed", 2);
+	}
+	fs.waitCompaction();
+	if (fs.checkpointSegments() >= CheckpointStore::kCompactAfter)
+		errorOut_("segments after compaction: ", static_cast<int>(fs.checkpointSegments()), 2);
+	FileSystem copy;
+	copy.restore(compacted);
+	if (copy.tree() != fs.tree()) errorOut_("restored after compaction: ", fs.tree(), copy.tree(), 2);
+
+	}
+	{
+
+	// errors, and the shell commands
+	FileSystem fs("2");
+	if (fs.restore(string(base) + "/missing") != Status::CheckpointUnreadable) errorOut_("restore of nothing", 3);
+	if (fs.checkpoint(string(base) + "/missing/deeper", report) != Status::CheckpointFailed)
+		errorOut_("checkpoint into a missing directory", 3);
+	Session session;
+	fs.openSession(session);
+	if (fs.restore(store) != Status::DirectoryInUse) errorOut_("restore with a session open", 3);
+	fs.closeSession(session);
+	if (fs.ls() != "a.txt\nb/\nc.txt\nd/\ne.txt\nf/\ng.txt\nh/") errorOut_("failed restore changed the tree", 3);
+
+	FileSystem* shellFs = new FileSystem("1");
+	CommandShell shell;
+	shell.run(shellFs, "checkpoint " + string(base) + "/shell", s);
+	if (s.compare(0, 29, "checkpoint 1: 5 directories, ") != 0) errorOut_("checkpoint in the shell: ", s, 3);
+	shell.run(shellFs, "checkpoint " + string(base) + "/shell", s);
+	if (s != "nothing changed since checkpoint 1") errorOut_("checkpoint without changes: ", s, 3);
+	shell.run(shellFs, "rm -r b", s);
+	shell.run(shellFs, "restore " + string(base) + "/shell", s);
+	if (s != "" || shellFs->ls() != "a.txt\nb/\nc.txt\nd.txt\ne/") errorOut_("restore in the shell: ", s, 3);
+	shell.run(shellFs, "restore", s);
+	if (s != "usage: restore [--paged <bytes>] <hostdir>") errorOut_("restore without a directory: ", s, 3);
+	delete shellFs;
+
+	}
+	string cleanup = string("rm -rf ") + base;
+	if (system(cleanup.c_str()) != 0) errorOut_("cleanup failed", 4);
+	passOut_();
+}
+
+void FileSystemTester::testV() {
+	funcname_ = "FileSystemTester::testV";
+	string s, ans;
+	char base[] = "/tmp/fstestXXXXXX";
+	if (mkdtemp(base) == nullptr) {
+		errorOut_("mkdtemp failed", 0);
+		return;
+	}
+	string store = string(base) + "/store";
+	CheckpointReport report;
+	MemUsage usage;
+	// a counter as the stats command shows it
+	auto counter = [](const string& name) -> uint64_t {
+		string all = Stats::report();
+		size_t at = all.find("\n" + name + ": ");
+		return at == string::npos ? 0 : std::stoull(all.substr(at + name.size() + 3));
+	};
+	// first directory of the current one that is not empty, with deep
+	// one that has such a directory itself
+	std::function<string(FileSystem&, bool)> fullDir = [&fullDir](FileSystem& fs, bool deep) -> string {
+		string listing = fs.ls() + "\n";
+		for (size_t pos = 0, end; (end = listing.find('\n', pos)) != string::npos; pos = end + 1) {
+			if (end == pos || listing[end - 1] != '/') continue;
+			string name = listing.substr(pos, end - pos - 1);
+			fs.tryCd(name);
+			bool found = deep ? fullDir(fs, false) != "" : fs.ls() != "";
+			fs.tryCd("..");
+			if (found) return name;
+		}
+		return "";
+	};
+	GenSpec spec;
+	spec.depth = 5;
+	spec.minFanout = 3;
+	spec.maxFanout = 8;
+	spec.filePercent = 40;
+	FileSystem full(spec);
+	full.checkpoint(store, report);
+	ans = full.tree();
+	full.tryMem("/", usage);
+	uint64_t fullNodes = usage.nodes;
+	string a = fullDir(full, true);
+	full.tryCd(a);
+	string b = fullDir(full, true);
+	full.tryCd("/");
+	if (a == "" || b == "") errorOut_("generated tree too small", 0);
+	{
+
+	// directories come in as they are looked at, and show what was saved
+	Stats::reset();
+	FileSystem fs;
+	if (fs.restorePaged(store, 0) != Status::Ok) errorOut_("paged restore failed", 0);
+	fs.tryMem("/", usage);
+	if (usage.nodes != 1) errorOut_("nodes before any fault: ", static_cast<int>(usage.nodes), 0);
+	if (fs.ls() != full.ls()) errorOut_("paged ls: ", full.ls(), fs.ls(), 0);
+	if (counter("page_faults") != 1) errorOut_("faults after ls: ", static_cast<int>(counter("page_faults")), 0);
+	(void)fs.ls();
+	if (counter("page_faults") != 1 || counter("page_hits") == 0) errorOut_("second ls faulted", 0);
+	fs.tryCd(a);
+	fs.tryCd(b);
+	if (counter("page_faults") != 2) errorOut_("faults after cd a/b: ", static_cast<int>(counter("page_faults")), 0);
+	fs.tryCd("/");
+	if (fs.tree() != ans) errorOut_("paged tree: ", ans, fs.tree(), 0);
+	fs.tryMem("/", usage);
+	if (usage.nodes != fullNodes) errorOut_("nodes after tree: ", static_cast<int>(usage.nodes), 0);
+	if (Stats::report().find("page_hit_rate: ") == string::npos) errorOut_("no hit rate in stats", 0);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after faults: ", s, 0);
+
+	// changes are checkpointed to the same store, and only to it
+	fs.tryMkdir("new");
+	fs.tryCd("new");
+	fs.tryTouch("f");
+	fs.tryCd("/");
+	if (fs.checkpoint(store, report) != Status::Ok || report.directories != 2)
+		errorOut_("checkpoint of paged tree wrote: ", static_cast<int>(report.directories), 1);
+	if (fs.checkpoint(string(base) + "/other", report) != Status::CheckpointFailed)
+		errorOut_("paged tree checkpointed to another store", 1);
+	FileSystem copy;
+	copy.restore(store);
+	if (copy.tree() != fs.tree()) errorOut_("restored after paged changes: ", fs.tree(), copy.tree(), 1);
+	ans = copy.tree();
+
+	}
+	{
+
+	// past the limit cold subtrees go back to stubs, and come back the same
+	Stats::reset();
+	FileSystem fs;
+	fs.restorePaged(store, 1);
+	(void)fs.tree();
+	(void)fs.ls();
+	if (counter("page_evictions") == 0) errorOut_("nothing evicted", 2);
+	fs.tryMem("/", usage);
+	if (usage.nodes >= fullNodes) errorOut_("nodes after eviction: ", static_cast<int>(usage.nodes), 2);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after eviction: ", s, 2);
+	if (fs.tree() != ans) errorOut_("tree after eviction: ", ans, fs.tree(), 2);
+
+	// a changed directory is kept, so is the current one
+	fs.tryCd(a);
+	fs.tryTouch("kept");
+	fs.tryCd(b);
+	(void)fs.tree();
+	uint64_t faults = counter("page_faults");
+	uint64_t evictions = counter("page_evictions");
+	(void)fs.ls();
+	if (counter("page_faults") != faults) errorOut_("current directory evicted", 3);
+	if (counter("page_evictions") == evictions) errorOut_("nothing below the current directory evicted", 3);
+	fs.tryCd("/");
+	(void)fs.tree();
+	(void)fs.ls();
+	fs.tryCd(a);
+	if (fs.ls().find("kept") == string::npos) errorOut_("changed directory evicted: ", fs.ls(), 3);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after keeping: ", s, 3);
+
+	// eviction of a directory a transaction read makes it conflict
+	fs.tryCd(b);
+	(void)fs.ls();
+	Transaction tx;
+	fs.begin(tx);
+	fs.observe(tx);
+	fs.stage(tx, BatchOp{BatchOp::Kind::Touch, "t", ""});
+	fs.tryCd("/");
+	(void)fs.tree();
+	(void)fs.ls();
+	if (fs.commit(tx) != Status::TransactionConflict) errorOut_("commit after eviction", 4);
+
+	// so does metadata set in a paged directory, which is kept for it
+	fs.tryCd(a);
+	fs.tryCd(b);
+	string c = fullDir(fs, false);
+	fs.tryCd(c);
+	string first = fs.ls().substr(0, fs.ls().find('\n'));
+	if (first.back() == '/') first.pop_back();
+	fs.trySetMeta(first, 1234, 0600, 7);
+	fs.tryCd("/");
+	(void)fs.tree();
+	(void)fs.ls();
+	fs.tryCd(a);
+	fs.tryCd(b);
+	fs.tryCd(c);
+	NodeMeta meta;
+	if (fs.tryStat(first, meta) != Status::Ok || meta.size != 1234 || meta.mode != 0600 || meta.owner != 7)
+		errorOut_("metadata after eviction: size ", static_cast<int>(meta.size), 4);
+	s = fs.checkInvariants();
+	if (s != "") errorOut_("after setting metadata: ", s, 4);
+
+	}
+	{
+
+	// the shell
+	FileSystem* shellFs = new FileSystem();
+	CommandShell shell;
+	shell.run(shellFs, "restore --paged 100000 " + store, s);
+	if (s != "" || shellFs->tree() != ans) errorOut_("paged restore in the shell: ", s, 5);
+	shell.run(shellFs, "restore --paged lots " + store, s);
+	if (s != "usage: restore [--paged <bytes>] <hostdir>") errorOut_("restore --paged without a limit: ", s, 5);
+	delete shellFs;
+
+	}
+	string cleanup = string("rm -rf ") + base;
+	if (system(cleanup.c_str()) != 0) errorOut_("cleanup failed", 6);
+	passOut_();
+}
+
+// trace output is well formed, also while other threads are still tracing
+void FileSystemTester::testW() {
+	funcname_ = "FileSystemTester::testW";
+	string s, ans;
+	char path[] = "/tmp/fstraceXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		errorOut_("mkstemp failed", 0);
+		return;
+	}
+	close(fd);
+	auto readAll = [](const char* file) {
+		string text;
+		char buf[4096];
+		int in = open(file, O_RDONLY);
+		for (ssize_t got; in >= 0 && (got = read(in, buf, sizeof(buf))) > 0;) text.append(buf, static_cast<size_t>(got));
+		if (in >= 0) close(in);
+		return text;
+	};
+	{
+
+	// spans from the shell's thread and from one that keeps going through stop
+	FileSystem* fs = new FileSystem("1");
+	CommandShell shell;
+	shell.run(fs, string("trace start ") + path, s);
+	if (s != "") errorOut_("trace start: ", s, 1);
+	shell.run(fs, string("trace start ") + path, s);
+	if (s != "trace already running") errorOut_("second trace start: ", s, 1);
+	std::atomic<bool> stop(false);
+	std::atomic<int> rounds(0);
+	std::thread other([&stop, &rounds]() {
+		FileSystem mine;
+		while (!stop.load()) {
+			mine.tryTouch("f");
+			mine.tryRm("f");
+			rounds++;
+		}
+	});
+	const char* lines[] = { "touch n", "mkdir m", "ls", "tree", "cd b", "cd .." };
+	for (const char* line : lines) shell.run(fs, line, s);
+	while (rounds.load() < 100) std::this_thread::yield();
+	shell.run(fs, "trace stop", s);
+	stop = true;
+	other.join();
+	if (s != "") errorOut_("trace stop: ", s, 1);
+	shell.run(fs, "trace stop", s);
+	if (s != "trace not running") errorOut_("second trace stop: ", s, 1);
+	delete fs;
+
+	// {"traceEvents":[ then one complete event per line, then the trailer
+	string text = readAll(path);
+	const string head = "{\"traceEvents\":[";
+	const string tail = "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":0}}\n";
+	if (text.compare(0, head.size(), head) != 0 || text.size() < head.size() + tail.size() ||
+	    text.compare(text.size() - tail.size(), tail.size(), tail) != 0)
+		errorOut_("trace file framing: ", text.substr(0, 200), 2);
+	size_t pos = head.size() + 1, events = 0;
+	std::vector<string> names, tids;
+	while (pos < text.size() - tail.size() + 1) {
+		size_t end = text.find('\n', pos);
+		string line = text.substr(pos, end - pos);
+		pos = end + 1;
+		if (!line.empty() && line.back() == ',') line.pop_back();
+		const string name = "{\"name\":\"", mid = "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+		size_t at = line.find(mid), ts = line.find(",\"ts\":"), dur = line.find(",\"dur\":");
+		if (line.compare(0, name.size(), name) != 0 || at == string::npos || ts == string::npos ||
+		    dur == string::npos || line.back() != '}' || std::stod(line.substr(dur + 7)) < 0) {
+			errorOut_("malformed trace event: ", line, 2);
+			break;
+		}
+		names.push_back(line.substr(name.size(), at - name.size()));
+		tids.push_back(line.substr(at + mid.size(), ts - at - mid.size()));
+		events++;
+	}
+	if (events == 0) errorOut_("no trace events", 2);
+	if (std::find(names.begin(), names.end(), "insertChildAlphabetical") == names.end() ||
+	    std::find(names.begin(), names.end(), "findChild") == names.end())
+		errorOut_("expected spans missing from the trace", 2);
+	std::sort(tids.begin(), tids.end());
+	if (std::unique(tids.begin(), tids.end()) - tids.begin() < 2)
+		errorOut_("trace holds only one thread", 2);
+
+	// a new session starts empty, nothing of the last one comes back
+	if (Tracer::start(path) != "" || Tracer::stop() != "") errorOut_("empty trace session", 3);
+	ans = "{\"traceEvents\":[" + tail;
+	s = readAll(path);
+	if (s != ans) errorOut_("empty trace session: ", ans, s, 3);
+
+	}
+	unlink(path);
+	passOut_();
+}
+
+void FileSystemTester::testX() {
+	funcname_ = "FileSystemTester::testX";
+	string s, ans;
+	// the count column of a command's row in the stats table
+	auto row = [](const string& report, const string& name) -> long long {
+		size_t at = report.find("\n" + name + " ");
+		return at == string::npos ? -1 : std::stoll(report.substr(at + name.size() + 1));
+	};
+	// a counter as the stats command shows it
+	auto counter = [](const string& report, const string& name) -> long long {
+		size_t at = report.find("\n" + name + ": ");
+		return at == string::npos ? -1 : std::stoll(report.substr(at + name.size() + 3));
+	};
+	{
+
+	// the table counts every command but stats itself and unknown ones
+	FileSystem* fs = new FileSystem("1");
+	CommandShell shell;
+	shell.run(fs, "stats reset", s);
+	if (s != "") errorOut_("stats reset: ", s, 0);
+	const char* lines[] = { "touch a", "touch b", "mkdir d", "ls", "cd d", "cd ..", "bogus", "stats" };
+	for (const char* line : lines) shell.run(fs, line, s);
+	char header[160];
+	std::snprintf(header, sizeof(header), "%-8s %10s %12s %12s %12s %12s",
+	              "command", "count", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+	if (s.compare(0, s.find('\n'), header) != 0) errorOut_("stats header: ", header, s.substr(0, s.find('\n')), 0);
+	if (row(s, "touch") != 2 || row(s, "mkdir") != 1 || row(s, "ls") != 1 || row(s, "cd") != 2 ||
+	    row(s, "rm") != 0 || row(s, "tree") != 0)
+		errorOut_("stats counts: ", s, 0);
+	if (counter(s, "findchild_visits") <= 0 || counter(s, "tx_conflicts") != 0)
+		errorOut_("stats counters: ", s, 0);
+	if (std::count(s.begin(), s.end(), '\n') != static_cast<int>(Command::Count) + static_cast<int>(Counter::Count) ||
+	    s.back() == '\n' || s.find("page_hit_rate") != string::npos)
+		errorOut_("stats line count: ", s, 0);
+
+	// the same numbers as JSON
+	shell.run(fs, "stats --json", s);
+	if (s.compare(0, 26, "{\"commands\":{\"cd\":{\"count\"") != 0 || s.find("\"touch\":{\"count\":2,") == string::npos ||
+	    s.find("\"rm\":{\"count\":0,\"sum_ns\":0,\"max_ns\":0,\"buckets\":{}}") == string::npos ||
+	    s.find("},\"counters\":{\"findchild_visits\":") == string::npos ||
+	    s.find("\"tx_conflicts\":0,") == string::npos)
+		errorOut_("stats --json: ", s, 1);
+	ans = "},\"page_hit_rate\":0.0000}";
+	if (s.size() < ans.size() || s.compare(s.size() - ans.size(), ans.size(), ans) != 0)
+		errorOut_("stats --json trailer: ", s, 1);
+
+	// reset clears both views, and usage for anything else
+	shell.run(fs, "stats reset", s);
+	if (s != "") errorOut_("second stats reset: ", s, 2);
+	shell.run(fs, "stats", s);
+	for (int i = 0; i < static_cast<int>(Command::Count); i++) {
+		if (row(s, Stats::commandName(static_cast<Command>(i))) != 0) errorOut_("stats after reset: ", s, 2);
+	}
+	for (int i = 0; i < static_cast<int>(Counter::Count); i++) {
+		if (counter(s, Stats::counterName(static_cast<Counter>(i))) != 0) errorOut_("stats after reset: ", s, 2);
+	}
+	shell.run(fs, "stats --json", s);
+	if (s.find("\"touch\":{\"count\":0,\"sum_ns\":0,\"max_ns\":0,\"buckets\":{}}") == string::npos)
+		errorOut_("stats --json after reset: ", s, 2);
+	shell.run(fs, "stats now", s);
+	if (s != "usage: stats [--json|reset]") errorOut_("stats usage: ", s, 2);
+	delete fs;
+
+	// resets while another thread counts, and a thread that is gone
+	std::atomic<bool> stop(false);
+	std::atomic<int> rounds(0);
+	std::thread busy([&stop, &rounds]() {
+		while (!stop.load()) {
+			Stats::count(Counter::TxConflicts);
+			Stats::recordCommand(Command::Rm, 5);
+			rounds++;
+		}
+	});
+	for (int i = 0; i < 100; i++) {
+		Stats::reset();
+		while (rounds.load() < i) std::this_thread::yield();
+	}
+	stop = true;
+	busy.join();
+	Stats::reset();
+	s = Stats::report();
+	if (counter(s, "tx_conflicts") != 0 || row(s, "rm") != 0) errorOut_("stats after busy thread: ", s, 3);
+	std::thread later([]() {
+		Stats::count(Counter::TxConflicts, 5);
+		Stats::recordCommand(Command::Rm, 5);
+	});
+	later.join();
+	s = Stats::report();
+	if (counter(s, "tx_conflicts") != 5 || row(s, "rm") != 1) errorOut_("stats after later thread: ", s, 3);
+	Stats::reset();
+	Stats::count(Counter::TxConflicts);
+	s = Stats::report();
+	if (counter(s, "tx_conflicts") != 1 || row(s, "rm") != 0) errorOut_("stats after reset of gone thread: ", s, 3);
+
+	}
+	passOut_();
+}
+
 void FileSystemTester::errorOut_(const string& errMsg, unsigned int errBit) {
 
 	cerr << funcname_ << ":" << " fail" << errBit << ": ";
@@ -49,6 +49,76 @@ public:
 	// unused
 	void testz();
 
+	// status api
+	void testA();
+
+	// big (indexed) directories, paged ls
+	void testB();
+
+	// prefix listing, completion
+	void testC();
+
+	// compact storage engine matches FileSystem
+	void testD();
+
+	// cp, cp -r
+	void testE();
+
+	// rm -r, background reclamation
+	void testF();
+
+	// synthetic tree generator
+	void testG();
+
+	// structural invariants under random commands
+	void testH();
+
+	// command line tokenizer and verb table
+	void testI();
+
+	// string_view, const char* and string&& arguments
+	void testJ();
+
+	// sessions, socket server
+	void testK();
+
+	// batch operations match running them one by one
+	void testL();
+
+	// transactions: all or nothing, conflicts
+	void testM();
+
+	// watches: events, recursion, overflow, a consumer thread
+	void testN();
+
+	// import of a host directory tree
+	void testO();
+
+	// metadata side tables, ls -l, stat
+	void testP();
+
+	// tree with depth and node limits, expanding elided directories
+	void testQ();
+
+	// memoized tree renderings stay in step with changes
+	void testR();
+
+	// memory usage per subtree and the memory budget
+	void testS();
+
+	// sharded mode agrees with one FileSystem, mv between shards
+	void testT();
+
+	// incremental checkpoints, restore and compaction
+	void testU();
+	void testV();
+
+	// trace output is well formed
+	void testW();
+
+	// stats, stats --json and stats reset output
+	void testX();
+
 private:
 
 	// four overloaded versions
@@ -34,7 +34,31 @@ int main(int argc, char* argv[]) {
 		case 'x': { FileSystemTester t; t.testx(); } break;
 		case 'y': { FileSystemTester t; t.testy(); } break;
 		case 'z': { FileSystemTester t; t.testz(); } break;
-		default: { cout << "Options are a -- z." << endl; } break;
+		case 'A': { FileSystemTester t; t.testA(); } break;
+		case 'B': { FileSystemTester t; t.testB(); } break;
+		case 'C': { FileSystemTester t; t.testC(); } break;
+		case 'D': { FileSystemTester t; t.testD(); } break;
+		case 'E': { FileSystemTester t; t.testE(); } break;
+		case 'F': { FileSystemTester t; t.testF(); } break;
+		case 'G': { FileSystemTester t; t.testG(); } break;
+		case 'H': { FileSystemTester t; t.testH(); } break;
+		case 'I': { FileSystemTester t; t.testI(); } break;
+		case 'J': { FileSystemTester t; t.testJ(); } break;
+		case 'K': { FileSystemTester t; t.testK(); } break;
+		case 'L': { FileSystemTester t; t.testL(); } break;
+		case 'M': { FileSystemTester t; t.testM(); } break;
+		case 'N': { FileSystemTester t; t.testN(); } break;
+		case 'O': { FileSystemTester t; t.testO(); } break;
+		case 'P': { FileSystemTester t; t.testP(); } break;
+		case 'Q': { FileSystemTester t; t.testQ(); } break;
+		case 'R': { FileSystemTester t; t.testR(); } break;
+		case 'S': { FileSystemTester t; t.testS(); } break;
+		case 'T': { FileSystemTester t; t.testT(); } break;
+		case 'U': { FileSystemTester t; t.testU(); } break;
+		case 'V': { FileSystemTester t; t.testV(); } break;
+		case 'W': { FileSystemTester t; t.testW(); } break;
+		case 'X': { FileSystemTester t; t.testX(); } break;
+		default: { cout << "Options are a -- z, A -- X." << endl; } break;
 	       	}
 	}
 	return 0;
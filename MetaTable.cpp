@@ -0,0 +1,186 @@
+#include "MetaTable.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+
+const uint32_t kPageRows = 4096;
+const uint32_t kMaxPages = 1 << 16;
+
+// One column slice per field, so reading one field of many rows stays dense.
+struct Page {
+    int64_t ctime[kPageRows];
+    int64_t mtime[kPageRows];
+    uint64_t size[kPageRows];
+    uint32_t mode[kPageRows];
+    uint32_t owner[kPageRows];
+    uint64_t usageBytes[kPageRows];
+    uint64_t usageNodes[kPageRows];
+    uint32_t checkpointId[kPageRows];
+};
+static_assert(sizeof(Page) == MetaTable::kRowBytes * kPageRows, "kRowBytes is out of date");
+
+// A bound thread's own free ids. Only its thread touches ids; held is
+// published for rowsInUse().
+struct IdCache {
+    std::vector<uint32_t> ids;
+    std::atomic<uint64_t> held{0};
+    IdCache* next = nullptr; // in caches, under tableMutex
+};
+
+std::mutex tableMutex;
+Page* pages[kMaxPages];           // pages[id / kPageRows], created as ids reach them
+std::vector<uint32_t> freeIds;    // under tableMutex
+uint32_t nextId = 1;              // 0 is MetaTable::kNone
+IdCache* caches = nullptr;        // every bound thread's ids, under tableMutex
+thread_local IdCache* cache = nullptr;
+
+inline Page& pageOf(uint32_t id) {
+    return *pages[id / kPageRows];
+}
+
+// The cache ran dry: take up to kPageRows released ids, or if there are
+// none the rest of the page nextId is on. False once every id is taken.
+bool refill(IdCache& c) {
+    std::lock_guard<std::mutex> lock(tableMutex);
+    while (c.ids.size() < kPageRows && !freeIds.empty()) {
+        c.ids.push_back(freeIds.back());
+        freeIds.pop_back();
+    }
+    if (!c.ids.empty()) return true;
+    if (nextId / kPageRows >= kMaxPages) return false;
+    if (pages[nextId / kPageRows] == nullptr) pages[nextId / kPageRows] = new Page();
+    uint32_t end = (nextId / kPageRows + 1) * kPageRows;
+    for (uint32_t id = end; id-- > nextId;) c.ids.push_back(id); // lowest first out
+    nextId = end;
+    return true;
+}
+
+} // namespace
+
+uint32_t MetaTable::allocate() {
+    uint32_t id;
+    if (IdCache* c = cache) {
+        if (c->ids.empty() && !refill(*c)) return kNone;
+        id = c->ids.back();
+        c->ids.pop_back();
+        c->held.store(c->ids.size(), std::memory_order_relaxed);
+    } else {
+        std::lock_guard<std::mutex> lock(tableMutex);
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        } else {
+            if (nextId / kPageRows >= kMaxPages) return kNone;
+            id = nextId++;
+            if (pages[id / kPageRows] == nullptr) pages[id / kPageRows] = new Page();
+        }
+    }
+    write(id, NodeMeta());
+    setUsage(id, 0, 0);
+    setCheckpointId(id, 0);
+    return id;
+}
+
+void MetaTable::release(uint32_t id) {
+    if (IdCache* c = cache) {
+        c->ids.push_back(id);
+        if (c->ids.size() > 2 * kPageRows) {
+            // More than it will use soon: give a page's worth back.
+            std::lock_guard<std::mutex> lock(tableMutex);
+            freeIds.insert(freeIds.end(), c->ids.end() - kPageRows, c->ids.end());
+            c->ids.resize(c->ids.size() - kPageRows);
+        }
+        c->held.store(c->ids.size(), std::memory_order_relaxed);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(tableMutex);
+    freeIds.push_back(id);
+}
+
+void MetaTable::bindThread() {
+    if (cache != nullptr) return;
+    IdCache* c = new IdCache();
+    std::lock_guard<std::mutex> lock(tableMutex);
+    c->next = caches;
+    caches = c;
+    cache = c;
+}
+
+void MetaTable::unbindThread() {
+    IdCache* c = cache;
+    if (c == nullptr) return;
+    cache = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(tableMutex);
+        freeIds.insert(freeIds.end(), c->ids.begin(), c->ids.end());
+        IdCache** link = &caches;
+        while (*link != c) link = &(*link)->next;
+        *link = c->next;
+    }
+    delete c;
+}
+
+void MetaTable::read(uint32_t id, NodeMeta& meta) {
+    Page& page = pageOf(id);
+    uint32_t row = id % kPageRows;
+    meta.ctime = page.ctime[row];
+    meta.mtime = page.mtime[row];
+    meta.size = page.size[row];
+    meta.mode = page.mode[row];
+    meta.owner = page.owner[row];
+}
+
+void MetaTable::write(uint32_t id, const NodeMeta& meta) {
+    Page& page = pageOf(id);
+    uint32_t row = id % kPageRows;
+    page.ctime[row] = meta.ctime;
+    page.mtime[row] = meta.mtime;
+    page.size[row] = meta.size;
+    page.mode[row] = meta.mode;
+    page.owner[row] = meta.owner;
+}
+
+void MetaTable::setMtime(uint32_t id, int64_t ns) {
+    pageOf(id).mtime[id % kPageRows] = ns;
+}
+
+void MetaTable::usage(uint32_t id, uint64_t& bytes, uint64_t& nodes) {
+    Page& page = pageOf(id);
+    bytes = page.usageBytes[id % kPageRows];
+    nodes = page.usageNodes[id % kPageRows];
+}
+
+void MetaTable::setUsage(uint32_t id, uint64_t bytes, uint64_t nodes) {
+    Page& page = pageOf(id);
+    page.usageBytes[id % kPageRows] = bytes;
+    page.usageNodes[id % kPageRows] = nodes;
+}
+
+void MetaTable::addUsage(uint32_t id, int64_t bytes, int64_t nodes) {
+    Page& page = pageOf(id);
+    page.usageBytes[id % kPageRows] += bytes;
+    page.usageNodes[id % kPageRows] += nodes;
+}
+
+uint32_t MetaTable::checkpointId(uint32_t id) {
+    return pageOf(id).checkpointId[id % kPageRows];
+}
+
+void MetaTable::setCheckpointId(uint32_t id, uint32_t checkpointId) {
+    pageOf(id).checkpointId[id % kPageRows] = checkpointId;
+}
+
+uint64_t MetaTable::rowsInUse() {
+    std::lock_guard<std::mutex> lock(tableMutex);
+    uint64_t free = freeIds.size();
+    for (const IdCache* c = caches; c != nullptr; c = c->next) free += c->held.load(std::memory_order_relaxed);
+    return nextId - 1 - free;
+}
+
+uint64_t MetaTable::reservedBytes() {
+    std::lock_guard<std::mutex> lock(tableMutex);
+    return static_cast<uint64_t>((nextId + kPageRows - 1) / kPageRows) * sizeof(Page);
+}
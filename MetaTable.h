@@ -0,0 +1,66 @@
+#ifndef METATABLE_H_
+#define METATABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Metadata of one node, as FileSystem::tryStat() reports it.
+struct NodeMeta {
+	int64_t ctime = 0;  // ns since the epoch, 0 if not known
+	int64_t mtime = 0;  // last change of the node, or of a directory's child list
+	uint64_t size = 0;
+	uint32_t mode = 0;  // permission bits, e.g. 0644
+	uint32_t owner = 0;
+};
+
+// Cold per node metadata, kept out of Node so that walks over links and
+// names (findChild(), treeRecursion()) never load it. Every field is its
+// own column indexed by Node::id_. Rows are handed out on first use and
+// given back when the node is destroyed; columns grow in pages that never
+// move, so a row stays where it is for the life of its node. Two more
+// columns hold a directory's memory use, see FileSystem::tryMem(), and one
+// its id in the checkpoint store, see FileSystem::checkpoint(). allocate()
+// and release() are thread safe (the Reclaimer destroys nodes on its own
+// thread); a row is only read and written by its FileSystem's thread.
+// Free ids are shared under a lock, unless the thread called bindThread():
+// then it keeps ids of its own and only locks to take or give back a
+// page's worth at a time, like NodePool.
+class MetaTable {
+public:
+	static const uint32_t kNone = 0; // id_ of a node without a row
+	static const uint32_t kRowBytes = 52; // all columns of one row
+
+	// a zeroed row, kNone once every id is taken
+	static uint32_t allocate();
+
+	// give a row back
+	static void release(uint32_t id);
+
+	// give the calling thread free ids of its own, until unbindThread()
+	static void bindThread();
+
+	// hand the calling thread's free ids back; must be called before a
+	// bound thread ends
+	static void unbindThread();
+
+	static void read(uint32_t id, NodeMeta& meta);
+	static void write(uint32_t id, const NodeMeta& meta);
+	static void setMtime(uint32_t id, int64_t ns);
+
+	// bytes and nodes held by a directory and everything below it
+	static void usage(uint32_t id, uint64_t& bytes, uint64_t& nodes);
+	static void setUsage(uint32_t id, uint64_t bytes, uint64_t nodes);
+	static void addUsage(uint32_t id, int64_t bytes, int64_t nodes);
+
+	// persistent id of a directory in its FileSystem's checkpoint store, 0 for none
+	[[nodiscard]] static uint32_t checkpointId(uint32_t id);
+	static void setCheckpointId(uint32_t id, uint32_t checkpointId);
+
+	// rows currently handed out
+	[[nodiscard]] static uint64_t rowsInUse();
+
+	// bytes reserved for column pages
+	[[nodiscard]] static uint64_t reservedBytes();
+};
+
+#endif /* METATABLE_H_ */
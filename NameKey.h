@@ -0,0 +1,34 @@
+#ifndef NAMEKEY_H_
+#define NAMEKEY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+using std::string;
+using std::string_view;
+
+// First 8 bytes of a name packed big-endian into an integer (zero padded).
+// Comparing two keys as unsigned integers orders names the same way as
+// std::string::compare does, so most comparisons are decided by the keys
+// alone; only names sharing their first 8 bytes need the full strings.
+[[nodiscard]] inline uint64_t nameKey(const char* data, size_t size) {
+	uint64_t key = 0;
+	size_t n = size < 8 ? size : 8;
+	for (size_t i = 0; i < n; i++) {
+		key |= uint64_t(static_cast<unsigned char>(data[i])) << (56 - 8 * i);
+	}
+	return key;
+}
+
+[[nodiscard]] inline uint64_t nameKey(string_view name) {
+	return nameKey(name.data(), name.size());
+}
+
+// Three-way compare of (key, name) pairs where key == nameKey(name).
+[[nodiscard]] inline int compareNames(uint64_t keyA, string_view a, uint64_t keyB, string_view b) {
+	if (keyA != keyB) return keyA < keyB ? -1 : 1;
+	return a.compare(b);
+}
+
+#endif /* NAMEKEY_H_ */
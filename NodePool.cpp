@@ -0,0 +1,222 @@
+#include "NodePool.h"
+#include "FileSystem.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+
+
+namespace {
+
+const size_t kSlot = sizeof(Node);
+const size_t kChunkSlots = 4096;
+const size_t kCacheSlots = kChunkSlots; // moved between a cache and the shared pool at a time
+
+// Released slots are chained through their first bytes.
+struct FreeSlot {
+    FreeSlot* next;
+};
+
+// Slots ready to hand out: released ones, and the unused end of a chunk.
+struct Slots {
+    FreeSlot* freeList = nullptr;
+    size_t freeCount = 0;  // slots on freeList
+    char* bump = nullptr;  // next unused slot of the current chunk
+    char* bumpEnd = nullptr; // end of the current chunk
+};
+
+// A bound thread's own slots. Only its thread touches them; held is
+// published for slotsInUse().
+struct Cache : Slots {
+    std::atomic<uint64_t> held{0};
+    Cache* next = nullptr; // in caches, under poolMutex
+};
+
+std::mutex poolMutex;
+Slots shared;           // under poolMutex
+Cache* caches = nullptr; // every bound thread's cache, under poolMutex
+std::atomic<uint64_t> reserved(0);
+thread_local Cache* cache = nullptr;
+
+char* newChunk(size_t slots) {
+    char* chunk = static_cast<char*>(::operator new(slots * kSlot));
+    reserved.fetch_add(slots * kSlot, std::memory_order_relaxed);
+    return chunk;
+}
+
+// Slots the pool holds but has not handed out.
+size_t spare(const Slots& pool) {
+    return pool.freeCount + static_cast<size_t>(pool.bumpEnd - pool.bump) / kSlot;
+}
+
+void publish(Cache& c) {
+    c.held.store(spare(c), std::memory_order_relaxed);
+}
+
+void push(Slots& pool, void* slot) {
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    freed->next = pool.freeList;
+    pool.freeList = freed;
+    pool.freeCount++;
+}
+
+// A slot from the free list or the current chunk, nullptr if both are empty.
+void* take(Slots& pool) {
+    if (pool.freeList != nullptr) {
+        FreeSlot* slot = pool.freeList;
+        pool.freeList = slot->next;
+        pool.freeCount--;
+        return slot;
+    }
+    if (pool.bump == pool.bumpEnd) return nullptr;
+    void* slot = pool.bump;
+    pool.bump += kSlot;
+    return slot;
+}
+
+void* takeBlock(Slots& pool, size_t count) {
+    size_t left = static_cast<size_t>(pool.bumpEnd - pool.bump) / kSlot;
+    if (count <= left) {
+        void* block = pool.bump;
+        pool.bump += count * kSlot;
+        return block;
+    }
+    if (count >= kChunkSlots) {
+        // Big blocks get a chunk of their own, the current chunk stays open.
+        return newChunk(count);
+    }
+    // Retire what is left of the current chunk to the free list.
+    while (pool.bump != pool.bumpEnd) {
+        push(pool, pool.bump);
+        pool.bump += kSlot;
+    }
+    pool.bump = newChunk(kChunkSlots);
+    pool.bumpEnd = pool.bump + kChunkSlots * kSlot;
+    void* block = pool.bump;
+    pool.bump += count * kSlot;
+    return block;
+}
+
+// The cache ran dry: take up to kCacheSlots released slots from the shared
+// pool, or a chunk of its own if there are none.
+void refill(Cache& c) {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        while (c.freeCount < kCacheSlots && shared.freeList != nullptr) push(c, take(shared));
+    }
+    if (c.freeCount == 0) {
+        c.bump = newChunk(kChunkSlots);
+        c.bumpEnd = c.bump + kChunkSlots * kSlot;
+    }
+}
+
+// The cache holds more than it will use soon: give kCacheSlots back.
+void spill(Cache& c) {
+    if (c.freeCount <= 2 * kCacheSlots) return;
+    FreeSlot* first = c.freeList;
+    FreeSlot* last = first;
+    for (size_t i = 1; i < kCacheSlots; i++) last = last->next;
+    c.freeList = last->next;
+    c.freeCount -= kCacheSlots;
+    std::lock_guard<std::mutex> lock(poolMutex);
+    last->next = shared.freeList;
+    shared.freeList = first;
+    shared.freeCount += kCacheSlots;
+}
+
+} // namespace
+
+void* NodePool::allocate() {
+    Cache* c = cache;
+    if (c != nullptr) {
+        void* slot = take(*c);
+        if (slot == nullptr) {
+            refill(*c);
+            slot = take(*c);
+        }
+        publish(*c);
+        return slot;
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    void* slot = take(shared);
+    if (slot == nullptr) {
+        shared.bump = newChunk(kChunkSlots);
+        shared.bumpEnd = shared.bump + kChunkSlots * kSlot;
+        slot = take(shared);
+    }
+    return slot;
+}
+
+void* NodePool::allocateBlock(size_t count) {
+    if (count == 0) return nullptr;
+
+    Cache* c = cache;
+    if (c != nullptr) {
+        void* block = takeBlock(*c, count);
+        publish(*c);
+        return block;
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return takeBlock(shared, count);
+}
+
+void NodePool::release(void* slot) {
+    if (slot == nullptr) return;
+    Cache* c = cache;
+    if (c != nullptr) {
+        push(*c, slot);
+        spill(*c);
+        publish(*c);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    push(shared, slot);
+}
+
+void NodePool::releaseMany(void* const* slots, size_t count) {
+    if (count == 0) return;
+    Cache* c = cache;
+    if (c != nullptr) {
+        for (size_t i = 0; i < count; i++) {
+            push(*c, slots[i]);
+            spill(*c);
+        }
+        publish(*c);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(poolMutex);
+    for (size_t i = 0; i < count; i++) push(shared, slots[i]);
+}
+
+void NodePool::bindThread() {
+    if (cache != nullptr) return;
+    Cache* c = new Cache();
+    std::lock_guard<std::mutex> lock(poolMutex);
+    c->next = caches;
+    caches = c;
+    cache = c;
+}
+
+void NodePool::unbindThread() {
+    Cache* c = cache;
+    if (c == nullptr) return;
+    cache = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        while (void* slot = take(*c)) push(shared, slot);
+        Cache** link = &caches;
+        while (*link != c) link = &(*link)->next;
+        *link = c->next;
+    }
+    delete c;
+}
+
+uint64_t NodePool::slotsInUse() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    uint64_t free = spare(shared);
+    for (const Cache* c = caches; c != nullptr; c = c->next) free += c->held.load(std::memory_order_relaxed);
+    return reserved.load(std::memory_order_relaxed) / kSlot - free;
+}
+
+uint64_t NodePool::reservedBytes() {
+    return reserved.load(std::memory_order_relaxed);
+}
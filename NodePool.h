@@ -0,0 +1,47 @@
+#ifndef NODEPOOL_H_
+#define NODEPOOL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Slab allocator behind Node::operator new/delete.
+// Single nodes come from 4096-slot chunks with a free list of released
+// slots. allocateBlock() hands out many contiguous slots in one go for
+// bulk builders (cp -r, generators, imports); every slot of a block is
+// still released on its own with delete. Chunks are kept for reuse and
+// never given back to the system. All calls are thread safe.
+//
+// By default every thread shares one pool under a lock. A thread that
+// calls bindThread() gets a cache of its own: it allocates and releases
+// through it without locking, and only takes the lock to refill the cache
+// from the shared pool, or spill to it, a chunk's worth of slots at a time.
+// Slots released on another thread (the Reclaimer) go to the shared pool.
+class NodePool {
+public:
+	// one slot
+	static void* allocate();
+
+	// count contiguous slots, construct Nodes into them with placement new
+	static void* allocateBlock(size_t count);
+
+	// give one slot back
+	static void release(void* slot);
+
+	// give count slots back under one lock
+	static void releaseMany(void* const* slots, size_t count);
+
+	// give the calling thread a cache of its own, until unbindThread()
+	static void bindThread();
+
+	// hand the calling thread's cache back to the shared pool; must be
+	// called before a bound thread ends
+	static void unbindThread();
+
+	// slots currently handed out
+	[[nodiscard]] static uint64_t slotsInUse();
+
+	// bytes reserved from the system for slots
+	[[nodiscard]] static uint64_t reservedBytes();
+};
+
+#endif /* NODEPOOL_H_ */
@@ -0,0 +1,159 @@
+#include "Reclaimer.h"
+#include "FileSystem.h"
+#include "NodePool.h"
+#include "Stats.h"
+#include "Tracer.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+
+namespace {
+
+struct ReclaimQueue {
+    std::mutex mutex;
+    std::condition_variable work;   // something was retired, or stopping
+    std::condition_variable idle;   // the queue ran empty
+    Node* head = nullptr;           // retired subtrees, chained through rightSibling_
+    uint64_t backlog = 0;           // nodes in head
+    uint64_t inFlight = 0;          // nodes in the list the worker is freeing
+    bool busy = false;              // the worker holds a list it has not freed yet
+    bool stopping = false;
+    std::thread worker;
+
+    // Runs at exit: let the worker finish the queue, then join it.
+    ~ReclaimQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+// Built on first use, so it is destroyed before NodePool's statics.
+ReclaimQueue& queue() {
+    static ReclaimQueue q;
+    return q;
+}
+
+} // namespace
+
+void Reclaimer::retire(Node* subtree, uint64_t nodes) {
+    if (subtree == nullptr) return;
+    subtree->rightSibling_ = nullptr;
+    retireList(subtree, nodes);
+}
+
+void Reclaimer::retireList(Node* first, uint64_t nodes) {
+    if (first == nullptr) return;
+    ReclaimQueue& q = queue();
+    if (nodes == 0) {
+        // Count no further than what could still be queued.
+        uint64_t room;
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            uint64_t pending = q.backlog + q.inFlight;
+            room = pending < kMaxBacklog ? kMaxBacklog - pending : 0;
+        }
+        nodes = count(first, room);
+    }
+    Node* last = first;
+    while (last->rightSibling_ != nullptr) last = last->rightSibling_;
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.backlog + q.inFlight + nodes <= kMaxBacklog) {
+            last->rightSibling_ = q.head;
+            q.head = first;
+            q.backlog += nodes;
+            if (!q.worker.joinable()) q.worker = std::thread(&Reclaimer::run);
+            first = nullptr;
+        }
+    }
+    if (first == nullptr) {
+        q.work.notify_one();
+        return;
+    }
+    // The worker is behind: the caller pays, rather than the queue growing.
+    Stats::count(Counter::ReclaimedInline);
+    reclaim(first);
+}
+
+void Reclaimer::drain() {
+    ReclaimQueue& q = queue();
+    std::unique_lock<std::mutex> lock(q.mutex);
+    q.idle.wait(lock, [&q] { return q.head == nullptr && !q.busy; });
+}
+
+void Reclaimer::run() {
+    ReclaimQueue& q = queue();
+    std::unique_lock<std::mutex> lock(q.mutex);
+    while (true) {
+        q.work.wait(lock, [&q] { return q.head != nullptr || q.stopping; });
+        if (q.head == nullptr) return; // Stopping and nothing left.
+
+        // Take the whole queue, the list is already in the shape reclaim() walks.
+        Node* work = q.head;
+        q.head = nullptr;
+        q.inFlight = q.backlog;
+        q.backlog = 0;
+        q.busy = true;
+        lock.unlock();
+        reclaim(work);
+        lock.lock();
+        q.inFlight = 0;
+        q.busy = false;
+        if (q.head == nullptr) q.idle.notify_all();
+    }
+}
+
+// Frees every node reachable from work, a list chained through rightSibling_.
+// A node's children are spliced onto the front of the list before it is
+// destroyed, so ~Node() never recurses.
+void Reclaimer::reclaim(Node* work) {
+    TRACE_SPAN("reclaim");
+    void* slots[kBatchNodes];
+    size_t count = 0;
+    while (work != nullptr) {
+        Node* node = work;
+        work = node->rightSibling_;
+        if (node->leftmostChild_ != nullptr) {
+            Node* last = node->leftmostChild_;
+            while (last->rightSibling_ != nullptr) last = last->rightSibling_;
+            last->rightSibling_ = work;
+            work = node->leftmostChild_;
+            node->leftmostChild_ = nullptr;
+        }
+        node->~Node();
+        slots[count++] = node;
+        if (count == kBatchNodes) {
+            NodePool::releaseMany(slots, count);
+            Stats::count(Counter::ReclaimedNodes, count);
+            count = 0;
+        }
+    }
+    NodePool::releaseMany(slots, count);
+    Stats::count(Counter::ReclaimedNodes, count);
+}
+
+// Nodes in the list of subtrees starting at first, counting stops once
+// past limit. Walks down leftmostChild_ and back up parent_, like
+// FileSystem::accountSubtree(), without changing anything.
+uint64_t Reclaimer::count(const Node* first, uint64_t limit) {
+    uint64_t nodes = 0;
+    for (const Node* top = first; top != nullptr; top = top->rightSibling_) {
+        const Node* node = top;
+        while (true) {
+            if (++nodes > limit) return nodes;
+            if (node->leftmostChild_ != nullptr) {
+                node = node->leftmostChild_;
+                continue;
+            }
+            while (node != top && node->rightSibling_ == nullptr) node = node->parent_;
+            if (node == top) break;
+            node = node->rightSibling_;
+        }
+    }
+    return nodes;
+}
@@ -0,0 +1,42 @@
+#ifndef RECLAIMER_H_
+#define RECLAIMER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+class Node;
+
+// Frees detached subtrees on a background thread, so rm -r returns as soon
+// as the subtree is unlinked. Retired subtrees are queued through their
+// rightSibling_ pointers and freed iteratively, kBatchNodes slots at a time,
+// so reclaiming allocates nothing and never recurses. The thread runs at
+// normal priority; a subtree that would take the nodes queued or being
+// freed past kMaxBacklog is freed by the caller instead, so the memory
+// waiting to be reclaimed stays bounded. The thread starts on the first
+// retire() and is joined, after freeing everything, at exit.
+class Reclaimer {
+public:
+	// nodes handed back to NodePool per lock
+	static const size_t kBatchNodes = 4096;
+
+	// nodes queued or being freed at most, past it retire() frees inline
+	static const uint64_t kMaxBacklog = uint64_t(1) << 18;
+
+	// take ownership of a subtree already unlinked from its parent; nodes
+	// is its size if the caller knows it, 0 to have it counted
+	static void retire(Node* subtree, uint64_t nodes = 0);
+
+	// same for a list of subtrees chained through rightSibling_, like the
+	// child list of a directory, taken in one go
+	static void retireList(Node* first, uint64_t nodes = 0);
+
+	// wait until everything retired so far has been freed
+	static void drain();
+
+private:
+	static void run();
+	static void reclaim(Node* work);
+	static uint64_t count(const Node* first, uint64_t limit);
+};
+
+#endif /* RECLAIMER_H_ */
@@ -0,0 +1,238 @@
+#include "Server.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "FileSystem.h"
+#include "Tracer.h"
+
+
+// One client. Input is kept until a whole line has arrived; replies are
+// queued in out and written as fast as the client reads them.
+struct Connection {
+    int fd;
+    Session session;
+    ShellClient client;    // transaction and watches
+    std::string in;        // received bytes, commands not yet run
+    std::string out;       // framed replies not yet written
+    size_t outStart = 0;   // bytes of out already written
+    uint32_t events = 0;   // epoll interest currently registered
+    bool closing = false;  // exit seen or client hung up: no more commands
+    Connection* prev = nullptr;
+    Connection* next = nullptr;
+};
+
+namespace {
+
+const size_t kReadChunk = 64 * 1024;
+// Stop running a client's commands while this many reply bytes are unsent,
+// so a client that pipelines without reading cannot grow out without bound.
+const size_t kMaxPendingOut = 1 << 20;
+// A "line" longer than this is not a command, drop the client.
+const size_t kMaxLine = 1 << 20;
+const int kMaxEvents = 256;
+
+} // namespace
+
+Server::Server(FileSystem* fs, const std::string& path) : fs_(fs), path_(path) {}
+
+Server::~Server() {
+    while (connections_ != nullptr) close(connections_);
+    if (listenFd_ >= 0) {
+        ::close(listenFd_);
+        unlink(path_.c_str());
+    }
+    if (epollFd_ >= 0) ::close(epollFd_);
+    if (wakeFd_ >= 0) ::close(wakeFd_);
+}
+
+std::string Server::listen() {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path)) return "socket path too long";
+    memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0) return std::string("socket: ") + strerror(errno);
+    unlink(path_.c_str());
+    if (bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        return std::string("bind: ") + strerror(errno);
+    }
+    if (::listen(listenFd_, SOMAXCONN) < 0) return std::string("listen: ") + strerror(errno);
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) return std::string("epoll_create1: ") + strerror(errno);
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) return std::string("eventfd: ") + strerror(errno);
+
+    // The listening socket and the wake fd are told apart from connections
+    // by their data pointer.
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = this;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &ev);
+    ev.data.ptr = &wakeFd_;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+    return "";
+}
+
+void Server::run() {
+    epoll_event events[kMaxEvents];
+    for (;;) {
+        int n = epoll_wait(epollFd_, events, kMaxEvents, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return;
+
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &wakeFd_) return;
+            if (tag == this) {
+                accept();
+                continue;
+            }
+            Connection* conn = static_cast<Connection*>(tag);
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                close(conn);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) onReadable(conn);
+            else flush(conn);
+        }
+    }
+}
+
+void Server::stop() {
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd_, &one, sizeof(one));
+    (void)written;
+}
+
+void Server::accept() {
+    for (;;) {
+        int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return; // EAGAIN: no more waiting, anything else: try on the next wakeup
+
+        Connection* conn = new Connection;
+        conn->fd = fd;
+        conn->next = connections_;
+        if (connections_ != nullptr) connections_->prev = conn;
+        connections_ = conn;
+        fs_->openSession(conn->session);
+        served_++;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+        conn->events = EPOLLIN;
+    }
+}
+
+void Server::onReadable(Connection* conn) {
+    // One read per wakeup keeps a busy client from starving the others;
+    // epoll is level triggered and reports the rest next time round.
+    size_t old = conn->in.size();
+    conn->in.resize(old + kReadChunk);
+    ssize_t got = read(conn->fd, &conn->in[old], kReadChunk);
+    conn->in.resize(old + (got > 0 ? got : 0));
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+        conn->closing = true; // Run what arrived whole, then hang up.
+    }
+    runLines(conn);
+    if (conn->in.size() > kMaxLine && conn->in.find('\n') == std::string::npos) {
+        close(conn);
+        return;
+    }
+    flush(conn);
+}
+
+void Server::runLines(Connection* conn) {
+    size_t start = 0;
+    bool more = true;
+    while (more && conn->out.size() - conn->outStart < kMaxPendingOut) {
+        size_t end = conn->in.find('\n', start);
+        if (end == std::string::npos) break;
+        std::string_view line(conn->in.data() + start, end - start);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        start = end + 1;
+
+        fs_->enter(conn->session);
+        more = shell_.run(fs_, line, reply_, conn->client);
+        fs_->leave(conn->session);
+
+        if (more) {
+            TRACE_SPAN("format");
+            conn->out += std::to_string(reply_.size());
+            conn->out += '\n';
+            conn->out += reply_;
+        }
+    }
+    if (!more) {
+        conn->closing = true;
+        conn->in.clear();
+    }
+    else conn->in.erase(0, start);
+}
+
+void Server::flush(Connection* conn) {
+    for (;;) {
+        while (conn->outStart < conn->out.size()) {
+            ssize_t sent = send(conn->fd, conn->out.data() + conn->outStart,
+                                conn->out.size() - conn->outStart, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && errno == EAGAIN) break;
+            if (sent < 0) {
+                close(conn);
+                return;
+            }
+            conn->outStart += sent;
+        }
+        if (conn->outStart != conn->out.size()) break;
+
+        conn->out.clear();
+        conn->outStart = 0;
+        // Lines held back while replies were piling up can run now.
+        bool waiting = conn->in.find('\n') != std::string::npos;
+        if (conn->closing && !waiting) {
+            close(conn);
+            return;
+        }
+        if (!waiting) break;
+        runLines(conn);
+    }
+    watch(conn);
+}
+
+void Server::watch(Connection* conn) {
+    // Read while there is room for replies, wait for writability while
+    // replies are pending.
+    size_t pending = conn->out.size() - conn->outStart;
+    uint32_t events = 0;
+    if (!conn->closing && pending < kMaxPendingOut) events |= EPOLLIN;
+    if (pending != 0) events |= EPOLLOUT;
+    if (events == conn->events) return;
+
+    epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+}
+
+void Server::close(Connection* conn) {
+    // A connection closed mid-command is impossible: commands run to the
+    // end before anything else happens, so the session is never entered here.
+    fs_->closeSession(conn->session);
+    CommandShell::release(fs_, conn->client);
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    if (conn->prev != nullptr) conn->prev->next = conn->next;
+    else connections_ = conn->next;
+    if (conn->next != nullptr) conn->next->prev = conn->prev;
+    delete conn;
+}
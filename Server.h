@@ -0,0 +1,62 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <cstdint>
+#include <string>
+#include "CommandLine.h"
+
+class FileSystem;
+struct Connection;
+
+// Serves one FileSystem to many local clients over a Unix domain socket.
+// A single thread multiplexes every connection with epoll, so commands
+// never run concurrently and FileSystem needs no locking. Each connection
+// has its own Session (working directory) and speaks the REPL's command
+// language: one command per line, any number of lines may be sent before
+// reading the replies (pipelining). Replies come back in order, each as
+// "<length>\n" followed by length bytes of what the REPL would print
+// without its trailing newline. "exit" closes the connection after its
+// earlier replies are flushed; load and gen are refused. Every connection
+// has its own transaction (begin/commit/abort), so clients working in
+// disjoint subtrees commit without ever conflicting, and its own watches,
+// whose events it collects with "events".
+class Server {
+public:
+	// serve fs (not owned) on the socket at path
+	Server(FileSystem* fs, const std::string& path);
+
+	// closes every connection and removes the socket file
+	~Server();
+
+	// create the socket, replacing a stale one at path.
+	// Returns "" on success, otherwise what failed.
+	std::string listen();
+
+	// serve until stop(); call listen() first
+	void run();
+
+	// make run() return; safe from another thread or a signal handler
+	void stop();
+
+	[[nodiscard]] uint64_t connectionsServed() const { return served_; }
+
+private:
+	void accept();
+	void onReadable(Connection* conn);
+	void runLines(Connection* conn);
+	void flush(Connection* conn);
+	void watch(Connection* conn);
+	void close(Connection* conn);
+
+	FileSystem* fs_;
+	std::string path_;
+	int listenFd_ = -1;
+	int epollFd_ = -1;
+	int wakeFd_ = -1;             // eventfd written by stop()
+	Connection* connections_ = nullptr; // open connections, doubly linked
+	uint64_t served_ = 0;
+	CommandShell shell_{false};
+	std::string reply_;           // scratch for one command's output
+};
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,417 @@
+#include "ShardedFileSystem.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MetaTable.h"
+#include "NodePool.h"
+#include "Stats.h"
+#include "Tracer.h"
+
+
+namespace {
+
+// yields of an idle worker before it sleeps
+const unsigned kIdleSpins = 64;
+
+// First component of a path from the root, "" for the root itself.
+string_view topName(string_view path) {
+    size_t start = path.find_first_not_of('/');
+    if (start == string_view::npos) return string_view();
+    path.remove_prefix(start);
+    return path.substr(0, path.find('/'));
+}
+
+BatchOp::Kind batchKind(ShardOp::Kind kind) {
+    switch (kind) {
+    case ShardOp::Kind::Touch: return BatchOp::Kind::Touch;
+    case ShardOp::Kind::Mkdir: return BatchOp::Kind::Mkdir;
+    case ShardOp::Kind::Rm:    return BatchOp::Kind::Rm;
+    case ShardOp::Kind::Rmdir: return BatchOp::Kind::Rmdir;
+    default:                   return BatchOp::Kind::Mv;
+    }
+}
+
+bool batched(ShardOp::Kind kind) {
+    return kind == ShardOp::Kind::Touch || kind == ShardOp::Kind::Mkdir || kind == ShardOp::Kind::Rm ||
+           kind == ShardOp::Kind::Rmdir || kind == ShardOp::Kind::Mv;
+}
+
+// Name an ls line or tree block of / is sorted by.
+string_view entryName(string_view entry) {
+    entry = entry.substr(0, entry.find('\n'));
+    if (!entry.empty() && entry[0] == ' ') entry.remove_prefix(1);
+    if (!entry.empty() && entry.back() == '/') entry.remove_suffix(1);
+    return entry;
+}
+
+} // namespace
+
+ShardQueue::ShardQueue(size_t capacity) : head_(0), tail_(0) {
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+    slots_ = new ShardOp*[size];
+    mask_ = size - 1;
+}
+
+ShardQueue::~ShardQueue() {
+    delete[] slots_;
+}
+
+bool ShardQueue::push(ShardOp* op) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_) return false;
+    slots_[tail & mask_] = op;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+ShardOp* ShardQueue::pop() {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return nullptr;
+    ShardOp* op = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return op;
+}
+
+bool ShardQueue::empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
+struct ShardedFileSystem::Shard {
+    FileSystem fs;
+    ShardQueue* queues = nullptr; // one per client
+    std::thread worker;
+    // An idle worker sleeps on wake; a client that queues an op while
+    // sleeping is set wakes it.
+    std::atomic<bool> sleeping{false};
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool woken = false; // under mutex
+    bool stop = false;  // under mutex
+};
+
+ShardedFileSystem::ShardedFileSystem(unsigned shards, unsigned clients)
+    : count_(std::max(shards, 1u)), clients_(std::max(clients, 1u)) {
+    shards_ = new Shard[count_];
+    for (unsigned s = 0; s < count_; s++) shards_[s].queues = new ShardQueue[clients_];
+    for (unsigned s = 0; s < count_; s++) shards_[s].worker = std::thread(&ShardedFileSystem::serve, this, std::ref(shards_[s]));
+}
+
+ShardedFileSystem::~ShardedFileSystem() {
+    for (unsigned s = 0; s < count_; s++) {
+        Shard& shard = shards_[s];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.stop = true;
+        }
+        shard.wake.notify_one();
+        shard.worker.join();
+        delete[] shard.queues;
+    }
+    delete[] shards_;
+}
+
+unsigned ShardedFileSystem::shardOf(string_view name) const {
+    return static_cast<unsigned>(std::hash<string_view>()(name) % count_);
+}
+
+void ShardedFileSystem::submit(unsigned client, ShardOp& op) {
+    op.done.store(false, std::memory_order_relaxed);
+    string_view top = topName(op.path);
+    if ((op.kind == ShardOp::Kind::Ls || op.kind == ShardOp::Kind::Tree) && top.empty()) {
+        gather(client, op);
+        op.done.store(true, std::memory_order_release);
+        return;
+    }
+    unsigned from, to;
+    string name, dest;
+    if (op.kind == ShardOp::Kind::Mv && routeMove(op, from, to, name, dest)) {
+        moveAcross(client, op, from, to, name, dest);
+        op.done.store(true, std::memory_order_release);
+        return;
+    }
+    push(client, shardOf(top), op);
+}
+
+Status ShardedFileSystem::wait(ShardOp& op) {
+    while (!op.done.load(std::memory_order_acquire)) std::this_thread::yield();
+    return op.status;
+}
+
+Status ShardedFileSystem::run(unsigned client, ShardOp& op) {
+    submit(client, op);
+    return wait(op);
+}
+
+void ShardedFileSystem::push(unsigned client, unsigned shard, ShardOp& op) {
+    Shard& target = shards_[shard];
+    while (!target.queues[client].push(&op)) std::this_thread::yield();
+    // Pairs with the fence in serve(): either the worker sees the op
+    // before it sleeps, or this sees it sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (target.sleeping.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(target.mutex);
+            target.woken = true;
+        }
+        target.wake.notify_one();
+    }
+}
+
+// Worker of one shard: runs everything queued, mutations batched, then
+// spins a little and sleeps until woken. Nodes and metadata rows come from
+// caches of the worker's own, so no shard locks the allocators per op.
+void ShardedFileSystem::serve(Shard& shard) {
+    NodePool::bindThread();
+    MetaTable::bindThread();
+    std::vector<BatchOp> batch;
+    std::vector<ShardOp*> waiting;
+    std::vector<Status> results;
+    auto flush = [&]() {
+        if (batch.empty()) return;
+        shard.fs.applyBatch(batch, results);
+        for (size_t i = 0; i < waiting.size(); i++) {
+            waiting[i]->status = results[i];
+            waiting[i]->done.store(true, std::memory_order_release);
+        }
+        batch.clear();
+        waiting.clear();
+    };
+
+    unsigned idle = 0;
+    while (true) {
+        bool found = false;
+        for (unsigned c = 0; c < clients_; c++) {
+            while (ShardOp* op = shard.queues[c].pop()) {
+                found = true;
+                if (batched(op->kind)) {
+                    batch.push_back(BatchOp{batchKind(op->kind), op->path, op->dest});
+                    waiting.push_back(op);
+                    continue;
+                }
+                // Anything else sees the batch queued before it applied.
+                flush();
+                execute(shard, *op);
+                op->done.store(true, std::memory_order_release);
+            }
+        }
+        flush();
+        if (found) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < kIdleSpins) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        shard.sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool queued = false;
+        for (unsigned c = 0; c < clients_ && !queued; c++) queued = !shard.queues[c].empty();
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            if (!queued) shard.wake.wait(lock, [&shard]() { return shard.woken || shard.stop; });
+            shard.woken = false;
+            stop = shard.stop;
+        }
+        shard.sleeping.store(false, std::memory_order_relaxed);
+        if (stop) {
+            MetaTable::unbindThread();
+            NodePool::unbindThread();
+            return;
+        }
+        idle = 0;
+    }
+}
+
+void ShardedFileSystem::execute(Shard& shard, ShardOp& op) {
+    TRACE_SPAN("shard");
+    FileSystem& fs = shard.fs;
+    switch (op.kind) {
+    case ShardOp::Kind::Ls:
+    case ShardOp::Kind::Tree: {
+        op.out.clear();
+        string dirPath(op.path);
+        if (dirPath.empty() || dirPath.back() != '/') dirPath += '/';
+        Node* dir;
+        op.status = fs.resolvePath(fs.root_, dirPath, dir);
+        if (op.status != Status::Ok) break;
+        Node* originalCurr = fs.curr_;
+        fs.curr_ = dir;
+        if (op.kind == ShardOp::Kind::Ls) fs.lsInto(op.out);
+        else fs.treeInto(op.out);
+        fs.curr_ = originalCurr;
+        break;
+    }
+    case ShardOp::Kind::Hold:
+        op.status = fs.holdNode(op.path, op.node, op.isDir);
+        break;
+    case ShardOp::Kind::Release:
+        fs.releaseNode(op.node);
+        op.status = Status::Ok;
+        break;
+    case ShardOp::Kind::Take:
+        op.subtree = fs.takeNode(op.node);
+        op.status = Status::Ok;
+        break;
+    case ShardOp::Kind::Reserve: {
+        size_t slash = op.path.rfind('/');
+        string_view path(op.path);
+        op.status = fs.reserveNode(path.substr(0, slash + 1), op.dest, path.substr(slash + 1), op.isDir, op.node);
+        break;
+    }
+    case ShardOp::Kind::Fill:
+        fs.fillReserved(op.node, op.subtree);
+        op.status = Status::Ok;
+        break;
+    default:
+        break;
+    }
+}
+
+// A mv crosses shards when it moves a top-level entry into another one,
+// renames it to a name hashed elsewhere, or moves something up to /.
+// name is the top-level name the node ends up under, unless dest, as
+// FileSystem::reserveNode() takes it, says otherwise.
+bool ShardedFileSystem::routeMove(const ShardOp& op, unsigned& from, unsigned& to, string& name, string& dest) const {
+    string_view path(op.path);
+    path.remove_prefix(std::min(path.find_first_not_of('/'), path.size()));
+    size_t slash = path.find('/');
+    string_view top = path.substr(0, slash);
+    if (top.empty() || top == "." || top == ".." || top == "~") return false;
+    from = shardOf(top);
+
+    if (slash == string_view::npos) {
+        // mv /x dest: dest is a top-level entry, or becomes one.
+        if (op.dest.empty() || op.dest == "." || op.dest == ".." || op.dest == "~" ||
+            op.dest.find('/') != string::npos) return false;
+        to = shardOf(op.dest);
+        name = top;
+        dest = op.dest;
+    } else {
+        // mv /top/x ..: x becomes a top-level entry.
+        string_view rest = path.substr(slash + 1);
+        if (op.dest != ".." || rest.empty() || rest == "." || rest == ".." || rest == "~" ||
+            rest.find('/') != string_view::npos) return false;
+        to = shardOf(rest);
+        name = rest;
+        dest.clear();
+    }
+    return from != to;
+}
+
+// mv between shards in two phases. The source is held, pinned so nothing
+// can remove it, and a placeholder reserved under its new name at the
+// destination. If either fails, the hold is released and nothing changed.
+// Otherwise the node is unlinked from its shard and put in place of the
+// placeholder. Every step is one op on one worker, so no shard ever waits
+// for another; in between, other clients may see both the source and a
+// placeholder file.
+void ShardedFileSystem::moveAcross(unsigned client, ShardOp& op, unsigned from, unsigned to,
+                                   const string& name, const string& dest) {
+    ShardOp hold;
+    hold.kind = ShardOp::Kind::Hold;
+    hold.path = op.path;
+    push(client, from, hold);
+    if (wait(hold) != Status::Ok) {
+        op.status = hold.status;
+        return;
+    }
+
+    ShardOp reserve;
+    reserve.kind = ShardOp::Kind::Reserve;
+    reserve.path = "/" + name;
+    reserve.dest = dest;
+    reserve.isDir = hold.isDir;
+    push(client, to, reserve);
+    if (wait(reserve) != Status::Ok) {
+        ShardOp release;
+        release.kind = ShardOp::Kind::Release;
+        release.node = hold.node;
+        push(client, from, release);
+        wait(release);
+        op.status = reserve.status;
+        return;
+    }
+
+    ShardOp take;
+    take.kind = ShardOp::Kind::Take;
+    take.node = hold.node;
+    push(client, from, take);
+    wait(take);
+
+    ShardOp fill;
+    fill.kind = ShardOp::Kind::Fill;
+    fill.node = reserve.node;
+    fill.subtree = take.subtree;
+    push(client, to, fill);
+    wait(fill);
+    Stats::count(Counter::ShardHandoffs);
+    op.status = Status::Ok;
+}
+
+// ls or tree of /: every shard lists its own top-level entries, and as
+// each answer is sorted and every name is on one shard only, merging the
+// entries by name gives what one FileSystem would have printed.
+void ShardedFileSystem::gather(unsigned client, ShardOp& op) {
+    std::vector<ShardOp> parts(count_);
+    for (unsigned s = 0; s < count_; s++) {
+        parts[s].kind = op.kind;
+        parts[s].path = "/";
+        push(client, s, parts[s]);
+    }
+    bool tree = op.kind == ShardOp::Kind::Tree;
+    std::vector<string_view> entries; // ls lines, or tree blocks of one entry each
+    for (unsigned s = 0; s < count_; s++) {
+        wait(parts[s]);
+        string_view out(parts[s].out);
+        size_t pos = 0;
+        if (tree) {
+            // "/" then a block per entry, each starting at a line indented by one.
+            pos = out.find('\n');
+            pos = pos == string_view::npos ? out.size() : pos + 1;
+        }
+        while (pos < out.size()) {
+            size_t end = out.find('\n', pos);
+            while (tree && end != string_view::npos && end + 2 < out.size() && out[end + 2] == ' ') {
+                end = out.find('\n', end + 1);
+            }
+            if (end == string_view::npos) end = out.size();
+            entries.push_back(out.substr(pos, end - pos));
+            pos = end + 1;
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](string_view a, string_view b) {
+        return entryName(a) < entryName(b);
+    });
+
+    op.out = tree ? "/" : "";
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (tree || i != 0) op.out += '\n';
+        op.out += entries[i];
+    }
+    op.status = Status::Ok;
+}
+
+string ShardedFileSystem::checkInvariants() const {
+    for (unsigned s = 0; s < count_; s++) {
+        const FileSystem& fs = shards_[s].fs;
+        string problem = fs.checkInvariants();
+        if (!problem.empty()) return "shard " + std::to_string(s) + ": " + problem;
+        string top = fs.ls();
+        string_view rest(top);
+        while (!rest.empty()) {
+            size_t end = std::min(rest.find('\n'), rest.size());
+            string_view name = entryName(rest.substr(0, end));
+            if (shardOf(name) != s) {
+                return "/" + string(name) + " is on shard " + std::to_string(s) + ", not " + std::to_string(shardOf(name));
+            }
+            rest.remove_prefix(std::min(end + 1, rest.size()));
+        }
+    }
+    return "";
+}
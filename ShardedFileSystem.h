@@ -0,0 +1,118 @@
+#ifndef SHARDEDFILESYSTEM_H_
+#define SHARDEDFILESYSTEM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "FileSystem.h"
+using std::string;
+using std::string_view;
+
+// One command for a ShardedFileSystem. Paths are taken from the root, as
+// BatchOp paths starting with /. The client owns the op and leaves it
+// alone from submit() until it is done.
+struct ShardOp {
+	enum class Kind : unsigned char {
+		Touch, Mkdir, Rm, Rmdir,
+		Mv,      // dest as tryMv() takes it, seen from path's directory
+		Ls, Tree,
+		// Steps of a mv between shards, only sent by ShardedFileSystem itself
+		Hold, Release, Take, Reserve, Fill
+	};
+	Kind kind = Kind::Touch;
+	string path;
+	string dest;
+	Status status = Status::Ok;
+	string out;               // Ls and Tree output
+	Node* node = nullptr;     // handoff: the held node, or the placeholder
+	Node* subtree = nullptr;  // handoff: the node taken
+	bool isDir = false;       // handoff: kind of the node moving
+	std::atomic<bool> done{false};
+};
+
+// Single producer, single consumer ring of ShardOp pointers: one client
+// feeding one shard, neither side locking.
+class ShardQueue {
+public:
+	// capacity is rounded up to a power of two, at least 2
+	explicit ShardQueue(size_t capacity = 1024);
+	~ShardQueue();
+
+	ShardQueue(const ShardQueue&) = delete;
+	ShardQueue& operator=(const ShardQueue&) = delete;
+
+	// producer side, false if the ring is full
+	bool push(ShardOp* op);
+
+	// consumer side, nullptr if the ring is empty
+	ShardOp* pop();
+
+	[[nodiscard]] bool empty() const;
+
+private:
+	ShardOp** slots_;
+	uint64_t mask_;
+	alignas(64) std::atomic<uint64_t> head_; // next slot to pop, written by the consumer
+	alignas(64) std::atomic<uint64_t> tail_; // next slot to push, written by the producer
+};
+
+// Shared-nothing FileSystem split by top-level entry: every child of / and
+// all below it lives in one shard, picked by hashing its name, and each
+// shard is a FileSystem of its own served by one worker thread. Clients
+// talk to the workers only through ShardQueues, one per client and shard,
+// and never touch a shard's nodes. A worker drains its queues and runs
+// consecutive mutations as one applyBatch().
+//
+// Everything below a top-level entry stays on its shard, so only commands
+// on / itself cross shards: ls and tree of / ask every shard and merge the
+// answers, and a mv that moves an entry to or from / on another shard
+// is done in two phases, see moveAcross(). There is no current directory,
+// no watches and no transactions. Each worker allocates nodes and
+// metadata rows from caches of its own, see NodePool::bindThread().
+class ShardedFileSystem {
+public:
+	// shards workers; client ids run from 0 to clients - 1, and each
+	// client is a single thread
+	explicit ShardedFileSystem(unsigned shards, unsigned clients = 1);
+	~ShardedFileSystem();
+
+	ShardedFileSystem(const ShardedFileSystem&) = delete;
+	ShardedFileSystem& operator=(const ShardedFileSystem&) = delete;
+
+	[[nodiscard]] unsigned shards() const { return count_; }
+
+	// shard holding the top-level entry name
+	[[nodiscard]] unsigned shardOf(string_view name) const;
+
+	// Queue op for the shard it belongs to. Ops of one client on one shard
+	// run in the order submitted. Ls and Tree of / and a mv between shards
+	// run before submit() returns.
+	void submit(unsigned client, ShardOp& op);
+
+	// wait for a submitted op, its status
+	Status wait(ShardOp& op);
+
+	// submit() and wait()
+	Status run(unsigned client, ShardOp& op);
+
+	// checkInvariants() of every shard, plus every top-level entry being
+	// on its own shard; "" if all hold. Only while no client is running.
+	[[nodiscard]] string checkInvariants() const;
+
+private:
+	struct Shard;
+	Shard* shards_;
+	unsigned count_;
+	unsigned clients_;
+
+	void serve(Shard& shard);
+	void execute(Shard& shard, ShardOp& op);
+	void push(unsigned client, unsigned shard, ShardOp& op);
+	[[nodiscard]] bool routeMove(const ShardOp& op, unsigned& from, unsigned& to, string& name, string& dest) const;
+	void moveAcross(unsigned client, ShardOp& op, unsigned from, unsigned to, const string& name, const string& dest);
+	void gather(unsigned client, ShardOp& op);
+};
+
+#endif /* SHARDEDFILESYSTEM_H_ */
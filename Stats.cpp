@@ -0,0 +1,314 @@
+#include "Stats.h"
+#include <cstdio>
+#include <string>
+
+
+/*
+==================================
+// Latency histogram.
+==================================
+*/
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    // Bucket is the bit width of ns, so 0 -> 0, 1 -> 1, 2..3 -> 2, 4..7 -> 3 ...
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    if (bucket >= kBuckets) bucket = kBuckets - 1;
+
+    // Single writer per shard, no read-modify-write atomics needed.
+    buckets_[bucket].store(buckets_[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum_.store(sum_.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > max_.load(std::memory_order_relaxed)) {
+        max_.store(ns, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other) {
+    for (int i = 0; i < kBuckets; i++) {
+        buckets_[i].store(buckets_[i].load(std::memory_order_relaxed) +
+                          other.buckets_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    count_.store(count_.load(std::memory_order_relaxed) + other.count(), std::memory_order_relaxed);
+    sum_.store(sum_.load(std::memory_order_relaxed) + other.sum_.load(std::memory_order_relaxed),
+               std::memory_order_relaxed);
+    uint64_t m = other.max_.load(std::memory_order_relaxed);
+    if (m > max_.load(std::memory_order_relaxed)) max_.store(m, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < kBuckets; i++) {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::addTo(uint64_t* buckets, uint64_t& count, uint64_t& sum, uint64_t& max) const {
+    for (int i = 0; i < kBuckets; i++) {
+        buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+    }
+    count += count_.load(std::memory_order_relaxed);
+    sum += sum_.load(std::memory_order_relaxed);
+    uint64_t m = max_.load(std::memory_order_relaxed);
+    if (m > max) max = m;
+}
+
+
+/*
+==================================
+// Per-thread shards.
+==================================
+*/
+
+namespace {
+
+const int kCommands = static_cast<int>(Command::Count);
+const int kCounters = static_cast<int>(Counter::Count);
+
+struct StatsShard {
+    LatencyHistogram commands[kCommands];
+    std::atomic<uint64_t> counters[kCounters];
+    std::atomic<uint64_t> epoch; // resetEpoch the contents were last cleared for
+    StatsShard* next;
+};
+
+// Shards are pushed once per thread and never freed, so readers can walk
+// the list without locking.
+std::atomic<StatsShard*> shardList(nullptr);
+
+// Bumped by Stats::reset(). Only the owner ever writes a shard: it clears
+// its own shard when it sees a new epoch, and until then readers count the
+// shard as empty.
+std::atomic<uint64_t> resetEpoch(0);
+
+void clearShard(StatsShard* shard) {
+    for (int i = 0; i < kCommands; i++) {
+        shard->commands[i].reset();
+    }
+    for (int i = 0; i < kCounters; i++) {
+        shard->counters[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+StatsShard* localShard() {
+    thread_local StatsShard* shard = nullptr;
+    uint64_t epoch = resetEpoch.load(std::memory_order_relaxed);
+    if (shard == nullptr) {
+        shard = new StatsShard();
+        clearShard(shard);
+        shard->epoch.store(epoch, std::memory_order_relaxed);
+        shard->next = shardList.load(std::memory_order_relaxed);
+        while (!shardList.compare_exchange_weak(shard->next, shard)) {
+        }
+    } else if (shard->epoch.load(std::memory_order_relaxed) != epoch) {
+        // Release so a reader that sees the new epoch also sees the zeroes.
+        clearShard(shard);
+        shard->epoch.store(epoch, std::memory_order_release);
+    }
+    return shard;
+}
+
+// True if the shard was cleared since the last reset, so its contents count.
+bool current(const StatsShard* shard) {
+    return shard->epoch.load(std::memory_order_acquire) == resetEpoch.load(std::memory_order_relaxed);
+}
+
+// Merged view of every shard for one command.
+struct Summary {
+    uint64_t buckets[LatencyHistogram::kBuckets];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+Summary summarise(Command cmd) {
+    Summary s = {};
+    for (StatsShard* shard = shardList.load(); shard != nullptr; shard = shard->next) {
+        if (!current(shard)) continue;
+        shard->commands[static_cast<int>(cmd)].addTo(s.buckets, s.count, s.sum, s.max);
+    }
+    return s;
+}
+
+uint64_t counterTotal(Counter counter) {
+    uint64_t total = 0;
+    for (StatsShard* shard = shardList.load(); shard != nullptr; shard = shard->next) {
+        if (!current(shard)) continue;
+        total += shard->counters[static_cast<int>(counter)].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// Largest value (in ns) that falls into bucket b.
+uint64_t bucketUpper(int b) {
+    return b == 0 ? 0 : (uint64_t(1) << b) - 1;
+}
+
+// Upper bound (in ns) of the bucket holding the p-th quantile.
+uint64_t percentile(const Summary& s, double p) {
+    if (s.count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p * s.count);
+    if (rank >= s.count) rank = s.count - 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < LatencyHistogram::kBuckets; b++) {
+        seen += s.buckets[b];
+        if (seen > rank) {
+            // Never report more than the largest sample actually seen.
+            return bucketUpper(b) < s.max ? bucketUpper(b) : s.max;
+        }
+    }
+    return s.max;
+}
+
+} // namespace
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    Summary s = {};
+    addTo(s.buckets, s.count, s.sum, s.max);
+    return ::percentile(s, p);
+}
+
+
+/*
+==================================
+// Stats facade.
+==================================
+*/
+
+void Stats::recordCommand(Command cmd, uint64_t ns) {
+    if (cmd == Command::Count) return;
+    localShard()->commands[static_cast<int>(cmd)].record(ns);
+}
+
+void Stats::count(Counter counter, uint64_t n) {
+    std::atomic<uint64_t>& c = localShard()->counters[static_cast<int>(counter)];
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+Command Stats::commandFromName(const string& name) {
+    for (int i = 0; i < kCommands; i++) {
+        if (name == commandName(static_cast<Command>(i))) {
+            return static_cast<Command>(i);
+        }
+    }
+    return Command::Count;
+}
+
+const char* Stats::commandName(Command cmd) {
+    switch (cmd) {
+    case Command::Cd:    return "cd";
+    case Command::Ls:    return "ls";
+    case Command::Tree:  return "tree";
+    case Command::Touch: return "touch";
+    case Command::Mkdir: return "mkdir";
+    case Command::Rm:    return "rm";
+    case Command::Rmdir: return "rmdir";
+    case Command::Mv:    return "mv";
+    case Command::Cp:    return "cp";
+    default:             return "";
+    }
+}
+
+const char* Stats::counterName(Counter counter) {
+    switch (counter) {
+    case Counter::FindChildVisits:   return "findchild_visits";
+    case Counter::InsertSiblingHops: return "insert_sibling_hops";
+    case Counter::TreeBytes:         return "tree_bytes";
+    case Counter::ReclaimedNodes:    return "reclaimed_nodes";
+    case Counter::ReclaimedInline:   return "reclaimed_inline";
+    case Counter::TxConflicts:       return "tx_conflicts";
+    case Counter::WatchDropped:      return "watch_dropped";
+    case Counter::TreeCacheHits:     return "tree_cache_hits";
+    case Counter::ShardHandoffs:     return "shard_handoffs";
+    case Counter::CheckpointBytes:   return "checkpoint_bytes";
+    case Counter::Compactions:       return "compactions";
+    case Counter::PageFaults:        return "page_faults";
+    case Counter::PageHits:          return "page_hits";
+    case Counter::PageEvictions:     return "page_evictions";
+    default:                         return "";
+    }
+}
+
+string Stats::report() {
+    string res;
+    char line[160];
+
+    std::snprintf(line, sizeof(line), "%-8s %10s %12s %12s %12s %12s\n",
+                  "command", "count", "mean_ns", "p50_ns", "p99_ns", "max_ns");
+    res += line;
+    for (int i = 0; i < kCommands; i++) {
+        Summary s = summarise(static_cast<Command>(i));
+        std::snprintf(line, sizeof(line), "%-8s %10llu %12llu %12llu %12llu %12llu\n",
+                      commandName(static_cast<Command>(i)),
+                      (unsigned long long)s.count,
+                      (unsigned long long)(s.count ? s.sum / s.count : 0),
+                      (unsigned long long)percentile(s, 0.50),
+                      (unsigned long long)percentile(s, 0.99),
+                      (unsigned long long)s.max);
+        res += line;
+    }
+    for (int i = 0; i < kCounters; i++) {
+        std::snprintf(line, sizeof(line), "%s: %llu\n",
+                      counterName(static_cast<Counter>(i)),
+                      (unsigned long long)counterTotal(static_cast<Counter>(i)));
+        res += line;
+    }
+    uint64_t looks = counterTotal(Counter::PageFaults) + counterTotal(Counter::PageHits);
+    if (looks != 0) {
+        std::snprintf(line, sizeof(line), "page_hit_rate: %.4f\n",
+                      static_cast<double>(counterTotal(Counter::PageHits)) / static_cast<double>(looks));
+        res += line;
+    }
+    res.pop_back(); // remove extra \n like in ls().
+    return res;
+}
+
+string Stats::dump() {
+    string res = "{\"commands\":{";
+    char buf[64];
+
+    for (int i = 0; i < kCommands; i++) {
+        Summary s = summarise(static_cast<Command>(i));
+        if (i > 0) res += ",";
+        res += "\"";
+        res += commandName(static_cast<Command>(i));
+        res += "\":{\"count\":" + std::to_string(s.count);
+        res += ",\"sum_ns\":" + std::to_string(s.sum);
+        res += ",\"max_ns\":" + std::to_string(s.max);
+        // Sparse buckets keyed by their upper bound in ns.
+        res += ",\"buckets\":{";
+        bool first = true;
+        for (int b = 0; b < LatencyHistogram::kBuckets; b++) {
+            if (s.buckets[b] == 0) continue;
+            std::snprintf(buf, sizeof(buf), "%s\"%llu\":%llu", first ? "" : ",",
+                          (unsigned long long)bucketUpper(b), (unsigned long long)s.buckets[b]);
+            res += buf;
+            first = false;
+        }
+        res += "}}";
+    }
+    res += "},\"counters\":{";
+    for (int i = 0; i < kCounters; i++) {
+        if (i > 0) res += ",";
+        res += "\"";
+        res += counterName(static_cast<Counter>(i));
+        res += "\":" + std::to_string(counterTotal(static_cast<Counter>(i)));
+    }
+    // Hits over all looks at paged directories, 0 before the first.
+    uint64_t looks = counterTotal(Counter::PageFaults) + counterTotal(Counter::PageHits);
+    std::snprintf(buf, sizeof(buf), "},\"page_hit_rate\":%.4f}",
+                  looks != 0 ? static_cast<double>(counterTotal(Counter::PageHits)) / static_cast<double>(looks) : 0.0);
+    res += buf;
+    return res;
+}
+
+void Stats::reset() {
+    // Writing other threads' shards here would race with their plain
+    // load/store updates, so leave the clearing to each owner.
+    resetEpoch.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,93 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+using std::string;
+
+// REPL commands that are counted and timed.
+enum class Command : unsigned char {
+	Cd, Ls, Tree, Touch, Mkdir, Rm, Rmdir, Mv, Cp,
+	Count // number of commands, also used as "not counted"
+};
+
+// Internal work counters bumped from inside FileSystem.
+enum class Counter : unsigned char {
+	FindChildVisits,   // nodes looked at by findChild()
+	InsertSiblingHops, // siblings stepped over by insertChildAlphabetical()
+	TreeBytes,         // bytes produced by treeRecursion()
+	ReclaimedNodes,    // nodes freed by the Reclaimer after rm -r or an eviction
+	ReclaimedInline,   // subtrees freed by the caller of retire(), past the Reclaimer's backlog
+	TxConflicts,       // commits refused because something they read changed
+	WatchDropped,      // watch events lost to a full WatchRing
+	TreeCacheHits,     // tree() renderings of a directory reused from the cache
+	ShardHandoffs,     // mv of a node from one ShardedFileSystem shard to another
+	CheckpointBytes,   // bytes of checkpoint segments written, compaction not included
+	Compactions,       // checkpoint segments merged into a new base
+	PageFaults,        // paged directories whose children were read in from the image
+	PageHits,          // looks at a paged directory whose children were in memory already
+	PageEvictions,     // paged subtrees turned back into stubs
+	Count
+};
+
+// Latency histogram with one bucket per power of two nanoseconds.
+// Bucket b holds samples in [2^(b-1), 2^b), bucket 0 holds 0ns.
+// Only the owning thread writes, so relaxed load/store is enough and
+// compiles down to plain moves on the hot path.
+class LatencyHistogram {
+public:
+	static const int kBuckets = 64;
+
+	LatencyHistogram();
+
+	void record(uint64_t ns);
+	void reset();
+
+	// merge other's samples in, from the owning thread
+	void add(const LatencyHistogram& other);
+
+	// add the other histogram's samples into a plain snapshot
+	void addTo(uint64_t* buckets, uint64_t& count, uint64_t& sum, uint64_t& max) const;
+
+	// upper bound in ns of the bucket holding the p-th quantile (0 <= p <= 1),
+	// never more than the largest sample
+	[[nodiscard]] uint64_t percentile(double p) const;
+	[[nodiscard]] uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	[[nodiscard]] uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> buckets_[kBuckets];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+};
+
+// Process wide statistics. Each thread writes into its own shard and the
+// report functions sum every shard, so recording never takes a lock.
+// reset() only starts a new epoch; a shard from an older epoch reads as
+// empty and is cleared by its owner the next time it records.
+class Stats {
+public:
+	// record one command execution and how long it took
+	static void recordCommand(Command cmd, uint64_t ns);
+
+	// add n to an internal work counter
+	static void count(Counter counter, uint64_t n = 1);
+
+	// map a REPL command word to its Command, Command::Count if not counted
+	static Command commandFromName(const string& name);
+	static const char* commandName(Command cmd);
+	static const char* counterName(Counter counter);
+
+	// human readable table for the stats command
+	static string report();
+
+	// machine readable JSON for "stats --json"
+	static string dump();
+
+	// zero every shard, as seen by report() and dump()
+	static void reset();
+};
+
+#endif /* STATS_H_ */
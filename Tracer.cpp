@@ -0,0 +1,127 @@
+#include "Tracer.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+std::atomic<bool> Tracer::enabled_(false);
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+// One ring per thread, written only by its owner. head counts every event
+// ever written, so head - kRingEvents is the oldest one still present; base
+// is head when the current session started, kept by start()/stop() only.
+struct TraceRing {
+    TraceEvent* events;
+    std::atomic<uint64_t> head;
+    std::atomic<bool> writing; // the owner is in emit()
+    uint64_t base;
+    uint32_t tid;
+    TraceRing* next;
+};
+
+// Rings are pushed once per thread and never freed.
+std::atomic<TraceRing*> ringList(nullptr);
+std::atomic<uint32_t> nextTid(1);
+
+// Guards start()/stop() against each other, never taken by emit().
+std::mutex controlMutex;
+string outputPath;
+
+TraceRing* localRing() {
+    thread_local TraceRing* ring = nullptr;
+    if (ring == nullptr) {
+        ring = new TraceRing();
+        ring->events = new TraceEvent[Tracer::kRingEvents];
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->writing.store(false, std::memory_order_relaxed);
+        ring->base = 0;
+        ring->tid = nextTid.fetch_add(1);
+        ring->next = ringList.load(std::memory_order_relaxed);
+        while (!ringList.compare_exchange_weak(ring->next, ring)) {
+        }
+    }
+    return ring;
+}
+
+} // namespace
+
+uint64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+string Tracer::start(const string& path) {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    if (path == "") return "invalid path";
+    if (enabled()) return "trace already running";
+
+    // Skip whatever an earlier session left behind. Nobody writes while
+    // stopped, and heads only ever move forward, so nothing is reset.
+    for (TraceRing* ring = ringList.load(); ring != nullptr; ring = ring->next) {
+        ring->base = ring->head.load(std::memory_order_acquire);
+    }
+    outputPath = path;
+    enabled_.store(true, std::memory_order_release);
+    return ""; // success.
+}
+
+void Tracer::emit(const char* name, uint64_t beginNs, uint64_t endNs) {
+    TraceRing* ring = localRing();
+    // writing goes up before enabled_ is looked at, and stop() clears
+    // enabled_ before it waits for writing to drop: either stop() waits for
+    // this event or this event sees tracing is off.
+    ring->writing.store(true, std::memory_order_seq_cst);
+    if (enabled_.load(std::memory_order_seq_cst)) {
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        TraceEvent& ev = ring->events[head & (kRingEvents - 1)];
+        ev.name = name;
+        ev.begin = beginNs;
+        ev.end = endNs;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+    ring->writing.store(false, std::memory_order_release);
+}
+
+string Tracer::stop() {
+    std::lock_guard<std::mutex> lock(controlMutex);
+    if (!enabled()) return "trace not running";
+    enabled_.store(false, std::memory_order_seq_cst);
+    // Let events already being written land; no new ones start.
+    for (TraceRing* ring = ringList.load(); ring != nullptr; ring = ring->next) {
+        while (ring->writing.load(std::memory_order_seq_cst)) std::this_thread::yield();
+    }
+
+    std::FILE* out = std::fopen(outputPath.c_str(), "w");
+    if (out == nullptr) return "cannot open " + outputPath;
+
+    std::fputs("{\"traceEvents\":[", out);
+    bool first = true;
+    uint64_t dropped = 0;
+    for (TraceRing* ring = ringList.load(); ring != nullptr; ring = ring->next) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t oldest = head - ring->base > kRingEvents ? head - kRingEvents : ring->base;
+        dropped += oldest - ring->base;
+        for (uint64_t i = oldest; i < head; i++) {
+            const TraceEvent& ev = ring->events[i & (kRingEvents - 1)];
+            // Chrome trace timestamps are microseconds.
+            std::fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                         first ? "" : ",", ev.name, ring->tid,
+                         ev.begin / 1000.0, (ev.end - ev.begin) / 1000.0);
+            first = false;
+        }
+        ring->base = head;
+    }
+    std::fprintf(out, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":%llu}}\n",
+                 (unsigned long long)dropped);
+    std::fclose(out);
+    return ""; // success.
+}
@@ -0,0 +1,66 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+using std::string;
+
+// Opt-in recorder of Chrome trace-event JSON (open the file in Perfetto or
+// chrome://tracing). Every thread appends complete ("X") events into its
+// own fixed size ring buffer, so a long run keeps only the most recent
+// events and never allocates or locks while tracing. Only a ring's owner
+// ever writes it; stop() turns tracing off and waits for writes already
+// under way before it reads the rings.
+class Tracer {
+public:
+	// events kept per thread before the oldest are overwritten
+	static const uint32_t kRingEvents = 1 << 18;
+
+	// start buffering events that will be written to path on stop()
+	// returns "" on success, otherwise an error message
+	static string start(const string& path);
+
+	// stop buffering and write every ring to the file given to start()
+	// returns "" on success, otherwise an error message
+	static string stop();
+
+	[[nodiscard]] static bool enabled() {
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	// append one span to the calling thread's ring, nothing once stopped
+	// name must be a string literal (only the pointer is stored)
+	static void emit(const char* name, uint64_t beginNs, uint64_t endNs);
+
+	// monotonic timestamp in ns
+	[[nodiscard]] static uint64_t now();
+
+private:
+	static std::atomic<bool> enabled_;
+};
+
+// RAII span: records [construction, destruction) when tracing is on,
+// and costs one relaxed load when it is off.
+class TraceSpan {
+	const char* name_;
+	uint64_t start_;
+
+public:
+	explicit TraceSpan(const char* name) : name_(name), start_(0) {
+		if (Tracer::enabled()) start_ = Tracer::now();
+	}
+
+	~TraceSpan() {
+		if (start_ != 0) Tracer::emit(name_, start_, Tracer::now());
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan_, __LINE__)(name)
+
+#endif /* TRACER_H_ */
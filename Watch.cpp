@@ -0,0 +1,62 @@
+#include "Watch.h"
+#include "Stats.h"
+
+
+WatchRing::WatchRing(size_t capacity)
+    : head_(0), tail_(0), headSeen_(0), overflowed_(false), dropped_(0) {
+    size_t size = 2;
+    while (size < capacity) size *= 2;
+    slots_ = new WatchEvent[size];
+    mask_ = size - 1;
+}
+
+WatchRing::~WatchRing() {
+    delete[] slots_;
+}
+
+void WatchRing::push(const WatchEvent& event) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    // Events needed now: the event itself, plus the Resync still owed.
+    uint64_t needed = overflowed_ ? 2 : 1;
+    if (tail - headSeen_ + needed > mask_ + 1) {
+        headSeen_ = head_.load(std::memory_order_acquire);
+        if (tail - headSeen_ + needed > mask_ + 1) {
+            overflowed_ = true;
+            dropped_++;
+            Stats::count(Counter::WatchDropped);
+            return;
+        }
+    }
+    if (overflowed_) {
+        WatchEvent& resync = slots_[tail & mask_];
+        resync.kind = WatchEvent::Kind::Resync;
+        resync.isDir = false;
+        resync.truncated = false;
+        resync.length = 0;
+        resync.node = 0;
+        resync.dir = 0;
+        tail++;
+        overflowed_ = false;
+    }
+    slots_[tail & mask_] = event;
+    tail_.store(tail + 1, std::memory_order_release);
+}
+
+bool WatchRing::pop(WatchEvent& event) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    event = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+const char* watchKindName(WatchEvent::Kind kind) {
+    switch (kind) {
+    case WatchEvent::Kind::Create:    return "create";
+    case WatchEvent::Kind::Delete:    return "delete";
+    case WatchEvent::Kind::MovedFrom: return "moved_from";
+    case WatchEvent::Kind::MovedTo:   return "moved_to";
+    case WatchEvent::Kind::Resync:    return "resync";
+    }
+    return "";
+}
@@ -0,0 +1,65 @@
+#ifndef WATCH_H_
+#define WATCH_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// One change seen by a watch, see FileSystem::watch(). Fixed size (one
+// cache line) so rings hold events by value and publishing never allocates.
+struct WatchEvent {
+	enum class Kind : unsigned char {
+		Create,
+		Delete,
+		MovedFrom, // mv and renames give a MovedFrom and a MovedTo
+		MovedTo,   // with the same node handle
+		Resync     // events were dropped, list the watched tree again
+	};
+	static const size_t kPathBytes = 44;
+
+	Kind kind;
+	bool isDir;
+	bool truncated;          // path holds only the last kPathBytes bytes
+	unsigned char length;    // bytes used in path
+	char path[kPathBytes];   // relative to the watched directory
+	uint64_t node;           // opaque handle of the node, stable while it lives
+	uint64_t dir;            // opaque handle of the directory it is (was) in
+};
+
+// Single producer, single consumer ring of WatchEvents. The producer is
+// whichever thread mutates the FileSystem; the consumer may be any one
+// other thread. Neither side ever blocks or locks: when the ring is full
+// new events are dropped, and the consumer gets a Resync event in their
+// place once there is room again.
+class WatchRing {
+public:
+	// capacity is rounded up to a power of two, at least 2
+	explicit WatchRing(size_t capacity = 4096);
+	~WatchRing();
+
+	WatchRing(const WatchRing&) = delete;
+	WatchRing& operator=(const WatchRing&) = delete;
+
+	// producer side
+	void push(const WatchEvent& event);
+
+	// consumer side: take the oldest event, false if there is none
+	bool pop(WatchEvent& event);
+
+	// events dropped because the ring was full (producer side)
+	[[nodiscard]] uint64_t dropped() const { return dropped_; }
+
+private:
+	WatchEvent* slots_;
+	uint64_t mask_;
+	alignas(64) std::atomic<uint64_t> head_; // next slot to pop, written by the consumer
+	alignas(64) std::atomic<uint64_t> tail_; // next slot to push, written by the producer
+	uint64_t headSeen_;   // producer's last look at head_, saves a shared load per push
+	bool overflowed_;     // producer dropped events and still owes a Resync
+	uint64_t dropped_;
+};
+
+// name of an event kind for output: "create", "delete", "moved_from" ...
+[[nodiscard]] const char* watchKindName(WatchEvent::Kind kind);
+
+#endif /* WATCH_H_ */
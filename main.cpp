@@ -1,42 +1,73 @@
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include "CommandLine.h"
 #include "FileSystem.h"
+#include "Server.h"
+#include "Tracer.h"
 using namespace std;
 
-int main() {
+namespace {
 
+Server* running = nullptr; // the server main() waits in, for the signal handler
+
+void stopServer(int) {
+	if (running != nullptr) running->stop();
+}
+
+// "main --serve <socket>": serve a fresh FileSystem to local clients until
+// SIGINT or SIGTERM, see Server.h for the protocol.
+int serve(const string& path) {
 	FileSystem* fs = new FileSystem();
+	Server server(fs, path);
+	string error = server.listen();
+	if (error != "") {
+		cerr << error << endl;
+		delete fs;
+		return 1;
+	}
+	running = &server;
+	signal(SIGINT, stopServer);
+	signal(SIGTERM, stopServer);
+	cout << "serving on " << path << endl;
+	server.run();
+	running = nullptr;
+	cout << "served " << server.connectionsServed() << " connections" << endl;
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
 
-	string input, output, cmd, arg1, arg2;
-
-	while(true) {
-		cmd = arg1 = arg2 = "";
-		cout << fs->pwd() << "> ";
-		getline(cin, input);
-		stringstream ss(input);
-		ss >> cmd >> arg1 >> arg2;
-
-		if (cmd == "exit") break;
-		else if (cmd == "cd") output = fs->cd(arg1);
-		else if (cmd == "ls") output = fs->ls();
-		else if (cmd == "pwd") output = fs->pwd();
-		else if (cmd == "tree") output = fs->tree();
-		else if (cmd == "touch") output = fs->touch(arg1);
-		else if (cmd == "mkdir") output = fs->mkdir(arg1);
-		else if (cmd == "rm") output = fs->rm(arg1);
-		else if (cmd == "rmdir") output = fs->rmdir(arg1);
-		else if (cmd == "mv") output = fs->mv(arg1, arg2);
-		else if (cmd == "load") {
-			delete fs;
-			fs = new FileSystem(arg1);
-			output = "";
-		}
-		else output = "command not found";
+	// FS_TRACE=<file> traces the whole session without typing "trace start".
+	const char* tracePath = getenv("FS_TRACE");
+	if (tracePath != nullptr) Tracer::start(tracePath);
 
+	if (argc == 3 && string_view(argv[1]) == "--serve") {
+		int code = serve(argv[2]);
+		if (Tracer::enabled()) Tracer::stop();
+		return code;
+	}
+
+	FileSystem* fs = new FileSystem();
+
+	// Everything here is reused from line to line, so parsing a steady stream
+	// of commands allocates nothing: the shell splits input into views that
+	// go to FileSystem as they are.
+	CommandShell shell;
+	string input, output, prompt;
+
+	for (;;) {
+		fs->pwdInto(prompt);
+		cout << prompt << "> ";
+		if (!getline(cin, input)) break; // End of input ends the session like exit.
+		if (!shell.run(fs, input, output)) break;
 		if (output != "") cout << output << endl;
 	}
 
+	if (Tracer::enabled()) Tracer::stop();
 	delete fs;
 }
-